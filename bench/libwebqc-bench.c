@@ -0,0 +1,438 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <cjson/cJSON.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-json.h"
+#include "webqc-web-access.h"
+
+/*
+ * Microbenchmarks of the library's hot paths: parsing integrals information and ERI status replies, iterating over
+ * shell quartets, and reading downloaded ERI values. Inputs are synthetic, so no server is needed. Results are
+ * written as JSON, one entry per benchmark and input size, so they can be compared between releases.
+ */
+
+#define BENCH_DEFAULT_REPETITIONS (10) /// Times each benchmark runs, when not set on the command line
+#define BENCH_DOWNLOAD_CHUNK (16*1024) /// Bytes cURL hands the write callback at once
+#define BENCH_STATUS_CHANGES (10) /// Sub-jobs that changed between two polls, in the status changes benchmark
+
+//! One benchmark on one input size
+struct benchmark {
+    const char *name; /// Name of the benchmarked function
+    const char *unit; /// What the size counts
+    long size; /// Input size, in units
+    void *(*setup)(long size); /// Create the input, once for all repetitions. Returns NULL on failure.
+    double (*run)(void *input); /// Run once and return the time it took in seconds, or a negative number on failure
+    void (*teardown)(void *input); /// Release the input
+};
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//! Create the text of an int_info reply for a system of alternating s and p shells with the given number of functions
+static char *make_integrals_info_text(long functions_count)
+{
+    static const char *p_labels[] = {"px", "py", "pz"};
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *system = cJSON_AddObjectToObject(reply, "system");
+    cJSON *functions = cJSON_AddArrayToObject(system, "functions");
+    int shell = 0;
+    long added = 0;
+
+    for (; added < functions_count; ++shell) {
+        int l = shell % 2;
+        for (int orientation = 0; orientation < 2 * l + 1 && added < functions_count; ++orientation, ++added) {
+            double origin[3] = {0.0, 0.0, 1.5 * (shell / 2)};
+            cJSON *function = cJSON_CreateObject();
+            cJSON_AddItemToObject(function, "origin", cJSON_CreateDoubleArray(origin, 3));
+            cJSON_AddStringToObject(function, "angular_moment_symbol", l ? "p" : "s");
+            cJSON_AddStringToObject(function, "element_name", "Helium");
+            cJSON_AddStringToObject(function, "element_symbol", "He");
+            cJSON_AddStringToObject(function, "function_label", l ? p_labels[orientation] : "s");
+            cJSON_AddNumberToObject(function, "angular_moment_l", l);
+            cJSON_AddNumberToObject(function, "atom_index", shell / 2);
+            cJSON_AddNumberToObject(function, "shell_index", shell);
+            cJSON_AddNumberToObject(function, "atomic_number", 2);
+            cJSON_AddNumberToObject(function, "number_of_primitives", 1);
+            cJSON_AddBoolToObject(function, "spherical", false);
+            cJSON *primitive = cJSON_CreateObject();
+            cJSON_AddNumberToObject(primitive, "coefficient", 1.0);
+            cJSON_AddNumberToObject(primitive, "exponent", 1.0 + shell);
+            cJSON_AddItemToArray(cJSON_AddArrayToObject(function, "primitives"), primitive);
+            cJSON_AddItemToArray(functions, function);
+        }
+    }
+    cJSON_AddNumberToObject(system, "number_of_atoms", (shell + 1) / 2);
+    cJSON_AddNumberToObject(system, "number_of_electrons", shell + 1);
+    cJSON_AddNumberToObject(system, "number_of_functions", (double) functions_count);
+    cJSON_AddNumberToObject(system, "number_of_integrals", 0);
+    cJSON_AddNumberToObject(system, "number_of_shells", shell);
+    cJSON_AddNumberToObject(system, "number_of_primitives", (double) functions_count);
+
+    char *text = cJSON_PrintUnformatted(reply);
+    cJSON_Delete(reply);
+    return text;
+}
+
+//! Create the text of an ERI status reply with items first_item to end_item, half of them done. A partial reply
+//! only has the items that changed since the status cursor.
+static char *make_eri_status_text(long first_item, long end_item, bool partial)
+{
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *items = cJSON_AddArrayToObject(reply, "items");
+
+    cJSON_AddStringToObject(reply, "job_id", "bench-job");
+    cJSON_AddStringToObject(reply, "cursor", "bench-cursor");
+    if (partial) {
+        cJSON_AddBoolToObject(reply, "partial", true);
+    }
+    for (long i = first_item; i < end_item; ++i) {
+        char blob[64];
+        int begin[4] = {(int) (i / 1000), (int) (i % 1000 / 100), (int) (i % 100 / 10), (int) (i % 10)};
+        int end[4] = {begin[0], begin[1], begin[2], begin[3] + 1};
+        cJSON *item = cJSON_CreateObject();
+        cJSON_AddNumberToObject(item, "id", (double) i);
+        cJSON_AddStringToObject(item, "status", i % 2 ? "processing" : "done");
+        if (i % 2) {
+            cJSON_AddNullToObject(item, "result_blob");
+        } else {
+            snprintf(blob, sizeof(blob), "blobs/bench/%ld", i);
+            cJSON_AddStringToObject(item, "result_blob", blob);
+        }
+        cJSON_AddItemToObject(item, "begin", cJSON_CreateIntArray(begin, 4));
+        cJSON_AddItemToObject(item, "end", cJSON_CreateIntArray(end, 4));
+        cJSON_AddItemToArray(items, item);
+    }
+
+    char *text = cJSON_PrintUnformatted(reply);
+    cJSON_Delete(reply);
+    return text;
+}
+
+//! Create a handler with a reply waiting to be parsed, as if a call just returned it
+static WQC *make_handler_with_reply(const char *reply)
+{
+    WQC *handler = wqc_init();
+
+    if (handler) {
+        handler->job_type = WQC_JOB_TWO_ELECTRONS_INTEGRALS;
+        wqc_set_downloaded_data((void *) reply, strlen(reply), &handler->web_call_info.web_reply);
+    }
+    return handler;
+}
+
+//! Create a handler that knows the details of a system with the given number of functions
+static void *setup_system(long functions_count)
+{
+    char *text = make_integrals_info_text(functions_count);
+    WQC *handler = text ? make_handler_with_reply(text) : NULL;
+
+    if (handler && !update_eri_details(handler)) {
+        wqc_cleanup(handler);
+        handler = NULL;
+    }
+    free(text);
+    return handler;
+}
+
+//! Create a handler that knows the details of a system with about the given number of shell quartets
+static void *setup_quartets(long quartets_count)
+{
+    long shells = 1;
+    while (shells * shells * shells * shells < quartets_count) {
+        shells++;
+    }
+    // Shells alternate between s and p, so a system with an even number of shells has two functions per shell
+    return setup_system(2 * shells);
+}
+
+static void *setup_integrals_info(long functions_count)
+{
+    return make_integrals_info_text(functions_count);
+}
+
+static double run_update_eri_details(void *input)
+{
+    // Integrals details are parsed once per handler, so every repetition needs a fresh one
+    WQC *handler = make_handler_with_reply(input);
+    if (!handler) {
+        return -1;
+    }
+
+    double start = now_seconds();
+    bool rv = update_eri_details(handler);
+    double elapsed = now_seconds() - start;
+
+    wqc_cleanup(handler);
+    return rv ? elapsed : -1;
+}
+
+static void *setup_eri_status(long items_count)
+{
+    char *text = make_eri_status_text(0, items_count, false);
+    WQC *handler = text ? make_handler_with_reply(text) : NULL;
+
+    free(text);
+    return handler;
+}
+
+//! Create a handler that has the status of a job with the given number of items, and a reply with the changes of
+//! BENCH_STATUS_CHANGES of them waiting to be merged
+static void *setup_eri_status_changes(long items_count)
+{
+    WQC *handler = setup_eri_status(items_count);
+    char *text = make_eri_status_text(items_count / 2, items_count / 2 + BENCH_STATUS_CHANGES, true);
+
+    if (handler && text && update_eri_job_status(handler)) {
+        wqc_set_downloaded_data(text, strlen(text), &handler->web_call_info.web_reply);
+    } else {
+        wqc_cleanup(handler);
+        handler = NULL;
+    }
+    free(text);
+    return handler;
+}
+
+static double run_update_eri_job_status(void *input)
+{
+    double start = now_seconds();
+    bool rv = update_eri_job_status(input);
+    double elapsed = now_seconds() - start;
+
+    return rv ? elapsed : -1;
+}
+
+static double run_shell_iteration(void *input)
+{
+    WQC *handler = input;
+    eri_shell_index_t index = {0, 0, 0, 0};
+    eri_shell_index_t end = {handler->eri_info.number_of_shells, 0, 0, 0};
+    long functions = 0;
+
+    double start = now_seconds();
+    for (; !wqc_indices_equal(&index, &end); wqc_next_shell_index(handler, &index)) {
+        int shells_count[4];
+        wqc_get_number_of_functions_in_shells(handler, index, shells_count, 4);
+        functions += shells_count[0] * shells_count[1] * shells_count[2] * shells_count[3];
+    }
+    double elapsed = now_seconds() - start;
+
+    return functions > 0 ? elapsed : -1;
+}
+
+//! ERI values file and the handler that reads it
+struct values_file {
+    WQC *handler;
+    FILE *file;
+};
+
+static void *setup_values_file(long size)
+{
+    struct values_file *input = calloc(1, sizeof(struct values_file));
+    double *values = calloc(size / sizeof(double), sizeof(double));
+    bool rv = input && values;
+
+    if (rv) {
+        input->handler = wqc_init();
+        input->file = tmpfile();
+        rv = input->handler && input->file && fwrite(values, 1, size, input->file) == size;
+    }
+    if (rv) {
+        input->handler->eri_info.eri_values.eri_data_size = size;
+    } else if (input) {
+        wqc_cleanup(input->handler);
+        if (input->file) {
+            fclose(input->file);
+        }
+        free(input);
+        input = NULL;
+    }
+
+    free(values);
+    return input;
+}
+
+static double run_read_ERI_values_from_file(void *input)
+{
+    struct values_file *values_file = input;
+    rewind(values_file->file);
+
+    double start = now_seconds();
+    bool rv = read_ERI_values_from_file(values_file->handler, values_file->file);
+    double elapsed = now_seconds() - start;
+
+    return rv ? elapsed : -1;
+}
+
+static void teardown_values_file(void *input)
+{
+    struct values_file *values_file = input;
+    wqc_cleanup(values_file->handler);
+    fclose(values_file->file);
+    free(values_file);
+}
+
+static void *setup_download_chunk(long size)
+{
+    return calloc(BENCH_DOWNLOAD_CHUNK, 1);
+}
+
+static double run_write_to_download_buffer(void *input)
+{
+    struct download_buffer download = {NULL, BENCH_DOWNLOAD_CHUNK * 1024L, 0};
+    bool rv = true;
+
+    double start = now_seconds();
+    download.data = malloc(download.size);
+    while (rv && download.data && download.received < download.size) {
+        rv = wqc_write_to_download_buffer(input, 1, BENCH_DOWNLOAD_CHUNK, &download) == BENCH_DOWNLOAD_CHUNK;
+    }
+    double elapsed = now_seconds() - start;
+
+    rv = rv && download.data;
+    free(download.data);
+    return rv ? elapsed : -1;
+}
+
+static void teardown_handler(void *input)
+{
+    wqc_cleanup(input);
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+//! Run a benchmark and add its results to the results array
+static bool run_benchmark(const struct benchmark *benchmark, int repetitions, cJSON *results)
+{
+    double *times = calloc(repetitions, sizeof(double));
+    void *input = benchmark->setup(benchmark->size);
+    bool rv = times && input;
+    double total = 0;
+
+    for (int i = 0; rv && i < repetitions; ++i) {
+        times[i] = benchmark->run(input);
+        rv = times[i] >= 0;
+        total += times[i];
+    }
+
+    if (rv) {
+        qsort(times, repetitions, sizeof(double), compare_doubles);
+        double median = times[repetitions / 2];
+        cJSON *result = cJSON_CreateObject();
+        cJSON_AddStringToObject(result, "name", benchmark->name);
+        cJSON_AddStringToObject(result, "unit", benchmark->unit);
+        cJSON_AddNumberToObject(result, "size", (double) benchmark->size);
+        cJSON_AddNumberToObject(result, "repetitions", repetitions);
+        cJSON_AddNumberToObject(result, "min_ns", times[0] * 1e9);
+        cJSON_AddNumberToObject(result, "median_ns", median * 1e9);
+        cJSON_AddNumberToObject(result, "mean_ns", total / repetitions * 1e9);
+        cJSON_AddNumberToObject(result, "max_ns", times[repetitions - 1] * 1e9);
+        cJSON_AddNumberToObject(result, "units_per_second", median > 0 ? benchmark->size / median : 0);
+        cJSON_AddItemToArray(results, result);
+        fprintf(stderr, "%-32s %10ld %-9s median %12.0f ns\n", benchmark->name, benchmark->size, benchmark->unit,
+                median * 1e9);
+    } else {
+        fprintf(stderr, "%-32s %10ld %-9s FAILED\n", benchmark->name, benchmark->size, benchmark->unit);
+    }
+
+    if (input) {
+        benchmark->teardown(input);
+    }
+    free(times);
+    return rv;
+}
+
+static const struct benchmark benchmarks[] = {
+    {"update_eri_details", "functions", 10, setup_integrals_info, run_update_eri_details, free},
+    {"update_eri_details", "functions", 1000, setup_integrals_info, run_update_eri_details, free},
+    {"update_eri_details", "functions", 100000, setup_integrals_info, run_update_eri_details, free},
+    {"update_eri_job_status", "items", 10000, setup_eri_status, run_update_eri_job_status, teardown_handler},
+    {"update_eri_job_status_changes", "items", 10000, setup_eri_status_changes, run_update_eri_job_status,
+        teardown_handler},
+    {"wqc_next_shell_index", "quartets", 20L*20*20*20, setup_quartets, run_shell_iteration, teardown_handler},
+    {"wqc_next_shell_index", "quartets", 40L*40*40*40, setup_quartets, run_shell_iteration, teardown_handler},
+    {"read_ERI_values_from_file", "bytes", 1L << 20, setup_values_file, run_read_ERI_values_from_file,
+        teardown_values_file},
+    {"read_ERI_values_from_file", "bytes", 64L << 20, setup_values_file, run_read_ERI_values_from_file,
+        teardown_values_file},
+    {"wqc_write_to_download_buffer", "bytes", BENCH_DOWNLOAD_CHUNK * 1024L, setup_download_chunk,
+        run_write_to_download_buffer, free},
+};
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -r repetitions  times to run each benchmark (default %d)\n"
+            "  -o file         write the JSON results to a file instead of the standard output\n"
+            "  -q              quick run: only the smallest input of each benchmark\n",
+            program, BENCH_DEFAULT_REPETITIONS);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int repetitions = BENCH_DEFAULT_REPETITIONS;
+    const char *output_name = NULL;
+    bool quick = false;
+    bool rv = true;
+    int option = 0;
+
+    while ((option = getopt(argc, argv, "r:o:qh")) != -1) {
+        switch (option) {
+            case 'r': repetitions = atoi(optarg); break;
+            case 'o': output_name = optarg; break;
+            case 'q': quick = true; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (repetitions < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    wqc_global_init();
+
+    cJSON *report = cJSON_CreateObject();
+    cJSON_AddStringToObject(report, "suite", "libwebqc-bench");
+    cJSON_AddStringToObject(report, "curl_version", curl_version());
+    cJSON *results = cJSON_AddArrayToObject(report, "results");
+
+    for (size_t i = 0; i < sizeof(benchmarks) / sizeof(benchmarks[0]); ++i) {
+        bool smallest = i == 0 || strcmp(benchmarks[i].name, benchmarks[i - 1].name) != 0;
+        if (smallest || !quick) {
+            rv = run_benchmark(&benchmarks[i], repetitions, results) && rv;
+        }
+    }
+
+    char *text = cJSON_Print(report);
+    FILE *output = output_name ? fopen(output_name, "w") : stdout;
+    if (output && text) {
+        fprintf(output, "%s\n", text);
+    } else {
+        fprintf(stderr, "Cannot write results to %s\n", output_name);
+        rv = false;
+    }
+    if (output && output != stdout) {
+        fclose(output);
+    }
+
+    free(text);
+    cJSON_Delete(report);
+    wqc_global_cleanup();
+
+    return rv ? 0 : 1;
+}
@@ -0,0 +1,457 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <cjson/cJSON.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-mock-server.h"
+
+/*
+ * End to end load generator. Runs jobs on a number of concurrent handlers, each job going through submit, wait,
+ * integrals details and fetching of all its ERI values, and reports throughput and latency percentiles of every
+ * phase. Runs against a WebQC server, or against an in-process mock server with -m.
+ */
+
+#define LOADGEN_DEFAULT_JOBS (20) /// Jobs to run, when not set on the command line
+#define LOADGEN_DEFAULT_CONCURRENCY (4) /// Concurrent handlers, when not set on the command line
+#define LOADGEN_DEFAULT_WAIT (600000) /// Longest time to wait for a job, in milliseconds
+#define LOADGEN_GEOMETRY_SIZE (256) /// Room for the geometry of one job
+
+/// Phases of a job, in the order they run
+enum loadgen_phase {
+    LOADGEN_SUBMIT = 0,
+    LOADGEN_WAIT = 1,
+    LOADGEN_DETAILS = 2,
+    LOADGEN_FETCH = 3,
+    LOADGEN_JOB = 4, /// The whole job, all phases together
+    LOADGEN_PHASES_COUNT = 5
+};
+
+static const char *phase_names[LOADGEN_PHASES_COUNT] = {"submit", "wait", "details", "fetch", "job"};
+
+/// Load generator settings
+struct loadgen_config {
+    int jobs; /// Number of jobs to run
+    int concurrency; /// Number of handlers running jobs at once
+    int wait_timeout; /// Longest time to wait for a job, in milliseconds
+    bool fetch_all; /// Fetch ERI values with wqc_fetch_all_ERI_values instead of one sub-job at a time
+    bool fetch_done_items; /// Fetch the ERI values of each sub-job as soon as it is done, while waiting for the job
+    int shell_sets_per_file; /// Shell quartets per ERI values blob to ask for, 0 for the server default
+    const char *server_name; /// Server to call
+    int server_port; /// Server port, 0 for the default
+    bool plain_http; /// Call the server over plain HTTP
+    bool insecure; /// Do not verify the server certificate
+    const char *access_token; /// Access token, NULL for the default one
+    const char *trace_file; /// Chrome trace file all handlers write their spans to, NULL for no tracing
+};
+
+/// Shared state of a load generator run
+struct loadgen_run {
+    const struct loadgen_config *config;
+    pthread_mutex_t lock;
+    int next_job; /// Next job to start
+    int succeeded; /// Jobs that went through all phases
+    int failed; /// Jobs that failed in some phase
+    size_t bytes; /// ERI values bytes fetched
+    double *latencies[LOADGEN_PHASES_COUNT]; /// Latency of every successful job in every phase, in seconds
+    struct wqc_endpoint_timing endpoints[WQC_ENDPOINTS_COUNT]; /// Network timing of all handlers, per endpoint
+};
+
+static const char *endpoint_names[WQC_ENDPOINTS_COUNT] = {"job", "params", "eri", "int_info", "eri_values", "download",
+                                                          "submit", "submit_batch", "status_batch"};
+
+static double now_seconds(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+//! Set up a handler to call the configured server
+static bool configure_handler(WQC *handler, const struct loadgen_config *config)
+{
+    bool rv = true;
+
+    if (config->server_name) {
+        rv = wqc_set_option(handler, WQC_OPTION_SERVER_NAME, config->server_name);
+    }
+    if (rv && config->server_port) {
+        rv = wqc_set_option(handler, WQC_OPTION_SERVER_PORT, config->server_port);
+    }
+    if (rv && config->plain_http) {
+        rv = wqc_set_option(handler, WQC_OPTION_PLAIN_HTTP, true);
+    }
+    if (rv && config->insecure) {
+        rv = wqc_set_option(handler, WQC_OPTION_INSECURE_SSL, true);
+    }
+    if (rv && config->access_token) {
+        rv = wqc_set_option(handler, WQC_OPTION_ACCESS_TOKEN, config->access_token);
+    }
+    if (rv && config->trace_file) {
+        rv = wqc_set_option(handler, WQC_OPTION_TRACE_FILE, config->trace_file);
+    }
+
+    return rv;
+}
+
+//! Fetch all the ERI values of a job, one sub-job at a time, and count their bytes
+static bool fetch_values(WQC *handler, const struct loadgen_config *config, size_t *bytes)
+{
+    eri_shell_index_t index = {0, 0, 0, 0};
+    eri_shell_index_t end = {handler->eri_info.number_of_shells, 0, 0, 0};
+    eri_shell_index_t range_begin;
+    bool rv = true;
+
+    if (config->fetch_all) {
+        rv = wqc_fetch_all_ERI_values(handler);
+        *bytes += rv ? handler->eri_info.eri_values.eri_data_size : 0;
+        return rv;
+    }
+
+    while (rv && !wqc_indices_equal(&index, &end)) {
+        rv = wqc_fetch_ERI_values(handler, &index) && wqc_get_shell_set_range(handler, &range_begin, &index);
+        *bytes += rv ? handler->eri_info.eri_values.eri_data_size : 0;
+    }
+
+    return rv;
+}
+
+//! Wait for a job while fetching the ERI values of its sub-jobs as they are done, and count their bytes
+static bool wait_and_fetch_done_items(WQC *handler, const struct loadgen_config *config, size_t *bytes)
+{
+    bool rv = wqc_get_integrals_details(handler);
+
+    while (rv && wqc_wait_for_any_items(handler, config->wait_timeout)) {
+        const struct ERI_item_status *item = NULL;
+        while (rv && (item = wqc_next_done_ERI_item(handler)) != NULL) {
+            rv = wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &item->range_begin);
+            *bytes += rv ? handler->eri_info.eri_values.eri_data_size : 0;
+        }
+    }
+
+    return rv && wqc_job_done(handler);
+}
+
+//! Run one job through all phases, and record how long each one took
+static bool run_job(WQC *handler, struct loadgen_run *run, int job)
+{
+    char geometry[LOADGEN_GEOMETRY_SIZE];
+    double times[LOADGEN_PHASES_COUNT + 1];
+    size_t bytes = 0;
+    bool rv = true;
+
+    // Move an atom a little in every job, so that no job is a duplicate of another
+    snprintf(geometry, sizeof(geometry),
+             "3\nH2O\nO 0.00000000 0.00000000 %.8f\nH 0.83020871 0.00000000 0.53109206\nH 0.00000000 0.53109206 0.56568542\n",
+             -0.07223463 + job * 1e-6);
+    struct two_electron_integrals_job_parameters parameters = {"sto-3g", geometry, WQC_PRECISION_UNKNOWN, "angstrom",
+                                                               run->config->shell_sets_per_file};
+
+    times[0] = now_seconds();
+    for (int phase = LOADGEN_SUBMIT; rv && phase < LOADGEN_JOB; ++phase) {
+        switch (phase) {
+            case LOADGEN_SUBMIT: rv = wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters); break;
+            case LOADGEN_WAIT:
+                rv = run->config->fetch_done_items ? wait_and_fetch_done_items(handler, run->config, &bytes)
+                                                   : wqc_wait_for_job(handler, run->config->wait_timeout);
+                break;
+            // When sub-jobs are fetched as they are done, the details and the values were fetched while waiting
+            case LOADGEN_DETAILS: rv = run->config->fetch_done_items || wqc_get_integrals_details(handler); break;
+            case LOADGEN_FETCH: rv = run->config->fetch_done_items || fetch_values(handler, run->config, &bytes); break;
+        }
+        times[phase + 1] = now_seconds();
+    }
+
+    if (!rv) {
+        struct wqc_return_value error = init_webqc_return_value();
+        wqc_get_last_error(handler, &error);
+        fprintf(stderr, "Job %d failed: %s\n", job, error.error_message);
+    }
+
+    pthread_mutex_lock(&run->lock);
+    if (rv) {
+        for (int phase = LOADGEN_SUBMIT; phase < LOADGEN_JOB; ++phase) {
+            run->latencies[phase][run->succeeded] = times[phase + 1] - times[phase];
+        }
+        run->latencies[LOADGEN_JOB][run->succeeded] = times[LOADGEN_JOB] - times[0];
+        run->succeeded++;
+        run->bytes += bytes;
+    } else {
+        run->failed++;
+    }
+    pthread_mutex_unlock(&run->lock);
+
+    return rv;
+}
+
+//! Add the network timing of a handler to the run's totals. Must be called with the run locked.
+static void add_network_timing(struct loadgen_run *run, WQC *handler)
+{
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handler, &timing);
+
+    for (int i = 0; i < WQC_ENDPOINTS_COUNT; ++i) {
+        const struct wqc_endpoint_timing *from = &timing.endpoints[i];
+        struct wqc_endpoint_timing *to = &run->endpoints[i];
+        to->calls += from->calls;
+        to->failed_calls += from->failed_calls;
+        to->sum.name_lookup += from->sum.name_lookup;
+        to->sum.connect += from->sum.connect;
+        to->sum.tls_handshake += from->sum.tls_handshake;
+        to->sum.first_byte += from->sum.first_byte;
+        to->sum.total += from->sum.total;
+        to->sum.bytes_sent += from->sum.bytes_sent;
+        to->sum.bytes_received += from->sum.bytes_received;
+        to->max_total = from->max_total > to->max_total ? from->max_total : to->max_total;
+    }
+}
+
+//! Thread body: run jobs on one handler until all jobs are taken
+static void *run_worker(void *arg)
+{
+    struct loadgen_run *run = arg;
+    WQC *handler = wqc_init();
+    bool configured = handler && configure_handler(handler, run->config);
+
+    for (;;) {
+        pthread_mutex_lock(&run->lock);
+        int job = run->next_job < run->config->jobs ? run->next_job++ : -1;
+        if (job >= 0 && !configured) {
+            run->failed++;
+        }
+        pthread_mutex_unlock(&run->lock);
+
+        if (job < 0) {
+            break;
+        }
+        if (configured) {
+            run_job(handler, run, job);
+        }
+    }
+
+    if (handler) {
+        pthread_mutex_lock(&run->lock);
+        add_network_timing(run, handler);
+        pthread_mutex_unlock(&run->lock);
+    }
+    wqc_cleanup(handler);
+    return NULL;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *) a;
+    double y = *(const double *) b;
+    return (x > y) - (x < y);
+}
+
+//! Nearest-rank percentile of sorted values
+static double percentile(const double *sorted, int count, double fraction)
+{
+    int rank = (int) (fraction * count + 0.999999);
+    return count ? sorted[(rank < 1 ? 1 : rank > count ? count : rank) - 1] : 0;
+}
+
+//! Build the JSON report of a finished run, and print a summary of it
+static cJSON *make_report(struct loadgen_run *run, double elapsed)
+{
+    cJSON *report = cJSON_CreateObject();
+    cJSON *phases = cJSON_AddObjectToObject(report, "phases");
+
+    cJSON_AddStringToObject(report, "tool", "wqc-loadgen");
+    cJSON_AddNumberToObject(report, "concurrency", run->config->concurrency);
+    cJSON_AddNumberToObject(report, "jobs", run->config->jobs);
+    cJSON_AddNumberToObject(report, "succeeded", run->succeeded);
+    cJSON_AddNumberToObject(report, "failed", run->failed);
+    cJSON_AddNumberToObject(report, "elapsed_s", elapsed);
+    cJSON_AddNumberToObject(report, "jobs_per_second", run->succeeded / elapsed);
+    cJSON_AddNumberToObject(report, "bytes", (double) run->bytes);
+    cJSON_AddNumberToObject(report, "bytes_per_second", run->bytes / elapsed);
+
+    fprintf(stderr, "%d jobs done, %d failed in %.3f s: %.2f jobs/s, %.0f bytes/s\n", run->succeeded, run->failed,
+            elapsed, run->succeeded / elapsed, run->bytes / elapsed);
+    fprintf(stderr, "%-8s %12s %12s %12s %12s\n", "phase", "p50 ms", "p99 ms", "p999 ms", "max ms");
+
+    for (int phase = 0; phase < LOADGEN_PHASES_COUNT; ++phase) {
+        double *latencies = run->latencies[phase];
+        int count = run->succeeded;
+        qsort(latencies, count, sizeof(double), compare_doubles);
+
+        cJSON *stats = cJSON_AddObjectToObject(phases, phase_names[phase]);
+        cJSON_AddNumberToObject(stats, "p50_ms", percentile(latencies, count, 0.5) * 1e3);
+        cJSON_AddNumberToObject(stats, "p99_ms", percentile(latencies, count, 0.99) * 1e3);
+        cJSON_AddNumberToObject(stats, "p999_ms", percentile(latencies, count, 0.999) * 1e3);
+        cJSON_AddNumberToObject(stats, "max_ms", count ? latencies[count - 1] * 1e3 : 0);
+        fprintf(stderr, "%-8s %12.2f %12.2f %12.2f %12.2f\n", phase_names[phase],
+                percentile(latencies, count, 0.5) * 1e3, percentile(latencies, count, 0.99) * 1e3,
+                percentile(latencies, count, 0.999) * 1e3, count ? latencies[count - 1] * 1e3 : 0);
+    }
+
+    cJSON *endpoints = cJSON_AddObjectToObject(report, "endpoints");
+    fprintf(stderr, "%-10s %8s %8s %12s %12s %12s %14s\n", "endpoint", "calls", "failed", "connect ms", "ttfb ms",
+            "total ms", "bytes in");
+    for (int i = 0; i < WQC_ENDPOINTS_COUNT; ++i) {
+        const struct wqc_endpoint_timing *timing = &run->endpoints[i];
+        double calls = timing->calls ? timing->calls : 1;
+
+        cJSON *stats = cJSON_AddObjectToObject(endpoints, endpoint_names[i]);
+        cJSON_AddNumberToObject(stats, "calls", timing->calls);
+        cJSON_AddNumberToObject(stats, "failed_calls", timing->failed_calls);
+        cJSON_AddNumberToObject(stats, "mean_name_lookup_ms", timing->sum.name_lookup / calls * 1e3);
+        cJSON_AddNumberToObject(stats, "mean_connect_ms", timing->sum.connect / calls * 1e3);
+        cJSON_AddNumberToObject(stats, "mean_tls_handshake_ms", timing->sum.tls_handshake / calls * 1e3);
+        cJSON_AddNumberToObject(stats, "mean_first_byte_ms", timing->sum.first_byte / calls * 1e3);
+        cJSON_AddNumberToObject(stats, "mean_total_ms", timing->sum.total / calls * 1e3);
+        cJSON_AddNumberToObject(stats, "max_total_ms", timing->max_total * 1e3);
+        cJSON_AddNumberToObject(stats, "bytes_sent", (double) timing->sum.bytes_sent);
+        cJSON_AddNumberToObject(stats, "bytes_received", (double) timing->sum.bytes_received);
+        fprintf(stderr, "%-10s %8lu %8lu %12.2f %12.2f %12.2f %14zu\n", endpoint_names[i], timing->calls,
+                timing->failed_calls, (timing->sum.connect + timing->sum.tls_handshake) / calls * 1e3,
+                timing->sum.first_byte / calls * 1e3, timing->sum.total / calls * 1e3, timing->sum.bytes_received);
+    }
+
+    return report;
+}
+
+//! Run all jobs and return the JSON report, or NULL if the run could not start
+static cJSON *run_load(const struct loadgen_config *config)
+{
+    struct loadgen_run run = {config, PTHREAD_MUTEX_INITIALIZER, 0, 0, 0, 0, {NULL}, {{0}}};
+    pthread_t *threads = calloc(config->concurrency, sizeof(pthread_t));
+    bool rv = threads != NULL;
+    cJSON *report = NULL;
+    int started = 0;
+
+    for (int phase = 0; rv && phase < LOADGEN_PHASES_COUNT; ++phase) {
+        run.latencies[phase] = calloc(config->jobs, sizeof(double));
+        rv = run.latencies[phase] != NULL;
+    }
+
+    double start = now_seconds();
+    for (; rv && started < config->concurrency; ++started) {
+        rv = pthread_create(&threads[started], NULL, run_worker, &run) == 0;
+    }
+    for (int i = 0; i < started; ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    double elapsed = now_seconds() - start;
+
+    if (rv) {
+        report = make_report(&run, elapsed);
+    }
+
+    for (int phase = 0; phase < LOADGEN_PHASES_COUNT; ++phase) {
+        free(run.latencies[phase]);
+    }
+    free(threads);
+    return report;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -n jobs         number of jobs to run (default %d)\n"
+            "  -c handlers     number of concurrent handlers (default %d)\n"
+            "  -f quartets     shell quartets per ERI values blob, 0 for the server default (default 0)\n"
+            "  -a              fetch ERI values with wqc_fetch_all_ERI_values instead of one sub-job at a time\n"
+            "  -i              fetch the ERI values of each sub-job as soon as it is done, during the wait phase\n"
+            "  -w ms           longest time to wait for a job (default %d)\n"
+            "  -s server       server name\n"
+            "  -p port         server port\n"
+            "  -P              call the server over plain HTTP\n"
+            "  -k              do not verify the server certificate\n"
+            "  -t token        access token\n"
+            "  -m              run against an in-process mock server\n"
+            "  -d ms           time a mock server job takes (default %d)\n"
+            "  -l ms           latency of the mock server (default 0)\n"
+            "  -L              the mock server does not hold status calls (no long polling)\n"
+            "  -E              the mock server sends no ETag with job status (no 304 Not Modified)\n"
+            "  -S              the mock server has no combined submit, so jobs are submitted in three calls\n"
+            "  -Z              the mock server sends no compressed replies\n"
+            "  -o file         write the JSON report to a file instead of the standard output\n"
+            "  -T file         write a Chrome trace of all handlers to a file\n",
+            program, LOADGEN_DEFAULT_JOBS, LOADGEN_DEFAULT_CONCURRENCY, LOADGEN_DEFAULT_WAIT,
+            WQC_MOCK_DEFAULT_JOB_DURATION);
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct loadgen_config config = {LOADGEN_DEFAULT_JOBS, LOADGEN_DEFAULT_CONCURRENCY, LOADGEN_DEFAULT_WAIT};
+    struct wqc_mock_server_config mock_config;
+    WQC_MOCK_SERVER *mock_server = NULL;
+    const char *output_name = NULL;
+    bool use_mock = false;
+    int option = 0;
+
+    wqc_mock_server_default_config(&mock_config);
+    while ((option = getopt(argc, argv, "n:c:f:aiw:s:p:Pkt:md:l:LESZo:T:h")) != -1) {
+        switch (option) {
+            case 'n': config.jobs = atoi(optarg); break;
+            case 'c': config.concurrency = atoi(optarg); break;
+            case 'f': config.shell_sets_per_file = atoi(optarg); break;
+            case 'a': config.fetch_all = true; break;
+            case 'i': config.fetch_done_items = true; break;
+            case 'w': config.wait_timeout = atoi(optarg); break;
+            case 's': config.server_name = optarg; break;
+            case 'p': config.server_port = atoi(optarg); break;
+            case 'P': config.plain_http = true; break;
+            case 'k': config.insecure = true; break;
+            case 't': config.access_token = optarg; break;
+            case 'm': use_mock = true; break;
+            case 'd': mock_config.job_duration = atoi(optarg); break;
+            case 'l': mock_config.latency = atoi(optarg); break;
+            case 'L': mock_config.no_long_poll = true; break;
+            case 'E': mock_config.no_etag = true; break;
+            case 'S': mock_config.no_combined_submit = true; break;
+            case 'Z': mock_config.no_compression = true; break;
+            case 'o': output_name = optarg; break;
+            case 'T': config.trace_file = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (config.jobs < 1 || config.concurrency < 1) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    wqc_global_init();
+
+    if (use_mock) {
+        mock_server = wqc_mock_server_start(&mock_config);
+        if (!mock_server) {
+            fprintf(stderr, "Cannot start a mock server\n");
+            return 1;
+        }
+        config.server_name = "127.0.0.1";
+        config.server_port = wqc_mock_server_port(mock_server);
+        config.plain_http = true;
+    }
+
+    cJSON *report = run_load(&config);
+    char *text = report ? cJSON_Print(report) : NULL;
+    FILE *output = output_name ? fopen(output_name, "w") : stdout;
+    bool rv = text && output && cJSON_GetNumberValue(cJSON_GetObjectItem(report, "failed")) == 0;
+    if (text && output) {
+        fprintf(output, "%s\n", text);
+    } else {
+        fprintf(stderr, "Cannot write the report\n");
+    }
+    if (output && output != stdout) {
+        fclose(output);
+    }
+
+    free(text);
+    cJSON_Delete(report);
+    if (mock_server) {
+        wqc_mock_server_stop(mock_server);
+    }
+    wqc_global_cleanup();
+
+    return rv ? 0 : 1;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#include <stdbool.h>
+#include "libwebqc.h"
+#include "webqc-handler.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/// How to make one step of a WebQC API operation. The same steps are used for synchronous calls and for calls
+/// running asynchronously on a multi handle.
+struct wqc_call_step_info {
+    enum wqc_call_step step; /// The step this entry describes
+    const char *name; /// Name of the step in traces
+    bool (*prepare)(WQC *handler); /// Set up the handler's CURL handle for the HTTP call of the step
+    bool (*finish)(WQC *handler); /// Process the reply of a successful HTTP call
+    enum wqc_call_step next_step; /// Step to run after this one succeeds, WQC_STEP_NONE if the operation is done
+    enum wqc_call_step fallback_step; /// Step to run instead if the server does not support this one
+};
+
+
+//! Start a step of an operation: set up the handler's CURL handle for its HTTP call.
+//! \param handler handler to run the step on
+//! \param step the step to start
+//! \return true on success, false on failure (and sets error on the handler)
+bool wqc_start_call_step(
+    WQC *handler,
+    enum wqc_call_step step
+);
+
+//! Finish the step running on the handler after its HTTP call was performed, processing the reply.
+//! \param handler handler the step is running on
+//! \param call_succeeded did the HTTP call succeed
+//! \return true on success, false on failure (and sets error on the handler)
+bool wqc_finish_call_step(
+    WQC *handler,
+    bool call_succeeded
+);
+
+//! Abandon the step that was to run again on the handler, releasing what it kept for it
+//! \param handler handler the step ran on
+void wqc_abandon_call_step(
+    WQC *handler
+);
+
+//! Find which step follows the one that has just finished on the handler
+//! \param handler handler the step ran on
+//! \return the next step, or WQC_STEP_NONE if the operation is done
+enum wqc_call_step wqc_next_call_step(
+    const WQC *handler
+);
+
+//! Find which step submitting a job starts with: one combined call, unless it is turned off or the server was found
+//! not to support it, and otherwise creating the job
+//! \param handler handler the job is submitted on, with the job type set in its call state
+//! \return the first step of submitting the job
+enum wqc_call_step wqc_submit_job_first_step(
+    const WQC *handler
+);
+
+//! Check that no operation runs on the handler, on its own or in a WQC_MULTI, before one is started on it
+//! \param handler handler to start an operation on
+//! \return true if an operation can start, false if one runs (and sets WEBQC_HANDLER_BUSY on the handler)
+bool wqc_handler_idle(
+    WQC *handler
+);
+
+//! Run an operation synchronously, from the given step until it is done or a step fails
+//! \param handler handler to run the operation on
+//! \param first_step first step of the operation
+//! \return true on success, false on failure (and sets error on the handler)
+bool wqc_run_call(
+    WQC *handler,
+    enum wqc_call_step first_step
+);
+
+//! Set up the call that finds where a range of ERI values can be downloaded from
+//! \param handler handler a ERI calculation was submitted on, with the ERI index set in its call state
+//! \return true on success, false on failure (and sets error on the handler)
+bool prepare_ERI_values_call(
+    WQC *handler
+);
+
+//! Set up the download of ERI values straight into memory
+//! \param handler handler that already got the ERI values location
+//! \return true on success, false on failure (and sets error on the handler)
+bool prepare_ERI_values_download(
+    WQC *handler
+);
+
+//! Read the ERI values that were downloaded into the handler
+//! \param handler handler that downloaded ERI values
+//! \return true on success, false on failure (and sets error on the handler)
+bool finish_ERI_values_download(
+    WQC *handler
+);
+
+//! Remove a handler from the multi handle its operation is running on, abandoning the operation.
+//! \param handler handler to remove
+void wqc_multi_remove_handler(
+    WQC *handler
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
@@ -14,7 +14,10 @@ enum webqc_errors {
  WEBQC_OUT_OF_MEMORY = 4, ///< Run out of memory
  WEBQC_WEB_CALL_ERROR = 5, ///< Error calling a web service
  WEBQC_NOT_FETCHED = 6, ///< A value called for was not yet fetched from the WQC server
- WEBQC_IO_ERROR = 7 ///< A Some file-related error
+ WEBQC_IO_ERROR = 7, ///< A Some file-related error
+ WEBQC_HANDLER_BUSY = 8, ///< An operation is already running on the handler
+ WEBQC_SERVER_UNAVAILABLE = 9, ///< Calls to the server are stopped for a while, after too many of them failed
+ WEBQC_TIMEOUT = 10 ///< The operation did not finish before its timeout or the handler's deadline
 } ;
 
 typedef uint64_t error_code_t; ///< Numerical error code
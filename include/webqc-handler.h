@@ -13,6 +13,8 @@ extern "C" {
 #define UUID_LENGTH (37) /// UUID - 32 bytes for hex + 4 dash + terminating null
 #define WQC_JOB_ID_LENGTH (UUID_LENGTH) /// Job IDs are UUIDs
 #define WQC_PARAM_SET_ID_LENGTH (UUID_LENGTH) /// Parameter set IDs are UUIDs
+#define MAX_ETAG_SIZE (128) /// Maximum size of an ETag, with the quotes and terminating null
+#define MAX_STATUS_CURSOR_SIZE (64) /// Maximum size of a job status cursor, with the terminating null
 
 
 
@@ -22,19 +24,121 @@ struct web_reply_buffer {
     size_t size; /// Maximum length that can be stored in the "reply" buffer above
 };
 
+/// A memory area of known size that a download is written into
+struct download_buffer {
+    char *data; /// Where to write the downloaded data
+    size_t size; /// How many bytes the download is expected to have
+    size_t received; /// How many bytes were written so far
+    size_t range_start; /// Where the data starts in the resource, when only a range of it is downloaded
+    bool ranged; /// Only a range of the resource is downloaded, not all of it
+    size_t skip; /// Bytes at the start of the reply still to drop before the data, see whole_resource
+    bool whole_resource; /// The server ignored the range and sends the whole resource, of which only the range is kept
+    bool discard; /// The reply is an error, and its body is not data
+};
+
+#define WQC_LATENCY_SAMPLES (64) /// How many of the latest call times are kept per endpoint, to find hedge delays
+
+/// Times of the latest successful calls to one endpoint
+struct wqc_latency_samples {
+    double seconds[WQC_LATENCY_SAMPLES]; /// Call times, in seconds. Once all are taken, the oldest is replaced.
+    int count; /// How many call times are kept
+    int next; /// Where the next call time is kept
+};
+
 /**
  * The cURL-library related part of the data saved per handler.
  */
 struct handler_curl_info
 {
-    CURL *curl_handler; /// current CURL call handler
+    CURL *curl_handler; /// CURL handle used for all calls on the handler, kept open between calls
     char full_URL[MAX_URL_SIZE]; /// The full URL of the REST call to make
     struct web_reply_buffer web_reply; /// Buffer to collect replies from a web service
     char web_error_bufffer[CURL_ERROR_SIZE]; /// Buffer for errors from the web
     struct curl_slist *http_headers; /// HTTP headers to use in a web call
     int http_reply_code; /// HTTP Replu code from last call
+    CURLcode curl_result; /// Outcome of the transfer of the last call, CURLE_OK if it completed
+    int64_t retry_after; /// How long the server asked to wait before calling it again, in milliseconds, 0 if it did not
+    bool conditional; /// The call may be answered with 304 Not Modified
+    bool optional; /// The server may not have the endpoint of the call, and a reply saying so is not an error
+    bool compressed_body; /// The body of the call is compressed, and a reply that the server cannot take it is no error
+    char reply_etag[MAX_ETAG_SIZE]; /// ETag of the reply to a conditional call, empty if it had none
+    enum wqc_endpoint endpoint; /// Endpoint of the call being made, to time it
+    struct wqc_network_timing timing; /// Timing of the calls made with the handler
+    struct wqc_latency_samples latency[WQC_ENDPOINTS_COUNT]; /// Times of the latest calls, to find when to hedge calls
+    bool hedged; /// The call is made again on a second CURL handle if it is slow, see WQC_OPTION_HEDGE_PERCENTILE
+    struct download_buffer *download; /// Buffer the call downloads into, NULL if its reply is collected in web_reply
+    CURLM *hedge_multi; /// Runs the calls of the handler and their hedges together, once hedging is turned on
+    CURL *hedge_handler; /// CURL handle for the next hedge: the one of the call that lost the last hedged call
+};
+
+
+/// Where a range of calculated ERI values can be downloaded from, as returned by the eri_values endpoint
+struct ERI_values_location {
+    char URL[MAX_URL_SIZE]; /// URL of the ERI values blob
+    eri_shell_index_t begin; /// Index of the first ERI in the blob
+    eri_shell_index_t end; /// Index of the end ERI (one after last) in the blob
+    double precision; /// Precision of the ERIs in the blob
+    size_t size; /// Size of the blob, in bytes
+    char *values; /// The blob itself, if the server sent it with its location, NULL otherwise
 };
 
+/// Each step of a WebQC API operation is one HTTP call
+enum wqc_call_step {
+    WQC_STEP_NONE = 0, /// No call to make
+    WQC_STEP_CREATE_JOB = 1, /// Create a new job
+    WQC_STEP_SET_PARAMETERS = 2, /// Create the parameter set for the job
+    WQC_STEP_START_JOB = 3, /// Start the job with the parameter set
+    WQC_STEP_GET_STATUS = 4, /// Get the status of the job
+    WQC_STEP_GET_INTEGRALS_DETAILS = 5, /// Get information about the integrals calculated by the job
+    WQC_STEP_GET_ERI_VALUES = 6, /// Find where a range of ERI values can be downloaded from
+    WQC_STEP_DOWNLOAD_ERI_VALUES = 7, /// Download a range of ERI values
+    WQC_STEP_SUBMIT_JOB = 8, /// Create a job with its parameter set and start it, in one call
+    WQC_STEP_SUBMIT_BATCH = 9, /// Submit the jobs of a batch of handlers, in one call
+    WQC_STEP_GET_BATCH_STATUS = 10 /// Get the status of the jobs of a batch of handlers, in one call
+};
+
+/**
+ * Arguments and progress of the API operation running on a handler
+ */
+struct wqc_call_state
+{
+    enum wqc_call_step step; /// Step of the operation currently running
+    enum wqc_job_type job_type; /// Type of job to submit
+    const void *job_parameters; /// Parameters of the job to submit
+    WQC **batch_handlers; /// Handlers of the jobs a batched call is made for
+    void **batch_parameters; /// Parameters of each job of a batched submit
+    int batch_count; /// How many jobs a batched call is made for
+    eri_shell_index_t eri_index; /// ERI index to fetch the values of
+    eri_shell_index_t eri_range_end; /// End of the range of ERI values to fetch, if eri_range is set
+    bool eri_range; /// Fetch only the ERI values from eri_index to eri_range_end, not the whole blob they are in
+    struct ERI_values_location eri_location; /// Where to download ERI values from, and what range they are
+    struct download_buffer download; /// Memory ERI values are downloaded into, before they are stored in the handler
+    struct webqc_multi_t *multi; /// Multi handle running the operation, NULL if it is not running asynchronously
+    int multi_position; /// Position of the handler in the multi handle's list of running handlers
+    int64_t trace_start; /// When the current step started, for tracing
+    int64_t status_wait; /// How long the server may hold a status call until a sub-job finishes, 0 to reply at once
+    bool step_unsupported; /// The server does not support the step that just finished, so its fallback runs next
+    bool operation_done; /// The step that just finished did the rest of the operation, so no step runs next
+    bool resend; /// The server could not take the request of the step that just finished, so it runs again
+    bool resume_download; /// The step that just failed runs again, and its download goes on from where it stopped
+    int download_retries; /// How many times the download of the running step was resumed
+    int retries; /// How many times the running step was made again after a temporary error
+    int64_t retry_delay; /// How long to wait before the step that just failed runs again, in milliseconds
+    int64_t retry_at; /// When the step that just failed runs again, if the operation is running asynchronously
+    int64_t deadline; /// When the running operation must be done by, on the monotonic clock, 0 if it has no limit
+};
+
+/// Progress of a job, as seen by the status polls made while waiting for it
+struct job_progress {
+    int polls_count; /// How many polls were made
+    int64_t first_poll_time; /// When the first poll was made, in milliseconds
+    double first_progress; /// Progress of the job at the first poll
+    int first_finished; /// Sub-jobs that were finished at the first poll
+    double min_item_time; /// Lower bound of the time each sub-job takes, from the polls so far, in milliseconds
+    double max_item_time; /// Upper bound of the time each sub-job takes, 0 until sub-jobs are seen to progress
+    int64_t poll_interval; /// Time between the last two polls, in milliseconds
+    bool next_item_only; /// Waiting for the next sub-job to be done, rather than the whole job
+};
 
 /**
  * @brief Internal structure that maintains the status of an asynchrounous WQC operation.
@@ -46,6 +150,27 @@ struct webqc_handler_t {
     char *webqc_server_name; /// WebQC server name
     unsigned short webqc_server_port; /// Port of the WebQC server
     bool insecure_ssl; /// Do not verify SSL certificates
+    bool plain_http; /// Call the WebQC server over HTTP instead of HTTPS
+    int max_parallel_downloads; /// Maximum number of ERI values blobs to download at once
+    int max_inline_ERI_size; /// Largest ERI values blob the server is asked to send inside its replies, in bytes
+    int download_retries; /// How many times a blob download that broke off is resumed, before it fails
+    int call_retries; /// How many times a web call that failed with a temporary error is made again, before it fails
+    int retry_base_delay; /// Shortest wait before a failed web call is made again, in milliseconds
+    int retry_max_delay; /// Longest wait before a failed web call is made again, in milliseconds
+    unsigned int retry_random_state; /// State of the random numbers that spread the waits of handlers apart
+    int call_timeout; /// Longest time an operation may take, in milliseconds, 0 for no limit
+    int connect_timeout; /// Longest time to connect to a server, in milliseconds
+    int64_t deadline; /// When all operations must be done by, on the monotonic clock, 0 if there is no deadline
+    int hedge_percentile; /// Percentile of call times after which a slow call is hedged, 0 to never hedge calls
+    bool long_poll; /// Ask the server to hold status calls until a sub-job finishes, instead of polling
+    bool long_poll_unsupported; /// The server was found to reply to status calls at once, so poll it instead
+    bool combined_submit; /// Submit jobs in one call, instead of creating the job and parameters and starting it
+    bool combined_submit_unsupported; /// The server was found to have no combined submit, so use three calls
+    bool batch_unsupported; /// The server was found to have no batched calls, so make a call for each job
+    bool compression; /// Compress large request bodies, and accept compressed replies
+    bool compressed_body_unsupported; /// The server was found to reject compressed request bodies, so send them as is
+    int min_poll_interval; /// Shortest time between status polls, in milliseconds - bounds the load on the server
+    int max_poll_interval; /// Longest time between status polls, in milliseconds - bounds the latency of a result
     char job_id[WQC_JOB_ID_LENGTH]; /// Job ID the handler is currently doing
     char parameter_set_id[WQC_PARAM_SET_ID_LENGTH]; /// Job ID the handler is currently doing
     const char *wqc_endpoint; /// Which WebQC endpoint to call
@@ -53,8 +178,20 @@ struct webqc_handler_t {
     bool is_duplicate; /// Job was found to be a duplicate of another one
     enum job_status_t job_status; /// Last known status of job as require by the WebQC server
     struct ERI_item_status *eri_status; /// List of all ERI sub-jobs status...
+    char status_etag[MAX_ETAG_SIZE]; /// ETag of the job status eri_status was parsed from, empty if unknown
+    char status_cursor[MAX_STATUS_CURSOR_SIZE]; /// Server cursor eri_status is up to date with, empty if unknown
     int ERI_items_count;    /// How many ERI sub-jobs there are
+    int ERI_items_by_status[WQC_JOB_STATUS_ERROR + 1]; /// How many ERI sub-jobs are in each status
+    int *ERI_done_queue; /// Indices in eri_status of done sub-jobs not handed out yet, in the order they got done
+    int ERI_done_queue_begin; /// Position of the next sub-job to hand out in ERI_done_queue
+    int ERI_done_queue_end; /// Position after the last sub-job in ERI_done_queue
+    struct job_progress items_progress; /// Progress of the job seen by all wqc_wait_for_any_items() calls on it
     struct ERI_information eri_info;  /// Full ERI information
+    size_t eri_memory_metered; /// Bytes of ERI values of the handler counted in the process-wide metrics
+    struct wqc_call_state call; /// The API operation running on the handler
+    char *trace_file; /// File the handler's operations are traced into, NULL if not tracing
+    struct wqc_trace_file *trace; /// Open trace file, NULL if not tracing
+    int trace_track; /// Track of the handler's spans in the trace file
 };
 
 
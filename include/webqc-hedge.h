@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include "libwebqc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Hedging slow web calls. The times of the latest successful calls to each endpoint are kept per handler. A blob
+ * download or status poll still running after the WQC_OPTION_HEDGE_PERCENTILE percentile of those times is made
+ * again on a second CURL handle, and the first of the two to be answered is taken.
+ */
+
+#define WQC_HEDGE_MIN_SAMPLES (10) /// How many call times an endpoint needs before its calls are hedged
+
+struct download_buffer;
+
+//! Keep the time of a successful call, to find when later calls to its endpoint are slow
+//! \param handler handler the call was made with
+//! \param endpoint endpoint of the call
+//! \param seconds how long the call took, in seconds
+void wqc_record_latency(
+    WQC *handler,
+    enum wqc_endpoint endpoint,
+    double seconds
+);
+
+//! Find how long a call to an endpoint runs before it is hedged: the WQC_OPTION_HEDGE_PERCENTILE percentile of the
+//! times of the latest calls to the endpoint
+//! \param handler handler making the call
+//! \param endpoint endpoint of the call
+//! \return the delay, in milliseconds, or -1 if the call is not hedged: hedging is off, or too few calls were timed
+int64_t wqc_hedge_delay(
+    const WQC *handler,
+    enum wqc_endpoint endpoint
+);
+
+//! Set up where the second call of a hedged download writes: the same memory as the first call, from where the first
+//! call starts. A download that was resumed goes on from where it stopped, in the same range of the resource.
+//! \param hedge download of the second call, to set up
+//! \param download download of the first call, before the first call starts
+void wqc_init_hedge_download(
+    struct download_buffer *hedge,
+    const struct download_buffer *download
+);
+
+//! Take how far the second call of a hedged download got, once it is done and its reply is taken
+//! \param download download of the first call
+//! \param hedge download of the second call, set up by wqc_init_hedge_download()
+void wqc_take_hedge_download(
+    struct download_buffer *download,
+    const struct download_buffer *hedge
+);
+
+//! Forget the times of all calls made with a handler
+//! \param handler handler whose call times to forget
+void wqc_reset_latency(
+    WQC *handler
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
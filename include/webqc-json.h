@@ -2,6 +2,7 @@
 #include <stdbool.h>
 #include <cjson/cJSON.h>
 #include "libwebqc.h"
+#include "webqc-handler.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -53,6 +54,17 @@ bool get_parameter_set_id_from_reply(
         WQC *handler
 );
 
+//! Parse a WEB API JSON text that was received in a reply into a cJSON structure.
+//! \param handler handler to set the error on
+//! \param text JSON text to parse
+//! \param reply_json if JSON is parsed successfully, a cJSON handler. Caller must release memory with cJSON_Delete.
+//! \return true on success, false on failure (and error set on the handler).
+bool parse_JSON_text(
+    WQC *handler,
+    const char *text,
+    cJSON **reply_json
+);
+
 //! Parse a WEB API JSON text reply into a cJSON structure.
 //! \param handler handler where we recieved the reply
 //! \param reply_json if JSON is parsed successfully, a cJSON handler. Caller must release memory with cJSON_Delete.
@@ -63,6 +75,21 @@ bool parse_JSON_reply(
 );
 
 
+//! Decode a base64 field of a JSON object
+//! \param handler handler to set the error on
+//! \param json JSON object to get the field from
+//! \param field_name field to decode
+//! \param data output - the decoded data, to free by the caller, or NULL if there is no such field
+//! \param size output - size of the decoded data, in bytes
+//! \return true if the field was decoded or is missing, false if it is not base64 (and sets error on the handler)
+bool get_base64_from_JSON(
+    WQC *handler,
+    const cJSON *json,
+    const char *field_name,
+    char **data,
+    size_t *size
+);
+
 //! Update the handler's detail after a job submission
 //! \param handler handelr on which an HTTP reply was just recieved
 //! \return true on success, false on failure (and error set on the handler).
@@ -77,6 +104,37 @@ bool update_eri_job_status(
         WQC *handler
 );
 
+//! Find the replies for each job in the reply to a batched call
+//! \param handler handler the batched call was made on, to set the error on
+//! \param reply_json the parsed reply
+//! \param jobs_count how many jobs the call was made for
+//! \param replies output - array of the replies for each job, in the order of the jobs in the call
+//! \return true on success, false on failure (and sets error on the handler)
+bool get_batch_replies(
+    WQC *handler,
+    const cJSON *reply_json,
+    int jobs_count,
+    cJSON **replies
+);
+
+//! Update a handler's job and parameter set IDs from its reply in a batched submit, as a combined submit would
+//! \param handler handler of the job
+//! \param job_reply the reply for the job
+//! \return true on success, false on failure (and sets error on the handler)
+bool update_batch_job_details(
+    WQC *handler,
+    const cJSON *job_reply
+);
+
+//! Update a handler's job status from its reply in a batched status call, as update_eri_job_status() does
+//! \param handler handler of the job
+//! \param job_reply the reply for the job
+//! \return true on success, false on failure (and sets error on the handler)
+bool update_batch_job_status(
+    WQC *handler,
+    const cJSON *job_reply
+);
+
 //! Update the handler structure with the information about the ERIs.
 //! \param handler handler that just completed successfully any integral-related call
 //! \return true on success, false on failure (and sets error on the handler)
@@ -84,8 +142,19 @@ bool update_eri_details(
     WQC *handler
 );
 
-//! Update the handler structure with the values of the calculated ERIs.
-//! \param handler handler that just completed successfully ERI calculation job
+//! Parse the reply of a call to the eri_values endpoint
+//! \param handler handler to set the error on
+//! \param reply text of the reply
+//! \param location output - where the ERI values are and what they contain
+//! \return true on success, false on failure (and sets error on the handler)
+bool parse_ERI_values_location(
+    WQC *handler,
+    const char *reply,
+    struct ERI_values_location *location
+);
+
+//! Update the handler's call state with where a range of ERI values can be downloaded from.
+//! \param handler handler that just completed successfully a call to the eri_values endpoint
 //! \return true on success, false on failure (and sets error on the handler)
 bool update_eri_values(
     WQC *handler
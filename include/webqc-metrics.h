@@ -0,0 +1,69 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include "libwebqc.h"
+#include "webqc-errors.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Process-wide metrics of all handlers. Metrics are updated with relaxed atomic operations, so they can be updated
+ * from any thread without locks, and are exported with wqc_metrics_dump().
+ */
+
+#define WQC_METRICS_ERROR_CODES (32) /// Error codes below this number are counted each on its own
+
+/// Counters of events, each one a single number
+enum wqc_counter {
+    WQC_COUNTER_JOBS_SUBMITTED = 0, /// Jobs submitted
+    WQC_COUNTER_DUPLICATE_JOBS = 1, /// Submitted jobs that turned out to be duplicates of earlier jobs
+    WQC_COUNTER_STATUS_POLLS = 2, /// Job status calls
+    WQC_COUNTER_STATUS_POLLS_UNCHANGED = 3, /// Job status calls that found no new finished ERI sub-jobs
+    WQC_COUNTER_ERI_BYTES_DOWNLOADED = 4, /// Bytes of ERI values downloaded
+    WQC_COUNTER_RETRIES = 5, /// Web calls made again after a failure
+    WQC_COUNTER_BREAKER_OPENED = 6, /// Times calls to a server were stopped after too many of them failed
+    WQC_COUNTER_HEDGED_CALLS = 7, /// Slow web calls made again on a second connection
+    WQC_COUNTER_HEDGES_WON = 8, /// Hedged calls whose second call was answered first
+    WQC_COUNTERS_COUNT = 9 /// Number of counters
+};
+
+//! Add to a counter
+//! \param counter counter to add to
+//! \param amount how much to add
+void wqc_metrics_count(
+    enum wqc_counter counter,
+    unsigned long amount
+);
+
+//! Count an error set on a handler
+//! \param code error code
+void wqc_metrics_count_error(
+    error_code_t code
+);
+
+//! Count a finished web call
+//! \param endpoint endpoint that was called
+//! \param succeeded whether the call succeeded
+void wqc_metrics_count_web_call(
+    enum wqc_endpoint endpoint,
+    bool succeeded
+);
+
+//! Add the time it took to parse a JSON reply to the JSON parse time histogram
+//! \param seconds parse time
+void wqc_metrics_observe_JSON_parse(
+    double seconds
+);
+
+//! Update the memory held by ERI values after the ERI values of a handler were allocated, replaced or released
+//! \param handler handler whose ERI values changed
+void wqc_metrics_update_ERI_memory(
+    WQC *handler
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
@@ -8,4 +8,22 @@ typedef enum wqc_option_type
     WQC_OPTION_ACCESS_TOKEN = 1, /// Set the access token WebQC server uses to authenticate calls
     WQC_OPTION_SERVER_NAME = 2, /// Set the WebQC server name
     WQC_OPTION_INSECURE_SSL = 3,  /// Do not verify SSL certificates
+    WQC_OPTION_MAX_PARALLEL_DOWNLOADS = 4, /// Maximum number of ERI values blobs to download at once (int)
+    WQC_OPTION_SERVER_PORT = 5, /// Set the WebQC server port (int)
+    WQC_OPTION_PLAIN_HTTP = 6, /// Call the WebQC server over plain HTTP instead of HTTPS, e.g. for a local mock server
+    WQC_OPTION_TRACE_FILE = 7, /// Write a Chrome trace of the handler's operations to this file, NULL to stop tracing
+    WQC_OPTION_LONG_POLL = 8, /// Let the server hold status calls of wqc_wait_for_job until a sub-job finishes (default on)
+    WQC_OPTION_MIN_POLL_INTERVAL = 9, /// Shortest time between status polls of wqc_wait_for_job, in milliseconds (int)
+    WQC_OPTION_MAX_POLL_INTERVAL = 10, /// Longest time between status polls of wqc_wait_for_job, in milliseconds (int)
+    WQC_OPTION_COMBINED_SUBMIT = 11, /// Submit jobs in one call when the server supports it (default on)
+    WQC_OPTION_MAX_INLINE_ERI_SIZE = 12, /// Largest ERI values blob to get inside replies, in bytes (int, 0 for none)
+    WQC_OPTION_COMPRESSION = 13, /// Compress request bodies, and accept compressed replies and blobs (default on)
+    WQC_OPTION_DOWNLOAD_RETRIES = 14, /// Times a blob download that broke off is resumed from where it stopped (int)
+    WQC_OPTION_CALL_RETRIES = 15, /// Times a web call that failed with a temporary error is made again (int)
+    WQC_OPTION_RETRY_BASE_DELAY = 16, /// Shortest wait before a failed web call is made again, in milliseconds (int)
+    WQC_OPTION_RETRY_MAX_DELAY = 17, /// Longest wait before a failed web call is made again, in milliseconds (int)
+    WQC_OPTION_CALL_TIMEOUT = 18, /// Longest time an operation and its web calls may take, in milliseconds (int, 0 for none)
+    WQC_OPTION_CONNECT_TIMEOUT = 19, /// Longest time to connect to a server, in milliseconds (int)
+    WQC_OPTION_HEDGE_PERCENTILE = 20, /// Percentile of call times after which blob downloads and status polls are
+                                      /// made again on a second connection, first reply wins (int, 0 for never)
 } wqc_option_t;
\ No newline at end of file
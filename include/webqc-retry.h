@@ -0,0 +1,88 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include <curl/curl.h>
+#include "libwebqc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Making failed web calls again. A call that failed with a temporary error (see wqc_transient_failure()) is made again
+ * after a random wait that grows with each failure, so handlers that failed together do not call again together. A
+ * process-wide circuit breaker stops all calls to a server for a while after too many of them failed in a row.
+ * The web calls of an operation, and the waits between them, all fit in the time left until the operation's deadline.
+ */
+
+//! Get the time of a monotonic clock
+//! \return the time, in milliseconds
+int64_t wqc_monotonic_milliseconds();
+
+//! Find how long to wait before the web call that just failed on a handler with a temporary error is made again. A call
+//! whose reply broke off is made again at once. Otherwise the wait is drawn at random between the handler's shortest
+//! wait and three times the previous wait (decorrelated jitter). It is no shorter than the server asked for with a
+//! Retry-After header, and no longer than the handler's longest wait.
+//! \param handler handler whose call failed
+//! \param previous_delay the wait before the call was last made again, 0 if it was not yet. Set to the new wait.
+//! \return how long to wait, in milliseconds
+int64_t wqc_next_retry_delay(
+    WQC *handler,
+    int64_t *previous_delay
+);
+
+//! Check whether the circuit breaker lets a web call to the handler's server be made now
+//! \param handler handler to make the call with
+//! \return true if the call can be made, false if calls to the server are stopped (and sets error on the handler)
+bool wqc_breaker_allows_call(
+    WQC *handler
+);
+
+//! Tell the circuit breaker how a web call to the handler's server went
+//! \param handler handler the call was made with
+//! \param server_failed the call failed with a temporary error, so the server may be unhealthy
+void wqc_breaker_record_call(
+    WQC *handler,
+    bool server_failed
+);
+
+//! Set the deadline of an operation starting on a handler: the handler's deadline, or WQC_OPTION_CALL_TIMEOUT from
+//! now if that is earlier. A status call the server may hold is given the time it is held on top of the timeout.
+//! \param handler handler the operation runs on
+void wqc_start_deadline(
+    WQC *handler
+);
+
+//! Let a web call of the operation running on a handler take no longer than the time left until its deadline
+//! \param handler handler the operation runs on
+//! \param curl CURL handle of the call, set up for it
+//! \return true if there is time left for the call, false if not (and sets WEBQC_TIMEOUT on the handler)
+bool wqc_set_call_timeout(
+    WQC *handler,
+    CURL *curl
+);
+
+//! Check whether a failed web call of the operation running on a handler can wait before it is made again, and still
+//! be made before the operation's deadline
+//! \param handler handler the operation runs on
+//! \param wait how long the call would wait, in milliseconds
+//! \return true if it can, false if not (and sets WEBQC_TIMEOUT on the handler)
+bool wqc_deadline_allows_wait(
+    WQC *handler,
+    int64_t wait
+);
+
+//! Find the error code of a web call that libcURL failed: WEBQC_TIMEOUT if it was cut at the deadline of the operation
+//! running on the handler, WEBQC_WEB_CALL_ERROR otherwise
+//! \param handler handler the operation runs on
+//! \param res result of the call
+//! \return the error code
+int wqc_web_call_error_code(
+    const WQC *handler,
+    CURLcode res
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
@@ -0,0 +1,68 @@
+#pragma once
+#include <stdbool.h>
+#include <stdint.h>
+#include "libwebqc.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * Span tracing of the operations of handlers, written as Chrome trace events (load the file in chrome://tracing or
+ * https://ui.perfetto.dev). Handlers that trace into the same file share it, each handler on its own track. When a
+ * handler is not tracing, each call below costs one pointer check.
+ */
+
+/// Time a span started at, in microseconds. Zero when the handler is not tracing.
+typedef int64_t wqc_trace_time_t;
+
+//! Start or stop tracing the operations of a handler
+//! \param handler handler to trace
+//! \param path file to write the trace to, shared with other handlers tracing into it. NULL to stop tracing.
+//! \return true on success, false on failure (and sets error on the handler)
+bool wqc_trace_open(
+    WQC *handler,
+    const char *path
+);
+
+//! Stop tracing the operations of a handler, closing the trace file when no other handler traces into it
+//! \param handler handler to stop tracing
+void wqc_trace_close(
+    WQC *handler
+);
+
+//! Get the time a span starts at
+//! \param handler handler the span is on
+//! \return the current time, or zero if the handler is not tracing
+wqc_trace_time_t wqc_trace_begin(
+    const WQC *handler
+);
+
+//! Write a span that started at wqc_trace_begin() and ends now
+//! \param handler handler the span is on
+//! \param name name of the span, a string literal
+//! \param start what wqc_trace_begin() returned when the span started
+void wqc_trace_end(
+    WQC *handler,
+    const char *name,
+    wqc_trace_time_t start
+);
+
+//! Write a span that overlaps other spans of the handler, such as one of several concurrent downloads
+//! \param handler handler the span is on
+//! \param name name of the span, a string literal
+//! \param start what wqc_trace_begin() returned when the span started
+//! \param id tells apart the spans that overlap each other
+//! \param bytes bytes transferred during the span
+void wqc_trace_end_concurrent(
+    WQC *handler,
+    const char *name,
+    wqc_trace_time_t start,
+    unsigned int id,
+    size_t bytes
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
@@ -1,11 +1,68 @@
 #pragma once
 #include <stdbool.h>
+#include <curl/curl.h>
 #include "libwebqc.h"
+#include "webqc-handler.h"
 
 #ifdef __cplusplus
 extern "C" {
 #endif
 
+//! A CURL write callback that writes downloaded data into a struct download_buffer. The download is aborted if it
+//! has more data than the buffer size.
+//! \param data data received
+//! \param size size of one data item
+//! \param nmemb number of data items received
+//! \param userp the struct download_buffer to write into
+//! \return number of bytes written
+size_t wqc_write_to_download_buffer(
+    void *data,
+    size_t size,
+    size_t nmemb,
+    void *userp
+);
+
+//! Format the URL of a call to a WebQC service
+//! \param handler handler whose WebQC server to call
+//! \param web_endpoint specific service on the WebQC server
+//! \param URL output - buffer of MAX_URL_SIZE bytes for the URL
+//! \return true on success, false on failure (and sets error on the handler)
+bool format_web_call_URL(
+    WQC *handler,
+    const char *web_endpoint,
+    char *URL
+);
+
+//! Set the options that all CURL handles used by the handler share: connection keepalive, shared caches and SSL
+//! verification.
+//! \param handler handler whose options to use
+//! \param curl CURL handle to set up
+void setup_curl_handle(
+    WQC *handler,
+    CURL *curl
+);
+
+//! Add the HTTP headers every call to the WebQC server needs: authorization and content type
+//! \param handler handler whose access token to use
+//! \param headers list of headers to add to
+//! \return true on success, false on failure (and sets error on the handler)
+bool add_web_call_headers(
+    WQC *handler,
+    struct curl_slist **headers
+);
+
+//! Add the network timing of a finished call to the handler's most recent call and per-endpoint totals
+//! \param handler handler the call was made for
+//! \param curl CURL handle that made the call
+//! \param endpoint endpoint that was called. Calls to WQC_ENDPOINTS_COUNT are not recorded.
+//! \param succeeded whether the call succeeded
+void record_call_timing(
+    WQC *handler,
+    CURL *curl,
+    enum wqc_endpoint endpoint,
+    bool succeeded
+);
+
 //! Prepare a CURL object to make a call to the WebQC server
 //! \param handler handler to make a call with
 //! \param web_endpoint specific service on the WebQC server
@@ -18,12 +75,39 @@ bool prepare_web_call(
 
 //! Perform the call to the WebQC server.
 //! \param handler handler to make the call on
-//! \return true on success, false on failure. Success means the call was successful in getting a 2XX HTTP reply
+//! \return true on success, false on failure. Success means the call was successful in getting a 2XX HTTP reply, or
+//! 304 Not Modified for a conditional call, or a reply saying the server does not have the endpoint for an optional call
 bool make_web_call(
     WQC *handler
 );
 
-//! Cleanup CURL related information. Release all memory
+//! Find whether the reply to the last call said the server does not have its endpoint, or does not support the call
+//! \param handler handler the call was made on
+//! \return true if the HTTP reply code was 404 Not Found, 405 Method Not Allowed or 501 Not Implemented
+bool web_call_unsupported(
+    const WQC *handler
+);
+
+//! Find whether the server rejected the compressed body of the last call, which must then be made again as is
+//! \param handler handler the call was made on
+//! \return true if the body was compressed and the server replied 415 Unsupported Media Type
+bool compressed_body_rejected(
+    const WQC *handler
+);
+
+//! Check the outcome of a call that was performed with the handler's CURL handle, and set the error on the handler
+//! if it failed.
+//! \param handler handler the call was made on
+//! \param res result code CURL returned for the call
+//! \return true on success, false on failure. Success means the call was successful in getting a 2XX HTTP reply, or
+//! a reply saying the server does not have the endpoint for an optional call
+bool check_web_call_result(
+    WQC *handler,
+    CURLcode res
+);
+
+//! Cleanup the per-call CURL information, releasing the memory it uses. The handler's CURL handle, and the
+//! connection it holds to the WebQC server, are kept for the next call.
 //! \param handler handler to clean up
 //! \return true on success, false on failure
 bool cleanup_web_call(
@@ -40,6 +124,38 @@ bool set_eri_job_parameters(
     const struct two_electron_integrals_job_parameters *job_parameters
 );
 
+//! Generate the body of a call that creates an Electron Repulsion Integrals (ERI) job with its parameters and starts
+//! it, all at once.
+//! \param handler handler that call will be make on
+//! \param job_parameters Details of the ERI calculation desired
+//! \return true on success, false on failure
+bool set_eri_submit_parameters(
+    WQC *handler,
+    const struct two_electron_integrals_job_parameters *job_parameters
+);
+
+//! Generate the body of a call that submits many ERI jobs at once, each as set_eri_submit_parameters() does.
+//! \param handler handler that call will be make on
+//! \param job_parameters Details of each ERI calculation, as struct two_electron_integrals_job_parameters
+//! \param jobs_count How many jobs to submit
+//! \return true on success, false on failure
+bool set_eri_batch_submit_parameters(
+    WQC *handler,
+    void *job_parameters[],
+    int jobs_count
+);
+
+//! Generate the body of a call that gets the status of the jobs of many handlers at once
+//! \param handler handler that call will be make on
+//! \param handlers handlers whose jobs to get the status of
+//! \param jobs_count How many handlers there are
+//! \return true on success, false on failure
+bool set_batch_status_parameters(
+    WQC *handler,
+    WQC *handlers[],
+    int jobs_count
+);
+
 //! Set the next web call to have no parameters.
 //! \param handler handler that call will be make on
 //! \return true on success, false on failure
@@ -72,6 +188,16 @@ bool set_POST_fields(
 );
 
 
+//! Make the call being prepared conditional: send the ETag of the data the handler already has, so the server can
+//! reply 304 Not Modified instead of sending it again, and keep the ETag of the reply in web_call_info.reply_etag
+//! \param handler handler to make the call on
+//! \param etag ETag of the data the handler has, empty if it has none
+//! \return true on success, false on failure (and sets error on the handler)
+bool prepare_conditional_call(
+    WQC *handler,
+    const char *etag
+);
+
 //! Extend the URL to call by adding a resource to for an HTTP GET
 //! \param handler handler to make the call on
 //! \param param_name resource name to get
@@ -83,9 +209,68 @@ bool prepare_get_parameter(
     const char *param_value
 );
 
+//! Ask the server to send the ERI values of small sub-jobs with their status or location, if the handler's
+//! max_inline_ERI_size option allows it
+//! \param handler handler with the prepared call
+//! \return true on success, false if the URL is too long (and sets error on the handler)
+bool prepare_inline_values_parameter(
+    WQC *handler
+);
+
+
+/// A file a download is written into
+struct file_download {
+    FILE *fp; /// File pointer to write the data into
+    curl_off_t written; /// How many bytes were written so far, which a resumed download goes on from
+};
+
+//! Prepare the handler's CURL handle to download a file into an open file pointer
+//! \param handler Hanlder to download with, and to set error on, in case of error
+//! \param URL URL of the file to download
+//! \param file file to write the data into. Its file pointer should be opened with "wb" attributes
+//! \return true on success, false on failure (and sets error on the handler)
+bool prepare_file_download(
+    WQC *handler,
+    const char *URL,
+    struct file_download *file
+);
+
+//! Prepare the handler's CURL handle to download a file straight into a memory area of known size
+//! \param handler Hanlder to download with, and to set error on, in case of error
+//! \param URL URL of the file to download
+//! \param buffer where to write the data. The download fails if the file is larger than the buffer.
+//! \return true on success, false on failure (and sets error on the handler)
+bool prepare_buffer_download(
+    WQC *handler,
+    const char *URL,
+    struct download_buffer *buffer
+);
+
+//! Set up a CURL handle to download into a buffer the data it does not have yet. That is the whole file, unless the
+//! buffer is for a range of it, or already has the start of the data from a download that broke off: then only the
+//! rest is asked for, with an HTTP Range request. If the server ignores the range and sends the whole file, the
+//! range is cut out of it as it arrives. The body of an error reply is not written into the buffer.
+//! \param curl CURL handle to set up
+//! \param buffer where to write the data. Its range_start, ranged and received must be set.
+void wqc_set_download_buffer(
+    CURL *curl,
+    struct download_buffer *buffer
+);
+
+//! Check whether a call that failed may succeed if it is made again: the connection failed or broke off, or the
+//! server had a temporary error
+//! \param result outcome of the transfer of the call
+//! \param http_reply_code HTTP status of the reply, 0 if none came
+//! \return true if the failure is transient
+bool wqc_transient_failure(
+    CURLcode result,
+    long http_reply_code
+);
 
-//! Download a file into an open file pointer
-//! \param handler Hanlder to set error on, in case of error
+//! Download a file into an open file pointer, using the handler's CURL handle. A download that breaks off is
+//! resumed from where it stopped, as many times as WQC_OPTION_DOWNLOAD_RETRIES allows, after the wait
+//! wqc_next_retry_delay() finds. The download and its waits end by the deadline wqc_start_deadline() sets.
+//! \param handler Hanlder to download with, and to set error on, in case of error
 //! \param URL URL of the file to download
 //! \param fp file pointer to write the data into. Should be opened with "wb" attributes
 //! \return true if all went well. If not, false, and set error on the handler
@@ -96,16 +281,20 @@ bool wqc_download_file(
 );
 
 
-//! Set up the web access library
+//! Set up the web access library, including the DNS and TLS session caches shared by all handlers
 void web_access_init();
 
-//! Clean up the web access library
+//! Clean up the web access library. All handlers must be cleaned up before calling this function.
 void web_access_cleanup();
 
-//! Initialize the web access part of the hanlder
+//! Initialize the web access part of the hanlder, creating the CURL handle that is used for all its calls
 //! \param handler  handler to initialize
 void wqc_init_web_calls(WQC *handler);
 
+//! Release the web access part of the handler, closing the CURL handle and its connections
+//! \param handler handler to release
+void wqc_cleanup_web_calls(WQC *handler);
+
 #ifdef __cplusplus
 } // "extern C"
 #endif
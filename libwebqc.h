@@ -9,15 +9,42 @@ extern "C" {
 #include "webqc-errors.h"
 #include "webqc-options.h"
 #include <stdio.h>
+#include <sys/select.h>
 
 #define TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT "eri"
 #define NEW_JOB_SERVICE_ENDPOINT "job"
 #define PARAMETERS_SERVICE_ENDPOINT "params"
+#define SUBMIT_JOB_SERVICE_ENDPOINT "submit"
+#define SUBMIT_BATCH_SERVICE_ENDPOINT "submit_batch"
+#define STATUS_BATCH_SERVICE_ENDPOINT "status_batch"
 
 typedef double wqc_real;
 
 #define DEFAULT_WEBQC_SERVER_NAME "webqc.urysegal.com"
 #define DEFAULT_WEBQC_SERVER_PORT (5000)
+#define DEFAULT_MIN_POLL_INTERVAL (8) /// Default shortest time between status polls, in milliseconds
+#define DEFAULT_MAX_POLL_INTERVAL (1000) /// Default longest time between status polls, in milliseconds
+#define MAX_POLL_INTERVAL (3600 * 1000) /// Largest value of the poll interval options, in milliseconds
+#define DEFAULT_MAX_PARALLEL_DOWNLOADS (8) /// Default number of ERI values blobs to download at once
+#define MAX_PARALLEL_DOWNLOADS (256) /// Largest number of ERI values blobs that can be downloaded at once
+#define WQC_MAX_BATCH_JOBS (100) /// Most jobs sent in one batched submit or status call
+#define DEFAULT_MAX_INLINE_ERI_SIZE (16 * 1024) /// Default largest ERI values blob to get inside a reply, in bytes
+#define MAX_INLINE_ERI_SIZE (1024 * 1024) /// Largest value of the inline ERI size option, in bytes
+#define MIN_COMPRESSED_BODY_SIZE (1024) /// Smallest request body worth compressing, in bytes
+#define DEFAULT_DOWNLOAD_RETRIES (3) /// Default number of times a blob download that broke off is resumed
+#define MAX_DOWNLOAD_RETRIES (100) /// Largest value of the download retries option
+#define DEFAULT_CALL_RETRIES (3) /// Default number of times a web call that failed with a temporary error is made again
+#define MAX_CALL_RETRIES (100) /// Largest value of the call retries option
+#define DEFAULT_RETRY_BASE_DELAY (100) /// Default shortest wait before a web call is made again, in milliseconds
+#define DEFAULT_RETRY_MAX_DELAY (10000) /// Default longest wait before a web call is made again, in milliseconds
+#define MAX_RETRY_DELAY (3600 * 1000) /// Largest value of the retry delay options, in milliseconds
+#define DEFAULT_BREAKER_FAILURES (20) /// Default number of failed calls in a row that stops all calls to a server
+#define DEFAULT_BREAKER_OPEN_TIME (5000) /// Default time calls to a failing server are stopped for, in milliseconds
+#define DEFAULT_CALL_TIMEOUT (0) /// Default longest time an operation may take, in milliseconds, 0 for no limit
+#define DEFAULT_CONNECT_TIMEOUT (30000) /// Default longest time to connect to a server, in milliseconds
+#define MAX_TIMEOUT (24 * 3600 * 1000) /// Largest value of the timeout options, in milliseconds
+#define DEFAULT_HEDGE_PERCENTILE (0) /// By default slow calls are not hedged
+#define MAX_HEDGE_PERCENTILE (99) /// Largest value of the hedge percentile option
 
 
 #define WQC_PRECISION_UNKNOWN ((wqc_real)0.0)  /// A number is of unknown precision
@@ -44,6 +71,8 @@ enum wqc_coodinate_system
 
 typedef struct webqc_handler_t WQC; ///< A handler to a WQC operation. When starting an asynchronous job, a WQC is returned to the caller.
 
+typedef struct webqc_multi_t WQC_MULTI; ///< Runs the API calls of many handlers concurrently, without blocking.
+
 typedef double wqc_location_t[3]; /// A 3D location in the system
 
 typedef int eri_shell_index_t[4]; /// An index of an ERI
@@ -73,6 +102,10 @@ struct ERI_item_status {
     char *output_blob_name; /// If task is done, where to download the ERIs from
     int range_begin[4]; /// Beginning of range of integrals to calculate
     int range_end[4]; /// End of range of integrals to calculate
+    bool handed_out; /// Was already returned by wqc_next_done_ERI_item()
+    double *values; /// ERI values of the sub-job, if the server sent them with the status - NULL otherwise
+    size_t values_size; /// Size of values, in bytes
+    double precision; /// Precision of values
 };
 
 /// information about ERI values, and the values fetched from the server
@@ -125,13 +158,55 @@ struct radial_function_info {
     double exponent; /// Also known as "alpha" and "zetta"
 };
 
+/// WebQC endpoints whose calls are timed separately
+enum wqc_endpoint {
+    WQC_ENDPOINT_JOB = 0, /// Create a job
+    WQC_ENDPOINT_PARAMS = 1, /// Create a parameter set
+    WQC_ENDPOINT_ERI = 2, /// Start an ERI job, and get its status
+    WQC_ENDPOINT_INT_INFO = 3, /// Get information about the integrals of a job
+    WQC_ENDPOINT_ERI_VALUES = 4, /// Find where ERI values can be downloaded from
+    WQC_ENDPOINT_DOWNLOAD = 5, /// Download ERI values blobs
+    WQC_ENDPOINT_SUBMIT = 6, /// Create a job with its parameter set and start it, in one call
+    WQC_ENDPOINT_SUBMIT_BATCH = 7, /// Submit many jobs in one call
+    WQC_ENDPOINT_STATUS_BATCH = 8, /// Get the status of many jobs in one call
+    WQC_ENDPOINTS_COUNT = 9 /// Number of endpoints
+};
+
+/// Where the time of one web call went, as measured by cURL. Times are in seconds. The name lookup, connect and TLS
+/// handshake times are zero when the call reused an open connection.
+struct wqc_call_timing {
+    double name_lookup; /// Time to resolve the server name
+    double connect; /// Time to open the TCP connection, after the name was resolved
+    double tls_handshake; /// Time of the TLS handshake, after the TCP connection was open
+    double first_byte; /// Time from the start of the call until the first byte of the reply arrived
+    double total; /// Time of the whole call
+    size_t bytes_sent; /// Bytes of request body sent
+    size_t bytes_received; /// Bytes of reply body received
+};
 
+/// Timing of all calls to one WebQC endpoint
+struct wqc_endpoint_timing {
+    unsigned long calls; /// Number of calls made
+    unsigned long failed_calls; /// Number of calls that failed, either with a network error or an HTTP error
+    struct wqc_call_timing sum; /// Sum of the times and bytes of all calls
+    double max_total; /// Time of the slowest call
+};
 
+/// Network timing of the web calls made with a handler
+struct wqc_network_timing {
+    enum wqc_endpoint last_endpoint; /// Endpoint of the most recent call
+    struct wqc_call_timing last_call; /// Timing of the most recent call
+    struct wqc_endpoint_timing endpoints[WQC_ENDPOINTS_COUNT]; /// Timing of all calls, per endpoint
+};
 
-//! Initialize the WQC library. Call once before calling any thing WQC functions.
+
+
+
+//! Initialize the WQC library. Call once before calling any thing WQC functions. This also sets up the DNS and TLS
+//! session caches that all handlers in the process share.
 void wqc_global_init();
 
-//! Cleanip WQC library. Call one after finishing all calls to WQC functions.
+//! Cleanip WQC library. Call one after finishing all calls to WQC functions, and after all handlers were cleaned up.
 void wqc_global_cleanup();
 
 
@@ -145,7 +220,8 @@ WQC *wqc_init();
 /// \param handler the handler to cleanup and dispoose
 void wqc_cleanup(WQC *handler);
 
-/// Reset a handler so we can make another call with same access parameters
+/// Reset a handler so we can make another call with same access parameters. Only the state of the previous call is
+/// cleared; the connection to the WebQC server is kept open for the next call.
 /// \param handler the handler to reset
 void wqc_reset(WQC *handler);
 
@@ -205,6 +281,36 @@ bool wqc_get_status
 );
 
 
+/// Submit many jobs at once, one on each handler, as if wqc_submit_job() was called on each. The jobs are sent in
+/// batched calls of up to WQC_MAX_BATCH_JOBS jobs, made on the first handler, with its server and access token. A
+/// server without batched calls gets the jobs one by one instead, up to WQC_MAX_BATCH_JOBS of them at once.
+/// \param handlers Handlers to submit the jobs on, created by wqc_init(). No call may run on any of them.
+/// \param job_type Which type of job to perform, for all the jobs
+/// \param job_parameters Parameters of each job, job_parameters[i] for the job on handlers[i]
+/// \param jobs_count How many jobs to submit
+/// \return true if all jobs were submitted. Otherwise false, and the handlers of jobs that failed have the error.
+bool wqc_submit_jobs
+(
+    WQC *handlers[],
+    enum wqc_job_type job_type,
+    void *job_parameters[],
+    int jobs_count
+);
+
+
+/// Get the status of many jobs at once, as if wqc_get_status() was called on each handler. The statuses are fetched
+/// in batched calls of up to WQC_MAX_BATCH_JOBS jobs, made on the first handler, or one by one as in
+/// wqc_submit_jobs() from a server without batched calls.
+/// \param handlers Handlers the jobs were submitted on. No call may run on any of them.
+/// \param jobs_count How many handlers there are
+/// \return true if the status of all jobs was retrieved. Otherwise false, and the handlers that failed have the error.
+bool wqc_get_statuses
+(
+    WQC *handlers[],
+    int jobs_count
+);
+
+
 //! Set up an option for a WQC call
 //! \param handler a job handler to set options on
 //! \param option which options to set
@@ -239,8 +345,12 @@ bool wqc_job_done(
 
 
 //! @brief Wait for a job to be done, up to a given amount of time. When the function returns, you can call wqc_get_status to get the status of the job.
-//! The function will return early (with false value) if an error was encountered. It will call the WebQC server with an exponential backoff,
-//! every 1,2,4,8,16,32, 64 seconds, and then again in this sequence.
+//! Unless WQC_OPTION_LONG_POLL is turned off, each status call asks the server to hold it until another sub-job
+//! finishes, so the function returns as soon as the job is done. With a server that replies at once, the status is
+//! polled: once sub-jobs are seen to progress, the next poll is made just after the job is predicted to be done, and
+//! until then with an exponential backoff. Polls are WQC_OPTION_MIN_POLL_INTERVAL to WQC_OPTION_MAX_POLL_INTERVAL
+//! apart. Failed status calls are retried until the time is up. The wait ends early, with WEBQC_TIMEOUT, at the
+//! handler's deadline (see wqc_set_deadline()).
 //! \param handler Handler to the job. Job should have been submitted with wqc_submit_job()
 //! \param milliseconds_to_wait how many milliseconds to wait for the job to be done.
 //! \return true if the job is done by the time seconds_to_wait has passed.
@@ -249,6 +359,27 @@ bool wqc_wait_for_job(
         int64_t milliseconds_to_wait
 );
 
+//! @brief Wait for more sub-jobs of an ERI job to be done, up to a given amount of time, so their values can be
+//! fetched while the server is still computing the others. Get the sub-jobs with wqc_next_done_ERI_item(). Status
+//! calls are made as in wqc_wait_for_job(), polling at the time the next sub-job is predicted to be done.
+//! \param handler Handler to the job. Job should have been submitted with wqc_submit_job()
+//! \param milliseconds_to_wait how many milliseconds to wait for sub-jobs to be done.
+//! \return true if there are done sub-jobs that wqc_next_done_ERI_item() did not return yet. false if the time is up,
+//! if all sub-jobs were already returned (wqc_job_done() is then true), or on failure.
+bool wqc_wait_for_any_items(
+        WQC *handler,
+        int64_t milliseconds_to_wait
+);
+
+//! Get the next done sub-job of an ERI job, in the order they were seen to be done. Each sub-job is returned once.
+//! Fetch its values with wqc_fetch_ERI_values(), from the first shell quartet of its range.
+//! \param handler Handler to the job, after wqc_wait_for_any_items() or wqc_get_status()
+//! \return status of the sub-job, valid until the next status call on the handler, or NULL if there are no more
+//! done sub-jobs yet
+const struct ERI_item_status *wqc_next_done_ERI_item(
+        WQC *handler
+);
+
 //! @brief Initialize variables of type  webqc_return_value_t.
 //! \return empty webqc_return_value_t.
 struct wqc_return_value init_webqc_return_value();
@@ -301,6 +432,31 @@ wqc_fetch_ERI_values(
     const eri_shell_index_t *eri_index
 );
 
+//! Fetch from the WQC server only a range of the ERIs of a sub-job, e.g. one shell-pair block. Where each shell quartet
+//! starts in the sub-job's blob is known from the basis set, so only the bytes of the range are downloaded, with an
+//! HTTP Range request. The values stored in the handler then go from begin to end, as wqc_get_shell_set_range() tells.
+//! \param handler A handler where a ERI calculation was submitted on, after wqc_get_integrals_details()
+//! \param begin index of the first shell quartet to fetch
+//! \param end index of the end shell quartet (one after last) to fetch, {number of shells, 0, 0, 0} after the last
+//! quartet of the system. The range must be in one sub-job.
+//! \return true on success, false on failure and set up the error description in the handler
+bool
+wqc_fetch_ERI_range(
+    WQC *handler,
+    const eri_shell_index_t *begin,
+    const eri_shell_index_t *end
+);
+
+//! Fetch from the WQC server all the ERIs that were calculated by a job. The ERI values of all sub-jobs are downloaded
+//! concurrently, up to WQC_OPTION_MAX_PARALLEL_DOWNLOADS at once, and stored in the handler in shell order, as if
+//! fetched by one call to wqc_fetch_ERI_values(). All sub-jobs must be done - see wqc_get_status().
+//! \param handler A handler where a ERI calculation was submitted on
+//! \return true on success, false on failure and set up the error description in the handler
+bool
+wqc_fetch_all_ERI_values(
+    WQC *handler
+);
+
 
 //! When iterating over shells sequentially, use this function to increment the shell index to the next position.
 //! \param handler Handler where a call to calculate ERIs was made on
@@ -359,6 +515,161 @@ bool wqc_get_number_of_functions_in_shells(
     int n
 );
 
+//! Get the network timing of the web calls made with a handler: the most recent call, and all calls per endpoint
+//! since the handler was created or the timing was reset. Blobs downloaded by wqc_fetch_all_ERI_values count too.
+//! \param handler handler the calls were made with
+//! \param timing output - the network timing
+void wqc_get_network_timing(
+    WQC *handler,
+    struct wqc_network_timing *timing
+);
+
+//! Write the metrics of all handlers of the process as Prometheus exposition text. Like snprintf(), the text is cut
+//! to fit the buffer and always null terminated, and the returned length is that of the whole text.
+//! \param buffer buffer to write the text into. May be NULL if size is 0.
+//! \param size size of the buffer
+//! \return length of the whole text, not counting the terminating null. If it is size or more, the text was cut.
+size_t wqc_metrics_dump(
+    char *buffer,
+    size_t size
+);
+
+//! Set the circuit breaker all handlers of the process share. After a number of web calls in a row to a server fail
+//! with a temporary error, calls to it fail at once with WEBQC_SERVER_UNAVAILABLE for a while. Then one call is let
+//! through, and the server is called again if it succeeds.
+//! \param failures failed calls in a row that stop the calls to a server, 0 to never stop them
+//! \param open_milliseconds how long calls to the server are stopped for, in milliseconds
+void wqc_set_circuit_breaker(
+    int failures,
+    int64_t open_milliseconds
+);
+
+//! Set a deadline for all later operations on a handler, such as for all the work on one molecule. The web calls of
+//! each operation (including the calls made again after they failed) share the time left until the deadline, and an
+//! operation that would end after it fails with WEBQC_TIMEOUT. Waiting for a job ends at the deadline too. Each
+//! operation is also bounded by WQC_OPTION_CALL_TIMEOUT, whichever ends first.
+//! \param handler handler to set the deadline on
+//! \param milliseconds time from now to the deadline, in milliseconds, or a negative value to remove the deadline
+void wqc_set_deadline(
+    WQC *handler,
+    int64_t milliseconds
+);
+
+//! Forget the network timing of all web calls made with a handler so far
+//! \param handler handler whose timing to reset
+void wqc_reset_network_timing(
+    WQC *handler
+);
+
+
+//! @brief Create a multi handle, which runs API calls of many handlers at once. Calls are started with the
+//! wqc_multi_* functions, and make progress only when wqc_perform() or wqc_poll() is called. You must call
+//! wqc_multi_cleanup when you are done with it.
+//! \return a new multi handle, or NULL if there is not enough memory
+WQC_MULTI *wqc_multi_init();
+
+//! Cleanup a multi handle. Calls still running on it are abandoned.
+//! \param multi the multi handle to cleanup and dispose
+void wqc_multi_cleanup(
+    WQC_MULTI *multi
+);
+
+//! Start submitting a job, like wqc_submit_job() does, without waiting for it to be submitted. The job parameters
+//! must stay valid until the handler is returned by wqc_multi_next_done().
+//! \param multi multi handle to run the call on
+//! \param handler Handler to submit the job on. No other call may run on the handler until it is done.
+//! \param job_type Which type of job to perform
+//! \param job_parameters Parameters for the job
+//! \return true if the call was started, false otherwise (and sets error on the handler)
+bool wqc_multi_submit_job(
+    WQC_MULTI *multi,
+    WQC *handler,
+    enum wqc_job_type job_type,
+    void *job_parameters
+);
+
+//! Start getting the status of a job, like wqc_get_status() does, without waiting for the reply.
+//! \param multi multi handle to run the call on
+//! \param handler handler the job was submitted on
+//! \return true if the call was started, false otherwise (and sets error on the handler)
+bool wqc_multi_get_status(
+    WQC_MULTI *multi,
+    WQC *handler
+);
+
+//! Start getting details about integrals, like wqc_get_integrals_details() does, without waiting for the reply.
+//! \param multi multi handle to run the call on
+//! \param handler hanlder that an integral job was called on
+//! \return true if the call was started, false otherwise (and sets error on the handler)
+bool wqc_multi_get_integrals_details(
+    WQC_MULTI *multi,
+    WQC *handler
+);
+
+//! Start fetching a range of ERI values, like wqc_fetch_ERI_values() does, without waiting for them to download.
+//! \param multi multi handle to run the call on
+//! \param handler A handler where a ERI calculation was submitted on
+//! \param eri_index the 4 centers for which to fetch the ERI
+//! \return true if the call was started, false otherwise (and sets error on the handler)
+bool wqc_multi_fetch_ERI_values(
+    WQC_MULTI *multi,
+    WQC *handler,
+    const eri_shell_index_t *eri_index
+);
+
+//! Make progress on all calls running on the multi handle, without blocking. Handlers whose call is done can then
+//! be retrieved with wqc_multi_next_done(). Calls that failed with a temporary error are made again once their wait
+//! is over.
+//! \param multi the multi handle
+//! \return how many calls are still running or waiting to be made again, or -1 on failure
+int wqc_perform(
+    WQC_MULTI *multi
+);
+
+//! Wait until there is network activity on any call running on the multi handle, or until the timeout passes, and
+//! then make progress like wqc_perform() does.
+//! \param multi the multi handle
+//! \param timeout_milliseconds maximum time to wait
+//! \return how many calls are still running, or -1 on failure
+int wqc_poll(
+    WQC_MULTI *multi,
+    int timeout_milliseconds
+);
+
+//! Get the file descriptors the multi handle is waiting on, so you can wait for them in your own event loop. Call
+//! wqc_perform() when any of them is ready, or when wqc_multi_timeout() passes.
+//! \param multi the multi handle
+//! \param read_fd_set file descriptors to wait for reading are added to this set
+//! \param write_fd_set file descriptors to wait for writing are added to this set
+//! \param exc_fd_set file descriptors to wait for exceptions are added to this set
+//! \param max_fd output - highest file descriptor added to the sets, or -1 if none was added
+//! \return true on success, false on failure
+bool wqc_multi_fdset(
+    WQC_MULTI *multi,
+    fd_set *read_fd_set,
+    fd_set *write_fd_set,
+    fd_set *exc_fd_set,
+    int *max_fd
+);
+
+//! Get how long you may wait for file descriptors before you must call wqc_perform(), which is no longer than until a
+//! call that failed is due to be made again
+//! \param multi the multi handle
+//! \return the timeout in milliseconds, or -1 if there is no timeout
+long wqc_multi_timeout(
+    WQC_MULTI *multi
+);
+
+//! Get the next handler whose call is done. The handler can then be used like after the corresponding synchronous
+//! call returned.
+//! \param multi the multi handle
+//! \param success output - true if the call succeeded, false if it failed (and the error is set on the handler)
+//! \return a handler whose call is done, or NULL if there are no more such handlers
+WQC *wqc_multi_next_done(
+    WQC_MULTI *multi,
+    bool *success
+);
+
 #ifdef __cplusplus
 } // "extern C"
 #endif
@@ -0,0 +1,341 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#include "mock-http.h"
+
+#define MOCK_HTTP_SEND_CHUNK (16*1024) /// Bytes to send at once when the bandwidth is limited
+
+static const char *status_text(int status)
+{
+    switch (status) {
+        case 200: return "OK";
+        case 206: return "Partial Content";
+        case 304: return "Not Modified";
+        case 400: return "Bad Request";
+        case 401: return "Unauthorized";
+        case 404: return "Not Found";
+        case 409: return "Conflict";
+        case 415: return "Unsupported Media Type";
+        case 429: return "Too Many Requests";
+        case 500: return "Internal Server Error";
+        case 503: return "Service Unavailable";
+        default: return "Unknown";
+    }
+}
+
+//! Receive more data into the connection buffer
+static bool receive_more(struct mock_http_connection *conn)
+{
+    ssize_t received = 0;
+
+    if (conn->buffered < sizeof(conn->buffer) - 1) {
+        do {
+            received = recv(conn->fd, conn->buffer + conn->buffered, sizeof(conn->buffer) - 1 - conn->buffered, 0);
+        } while (received < 0 && errno == EINTR);
+    }
+    if (received > 0) {
+        conn->buffered += received;
+        conn->buffer[conn->buffered] = '\0';
+    }
+
+    return received > 0;
+}
+
+//! Remove the first size bytes from the connection buffer
+static void consume(struct mock_http_connection *conn, size_t size)
+{
+    memmove(conn->buffer, conn->buffer + size, conn->buffered - size);
+    conn->buffered -= size;
+    conn->buffer[conn->buffered] = '\0';
+}
+
+static bool parse_request_line(struct mock_http_request *request, const char *line)
+{
+    char target[MOCK_HTTP_MAX_PATH * 2];
+    char version[16];
+    bool rv = sscanf(line, "%7s %2047s %15s", request->method, target, version) == 3;
+
+    if (rv) {
+        char *query = strchr(target, '?');
+        if (query) {
+            *query++ = '\0';
+            strncpy(request->query, query, sizeof(request->query) - 1);
+        }
+        strncpy(request->path, target, sizeof(request->path) - 1);
+        request->keep_alive = strcmp(version, "HTTP/1.0") != 0;
+    }
+
+    return rv;
+}
+
+static bool read_body(struct mock_http_connection *conn, struct mock_http_request *request)
+{
+    bool rv = true;
+    size_t copied = 0;
+
+    request->body = malloc(request->body_size + 1);
+    if (!request->body) {
+        return false;
+    }
+
+    while (rv && copied < request->body_size) {
+        if (conn->buffered == 0) {
+            rv = receive_more(conn);
+        }
+        size_t chunk = conn->buffered < request->body_size - copied ? conn->buffered : request->body_size - copied;
+        memcpy(request->body + copied, conn->buffer, chunk);
+        consume(conn, chunk);
+        copied += chunk;
+    }
+    request->body[copied] = '\0';
+
+    return rv;
+}
+
+bool mock_http_read_request(struct mock_http_connection *conn, struct mock_http_request *request)
+{
+    char *headers_end = NULL;
+    char value[32];
+    bool rv = true;
+
+    memset(request, 0, sizeof(struct mock_http_request));
+
+    while (rv && (headers_end = strstr(conn->buffer, "\r\n\r\n")) == NULL) {
+        rv = receive_more(conn);
+    }
+
+    if (rv) {
+        size_t headers_size = headers_end + 4 - conn->buffer;
+        char *first_line_end = strstr(conn->buffer, "\r\n");
+        *first_line_end = '\0';
+        rv = parse_request_line(request, conn->buffer);
+        request->headers = strndup(first_line_end + 2, headers_end + 2 - (first_line_end + 2));
+        consume(conn, headers_size);
+    }
+
+    if (rv && mock_http_get_header(request, "Connection", value, sizeof(value))) {
+        if (strcasecmp(value, "close") == 0) {
+            request->keep_alive = false;
+        } else if (strcasecmp(value, "keep-alive") == 0) {
+            request->keep_alive = true;
+        }
+    }
+
+    if (rv && mock_http_get_header(request, "Content-Length", value, sizeof(value))) {
+        request->body_size = strtoul(value, NULL, 10);
+        rv = request->body_size <= MOCK_HTTP_MAX_BODY && read_body(conn, request);
+    }
+
+    return rv;
+}
+
+void mock_http_free_request(struct mock_http_request *request)
+{
+    free(request->headers);
+    free(request->body);
+    request->headers = NULL;
+    request->body = NULL;
+}
+
+bool mock_http_gunzip_body(struct mock_http_request *request)
+{
+    z_stream stream;
+    size_t capacity = request->body_size * 4 + 1;
+    char *body = malloc(capacity);
+    int status = Z_OK;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.next_in = (Bytef *) request->body;
+    stream.avail_in = request->body_size;
+    // 16 more bits of window ask zlib for a gzip header and trailer, instead of a zlib one
+    if (!body || inflateInit2(&stream, MAX_WBITS + 16) != Z_OK) {
+        free(body);
+        return false;
+    }
+
+    while (status == Z_OK) {
+        if (stream.total_out + 1 == capacity) {
+            char *larger = capacity < MOCK_HTTP_MAX_BODY ? realloc(body, capacity * 2) : NULL;
+            if (!larger) {
+                break;
+            }
+            body = larger;
+            capacity *= 2;
+        }
+        stream.next_out = (Bytef *) body + stream.total_out;
+        stream.avail_out = capacity - 1 - stream.total_out;
+        status = inflate(&stream, Z_NO_FLUSH);
+    }
+    inflateEnd(&stream);
+
+    if (status != Z_STREAM_END) {
+        free(body);
+        return false;
+    }
+    body[stream.total_out] = '\0';
+    free(request->body);
+    request->body = body;
+    request->body_size = stream.total_out;
+    return true;
+}
+
+bool mock_http_get_header(const struct mock_http_request *request, const char *name, char *value, size_t size)
+{
+    size_t name_length = strlen(name);
+    const char *line = request->headers;
+
+    while (line && *line) {
+        const char *line_end = strstr(line, "\r\n");
+        if (!line_end) {
+            break;
+        }
+        if (strncasecmp(line, name, name_length) == 0 && line[name_length] == ':') {
+            const char *start = line + name_length + 1;
+            while (*start == ' ' || *start == '\t') {
+                start++;
+            }
+            size_t length = line_end - start < size - 1 ? line_end - start : size - 1;
+            memcpy(value, start, length);
+            value[length] = '\0';
+            return true;
+        }
+        line = line_end + 2;
+    }
+
+    return false;
+}
+
+bool mock_http_get_query_parameter(const struct mock_http_request *request, const char *name, char *value, size_t size)
+{
+    size_t name_length = strlen(name);
+    const char *parameter = request->query;
+
+    while (parameter && *parameter) {
+        const char *parameter_end = strchr(parameter, '&');
+        if (!parameter_end) {
+            parameter_end = parameter + strlen(parameter);
+        }
+        if (strncmp(parameter, name, name_length) == 0 && parameter[name_length] == '=') {
+            const char *start = parameter + name_length + 1;
+            size_t length = parameter_end - start < size - 1 ? parameter_end - start : size - 1;
+            memcpy(value, start, length);
+            value[length] = '\0';
+            return true;
+        }
+        parameter = *parameter_end ? parameter_end + 1 : NULL;
+    }
+
+    return false;
+}
+
+static bool send_all(int fd, const char *data, size_t size)
+{
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+bool mock_http_send_headers(struct mock_http_connection *conn, int status, const char *content_type,
+                            const char *extra_headers, size_t content_length)
+{
+    char headers[MOCK_HTTP_BUFFER_SIZE];
+
+    int length = snprintf(headers, sizeof(headers),
+                          "HTTP/1.1 %d %s\r\n"
+                          "Content-Type: %s\r\n"
+                          "Content-Length: %zu\r\n"
+                          "%s"
+                          "\r\n",
+                          status, status_text(status), content_type, content_length,
+                          extra_headers ? extra_headers : "");
+
+    return length < sizeof(headers) && send_all(conn->fd, headers, length);
+}
+
+bool mock_http_send_data(struct mock_http_connection *conn, const void *data, size_t size)
+{
+    bool rv = true;
+    const char *position = data;
+
+    if (conn->bandwidth <= 0) {
+        return send_all(conn->fd, data, size);
+    }
+
+    while (rv && size > 0) {
+        size_t chunk = size < MOCK_HTTP_SEND_CHUNK ? size : MOCK_HTTP_SEND_CHUNK;
+        usleep((useconds_t)(chunk * 1000000.0 / conn->bandwidth));
+        rv = send_all(conn->fd, position, chunk);
+        position += chunk;
+        size -= chunk;
+    }
+
+    return rv;
+}
+
+//! Compress data in gzip format
+//! \return the compressed data, to free by the caller, or NULL on failure
+static char *gzip_data(const void *data, size_t size, size_t *compressed_size)
+{
+    z_stream stream;
+    char *compressed = NULL;
+
+    memset(&stream, 0, sizeof(stream));
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        uLong bound = deflateBound(&stream, size);
+        compressed = malloc(bound);
+        stream.next_in = (Bytef *) data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef *) compressed;
+        stream.avail_out = bound;
+        if (compressed && deflate(&stream, Z_FINISH) != Z_STREAM_END) {
+            free(compressed);
+            compressed = NULL;
+        }
+        *compressed_size = stream.total_out;
+        deflateEnd(&stream);
+    }
+
+    return compressed;
+}
+
+bool mock_http_send_body(struct mock_http_connection *conn, int status, const char *content_type,
+                         const char *extra_headers, const void *body, size_t size)
+{
+    size_t compressed_size = 0;
+    char *compressed = conn->gzip && size > 0 ? gzip_data(body, size, &compressed_size) : NULL;
+    bool rv = false;
+
+    if (compressed) {
+        char headers[MOCK_HTTP_BUFFER_SIZE];
+        snprintf(headers, sizeof(headers), "Content-Encoding: gzip\r\n%s", extra_headers ? extra_headers : "");
+        rv = mock_http_send_headers(conn, status, content_type, headers, compressed_size) &&
+             mock_http_send_data(conn, compressed, compressed_size);
+    } else {
+        rv = mock_http_send_headers(conn, status, content_type, extra_headers, size) &&
+             mock_http_send_data(conn, body, size);
+    }
+    free(compressed);
+
+    return rv;
+}
+
+bool mock_http_send_reply(struct mock_http_connection *conn, int status, const char *content_type, const void *body,
+                          size_t size)
+{
+    return mock_http_send_body(conn, status, content_type, NULL, body, size);
+}
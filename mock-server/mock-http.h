@@ -0,0 +1,141 @@
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOCK_HTTP_BUFFER_SIZE (16*1024) /// Largest request line and headers the mock server accepts
+#define MOCK_HTTP_MAX_PATH (1024) /// Largest path or query string in a request
+#define MOCK_HTTP_MAX_BODY (16*1024*1024) /// Largest request body the mock server accepts
+
+/// One HTTP request, as read from a connection
+struct mock_http_request {
+    char method[8]; /// HTTP method, e.g. GET
+    char path[MOCK_HTTP_MAX_PATH]; /// Path part of the request target
+    char query[MOCK_HTTP_MAX_PATH]; /// Query string of the request target, without the '?'
+    char *headers; /// Header lines of the request, as received
+    char *body; /// Request body, NUL terminated. NULL if there is none.
+    size_t body_size; /// Size of the request body, in bytes
+    bool keep_alive; /// Should the connection stay open after the reply
+};
+
+/// A client connection to the mock server
+struct mock_http_connection {
+    int fd; /// Connected socket
+    long bandwidth; /// Maximum bytes per second to send, 0 for no limit
+    char buffer[MOCK_HTTP_BUFFER_SIZE]; /// Data received but not processed yet
+    size_t buffered; /// How many bytes are in the buffer
+    bool gzip; /// Compress reply bodies with gzip, as the client of the current request accepts them
+};
+
+//! Read the next request from a connection
+//! \param conn connection to read from
+//! \param request output - the request. Release with mock_http_free_request().
+//! \return true if a request was read, false if the connection was closed or the request is malformed
+bool mock_http_read_request(
+    struct mock_http_connection *conn,
+    struct mock_http_request *request
+);
+
+//! Release the memory a request holds
+//! \param request request to release
+void mock_http_free_request(
+    struct mock_http_request *request
+);
+
+//! Decompress a gzip compressed request body in place
+//! \param request request whose body to decompress
+//! \return true on success, false if the body is not valid gzip data or is too large
+bool mock_http_gunzip_body(
+    struct mock_http_request *request
+);
+
+//! Get the value of a request header
+//! \param request request to look in
+//! \param name header name, case insensitive
+//! \param value output - header value, without leading spaces
+//! \param size size of the value buffer
+//! \return true if the request has the header
+bool mock_http_get_header(
+    const struct mock_http_request *request,
+    const char *name,
+    char *value,
+    size_t size
+);
+
+//! Get the value of a query string parameter
+//! \param request request to look in
+//! \param name parameter name
+//! \param value output - parameter value
+//! \param size size of the value buffer
+//! \return true if the request has the parameter
+bool mock_http_get_query_parameter(
+    const struct mock_http_request *request,
+    const char *name,
+    char *value,
+    size_t size
+);
+
+//! Send the status line and headers of a reply
+//! \param conn connection to send on
+//! \param status HTTP status code
+//! \param content_type MIME type of the body
+//! \param extra_headers more header lines, each ending with CRLF, or NULL
+//! \param content_length size of the body that will follow
+//! \return true on success, false if the connection failed
+bool mock_http_send_headers(
+    struct mock_http_connection *conn,
+    int status,
+    const char *content_type,
+    const char *extra_headers,
+    size_t content_length
+);
+
+//! Send part of a reply body, limited to the connection's bandwidth
+//! \param conn connection to send on
+//! \param data data to send
+//! \param size how many bytes to send
+//! \return true on success, false if the connection failed
+bool mock_http_send_data(
+    struct mock_http_connection *conn,
+    const void *data,
+    size_t size
+);
+
+//! Send the status line, headers and body of a reply, with the body compressed if the connection's client accepts it
+//! \param conn connection to send on
+//! \param status HTTP status code
+//! \param content_type MIME type of the body
+//! \param extra_headers more header lines, each ending with CRLF, or NULL
+//! \param body reply body
+//! \param size size of the body, in bytes
+//! \return true on success, false if the connection failed
+bool mock_http_send_body(
+    struct mock_http_connection *conn,
+    int status,
+    const char *content_type,
+    const char *extra_headers,
+    const void *body,
+    size_t size
+);
+
+//! Send a complete reply
+//! \param conn connection to send on
+//! \param status HTTP status code
+//! \param content_type MIME type of the body
+//! \param body reply body
+//! \param size size of the body, in bytes
+//! \return true on success, false if the connection failed
+bool mock_http_send_reply(
+    struct mock_http_connection *conn,
+    int status,
+    const char *content_type,
+    const void *body,
+    size_t size
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
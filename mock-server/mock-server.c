@@ -0,0 +1,1330 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <cjson/cJSON.h>
+
+#include "webqc-mock-server.h"
+#include "mock-http.h"
+
+#define MOCK_ID_LENGTH (37) /// IDs are UUIDs - 32 hex digits, 4 dashes and a terminating null
+#define MOCK_BLOB_CHUNK (8192) /// How many ERI values to generate at once when sending a blob
+#define MOCK_ERI_PRECISION (1e-10) /// Precision of the synthetic ERI values
+#define MOCK_LISTEN_BACKLOG (128) /// Connections waiting to be accepted
+#define MOCK_MAX_STATUS_WAIT (60000) /// Longest time a status call is held for, in milliseconds
+
+/// A parameter set, created by the params endpoint
+struct mock_parameter_set {
+    char id[MOCK_ID_LENGTH]; /// Parameter set ID
+    char *parameters; /// JSON text of the parameters, used to find duplicate jobs
+    long long shell_sets_per_file; /// How many shell quartets go in each ERI values blob
+    int job; /// Index of the job that calculates the ERIs for this set, -1 if none was started
+};
+
+/// A job, created by the job endpoint
+struct mock_job {
+    char id[MOCK_ID_LENGTH]; /// Job ID
+    int parameter_set; /// Index of the parameter set the job was started with, -1 if it was not started
+    long long start_time; /// When the job was started, in milliseconds
+};
+
+/// A running mock WebQC server
+struct wqc_mock_server {
+    struct wqc_mock_server_config config; /// Server configuration
+    int listen_fd; /// Listening socket
+    unsigned short port; /// Port the server listens on
+    pthread_t accept_thread; /// Thread that accepts new connections
+    pthread_mutex_t lock; /// Protects everything below
+    pthread_cond_t connections_closed; /// Signalled when a connection is closed
+    pthread_cond_t stopped; /// Signalled when the server starts stopping, to release held status calls
+    bool stopping; /// The server is being stopped
+    int *connections; /// Sockets of open connections
+    int connections_count; /// How many connections are open
+    int connections_capacity; /// Size of the connections array
+    struct mock_parameter_set *parameter_sets; /// All parameter sets that were created
+    int parameter_sets_count; /// How many parameter sets were created
+    int parameter_sets_capacity; /// Size of the parameter sets array
+    struct mock_job *jobs; /// All jobs that were created
+    int jobs_count; /// How many jobs were created
+    int jobs_capacity; /// Size of the jobs array
+    int *functions_per_shell; /// Number of basis functions in each shell of the synthetic system
+    long long quartets_count; /// Number of shell quartets in the synthetic system
+    unsigned int random_state; /// State of the random number generator
+};
+
+/// A blob of ERI values to look up
+struct mock_blob {
+    char set_id[MOCK_ID_LENGTH]; /// Parameter set the ERIs were calculated for
+    long long item; /// Number of the ERI sub-job that calculated the blob, -1 to find it by quartet
+    long long quartet; /// A shell quartet in the blob, used when item is -1
+    long long range[2]; /// Output - first and end shell quartets in the blob
+    const char *error; /// Output - why the blob is not available
+};
+
+/// Arguments of a connection thread
+struct mock_connection_args {
+    WQC_MOCK_SERVER *server; /// Server the connection was accepted by
+    int fd; /// Connected socket
+};
+
+/// Handles a request to one endpoint, and sends the reply
+typedef bool (*mock_endpoint_handler)(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                                      const struct mock_http_request *request);
+
+/// An endpoint of the mock server
+struct mock_endpoint {
+    const char *method; /// HTTP method
+    const char *path; /// Path of the endpoint. A path that ends with '/' matches all paths that start with it.
+    mock_endpoint_handler handle; /// Handles requests to the endpoint
+    bool authorized; /// Calls must carry the access token
+};
+
+
+void wqc_mock_server_default_config(struct wqc_mock_server_config *config)
+{
+    memset(config, 0, sizeof(struct wqc_mock_server_config));
+    config->shells = WQC_MOCK_DEFAULT_SHELLS;
+    config->job_duration = WQC_MOCK_DEFAULT_JOB_DURATION;
+    config->seed = 1;
+    config->access_token = WQC_MOCK_DEFAULT_TOKEN;
+}
+
+double wqc_mock_server_eri_value(long long quartet, int position)
+{
+    return 1.0 / (1.0 + (double) quartet) + position / 1024.0;
+}
+
+static long long now_milliseconds()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+//! Make sure an array has room for one more element
+static bool grow_array(void **array, int *capacity, int count, size_t element_size)
+{
+    if (count == *capacity) {
+        int new_capacity = *capacity ? *capacity * 2 : 16;
+        void *new_array = realloc(*array, new_capacity * element_size);
+        if (!new_array) {
+            return false;
+        }
+        *array = new_array;
+        *capacity = new_capacity;
+    }
+    return true;
+}
+
+//! Get a random number between 0 and 1. Must be called with the server locked.
+static double random_fraction(WQC_MOCK_SERVER *server)
+{
+    return rand_r(&server->random_state) / ((double) RAND_MAX + 1.0);
+}
+
+//! Draw whether a fault that happens at some rate happens now
+static bool inject_fault(WQC_MOCK_SERVER *server, double rate)
+{
+    pthread_mutex_lock(&server->lock);
+    bool rv = random_fraction(server) < rate;
+    pthread_mutex_unlock(&server->lock);
+    return rv;
+}
+
+//! Hold a request before it is answered, at the stall rate of the server, like a slow server replica would
+static void maybe_stall(WQC_MOCK_SERVER *server)
+{
+    if (server->config.stall_rate > 0 && inject_fault(server, server->config.stall_rate)) {
+        usleep(server->config.stall_time * 1000);
+    }
+}
+
+//! Make a new random UUID. Must be called with the server locked.
+static void make_id(WQC_MOCK_SERVER *server, char *id)
+{
+    unsigned int parts[4];
+
+    for (int i = 0; i < 4; ++i) {
+        parts[i] = (rand_r(&server->random_state) << 16) ^ rand_r(&server->random_state);
+    }
+    snprintf(id, MOCK_ID_LENGTH, "%08x-%04x-%04x-%04x-%04x%08x", parts[0], parts[1] >> 16, parts[1] & 0xffff,
+             parts[2] >> 16, parts[2] & 0xffff, parts[3]);
+}
+
+static int find_job(const WQC_MOCK_SERVER *server, const char *id)
+{
+    for (int i = 0; i < server->jobs_count; ++i) {
+        if (strcmp(server->jobs[i].id, id) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static int find_parameter_set(const WQC_MOCK_SERVER *server, const char *id)
+{
+    for (int i = 0; i < server->parameter_sets_count; ++i) {
+        if (strcmp(server->parameter_sets[i].id, id) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+
+//! Convert a position in shell order to a shell quartet index
+static void quartet_to_index(const WQC_MOCK_SERVER *server, long long quartet, int *index)
+{
+    long long n = server->config.shells;
+
+    index[3] = (int) (quartet % n);
+    index[2] = (int) ((quartet / n) % n);
+    index[1] = (int) ((quartet / (n * n)) % n);
+    index[0] = (int) (quartet / (n * n * n));
+}
+
+//! Parse a shell quartet index given as a_b_c_d, and convert it to a position in shell order
+static bool parse_quartet(const WQC_MOCK_SERVER *server, const char *text, long long *quartet)
+{
+    int index[4];
+    bool rv = sscanf(text, "%d_%d_%d_%d", &index[0], &index[1], &index[2], &index[3]) == 4;
+    long long n = server->config.shells;
+
+    for (int i = 0; rv && i < 4; ++i) {
+        rv = index[i] >= 0 && index[i] < n;
+    }
+    if (rv) {
+        *quartet = ((index[0] * n + index[1]) * n + index[2]) * n + index[3];
+    }
+    return rv;
+}
+
+static int quartet_size(const WQC_MOCK_SERVER *server, long long quartet)
+{
+    int index[4];
+    quartet_to_index(server, quartet, index);
+
+    return server->functions_per_shell[index[0]] * server->functions_per_shell[index[1]] *
+           server->functions_per_shell[index[2]] * server->functions_per_shell[index[3]];
+}
+
+static long long blob_size(const WQC_MOCK_SERVER *server, const long long *range)
+{
+    long long size = 0;
+
+    for (long long quartet = range[0]; quartet < range[1]; ++quartet) {
+        size += quartet_size(server, quartet);
+    }
+    return size * (long long) sizeof(double);
+}
+
+static long long items_count(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set)
+{
+    return (server->quartets_count + set->shell_sets_per_file - 1) / set->shell_sets_per_file;
+}
+
+//! Find the range of shell quartets of one ERI sub-job
+static void item_range(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set, long long item,
+                       long long *range)
+{
+    range[0] = item * set->shell_sets_per_file;
+    range[1] = range[0] + set->shell_sets_per_file;
+    if (range[1] > server->quartets_count) {
+        range[1] = server->quartets_count;
+    }
+}
+
+//! Find when an ERI sub-job is done. Sub-jobs finish one after the other, the last when the whole job is done.
+static long long item_done_time(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set, long long item)
+{
+    const struct mock_job *job = &server->jobs[set->job];
+
+    return job->start_time + server->config.job_duration * (item + 1) / items_count(server, set);
+}
+
+static bool item_done(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set, long long item)
+{
+    return now_milliseconds() >= item_done_time(server, set, item);
+}
+
+//! Count the ERI sub-jobs of a parameter set's job that are done
+static long long done_items_count(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set)
+{
+    long long done = 0;
+
+    while (done < items_count(server, set) && item_done(server, set, done)) {
+        done++;
+    }
+    return done;
+}
+
+//! Hold a status call until more ERI sub-jobs are done than the caller knows of, the wait is over, or the server
+//! stops. Must be called with the server lock held, which is released while waiting.
+static void wait_for_done_items(WQC_MOCK_SERVER *server, int set_index, long long known_done, long long wait)
+{
+    long long deadline = now_milliseconds() + wait;
+    long long done = done_items_count(server, &server->parameter_sets[set_index]);
+
+    while (!server->stopping && done <= known_done && done < items_count(server, &server->parameter_sets[set_index]) &&
+           now_milliseconds() < deadline) {
+        long long wake_time = item_done_time(server, &server->parameter_sets[set_index], done);
+        if (wake_time > deadline) {
+            wake_time = deadline;
+        }
+
+        struct timespec until;
+        long long delay = wake_time - now_milliseconds();
+        clock_gettime(CLOCK_REALTIME, &until);
+        until.tv_sec += (delay > 0 ? delay : 0) / 1000;
+        until.tv_nsec += (delay > 0 ? delay : 0) % 1000 * 1000000;
+        if (until.tv_nsec >= 1000000000) {
+            until.tv_sec++;
+            until.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&server->stopped, &server->lock, &until);
+
+        // Parameter sets may have moved while the lock was released
+        done = done_items_count(server, &server->parameter_sets[set_index]);
+    }
+}
+
+static cJSON *make_index_array(const WQC_MOCK_SERVER *server, long long quartet)
+{
+    int index[4];
+    quartet_to_index(server, quartet, index);
+    return cJSON_CreateIntArray(index, 4);
+}
+
+//! Generate the ERI values of a range of shell quartets
+//! \return the values, to free by the caller, or NULL if out of memory
+static double *make_blob_values(const WQC_MOCK_SERVER *server, const long long *range)
+{
+    double *values = malloc(blob_size(server, range) + 1);
+    int count = 0;
+
+    for (long long quartet = range[0]; values && quartet < range[1]; ++quartet) {
+        for (int position = 0; position < quartet_size(server, quartet); ++position) {
+            values[count++] = wqc_mock_server_eri_value(quartet, position);
+        }
+    }
+    return values;
+}
+
+//! Add the ERI values of a range of shell quartets to a reply, in base64 with their precision, if the client asked
+//! for blobs of their size to be sent inside replies
+static void add_inline_values(const WQC_MOCK_SERVER *server, cJSON *json, const long long *range, long long inline_max)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    long long size = blob_size(server, range);
+
+    if (server->config.no_inline || size > inline_max) {
+        return;
+    }
+
+    double *values = make_blob_values(server, range);
+    char *text = malloc((size + 2) / 3 * 4 + 1);
+    const unsigned char *bytes = (const unsigned char *) values;
+    long long length = 0;
+
+    for (long long i = 0; values && text && i < size; i += 3) {
+        unsigned long bits = (unsigned long) bytes[i] << 16;
+        bits |= i + 1 < size ? (unsigned long) bytes[i + 1] << 8 : 0;
+        bits |= i + 2 < size ? bytes[i + 2] : 0;
+        text[length++] = digits[bits >> 18];
+        text[length++] = digits[(bits >> 12) & 63];
+        text[length++] = i + 1 < size ? digits[(bits >> 6) & 63] : '=';
+        text[length++] = i + 2 < size ? digits[bits & 63] : '=';
+    }
+    if (values && text) {
+        text[length] = '\0';
+        cJSON_AddStringToObject(json, "values", text);
+        cJSON_AddNumberToObject(json, "precision", MOCK_ERI_PRECISION);
+    }
+    free(values);
+    free(text);
+}
+
+
+static bool send_json_with_headers(struct mock_http_connection *conn, int status, cJSON *json,
+                                   const char *extra_headers)
+{
+    char *text = cJSON_PrintUnformatted(json);
+    bool rv = mock_http_send_body(conn, status, "application/json", extra_headers, text, strlen(text));
+
+    free(text);
+    cJSON_Delete(json);
+    return rv;
+}
+
+static bool send_json(struct mock_http_connection *conn, int status, cJSON *json)
+{
+    return send_json_with_headers(conn, status, json, NULL);
+}
+
+static bool send_error(struct mock_http_connection *conn, int status, const char *message)
+{
+    cJSON *json = cJSON_CreateObject();
+    cJSON_AddStringToObject(json, "error", message);
+    return send_json(conn, status, json);
+}
+
+//! Fail a request on purpose: with error 500, or with error 429 asking the client to wait, as an overloaded server does
+static bool send_injected_error(WQC_MOCK_SERVER *server, struct mock_http_connection *conn)
+{
+    char retry_after[48];
+    cJSON *json = cJSON_CreateObject();
+
+    cJSON_AddStringToObject(json, "error", "Injected error");
+    if (server->config.retry_after > 0) {
+        snprintf(retry_after, sizeof(retry_after), "Retry-After: %d\r\n", server->config.retry_after);
+        return send_json_with_headers(conn, 429, json, retry_after);
+    }
+    return send_json(conn, 500, json);
+}
+
+//! Add a new job, that was not started yet. Must be called with the server locked.
+static int add_job(WQC_MOCK_SERVER *server)
+{
+    if (!grow_array((void **) &server->jobs, &server->jobs_capacity, server->jobs_count, sizeof(struct mock_job))) {
+        return -1;
+    }
+
+    struct mock_job *job = &server->jobs[server->jobs_count];
+    make_id(server, job->id);
+    job->parameter_set = -1;
+    job->start_time = 0;
+
+    return server->jobs_count++;
+}
+
+static bool handle_new_job(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                           const struct mock_http_request *request)
+{
+    char id[MOCK_ID_LENGTH] = "";
+
+    pthread_mutex_lock(&server->lock);
+    int job = add_job(server);
+    if (job >= 0) {
+        strcpy(id, server->jobs[job].id);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (!id[0]) {
+        return send_error(conn, 500, "Out of memory");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON_AddStringToObject(reply, "job_id", id);
+    return send_json(conn, 200, reply);
+}
+
+//! Find a parameter set with the same parameters, or add a new one. Must be called with the server locked.
+static int add_parameter_set(WQC_MOCK_SERVER *server, const char *parameters, long long shell_sets_per_file)
+{
+    for (int i = 0; i < server->parameter_sets_count; ++i) {
+        if (strcmp(server->parameter_sets[i].parameters, parameters) == 0) {
+            return i;
+        }
+    }
+
+    if (!grow_array((void **) &server->parameter_sets, &server->parameter_sets_capacity,
+                    server->parameter_sets_count, sizeof(struct mock_parameter_set))) {
+        return -1;
+    }
+
+    struct mock_parameter_set *set = &server->parameter_sets[server->parameter_sets_count];
+    set->parameters = strdup(parameters);
+    if (!set->parameters) {
+        return -1;
+    }
+    make_id(server, set->id);
+    set->shell_sets_per_file = shell_sets_per_file;
+    set->job = -1;
+
+    return server->parameter_sets_count++;
+}
+
+//! Find how many shell quartets go in each ERI values blob of a parameter set
+static long long parameters_shell_sets_per_file(const WQC_MOCK_SERVER *server, const cJSON *parameters)
+{
+    long long shell_sets_per_file = (long long) cJSON_GetNumberValue(
+        cJSON_GetObjectItemCaseSensitive(parameters, "shell_sets_per_file"));
+
+    if (shell_sets_per_file <= 0) {
+        shell_sets_per_file = server->config.shell_sets_per_file;
+    }
+    if (shell_sets_per_file <= 0 || shell_sets_per_file > server->quartets_count) {
+        shell_sets_per_file = server->quartets_count;
+    }
+    return shell_sets_per_file;
+}
+
+//! Find or add the parameter set of a JSON object of parameters. Parameter sets are the same when their parameters
+//! print the same. Must be called with the server locked.
+static int add_parameters_object(WQC_MOCK_SERVER *server, const cJSON *parameters)
+{
+    char *text = cJSON_PrintUnformatted(parameters);
+    int set = text ? add_parameter_set(server, text, parameters_shell_sets_per_file(server, parameters)) : -1;
+
+    free(text);
+    return set;
+}
+
+static bool handle_parameters(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                              const struct mock_http_request *request)
+{
+    char id[MOCK_ID_LENGTH] = "";
+    cJSON *parameters = cJSON_Parse(request->body ? request->body : "");
+
+    if (!cJSON_IsObject(parameters)) {
+        cJSON_Delete(parameters);
+        return send_error(conn, 400, "Parameters must be a JSON object");
+    }
+
+    pthread_mutex_lock(&server->lock);
+    int set = add_parameters_object(server, parameters);
+    if (set >= 0) {
+        strcpy(id, server->parameter_sets[set].id);
+    }
+    pthread_mutex_unlock(&server->lock);
+    cJSON_Delete(parameters);
+
+    if (!id[0]) {
+        return send_error(conn, 500, "Out of memory");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON_AddStringToObject(reply, "set_id", id);
+    return send_json(conn, 200, reply);
+}
+
+//! Start a job with a parameter set. If another job was already started with the same parameters, the job is a
+//! duplicate, and the ID of the other job is returned. Must be called with the server locked.
+static const char *start_job(WQC_MOCK_SERVER *server, int job, int set)
+{
+    struct mock_parameter_set *parameter_set = &server->parameter_sets[set];
+
+    if (parameter_set->job < 0) {
+        parameter_set->job = job;
+        server->jobs[job].parameter_set = set;
+        server->jobs[job].start_time = now_milliseconds();
+    }
+
+    return server->jobs[parameter_set->job].id;
+}
+
+static bool handle_start_eri_job(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                                 const struct mock_http_request *request)
+{
+    char job_id[MOCK_ID_LENGTH] = "";
+    char running_job_id[MOCK_ID_LENGTH] = "";
+    cJSON *body = cJSON_Parse(request->body ? request->body : "");
+    const char *requested_job = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(body, "job_id"));
+    const char *requested_set = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(body, "parameter_set_id"));
+
+    pthread_mutex_lock(&server->lock);
+    int job = requested_job ? find_job(server, requested_job) : -1;
+    int set = requested_set ? find_parameter_set(server, requested_set) : -1;
+    if (job >= 0 && set >= 0) {
+        strcpy(job_id, server->jobs[job].id);
+        strcpy(running_job_id, start_job(server, job, set));
+    }
+    pthread_mutex_unlock(&server->lock);
+    cJSON_Delete(body);
+
+    if (!job_id[0]) {
+        return send_error(conn, 404, "No such job or parameter set");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON_AddStringToObject(reply, "job_id", job_id);
+    cJSON_AddStringToObject(cJSON_AddObjectToObject(reply, "job_status"), "job_id", running_job_id);
+    return send_json(conn, 200, reply);
+}
+
+//! Create a job with its parameter set and start it, from a submit request of one job. Must be called with the server
+//! locked.
+//! \return NULL on success, or why the job cannot be submitted. The IDs are empty if the server is out of memory.
+static const char *submit_job(WQC_MOCK_SERVER *server, const cJSON *request, char *job_id, char *set_id,
+                              char *running_job_id)
+{
+    const cJSON *parameters = cJSON_GetObjectItemCaseSensitive(request, "parameters");
+    const char *job_type = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(request, "job_type"));
+
+    if (!cJSON_IsObject(parameters) || !job_type || strcmp(job_type, "eri") != 0) {
+        return "Submit needs an 'eri' job type and a parameters object";
+    }
+
+    int job = add_job(server);
+    int set = job >= 0 ? add_parameters_object(server, parameters) : -1;
+    if (job >= 0 && set >= 0) {
+        strcpy(job_id, server->jobs[job].id);
+        strcpy(set_id, server->parameter_sets[set].id);
+        strcpy(running_job_id, start_job(server, job, set));
+    }
+    return NULL;
+}
+
+//! Make the reply to a submit request of one job
+static cJSON *make_submit_reply(const char *job_id, const char *set_id, const char *running_job_id)
+{
+    cJSON *reply = cJSON_CreateObject();
+    cJSON_AddStringToObject(reply, "job_id", job_id);
+    cJSON_AddStringToObject(reply, "set_id", set_id);
+    cJSON_AddStringToObject(cJSON_AddObjectToObject(reply, "job_status"), "job_id", running_job_id);
+    return reply;
+}
+
+//! Create a job, its parameter set and start it, all in one call
+static bool handle_submit_job(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                              const struct mock_http_request *request)
+{
+    char job_id[MOCK_ID_LENGTH] = "";
+    char set_id[MOCK_ID_LENGTH] = "";
+    char running_job_id[MOCK_ID_LENGTH] = "";
+
+    if (server->config.no_combined_submit) {
+        return send_error(conn, 404, "No such endpoint");
+    }
+
+    cJSON *body = cJSON_Parse(request->body ? request->body : "");
+    pthread_mutex_lock(&server->lock);
+    const char *error = submit_job(server, body, job_id, set_id, running_job_id);
+    pthread_mutex_unlock(&server->lock);
+    cJSON_Delete(body);
+
+    if (error) {
+        return send_error(conn, 400, error);
+    }
+    if (!job_id[0]) {
+        return send_error(conn, 500, "Out of memory");
+    }
+    return send_json(conn, 200, make_submit_reply(job_id, set_id, running_job_id));
+}
+
+//! Submit many jobs in one call. A job that cannot be submitted has an error in its reply, and the others are submitted.
+static bool handle_submit_batch(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                                const struct mock_http_request *request)
+{
+    if (server->config.no_batch) {
+        return send_error(conn, 404, "No such endpoint");
+    }
+
+    cJSON *body = cJSON_Parse(request->body ? request->body : "");
+    const cJSON *jobs = cJSON_GetObjectItemCaseSensitive(body, "jobs");
+    const cJSON *job = NULL;
+    bool out_of_memory = false;
+
+    if (!cJSON_IsArray(jobs)) {
+        cJSON_Delete(body);
+        return send_error(conn, 400, "Batch needs an array of jobs");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *replies = cJSON_AddArrayToObject(reply, "jobs");
+    pthread_mutex_lock(&server->lock);
+    cJSON_ArrayForEach(job, jobs) {
+        char job_id[MOCK_ID_LENGTH] = "";
+        char set_id[MOCK_ID_LENGTH] = "";
+        char running_job_id[MOCK_ID_LENGTH] = "";
+        const char *error = submit_job(server, job, job_id, set_id, running_job_id);
+
+        if (error) {
+            cJSON *job_reply = cJSON_CreateObject();
+            cJSON_AddStringToObject(job_reply, "error", error);
+            cJSON_AddItemToArray(replies, job_reply);
+        } else {
+            out_of_memory = out_of_memory || !job_id[0];
+            cJSON_AddItemToArray(replies, make_submit_reply(job_id, set_id, running_job_id));
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    cJSON_Delete(body);
+
+    if (out_of_memory) {
+        cJSON_Delete(reply);
+        return send_error(conn, 500, "Out of memory");
+    }
+    return send_json(conn, 200, reply);
+}
+
+static cJSON *make_status_item(const WQC_MOCK_SERVER *server, const struct mock_parameter_set *set, long long item,
+                               long long inline_max)
+{
+    long long range[2];
+    cJSON *json = cJSON_CreateObject();
+    bool done = item_done(server, set, item);
+    bool started = item == 0 || item_done(server, set, item - 1);
+
+    item_range(server, set, item, range);
+    cJSON_AddNumberToObject(json, "id", (double) item);
+    cJSON_AddStringToObject(json, "status", done ? "done" : started ? "processing" : "pending");
+    if (done) {
+        char blob_name[MOCK_HTTP_MAX_PATH];
+        snprintf(blob_name, sizeof(blob_name), "blobs/%s/%lld", set->id, item);
+        cJSON_AddStringToObject(json, "result_blob", blob_name);
+    } else {
+        cJSON_AddNullToObject(json, "result_blob");
+    }
+    cJSON_AddItemToObject(json, "begin", make_index_array(server, range[0]));
+    cJSON_AddItemToObject(json, "end", make_index_array(server, range[1]));
+    if (done) {
+        add_inline_values(server, json, range, inline_max);
+    }
+
+    return json;
+}
+
+//! Make the status reply of a started job, with the sub-jobs that changed since a cursor, or with all of them if the
+//! cursor is NULL. Done sub-jobs carry their values if they are no larger than inline_max, in bytes. Must be called
+//! with the server locked.
+static cJSON *make_eri_status_reply(const WQC_MOCK_SERVER *server, int job, const char *since_text,
+                                    long long inline_max, long long *done)
+{
+    const struct mock_parameter_set *set = &server->parameter_sets[server->jobs[job].parameter_set];
+    cJSON *reply = cJSON_CreateObject();
+    bool diff = !server->config.no_status_diff && since_text;
+    // The status of all sub-jobs follows from how many are done, which is also the cursor of the status
+    long long since = diff ? atoll(since_text) : 0;
+    long long first_item = 0;
+    long long end_item = items_count(server, set);
+
+    *done = done_items_count(server, set);
+    cJSON_AddStringToObject(reply, "job_id", server->jobs[job].id);
+    if (!server->config.no_long_poll) {
+        cJSON_AddBoolToObject(reply, "long_poll", true);
+    }
+    if (!server->config.no_status_diff) {
+        char cursor[32];
+        snprintf(cursor, sizeof(cursor), "%lld", *done);
+        cJSON_AddStringToObject(reply, "cursor", cursor);
+    }
+    if (diff && since >= 0 && since <= *done) {
+        // Since the cursor, the sub-jobs that were processing or pending got done, and the next one started
+        first_item = since;
+        end_item = *done == since ? since : (*done < end_item ? *done + 1 : end_item);
+        cJSON_AddBoolToObject(reply, "partial", true);
+    }
+    cJSON *items = cJSON_AddArrayToObject(reply, "items");
+    for (long long item = first_item; item < end_item; ++item) {
+        cJSON_AddItemToArray(items, make_status_item(server, set, item, inline_max));
+    }
+
+    return reply;
+}
+
+static bool handle_eri_status(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                              const struct mock_http_request *request)
+{
+    char job_id[MOCK_ID_LENGTH] = "";
+    char wait_text[32] = "";
+    char done_text[32] = "";
+    char since_text[32] = "";
+    char inline_max[32] = "";
+    char etag[64] = "";
+    char if_none_match[64] = "";
+    cJSON *reply = NULL;
+    long long done = 0;
+
+    maybe_stall(server);
+    mock_http_get_query_parameter(request, "job_id", job_id, sizeof(job_id));
+    mock_http_get_query_parameter(request, "wait", wait_text, sizeof(wait_text));
+    mock_http_get_query_parameter(request, "done", done_text, sizeof(done_text));
+    mock_http_get_query_parameter(request, "inline_max", inline_max, sizeof(inline_max));
+    bool since = mock_http_get_query_parameter(request, "since", since_text, sizeof(since_text));
+    long long wait = server->config.no_long_poll ? 0 : atoll(wait_text);
+
+    pthread_mutex_lock(&server->lock);
+    int job = find_job(server, job_id);
+    if (job >= 0 && server->jobs[job].parameter_set >= 0 && wait > 0) {
+        wait_for_done_items(server, server->jobs[job].parameter_set, atoll(done_text),
+                            wait < MOCK_MAX_STATUS_WAIT ? wait : MOCK_MAX_STATUS_WAIT);
+    }
+    if (job >= 0 && server->jobs[job].parameter_set >= 0) {
+        reply = make_eri_status_reply(server, job, since ? since_text : NULL, atoll(inline_max), &done);
+        snprintf(etag, sizeof(etag), "\"%d-%lld\"", job, done);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (!reply) {
+        return send_error(conn, 404, "No such job, or job was not started");
+    }
+    if (server->config.no_etag) {
+        return send_json(conn, 200, reply);
+    }
+
+    char etag_header[80];
+    snprintf(etag_header, sizeof(etag_header), "ETag: %s\r\n", etag);
+    if (mock_http_get_header(request, "If-None-Match", if_none_match, sizeof(if_none_match)) &&
+        strcmp(if_none_match, etag) == 0) {
+        cJSON_Delete(reply);
+        return mock_http_send_headers(conn, 304, "application/json", etag_header, 0);
+    }
+    return send_json_with_headers(conn, 200, reply, etag_header);
+}
+
+//! Get the status of many jobs in one call. Status calls of a batch are never held.
+static bool handle_status_batch(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                                const struct mock_http_request *request)
+{
+    if (server->config.no_batch) {
+        return send_error(conn, 404, "No such endpoint");
+    }
+
+    cJSON *body = cJSON_Parse(request->body ? request->body : "");
+    const cJSON *jobs = cJSON_GetObjectItemCaseSensitive(body, "jobs");
+    const cJSON *job_request = NULL;
+    const cJSON *inline_max_json = cJSON_GetObjectItemCaseSensitive(body, "inline_max");
+    long long inline_max = cJSON_IsNumber(inline_max_json) ? (long long) inline_max_json->valuedouble : 0;
+
+    if (!cJSON_IsArray(jobs)) {
+        cJSON_Delete(body);
+        return send_error(conn, 400, "Batch needs an array of jobs");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *replies = cJSON_AddArrayToObject(reply, "jobs");
+    pthread_mutex_lock(&server->lock);
+    cJSON_ArrayForEach(job_request, jobs) {
+        const char *job_id = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(job_request, "job_id"));
+        const char *since = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(job_request, "since"));
+        int job = job_id ? find_job(server, job_id) : -1;
+        long long done = 0;
+
+        if (job >= 0 && server->jobs[job].parameter_set >= 0) {
+            cJSON_AddItemToArray(replies, make_eri_status_reply(server, job, since, inline_max, &done));
+        } else {
+            cJSON *job_reply = cJSON_CreateObject();
+            cJSON_AddStringToObject(job_reply, "error", "No such job, or job was not started");
+            cJSON_AddItemToArray(replies, job_reply);
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    cJSON_Delete(body);
+
+    return send_json(conn, 200, reply);
+}
+
+
+static cJSON *make_function(const WQC_MOCK_SERVER *server, int shell, int orientation)
+{
+    static const char *p_labels[] = {"px", "py", "pz"};
+    int l = server->functions_per_shell[shell] == 1 ? 0 : 1;
+    int atom = shell / 2;
+    double origin[3] = {0.0, 0.0, 1.5 * atom};
+    cJSON *function = cJSON_CreateObject();
+
+    cJSON_AddItemToObject(function, "origin", cJSON_CreateDoubleArray(origin, 3));
+    cJSON_AddStringToObject(function, "angular_moment_symbol", l ? "p" : "s");
+    cJSON_AddStringToObject(function, "element_name", "Helium");
+    cJSON_AddStringToObject(function, "element_symbol", "He");
+    cJSON_AddStringToObject(function, "function_label", l ? p_labels[orientation] : "s");
+    cJSON_AddNumberToObject(function, "angular_moment_l", l);
+    cJSON_AddNumberToObject(function, "atom_index", atom);
+    cJSON_AddNumberToObject(function, "shell_index", shell);
+    cJSON_AddNumberToObject(function, "atomic_number", 2);
+    cJSON_AddNumberToObject(function, "number_of_primitives", 1);
+    cJSON_AddBoolToObject(function, "spherical", false);
+    cJSON *primitive = cJSON_CreateObject();
+    cJSON_AddNumberToObject(primitive, "coefficient", 1.0);
+    cJSON_AddNumberToObject(primitive, "exponent", 1.0 + shell);
+    cJSON_AddItemToArray(cJSON_AddArrayToObject(function, "primitives"), primitive);
+
+    return function;
+}
+
+static bool handle_integrals_info(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                                  const struct mock_http_request *request)
+{
+    char set_id[MOCK_ID_LENGTH] = "";
+    int functions_count = 0;
+    int atoms_count = (server->config.shells + 1) / 2;
+
+    mock_http_get_query_parameter(request, "set_id", set_id, sizeof(set_id));
+    pthread_mutex_lock(&server->lock);
+    int set = find_parameter_set(server, set_id);
+    pthread_mutex_unlock(&server->lock);
+    if (set < 0) {
+        return send_error(conn, 404, "No such parameter set");
+    }
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON *system = cJSON_AddObjectToObject(reply, "system");
+    cJSON *functions = cJSON_AddArrayToObject(system, "functions");
+    for (int shell = 0; shell < server->config.shells; ++shell) {
+        for (int orientation = 0; orientation < server->functions_per_shell[shell]; ++orientation) {
+            cJSON_AddItemToArray(functions, make_function(server, shell, orientation));
+            functions_count++;
+        }
+    }
+    cJSON_AddNumberToObject(system, "number_of_atoms", atoms_count);
+    cJSON_AddNumberToObject(system, "number_of_electrons", 2 * atoms_count);
+    cJSON_AddNumberToObject(system, "number_of_functions", functions_count);
+    cJSON_AddNumberToObject(system, "number_of_integrals",
+                            (double) functions_count * functions_count * functions_count * functions_count);
+    cJSON_AddNumberToObject(system, "number_of_shells", server->config.shells);
+    cJSON_AddNumberToObject(system, "number_of_primitives", functions_count);
+
+    return send_json(conn, 200, reply);
+}
+
+//! Find a blob of ERI values, and check that the ERI sub-job that calculates it is done
+//! \return HTTP status - 200 if the blob is available, else an error status, and the reason is set in the blob
+static int find_done_blob(WQC_MOCK_SERVER *server, struct mock_blob *blob)
+{
+    int status = 200;
+
+    pthread_mutex_lock(&server->lock);
+    int set = find_parameter_set(server, blob->set_id);
+    if (set >= 0 && blob->item < 0) {
+        blob->item = blob->quartet / server->parameter_sets[set].shell_sets_per_file;
+    }
+    if (set < 0 || blob->item < 0 || blob->item >= items_count(server, &server->parameter_sets[set])) {
+        blob->error = "No such parameter set or ERI values";
+        status = 404;
+    } else if (server->parameter_sets[set].job < 0 || !item_done(server, &server->parameter_sets[set], blob->item)) {
+        blob->error = "ERI values are not calculated yet";
+        status = 409;
+    } else {
+        item_range(server, &server->parameter_sets[set], blob->item, blob->range);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    return status;
+}
+
+static bool handle_eri_values(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                              const struct mock_http_request *request)
+{
+    struct mock_blob blob = {.item = -1};
+    char begin[64] = "";
+    char inline_max[32] = "";
+    char host[256] = "";
+    char URL[MOCK_HTTP_MAX_PATH];
+
+    mock_http_get_query_parameter(request, "set_id", blob.set_id, sizeof(blob.set_id));
+    mock_http_get_query_parameter(request, "begin", begin, sizeof(begin));
+    mock_http_get_query_parameter(request, "inline_max", inline_max, sizeof(inline_max));
+    if (!parse_quartet(server, begin, &blob.quartet)) {
+        return send_error(conn, 400, "Bad ERI index");
+    }
+    if (!mock_http_get_header(request, "Host", host, sizeof(host))) {
+        snprintf(host, sizeof(host), "127.0.0.1:%u", server->port);
+    }
+
+    int status = find_done_blob(server, &blob);
+    if (status != 200) {
+        return send_error(conn, status, blob.error);
+    }
+
+    snprintf(URL, sizeof(URL), "http://%s/blobs/%s/%lld", host, blob.set_id, blob.item);
+
+    cJSON *reply = cJSON_CreateObject();
+    cJSON_AddStringToObject(reply, "raw_data_url", URL);
+    cJSON_AddItemToObject(reply, "begin", make_index_array(server, blob.range[0]));
+    cJSON_AddItemToObject(reply, "end", make_index_array(server, blob.range[1]));
+    cJSON_AddNumberToObject(reply, "precision", MOCK_ERI_PRECISION);
+    cJSON_AddNumberToObject(reply, "size", (double) blob_size(server, blob.range));
+    add_inline_values(server, reply, blob.range, atoll(inline_max));
+
+    return send_json(conn, 200, reply);
+}
+
+//! Generate the ERI values of a range of shell quartets, and send them
+static bool send_blob_values(WQC_MOCK_SERVER *server, struct mock_http_connection *conn, const long long *range)
+{
+    bool rv = true;
+    double *values = malloc(MOCK_BLOB_CHUNK * sizeof(double));
+    int count = 0;
+
+    for (long long quartet = range[0]; rv && values && quartet < range[1]; ++quartet) {
+        int size = quartet_size(server, quartet);
+        for (int position = 0; rv && position < size; ++position) {
+            values[count++] = wqc_mock_server_eri_value(quartet, position);
+            if (count == MOCK_BLOB_CHUNK) {
+                rv = mock_http_send_data(conn, values, count * sizeof(double));
+                count = 0;
+            }
+        }
+    }
+    if (rv && values && count) {
+        rv = mock_http_send_data(conn, values, count * sizeof(double));
+    }
+    free(values);
+
+    return rv && values;
+}
+
+//! Find the bytes of a blob a request asks for with a Range header, of the form "bytes=first-last" or
+//! "bytes=first-"
+//! \return true if the request asks for a range that is in the blob, false to send the whole blob
+static bool requested_range(const struct mock_http_request *request, long long size, long long *first,
+                            long long *last)
+{
+    char range[64] = "";
+    long long range_first = 0;
+    long long range_last = size - 1;
+
+    // The last byte may be left out, as when a client resumes a download
+    bool rv = mock_http_get_header(request, "Range", range, sizeof(range)) &&
+              sscanf(range, "bytes=%lld-%lld", &range_first, &range_last) >= 1 && 0 <= range_first &&
+              range_first <= range_last && range_last < size;
+    if (rv) {
+        *first = range_first;
+        *last = range_last;
+    }
+    return rv;
+}
+
+//! Send bytes first to last of a blob, uncompressed: as a 206 Partial Content reply if a range was asked for, else as
+//! a 200 reply. A broken reply has only the first half of its body, and its connection is closed after it.
+static bool send_blob_bytes(WQC_MOCK_SERVER *server, struct mock_http_connection *conn, const struct mock_blob *blob,
+                            long long first, long long last, bool partial, bool broken)
+{
+    long long size = blob_size(server, blob->range);
+    long long length = last - first + 1;
+    char content_range[96];
+    double *values = make_blob_values(server, blob->range);
+
+    snprintf(content_range, sizeof(content_range), "Content-Range: bytes %lld-%lld/%lld\r\n", first, last, size);
+    bool rv = values &&
+              mock_http_send_headers(conn, partial ? 206 : 200, "application/octet-stream",
+                                     partial ? content_range : NULL, length) &&
+              mock_http_send_data(conn, (const char *) values + first, broken ? length / 2 : length);
+    free(values);
+
+    return rv && !broken;
+}
+
+static bool handle_blob(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                        const struct mock_http_request *request)
+{
+    struct mock_blob blob = {.item = -1};
+    long long first = 0;
+    long long last = 0;
+
+    maybe_stall(server);
+    if (sscanf(request->path, "/blobs/%36[^/]/%lld", blob.set_id, &blob.item) != 2 || blob.item < 0) {
+        return send_error(conn, 404, "No such blob");
+    }
+
+    int status = find_done_blob(server, &blob);
+    if (status != 200) {
+        return send_error(conn, status, blob.error);
+    }
+
+    long long size = blob_size(server, blob.range);
+    bool partial = !server->config.no_range && requested_range(request, size, &first, &last);
+    bool broken = server->config.break_rate > 0 && inject_fault(server, server->config.break_rate);
+    if (!partial) {
+        last = size - 1;
+    }
+    if (partial || broken) {
+        return send_blob_bytes(server, conn, &blob, first, last, partial, broken);
+    }
+    if (conn->gzip) {
+        // The compressed size is known only once the whole blob is compressed
+        double *values = make_blob_values(server, blob.range);
+        bool rv = values && mock_http_send_body(conn, 200, "application/octet-stream", NULL, values,
+                                                blob_size(server, blob.range));
+        free(values);
+        return rv;
+    }
+    return mock_http_send_headers(conn, 200, "application/octet-stream", NULL, blob_size(server, blob.range)) &&
+           send_blob_values(server, conn, blob.range);
+}
+
+/// All endpoints of the mock server
+static const struct mock_endpoint endpoints[] = {
+    {"POST", "/job", handle_new_job, true},
+    {"POST", "/params", handle_parameters, true},
+    {"POST", "/eri", handle_start_eri_job, true},
+    {"POST", "/submit", handle_submit_job, true},
+    {"POST", "/submit_batch", handle_submit_batch, true},
+    {"POST", "/status_batch", handle_status_batch, true},
+    {"GET", "/eri", handle_eri_status, true},
+    {"GET", "/int_info", handle_integrals_info, true},
+    {"GET", "/eri_values", handle_eri_values, true},
+    {"GET", "/blobs/", handle_blob, false},
+};
+
+static const struct mock_endpoint *find_endpoint(const struct mock_http_request *request)
+{
+    for (int i = 0; i < sizeof(endpoints) / sizeof(endpoints[0]); ++i) {
+        const char *path = endpoints[i].path;
+        size_t path_length = strlen(path);
+        bool prefix = path[path_length - 1] == '/';
+
+        if (strcmp(request->method, endpoints[i].method) == 0 &&
+            (prefix ? strncmp(request->path, path, path_length) == 0 : strcmp(request->path, path) == 0)) {
+            return &endpoints[i];
+        }
+    }
+    return NULL;
+}
+
+static bool is_authorized(const WQC_MOCK_SERVER *server, const struct mock_http_request *request)
+{
+    char authorization[256];
+    char expected[256];
+
+    snprintf(expected, sizeof(expected), "Bearer %s", server->config.access_token);
+    return mock_http_get_header(request, "Authorization", authorization, sizeof(authorization)) &&
+           strcmp(authorization, expected) == 0;
+}
+
+
+//! Find whether the client of a request accepts gzip compressed replies
+static bool accepts_gzip(const struct mock_http_request *request)
+{
+    char encodings[256];
+    return mock_http_get_header(request, "Accept-Encoding", encodings, sizeof(encodings)) &&
+           strstr(encodings, "gzip") != NULL;
+}
+
+//! Find whether a request has a gzip compressed body
+static bool has_gzip_body(const struct mock_http_request *request)
+{
+    char encoding[32];
+    return mock_http_get_header(request, "Content-Encoding", encoding, sizeof(encoding)) &&
+           strcasecmp(encoding, "gzip") == 0;
+}
+
+static bool handle_request(WQC_MOCK_SERVER *server, struct mock_http_connection *conn,
+                           struct mock_http_request *request)
+{
+    const struct mock_endpoint *endpoint = find_endpoint(request);
+
+    conn->gzip = !server->config.no_compression && accepts_gzip(request);
+
+    if (server->config.latency > 0) {
+        usleep(server->config.latency * 1000);
+    }
+
+    if (!endpoint) {
+        return send_error(conn, 404, "No such endpoint");
+    }
+    if (inject_fault(server, server->config.error_rate)) {
+        return send_injected_error(server, conn);
+    }
+    if (endpoint->authorized && !is_authorized(server, request)) {
+        return send_error(conn, 401, "Bad access token");
+    }
+    if (has_gzip_body(request) && server->config.no_compression) {
+        return send_error(conn, 415, "Compressed request bodies are not supported");
+    }
+    if (has_gzip_body(request) && !mock_http_gunzip_body(request)) {
+        return send_error(conn, 400, "Bad compressed request body");
+    }
+    return endpoint->handle(server, conn, request);
+}
+
+
+static void remove_connection(WQC_MOCK_SERVER *server, int fd)
+{
+    pthread_mutex_lock(&server->lock);
+    for (int i = 0; i < server->connections_count; ++i) {
+        if (server->connections[i] == fd) {
+            server->connections[i] = server->connections[--server->connections_count];
+            break;
+        }
+    }
+    close(fd);
+    pthread_cond_broadcast(&server->connections_closed);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void *serve_connection(void *arg)
+{
+    struct mock_connection_args *args = arg;
+    WQC_MOCK_SERVER *server = args->server;
+    struct mock_http_connection *conn = calloc(1, sizeof(struct mock_http_connection));
+    struct mock_http_request request = {0};
+    bool keep_alive = conn != NULL;
+
+    if (conn) {
+        conn->fd = args->fd;
+        conn->bandwidth = server->config.bandwidth;
+    }
+
+    while (keep_alive && mock_http_read_request(conn, &request)) {
+        keep_alive = handle_request(server, conn, &request) && request.keep_alive;
+        mock_http_free_request(&request);
+    }
+    mock_http_free_request(&request);
+
+    remove_connection(server, args->fd);
+    free(conn);
+    free(args);
+
+    return NULL;
+}
+
+//! Start a thread that serves a new connection
+static void add_connection(WQC_MOCK_SERVER *server, int fd)
+{
+    pthread_t thread;
+    struct mock_connection_args *args = malloc(sizeof(struct mock_connection_args));
+    bool added = false;
+
+    pthread_mutex_lock(&server->lock);
+    if (args && !server->stopping &&
+        grow_array((void **) &server->connections, &server->connections_capacity, server->connections_count,
+                   sizeof(int))) {
+        args->server = server;
+        args->fd = fd;
+        if (pthread_create(&thread, NULL, serve_connection, args) == 0) {
+            pthread_detach(thread);
+            server->connections[server->connections_count++] = fd;
+            added = true;
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    if (!added) {
+        free(args);
+        close(fd);
+    }
+}
+
+static void *accept_connections(void *arg)
+{
+    WQC_MOCK_SERVER *server = arg;
+    int fd = -1;
+
+    while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0 || errno == EINTR || errno == ECONNABORTED) {
+        if (fd >= 0) {
+            // Replies are sent as headers and then body, so do not let the body wait for the client's delayed ACK
+            int no_delay = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &no_delay, sizeof(no_delay));
+            add_connection(server, fd);
+        }
+    }
+
+    return NULL;
+}
+
+static bool start_listening(WQC_MOCK_SERVER *server)
+{
+    struct sockaddr_in address;
+    socklen_t address_length = sizeof(address);
+    int reuse = 1;
+
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    address.sin_port = htons(server->config.port);
+
+    server->listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->listen_fd < 0) {
+        return false;
+    }
+    setsockopt(server->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    if (bind(server->listen_fd, (struct sockaddr *) &address, sizeof(address)) < 0 ||
+        listen(server->listen_fd, MOCK_LISTEN_BACKLOG) < 0 ||
+        getsockname(server->listen_fd, (struct sockaddr *) &address, &address_length) < 0) {
+        close(server->listen_fd);
+        return false;
+    }
+    server->port = ntohs(address.sin_port);
+
+    return true;
+}
+
+static bool init_synthetic_system(WQC_MOCK_SERVER *server)
+{
+    long long n = server->config.shells;
+
+    server->functions_per_shell = calloc(n, sizeof(int));
+    if (!server->functions_per_shell) {
+        return false;
+    }
+    for (int shell = 0; shell < n; ++shell) {
+        server->functions_per_shell[shell] = shell % 2 ? 3 : 1;
+    }
+    server->quartets_count = n * n * n * n;
+
+    return true;
+}
+
+static void free_server(WQC_MOCK_SERVER *server)
+{
+    for (int i = 0; i < server->parameter_sets_count; ++i) {
+        free(server->parameter_sets[i].parameters);
+    }
+    free(server->parameter_sets);
+    free(server->jobs);
+    free(server->connections);
+    free(server->functions_per_shell);
+    pthread_mutex_destroy(&server->lock);
+    pthread_cond_destroy(&server->connections_closed);
+    pthread_cond_destroy(&server->stopped);
+    free(server);
+}
+
+WQC_MOCK_SERVER *wqc_mock_server_start(const struct wqc_mock_server_config *config)
+{
+    WQC_MOCK_SERVER *server = calloc(1, sizeof(struct wqc_mock_server));
+
+    if (!server || config->shells <= 0) {
+        free(server);
+        return NULL;
+    }
+
+    server->config = *config;
+    server->random_state = config->seed;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->connections_closed, NULL);
+    pthread_cond_init(&server->stopped, NULL);
+
+    if (!init_synthetic_system(server) || !start_listening(server)) {
+        free_server(server);
+        return NULL;
+    }
+
+    if (pthread_create(&server->accept_thread, NULL, accept_connections, server) != 0) {
+        close(server->listen_fd);
+        free_server(server);
+        return NULL;
+    }
+
+    return server;
+}
+
+unsigned short wqc_mock_server_port(const WQC_MOCK_SERVER *server)
+{
+    return server->port;
+}
+
+void wqc_mock_server_stop(WQC_MOCK_SERVER *server)
+{
+    if (!server) {
+        return;
+    }
+
+    shutdown(server->listen_fd, SHUT_RDWR);
+    pthread_join(server->accept_thread, NULL);
+    close(server->listen_fd);
+
+    pthread_mutex_lock(&server->lock);
+    server->stopping = true;
+    pthread_cond_broadcast(&server->stopped);
+    for (int i = 0; i < server->connections_count; ++i) {
+        shutdown(server->connections[i], SHUT_RDWR);
+    }
+    while (server->connections_count > 0) {
+        pthread_cond_wait(&server->connections_closed, &server->lock);
+    }
+    pthread_mutex_unlock(&server->lock);
+
+    free_server(server);
+}
@@ -0,0 +1,110 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "webqc-mock-server.h"
+
+/*
+ * Command line front end of the mock WebQC server. Runs the server until interrupted. Point libwebqc at it with:
+ *   wqc_set_option(handler, WQC_OPTION_SERVER_NAME, "127.0.0.1");
+ *   wqc_set_option(handler, WQC_OPTION_SERVER_PORT, port);
+ *   wqc_set_option(handler, WQC_OPTION_PLAIN_HTTP, true);
+ */
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -p port      port to listen on, 0 for any free port (default 5000)\n"
+            "  -s shells    number of shells in the synthetic system (default %d)\n"
+            "  -f quartets  shell quartets per ERI values blob, 0 for one blob (default 0)\n"
+            "  -d ms        time it takes an ERI job to finish (default %d)\n"
+            "  -l ms        latency added to every reply (default 0)\n"
+            "  -b bytes     bandwidth limit per connection, in bytes per second (default none)\n"
+            "  -e rate      fraction of requests that fail with HTTP error 500 (default 0)\n"
+            "  -a seconds   make failed requests ask clients to wait, with HTTP error 429 and Retry-After\n"
+            "  -k rate      fraction of blob downloads whose connection is closed halfway through (default 0)\n"
+            "  -w rate      fraction of blob downloads and status calls held before they are answered (default 0)\n"
+            "  -W ms        how long held requests are held (default 0)\n"
+            "  -r seed      random seed (default 1)\n"
+            "  -t token     access token to accept (default %s)\n"
+            "  -n           reply to status calls at once instead of holding them until a sub-job finishes\n"
+            "  -E           send no ETag with status replies, and ignore If-None-Match\n"
+            "  -F           always send the full status of a job, ignoring the since cursor\n"
+            "  -S           have no endpoint to submit a job in one call\n"
+            "  -B           have no endpoints to submit or get the status of many jobs in one call\n"
+            "  -I           never send small ERI values blobs inside status or eri_values replies\n"
+            "  -Z           send no gzip compressed replies, and reject compressed request bodies\n"
+            "  -R           ignore Range headers, and always send whole blobs\n",
+            program, WQC_MOCK_DEFAULT_SHELLS, WQC_MOCK_DEFAULT_JOB_DURATION, WQC_MOCK_DEFAULT_TOKEN);
+}
+
+static int parse_options(int argc, char *argv[], struct wqc_mock_server_config *config)
+{
+    int option = 0;
+
+    config->port = 5000;
+    while ((option = getopt(argc, argv, "p:s:f:d:l:b:e:a:k:w:W:r:t:nEFSBIZRh")) != -1) {
+        switch (option) {
+            case 'p': config->port = (unsigned short) atoi(optarg); break;
+            case 's': config->shells = atoi(optarg); break;
+            case 'f': config->shell_sets_per_file = atoi(optarg); break;
+            case 'd': config->job_duration = atoi(optarg); break;
+            case 'l': config->latency = atoi(optarg); break;
+            case 'b': config->bandwidth = atol(optarg); break;
+            case 'e': config->error_rate = atof(optarg); break;
+            case 'a': config->retry_after = atoi(optarg); break;
+            case 'k': config->break_rate = atof(optarg); break;
+            case 'w': config->stall_rate = atof(optarg); break;
+            case 'W': config->stall_time = atoi(optarg); break;
+            case 'r': config->seed = (unsigned int) atoi(optarg); break;
+            case 't': config->access_token = optarg; break;
+            case 'n': config->no_long_poll = true; break;
+            case 'E': config->no_etag = true; break;
+            case 'F': config->no_status_diff = true; break;
+            case 'S': config->no_combined_submit = true; break;
+            case 'B': config->no_batch = true; break;
+            case 'I': config->no_inline = true; break;
+            case 'Z': config->no_compression = true; break;
+            case 'R': config->no_range = true; break;
+            default: return -1;
+        }
+    }
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct wqc_mock_server_config config;
+    sigset_t signals;
+    int signal_received = 0;
+
+    wqc_mock_server_default_config(&config);
+    if (parse_options(argc, argv, &config) < 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Block the stop signals before starting the server threads, so they are delivered to sigwait below
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    if (!server) {
+        fprintf(stderr, "Cannot start the mock WebQC server on port %u\n", config.port);
+        return 1;
+    }
+
+    printf("Mock WebQC server listening on http://127.0.0.1:%u\n", wqc_mock_server_port(server));
+    fflush(stdout);
+
+    sigwait(&signals, &signal_received);
+    wqc_mock_server_stop(server);
+
+    return 0;
+}
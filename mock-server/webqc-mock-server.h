@@ -0,0 +1,84 @@
+#pragma once
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @file
+ * A local stand-in for the WebQC server, for testing and benchmarking libwebqc without network access. It serves
+ * the job, params, eri, submit, submit_batch, status_batch, int_info and eri_values endpoints and ERI values blobs
+ * over plain HTTP. The system it calculates is synthetic: its size is set by the configuration, whatever the
+ * submitted geometry and basis set are.
+ */
+
+#define WQC_MOCK_DEFAULT_SHELLS (5) /// Default number of shells in the synthetic system
+#define WQC_MOCK_DEFAULT_JOB_DURATION (200) /// Default time it takes all ERI sub-jobs to finish, in milliseconds
+#define WQC_MOCK_DEFAULT_TOKEN "test-token" /// Default access token the mock server accepts
+
+/// Configuration of a mock WebQC server
+struct wqc_mock_server_config {
+    unsigned short port; /// Port to listen on. 0 picks any free port.
+    int shells; /// Number of shells in the synthetic system. Shells alternate between s and p.
+    int shell_sets_per_file; /// ERI shell quartets per blob, for jobs that do not ask for a number. 0 for one blob.
+    int job_duration; /// Time it takes all ERI sub-jobs to finish, in milliseconds. Sub-jobs finish one by one.
+    int latency; /// Delay before every reply, in milliseconds
+    long bandwidth; /// Maximum bytes per second sent on each connection, 0 for no limit
+    double error_rate; /// Fraction of requests that fail with HTTP error 500, between 0 and 1
+    int retry_after; /// Seconds failed requests ask clients to wait, sent with HTTP error 429 instead of 500. 0 for none.
+    double break_rate; /// Fraction of blob downloads whose connection is closed halfway through, between 0 and 1
+    double stall_rate; /// Fraction of blob downloads and status calls held for stall_time first, between 0 and 1
+    int stall_time; /// How long stalled requests are held before they are answered, in milliseconds
+    unsigned int seed; /// Seed for injected errors and for IDs
+    const char *access_token; /// Access token that calls must carry
+    bool no_long_poll; /// Reply to status calls at once, ignoring their wait parameter, like an older server
+    bool no_etag; /// Send no ETag with status replies and ignore If-None-Match, like an older server
+    bool no_combined_submit; /// Have no endpoint to submit a job in one call, like an older server
+    bool no_status_diff; /// Always send the status of all sub-jobs, and no status cursor, like an older server
+    bool no_batch; /// Have no endpoints to submit or get the status of many jobs in one call, like an older server
+    bool no_inline; /// Never send ERI values inside status or eri_values replies, like an older server
+    bool no_compression; /// Send no compressed replies, and reject compressed request bodies, like an older server
+    bool no_range; /// Ignore Range headers, and always send whole blobs
+};
+
+typedef struct wqc_mock_server WQC_MOCK_SERVER;
+
+//! Fill a configuration with default values: any free port, a small system, no latency, errors or bandwidth limit
+//! \param config configuration to fill
+void wqc_mock_server_default_config(
+    struct wqc_mock_server_config *config
+);
+
+//! Start a mock WebQC server on 127.0.0.1. The server runs on its own threads until stopped.
+//! \param config server configuration
+//! \return a running server, or NULL if it cannot listen on the port
+WQC_MOCK_SERVER *wqc_mock_server_start(
+    const struct wqc_mock_server_config *config
+);
+
+//! Get the port a running mock server listens on
+//! \param server a running server
+//! \return the port number
+unsigned short wqc_mock_server_port(
+    const WQC_MOCK_SERVER *server
+);
+
+//! Stop a mock server, closing all its connections, and release it
+//! \param server server to stop
+void wqc_mock_server_stop(
+    WQC_MOCK_SERVER *server
+);
+
+//! Get the synthetic value of an ERI, as the mock server sends it
+//! \param quartet position of the shell quartet in shell order
+//! \param position position of the ERI among the ERIs of the shell quartet
+//! \return the ERI value
+double wqc_mock_server_eri_value(
+    long long quartet,
+    int position
+);
+
+#ifdef __cplusplus
+} // "extern C"
+#endif
@@ -244,11 +244,25 @@ get_system_sizes(WQC *handler, const cJSON *system_info)
     return rv;
 }
 
+//! Forget the basis set of a previous job, so that the handler can be filled with a new one
+static void reset_basis_set(WQC *handler)
+{
+    struct ERI_information *eri_info = & handler->eri_info;
+
+    free(eri_info->basis_functions);
+    free(eri_info->basis_function_primitives);
+    eri_info->basis_functions = NULL;
+    eri_info->basis_function_primitives = NULL;
+    eri_info->next_function = 0;
+    eri_info->next_primitive = 0;
+}
+
 static bool
 parse_integrals_info(WQC *handler, const cJSON *system_info, const cJSON *functions_info)
 {
     bool rv = false;
 
+    reset_basis_set(handler);
     rv = get_system_sizes(handler, system_info);
     if ( rv ) {
         rv = get_functions(handler, functions_info);
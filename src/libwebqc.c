@@ -1,5 +1,6 @@
 #include <stddef.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef __APPLE__
@@ -13,6 +14,10 @@
 #include "webqc-handler.h"
 #include "webqc-web-access.h"
 #include "webqc-json.h"
+#include "webqc-metrics.h"
+#include "webqc-trace.h"
+#include "webqc-calls.h"
+#include "webqc-retry.h"
 
 
 
@@ -64,6 +69,7 @@ static void cleanup_ERI_info(WQC *handler)
     }
     bzero(&handler->eri_info.eri_values, sizeof(struct ERI_values));
     handler->eri_info.eri_values.eri_precision = WQC_PRECISION_UNKNOWN;
+    wqc_metrics_update_ERI_memory(handler);
 }
 
 
@@ -75,14 +81,48 @@ WQC *wqc_init()
     handler->webqc_server_name = strdup(DEFAULT_WEBQC_SERVER_NAME);
     handler->webqc_server_port = DEFAULT_WEBQC_SERVER_PORT;
     handler->insecure_ssl = false;
+    handler->plain_http = false;
+    handler->max_parallel_downloads = DEFAULT_MAX_PARALLEL_DOWNLOADS;
+    handler->max_inline_ERI_size = DEFAULT_MAX_INLINE_ERI_SIZE;
+    handler->download_retries = DEFAULT_DOWNLOAD_RETRIES;
+    handler->call_retries = DEFAULT_CALL_RETRIES;
+    handler->retry_base_delay = DEFAULT_RETRY_BASE_DELAY;
+    handler->retry_max_delay = DEFAULT_RETRY_MAX_DELAY;
+    handler->call_timeout = DEFAULT_CALL_TIMEOUT;
+    handler->connect_timeout = DEFAULT_CONNECT_TIMEOUT;
+    handler->deadline = 0;
+    handler->hedge_percentile = DEFAULT_HEDGE_PERCENTILE;
+    handler->retry_random_state = (unsigned int) (uintptr_t) handler ^ (unsigned int) wqc_monotonic_milliseconds();
+    handler->long_poll = true;
+    handler->long_poll_unsupported = false;
+    handler->combined_submit = true;
+    handler->combined_submit_unsupported = false;
+    handler->batch_unsupported = false;
+    handler->compression = true;
+    handler->compressed_body_unsupported = false;
+    handler->min_poll_interval = DEFAULT_MIN_POLL_INTERVAL;
+    handler->max_poll_interval = DEFAULT_MAX_POLL_INTERVAL;
     handler->job_id[0] = '\0';
+    handler->parameter_set_id[0] = '\0';
     handler->wqc_endpoint = NULL;
     handler->job_type = WQC_NULL_JOB;
     handler->is_duplicate = false;
     handler->job_status = WQC_JOB_STATUS_UNKNOWN;
     handler->eri_status = NULL;
     handler->ERI_items_count = 0;
+    handler->status_etag[0] = '\0';
+    handler->status_cursor[0] = '\0';
+    memset(handler->ERI_items_by_status, 0, sizeof(handler->ERI_items_by_status));
+    handler->ERI_done_queue = NULL;
+    handler->ERI_done_queue_begin = 0;
+    handler->ERI_done_queue_end = 0;
+    memset(&handler->items_progress, 0, sizeof(handler->items_progress));
     init_ERI_info(handler);
+    handler->eri_memory_metered = 0;
+    handler->trace_file = NULL;
+    handler->trace = NULL;
+    handler->trace_track = 0;
+    bzero(&handler->call, sizeof(handler->call));
 
     wqc_init_web_calls(handler);
 
@@ -104,6 +144,7 @@ void wqc_cleanup(WQC *handler)
 {
     if (handler) {
 
+        wqc_multi_remove_handler(handler);
         wqc_reset(handler);
 
         if (handler->access_token) {
@@ -113,11 +154,15 @@ void wqc_cleanup(WQC *handler)
         if ( handler->eri_status ) {
             for ( int i = 0 ; i < handler->ERI_items_count; ++i) {
                 free(handler->eri_status[i].output_blob_name);
+                free(handler->eri_status[i].values);
             }
             free(handler->eri_status);
         }
+        free(handler->ERI_done_queue);
         free(handler->webqc_server_name);
         cleanup_ERI_info(handler);
+        wqc_cleanup_web_calls(handler);
+        wqc_trace_close(handler);
         free(handler);
     }
 }
@@ -127,164 +172,164 @@ bool wqc_job_is_duplicate(WQC *handler)
     return handler->is_duplicate;
 }
 
-static bool start_wqc_job(WQC *handler)
+bool wqc_submit_job(WQC *handler, enum wqc_job_type job_type, void *job_parameters)
 {
-    bool rv = false;
-
-    handler->is_duplicate = false;
-
-    rv = prepare_web_call(handler, handler->wqc_endpoint);
+    bool rv = wqc_handler_idle(handler);
 
     if ( rv ) {
-        struct name_value_pair start_job_parameters[] = {
-                {"job_id",     WQC_STRING_TYPE, {.str_value=handler->job_id}},
-                {"parameter_set_id",   WQC_STRING_TYPE, {.str_value=handler->parameter_set_id}}
-        };
-        rv = set_POST_fields(handler, start_job_parameters, ARRAY_SIZE(start_job_parameters));
-    }
+        handler->call.job_type = job_type;
+        handler->call.job_parameters = job_parameters;
 
-    if ( rv ) {
-        rv = make_web_call(handler);
+        wqc_trace_time_t start = wqc_trace_begin(handler);
+        rv = wqc_run_call(handler, wqc_submit_job_first_step(handler));
+        wqc_trace_end(handler, "submit_job", start);
     }
 
-    if (rv) {
-        rv = update_job_details(handler);
-        wqc_reset(handler);
-    }
-    cleanup_web_call(handler);
-
     return rv;
 }
 
-
-static bool create_new_job(WQC *handler)
+bool
+wqc_get_integrals_details(WQC *handler)
 {
-    bool rv = false;
+    wqc_trace_time_t start = wqc_trace_begin(handler);
+    bool rv = wqc_run_call(handler, WQC_STEP_GET_INTEGRALS_DETAILS);
+    wqc_trace_end(handler, "get_integrals_details", start);
 
-    rv = prepare_web_call(handler, NEW_JOB_SERVICE_ENDPOINT);
+    return rv;
+}
 
-    if ( rv ) {
-        set_no_parameters(handler);
-        rv = make_web_call(handler);
 
-        if ( rv ) {
-            get_job_id_from_reply(handler);
-            wqc_reset(handler);
-        }
-    }
+bool wqc_get_status(WQC *handler)
+{
+    return wqc_run_call(handler, WQC_STEP_GET_STATUS);
+}
 
-    cleanup_web_call(handler);
+/// Starts the operation of one job of a batch on its handler, when the server has no batched calls
+typedef bool (*start_job_operation)(WQC_MULTI *multi, WQC *handler, enum wqc_job_type job_type, void *job_parameters);
 
-    return rv;
+static bool start_submit_job(WQC_MULTI *multi, WQC *handler, enum wqc_job_type job_type, void *job_parameters)
+{
+    return wqc_multi_submit_job(multi, handler, job_type, job_parameters);
 }
 
-static bool wqc_create_parameter_set(WQC *handler, enum wqc_job_type job_type, void *job_parameters)
+static bool start_get_status(WQC_MULTI *multi, WQC *handler, enum wqc_job_type job_type, void *job_parameters)
 {
-    bool rv = false;
-    const char *endpoint = NULL;
-
-
-    rv = prepare_web_call(handler, PARAMETERS_SERVICE_ENDPOINT);
+    return wqc_multi_get_status(multi, handler);
+}
 
-    if ( rv ) {
-        if (job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
-            rv = set_eri_job_parameters(handler, (const struct two_electron_integrals_job_parameters *) job_parameters);
-            endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
-        } else {
-            wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
-            rv = false;
+//! Run the operation of each job on its own handler, for a server that has no batched calls. The calls are made
+//! concurrently, up to WQC_MAX_BATCH_JOBS at once.
+static void run_one_by_one(WQC *handlers[], enum wqc_job_type job_type, void *job_parameters[], int jobs_count,
+                           start_job_operation start)
+{
+    WQC_MULTI *multi = wqc_multi_init();
+    int started = 0;
+    int running = 0;
+    bool success = false;
+
+    while ( multi && ( started < jobs_count || running > 0 ) ) {
+        while ( started < jobs_count && running < WQC_MAX_BATCH_JOBS ) {
+            running += start(multi, handlers[started], job_type, job_parameters ? job_parameters[started] : NULL);
+            started++;
+        }
+        if ( wqc_poll(multi, 1000) < 0 ) {
+            break; // LCOV_EXCL_LINE
+        }
+        while ( wqc_multi_next_done(multi, &success) ) {
+            running--;
         }
     }
 
-    if ( rv ) {
-
-        rv = make_web_call(handler);
-
-        if ( rv ) {
-            get_parameter_set_id_from_reply(handler);
-            wqc_reset(handler);
-            handler->wqc_endpoint = endpoint;
-            handler->job_type = job_type;
+    // Jobs whose calls were not started, or are abandoned, fail
+    for ( int i = 0 ; i < jobs_count ; ++i ) {
+        if ( ! multi ) {
+            wqc_set_error(handlers[i], WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+        } else if ( handlers[i]->call.step != WQC_STEP_NONE ) {
+            wqc_set_error_with_message(handlers[i], WEBQC_WEB_CALL_ERROR, "Cannot wait for web calls"); // LCOV_EXCL_LINE
         }
     }
-
-    cleanup_web_call(handler);
-
-    return rv;
+    wqc_multi_cleanup(multi);
 }
 
-
-bool wqc_submit_job(WQC *handler, enum wqc_job_type job_type, void *job_parameters)
+//! Run an operation on the jobs of many handlers, in batched calls made on the first handler, or one by one if the
+//! server has no batched calls
+static bool run_batched(WQC *handlers[], enum wqc_job_type job_type, void *job_parameters[], int jobs_count,
+                        enum wqc_call_step batch_step, start_job_operation start)
 {
-    bool rv = false;
-
-    rv = create_new_job(handler);
+    bool rv = true;
+    WQC *lead = jobs_count > 0 ? handlers[0] : NULL;
+    int first = 0;
 
-    if ( rv ) {
-        rv = wqc_create_parameter_set(handler, job_type, job_parameters);
+    for ( int i = 0 ; i < jobs_count ; ++i ) {
+        if ( ! wqc_handler_idle(handlers[i]) ) {
+            rv = false;
+        }
     }
-
-    if ( rv ) {
-        rv = start_wqc_job(handler);
+    for ( int i = 0 ; rv && i < jobs_count ; ++i ) {
+        handlers[i]->return_value = init_webqc_return_value();
     }
 
-    return rv ;
-}
-
-bool
-wqc_get_integrals_details(WQC *handler)
-{
-    bool rv = false;
-
-    rv = prepare_web_call(handler, "int_info");
-
-    if ( rv ) {
-        rv = prepare_get_parameter(handler, "set_id", handler->parameter_set_id);
+    while ( rv && first < jobs_count && ! lead->batch_unsupported ) {
+        int count = jobs_count - first < WQC_MAX_BATCH_JOBS ? jobs_count - first : WQC_MAX_BATCH_JOBS;
+        struct wqc_return_value lead_return_value = lead->return_value;
+
+        lead->call.job_type = job_type;
+        lead->call.batch_handlers = handlers + first;
+        lead->call.batch_parameters = job_parameters ? job_parameters + first : NULL;
+        lead->call.batch_count = count;
+        if ( ! wqc_run_call(lead, batch_step) ) {
+            // The whole call failed, and so did all its jobs - but not the lead's own job, if it was in another call
+            for ( int i = first ; i < first + count ; ++i ) {
+                handlers[i]->return_value = lead->return_value;
+            }
+            if ( first > 0 ) {
+                lead->return_value = lead_return_value;
+            }
+        }
+        if ( ! lead->batch_unsupported ) {
+            first += count;
+        }
     }
-    if ( rv ) {
-        rv = make_web_call(handler);
+    if ( lead ) {
+        lead->call.batch_handlers = NULL;
+        lead->call.batch_parameters = NULL;
+        lead->call.batch_count = 0;
     }
 
-    if (rv) {
-        rv = update_eri_details(handler);
-        wqc_reset(handler);
+    if ( rv && first < jobs_count ) {
+        run_one_by_one(handlers + first, job_type, job_parameters ? job_parameters + first : NULL, jobs_count - first,
+                       start);
     }
 
+    for ( int i = 0 ; rv && i < jobs_count ; ++i ) {
+        rv = handlers[i]->return_value.error_code == WEBQC_SUCCESS;
+    }
     return rv;
 }
 
-static bool
-get_eri_job_status(WQC *handler)
+bool wqc_submit_jobs(WQC *handlers[], enum wqc_job_type job_type, void *job_parameters[], int jobs_count)
 {
-    bool rv = false;
-
-    rv = prepare_web_call(handler, handler->wqc_endpoint);
-
-    if ( rv ) {
-        rv = prepare_get_parameter(handler, "job_id", handler->job_id);
-    }
-    if ( rv ) {
-        rv = make_web_call(handler);
-    }
+    bool rv = true;
 
-    if (rv) {
-        rv = update_eri_job_status(handler);
-        wqc_reset(handler);
+    if ( jobs_count > 0 ) {
+        wqc_trace_time_t start = wqc_trace_begin(handlers[0]);
+        rv = run_batched(handlers, job_type, job_parameters, jobs_count, WQC_STEP_SUBMIT_BATCH, start_submit_job);
+        wqc_trace_end(handlers[0], "submit_jobs", start);
     }
 
     return rv;
 }
 
-
-bool wqc_get_status(WQC *handler)
+bool wqc_get_statuses(WQC *handlers[], int jobs_count)
 {
-    bool rv = false;
-    if (handler->job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
-        rv = get_eri_job_status(handler);
-    } else {
-        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
-        rv = false;
+    bool rv = true;
+
+    if ( jobs_count > 0 ) {
+        wqc_trace_time_t start = wqc_trace_begin(handlers[0]);
+        rv = run_batched(handlers, WQC_NULL_JOB, NULL, jobs_count, WQC_STEP_GET_BATCH_STATUS, start_get_status);
+        wqc_trace_end(handlers[0], "get_statuses", start);
     }
+
     return rv;
 }
 
@@ -293,12 +338,8 @@ static bool integrals_job_done(WQC *handler)
     if ( handler->ERI_items_count == 0 ) {
         return false; // We don't know what the status is
     }
-    bool rv = true;
-    for ( int i = 0 ; rv && i < handler->ERI_items_count ; i++ ) {
-        enum job_status_t subjob_status = handler->eri_status[i].status;
-        rv =  ( subjob_status == WQC_JOB_STATUS_DONE || subjob_status == WQC_JOB_STATUS_ERROR ) ;
-    }
-    return rv;
+    return handler->ERI_items_by_status[WQC_JOB_STATUS_DONE] + handler->ERI_items_by_status[WQC_JOB_STATUS_ERROR] ==
+        handler->ERI_items_count;
 }
 
 
@@ -311,33 +352,163 @@ bool wqc_job_done( WQC *handler)
         handler->job_status == WQC_JOB_STATUS_ERROR ;
 }
 
-static const useconds_t initial_sleep = 8000;
-static const useconds_t max_sleep = 1000*1000000;
+static const int64_t max_status_wait = 25000; /// Longest time to ask the server to hold a status call, in milliseconds
 
 
-bool wqc_wait_for_job( WQC *handler, int64_t milliseconds_to_wait)
+//! Count the sub-jobs of an ERI job that are finished, and those being processed
+static void count_ERI_items(const WQC *handler, int *finished, int *processing)
 {
-    bool rv = false;
-    useconds_t microseconds_to_wait = milliseconds_to_wait * 1000;
+    *finished = handler->ERI_items_by_status[WQC_JOB_STATUS_DONE] + handler->ERI_items_by_status[WQC_JOB_STATUS_ERROR];
+    *processing = handler->ERI_items_by_status[WQC_JOB_STATUS_PROCESSING];
+}
 
-    useconds_t microseconds_to_sleep = max_sleep;
-    while ( rv == false && microseconds_to_wait > 0 ) {
+//! Find how long to wait before polling a job again. Each poll bounds the time a sub-job takes: if the job made
+//! progress p in t milliseconds, a sub-job takes more than t/(p+1) and at most t/p milliseconds. Once sub-jobs are
+//! seen to progress, the next poll is made half way into the range of times the job (or its next sub-job) is predicted
+//! to be done at, and the range narrows with every poll. Until then, back off exponentially.
+static int64_t next_poll_interval(const WQC *handler, struct job_progress *progress, int64_t now)
+{
+    int finished = 0, processing = 0;
+    count_ERI_items(handler, &finished, &processing);
+    // Sub-jobs being processed count as half done, so progress is seen before the first one finishes
+    double current_progress = finished + processing / 2.0;
+    int64_t min_interval = handler->min_poll_interval;
+    int64_t max_interval = handler->max_poll_interval > min_interval ? handler->max_poll_interval : min_interval;
+    int64_t interval = 0;
+
+    if ( progress->polls_count++ == 0 ) {
+        progress->first_poll_time = now;
+        progress->first_progress = current_progress;
+        progress->first_finished = finished;
+    }
 
-        microseconds_to_sleep *= 2;
-        if ( microseconds_to_sleep > max_sleep ) {
-            microseconds_to_sleep = initial_sleep;
-        }
-        usleep(microseconds_to_sleep);
-        microseconds_to_wait -= microseconds_to_sleep;
+    double elapsed = (double) (now - progress->first_poll_time);
+    double gained = current_progress - progress->first_progress;
+    if ( elapsed / (gained + 1) > progress->min_item_time ) {
+        progress->min_item_time = elapsed / (gained + 1);
+    }
+    if ( gained > 0 && (progress->max_item_time == 0 || elapsed / gained < progress->max_item_time) ) {
+        progress->max_item_time = elapsed / gained;
+    }
+
+    if ( progress->max_item_time > 0 ) {
+        // If the job does not progress evenly the bounds cross, and only the upper one is used
+        double min_item_time = progress->min_item_time < progress->max_item_time ? progress->min_item_time
+                                                                                 : progress->max_item_time;
+        double item_time = (min_item_time + progress->max_item_time) / 2;
+        double items_left = (progress->next_item_only ? finished + 1 : handler->ERI_items_count) -
+            progress->first_finished;
+        interval = progress->first_poll_time + (int64_t) (item_time * items_left) - now;
+    } else {
+        interval = progress->poll_interval ? progress->poll_interval * 2 : min_interval;
+    }
 
+    interval = interval < min_interval ? min_interval : interval;
+    interval = interval > max_interval ? max_interval : interval;
+    progress->poll_interval = interval;
+
+    return interval;
+}
+
+//! Poll the status of a job until a condition on it is met or the time is up. Status calls are held by the server, or
+//! spaced as next_poll_interval() finds, see wqc_wait_for_job().
+static bool wait_for_status(WQC *handler, int64_t milliseconds_to_wait, bool (*condition)(WQC *handler),
+                            struct job_progress *progress)
+{
+    bool rv = false;
+    // Status calls carry how long they are held in the call state, which a running operation owns
+    bool idle = wqc_handler_idle(handler);
+    int64_t now = wqc_monotonic_milliseconds();
+    int64_t deadline = now + milliseconds_to_wait;
+    // The handler's deadline ends the wait, and then it is an error
+    bool cut = handler->deadline && handler->deadline < deadline;
+    deadline = cut ? handler->deadline : deadline;
+    int64_t time_left = deadline - now;
+
+    while ( idle && rv == false && time_left > 0 ) {
+
+        bool long_poll = handler->long_poll && ! handler->long_poll_unsupported;
+        handler->call.status_wait = long_poll ? (time_left < max_status_wait ? time_left : max_status_wait) : 0;
         rv = wqc_get_status(handler);
+        bool held = rv && long_poll && ! handler->long_poll_unsupported;
+        handler->call.status_wait = 0;
+
         if ( rv ) {
-            rv = wqc_job_done(handler);
+            rv = condition(handler);
+        }
+        now = wqc_monotonic_milliseconds();
+        time_left = deadline - now;
+
+        // A held call already waited for the job to progress, otherwise wait before polling again
+        if ( ! rv && ! held && time_left > 0 ) {
+            int64_t poll_interval = next_poll_interval(handler, progress, now);
+            usleep((poll_interval < time_left ? poll_interval : time_left) * 1000);
+            time_left = deadline - wqc_monotonic_milliseconds();
         }
     }
+    if ( idle && ! rv && cut && time_left <= 0 ) {
+        wqc_set_error_with_message(handler, WEBQC_TIMEOUT, "The handler's deadline passed while waiting for the job");
+    }
     return rv;
 }
 
+bool wqc_wait_for_job( WQC *handler, int64_t milliseconds_to_wait)
+{
+    struct job_progress progress = {0};
+    wqc_trace_time_t start = wqc_trace_begin(handler);
+
+    bool rv = wait_for_status(handler, milliseconds_to_wait, wqc_job_done, &progress);
+
+    wqc_trace_end(handler, "wait_for_job", start);
+    return rv;
+}
+
+static bool has_done_items_to_hand_out(WQC *handler)
+{
+    return handler->ERI_done_queue_begin < handler->ERI_done_queue_end;
+}
+
+//! Stop waiting for sub-jobs once some are done, or none will ever be
+static bool done_items_or_job_done(WQC *handler)
+{
+    return has_done_items_to_hand_out(handler) || wqc_job_done(handler);
+}
+
+bool wqc_wait_for_any_items(WQC *handler, int64_t milliseconds_to_wait)
+{
+    bool rv = has_done_items_to_hand_out(handler);
+
+    if ( ! rv && handler->job_type != WQC_JOB_TWO_ELECTRONS_INTEGRALS ) {
+        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+    } else if ( ! rv ) {
+        // Sub-jobs take about the same time, so what was learned about them while waiting for earlier ones is kept
+        handler->items_progress.next_item_only = true;
+        wqc_trace_time_t start = wqc_trace_begin(handler);
+
+        rv = wait_for_status(handler, milliseconds_to_wait, done_items_or_job_done, &handler->items_progress) &&
+            has_done_items_to_hand_out(handler);
+
+        wqc_trace_end(handler, "wait_for_any_items", start);
+    }
+    return rv;
+}
+
+const struct ERI_item_status *wqc_next_done_ERI_item(WQC *handler)
+{
+    struct ERI_item_status *item = NULL;
+
+    while ( ! item && has_done_items_to_hand_out(handler) ) {
+        item = &handler->eri_status[handler->ERI_done_queue[handler->ERI_done_queue_begin++]];
+        if ( item->handed_out || item->status != WQC_JOB_STATUS_DONE ) {
+            item = NULL;
+        }
+    }
+    if ( item ) {
+        item->handed_out = true;
+    }
+    return item;
+}
+
 
 const char *
 wqc_get_parameter_set_id(WQC *handler)
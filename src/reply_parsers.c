@@ -1,4 +1,5 @@
 #include <string.h>
+#include <time.h>
 #include <cjson/cJSON.h>
 
 #ifdef __APPLE__
@@ -12,6 +13,7 @@
 
 #include "webqc-handler.h"
 #include "webqc-json.h"
+#include "webqc-metrics.h"
 
 bool get_string_from_JSON(const cJSON *json, const char *field_name, char *dest, unsigned int max_size)
 {
@@ -80,11 +82,76 @@ bool get_bool_from_JSON(const cJSON *json, const char *field_name, bool *dest)
 
 
 
-bool parse_JSON_reply(WQC *handler, cJSON **reply_json)
+//! Get the value of a base64 digit, or -1 if the character is not one
+static int base64_digit_value(char digit)
+{
+    if ( digit >= 'A' && digit <= 'Z' ) {
+        return digit - 'A';
+    }
+    if ( digit >= 'a' && digit <= 'z' ) {
+        return digit - 'a' + 26;
+    }
+    if ( digit >= '0' && digit <= '9' ) {
+        return digit - '0' + 52;
+    }
+    return digit == '+' ? 62 : digit == '/' ? 63 : -1;
+}
+
+bool get_base64_from_JSON(WQC *handler, const cJSON *json, const char *field_name, char **data, size_t *size)
 {
+    const char *text = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(json, field_name));
+    size_t length = text ? strlen(text) : 0;
+    unsigned int bits = 0;
+    int bits_count = 0;
     bool rv = true;
 
-    *reply_json = cJSON_Parse(handler->web_call_info.web_reply.reply);
+    *data = NULL;
+    *size = 0;
+    if ( ! text ) {
+        return true;
+    }
+
+    while ( length > 0 && text[length - 1] == '=' ) {
+        length--;
+    }
+    *data = malloc(length * 3 / 4 + 1);
+    if ( ! *data ) {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+        return false; // LCOV_EXCL_LINE
+    }
+
+    for ( size_t i = 0 ; rv && i < length ; ++i ) {
+        int value = base64_digit_value(text[i]);
+        rv = value >= 0;
+        bits = (bits << 6) | (unsigned int) value;
+        bits_count += 6;
+        if ( rv && bits_count >= 8 ) {
+            bits_count -= 8;
+            (*data)[(*size)++] = (char) (bits >> bits_count);
+            bits &= (1u << bits_count) - 1;
+        }
+    }
+
+    // A single digit left over cannot end a base64 text
+    if ( ! rv || length % 4 == 1 ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Bad base64 data in reply");
+        free(*data);
+        *data = NULL;
+        *size = 0;
+        rv = false;
+    }
+    return rv;
+}
+
+bool parse_JSON_text(WQC *handler, const char *text, cJSON **reply_json)
+{
+    bool rv = true;
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    *reply_json = cJSON_Parse(text);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    wqc_metrics_observe_JSON_parse((end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9);
 
     if (*reply_json == NULL) {
 
@@ -103,13 +170,18 @@ bool parse_JSON_reply(WQC *handler, cJSON **reply_json)
         if (error_ptr != NULL)
         {
             extra_messages[1] = error_ptr;
-            snprintf(position_str, sizeof position_str, "%lu", error_ptr - handler->web_call_info.web_reply.reply);
+            snprintf(position_str, sizeof position_str, "%lu", error_ptr - text);
         }
         wqc_set_error_with_messages(handler, WEBQC_WEB_CALL_ERROR, extra_messages);
     }
     return rv;
 }
 
+bool parse_JSON_reply(WQC *handler, cJSON **reply_json)
+{
+    return parse_JSON_text(handler, handler->web_call_info.web_reply.reply, reply_json);
+}
+
 static bool get_string_field_from_reply(WQC *handler, const char *label, char *target, int target_len)
 {
     bool rv = false;
@@ -136,17 +208,14 @@ bool get_parameter_set_id_from_reply(WQC *handler)
     return get_string_field_from_reply(handler, "set_id", handler->parameter_set_id, WQC_PARAM_SET_ID_LENGTH);
 }
 
-bool update_eri_job_details(WQC *handler)
+//! Update the handler's job ID from the status of the job that runs the calculation, which is another job when the
+//! submitted one is a duplicate
+static bool update_eri_job_details_from_JSON(WQC *handler, const cJSON *reply_json)
 {
     bool rv = false;
-    cJSON *reply_json = NULL;
     cJSON *job_status = NULL;
 
-    rv = parse_JSON_reply(handler, &reply_json);
-
-    if ( rv ) {
-        rv = get_object_from_reply(reply_json, "job_status", &job_status);
-    }
+    rv = get_object_from_reply(reply_json, "job_status", &job_status);
 
     char eri_job_id[WQC_JOB_ID_LENGTH];
 
@@ -165,13 +234,63 @@ bool update_eri_job_details(WQC *handler)
         memcpy(handler->job_id, eri_job_id, WQC_JOB_ID_LENGTH);
     }
 
-    if ( reply_json ) {
+    return rv;
+}
+
+bool update_eri_job_details(WQC *handler)
+{
+    bool rv = false;
+    cJSON *reply_json = NULL;
+
+    rv = parse_JSON_reply(handler, &reply_json);
+
+    if ( rv ) {
+        rv = update_eri_job_details_from_JSON(handler, reply_json);
         cJSON_Delete(reply_json);
     }
     return rv;
 
 }
 
+bool get_batch_replies(WQC *handler, const cJSON *reply_json, int jobs_count, cJSON **replies)
+{
+    bool rv = get_array_from_JSON(reply_json, "jobs", replies) && *replies;
+
+    if ( ! rv ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Cannot find array 'jobs' in reply");
+    } else if ( cJSON_GetArraySize(*replies) != jobs_count ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Wrong number of jobs in batch reply");
+        rv = false;
+    }
+    return rv;
+}
+
+//! Set the error the server replied with for one job of a batch on the job's handler, if there is one
+static bool check_batch_job_error(WQC *handler, const cJSON *job_reply)
+{
+    const char *error = cJSON_GetStringValue(cJSON_GetObjectItemCaseSensitive(job_reply, "error"));
+
+    if ( error ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, error);
+    }
+    return error == NULL;
+}
+
+bool update_batch_job_details(WQC *handler, const cJSON *job_reply)
+{
+    bool rv = check_batch_job_error(handler, job_reply);
+
+    if ( rv && ( ! get_string_from_JSON(job_reply, "job_id", handler->job_id, WQC_JOB_ID_LENGTH) ||
+                 ! get_string_from_JSON(job_reply, "set_id", handler->parameter_set_id, WQC_PARAM_SET_ID_LENGTH) ) ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Cannot find job or parameter set ID in batch reply");
+        rv = false;
+    }
+    if ( rv ) {
+        rv = update_eri_job_details_from_JSON(handler, job_reply);
+    }
+    return rv;
+}
+
 
 bool update_job_details(WQC *handler)
 {
@@ -295,37 +414,91 @@ parse_eri_status_item(WQC *handler, cJSON *iterator, struct ERI_item_status *sta
         rv = parse_eri_integral_range(handler, iterator, "end", status->range_end);
     }
 
+    if ( rv && status->status == WQC_JOB_STATUS_DONE ) {
+        // A server asked for it sends the values of a small sub-job with its status, and they need not be fetched
+        rv = get_base64_from_JSON(handler, iterator, "values", (char **) &status->values, &status->values_size);
+        if ( rv && status->values ) {
+            get_number_from_JSON(iterator, "precision", &status->precision);
+            wqc_metrics_count(WQC_COUNTER_ERI_BYTES_DOWNLOADED, status->values_size);
+        }
+    }
 
     return rv;
 }
 
+//! Free the blob names and values of ERI sub-jobs status
 static void
-add_eri_status_item(WQC *handler, struct ERI_item_status *status)
+free_eri_status_items(struct ERI_item_status *items, int items_count)
 {
-    handler->eri_status = realloc(handler->eri_status, (handler->ERI_items_count+1) * sizeof (struct ERI_item_status));
-    memcpy(&handler->eri_status[handler->ERI_items_count], status, sizeof (struct ERI_item_status));
-    handler->ERI_items_count++;
-    status->output_blob_name=NULL;
+    for ( int i = 0 ; i < items_count; ++i) {
+        free(items[i].output_blob_name);
+        free(items[i].values);
+    }
+    free(items);
 }
 
+//! Move the values of a done sub-job from its known status to its new one, if the new status came without them
+static void
+keep_eri_item_values(struct ERI_item_status *item, struct ERI_item_status *known_item)
+{
+    if ( known_item && known_item->values && ! item->values && item->status == WQC_JOB_STATUS_DONE ) {
+        item->values = known_item->values;
+        item->values_size = known_item->values_size;
+        item->precision = known_item->precision;
+        known_item->values = NULL;
+    }
+}
+
+static void
+count_eri_status_change(WQC *handler, enum job_status_t from, enum job_status_t to)
+{
+    handler->ERI_items_by_status[from]--;
+    handler->ERI_items_by_status[to]++;
+}
+
+//! Queue a sub-job that got done, to be handed out by wqc_next_done_ERI_item(). Every sub-job is queued once,
+//! so the queue never holds more than all of them.
+static void
+queue_done_eri_item(WQC *handler, int index)
+{
+    if ( handler->ERI_done_queue && handler->ERI_done_queue_end < handler->ERI_items_count ) {
+        handler->ERI_done_queue[handler->ERI_done_queue_end++] = index;
+    }
+}
+
+//! Find the status of a sub-job by its id. Sub-jobs are usually numbered by their position, so look there first.
+static struct ERI_item_status *
+find_eri_status_item(WQC *handler, int id)
+{
+    if ( id >= 0 && id < handler->ERI_items_count && handler->eri_status[id].id == id ) {
+        return &handler->eri_status[id];
+    }
+    for ( int i = 0 ; i < handler->ERI_items_count ; ++i ) {
+        if ( handler->eri_status[i].id == id ) {
+            return &handler->eri_status[i];
+        }
+    }
+    return NULL;
+}
+
+//! Replace the status of all sub-jobs with a full list of them
 static bool
 parse_eri_status_array(WQC *handler, cJSON *eri_items)
 {
-    bool rv = false;
+    bool rv = true;
     cJSON *iterator = NULL;
+    int items_count = 0;
+    struct ERI_item_status *items = calloc(cJSON_GetArraySize(eri_items) + 1, sizeof(struct ERI_item_status));
 
-    free(handler->eri_status);
-    handler->eri_status = NULL;
-    handler->ERI_items_count=0;
+    if ( ! items ) {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+        return false; // LCOV_EXCL_LINE
+    }
 
     cJSON_ArrayForEach(iterator, eri_items) {
         if (cJSON_IsObject(iterator)) {
-            struct ERI_item_status status;
-            bzero(&status, sizeof status);
-            rv = parse_eri_status_item(handler, iterator, &status);
-            if ( rv ) {
-                add_eri_status_item(handler, &status);
-            }
+            rv = parse_eri_status_item(handler, iterator, &items[items_count]);
+            items_count++;
         } else {
             wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Array 'items' in ERI reply must contain objects");
             rv = false;
@@ -335,26 +508,138 @@ parse_eri_status_array(WQC *handler, cJSON *eri_items)
         }
     }
 
+    int *done_queue = rv && items_count > 0 ? malloc(items_count * sizeof(int)) : NULL;
+    if ( rv && items_count > 0 && ! done_queue ) {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+        rv = false; // LCOV_EXCL_LINE
+    }
+
+    if ( rv && items_count > 0 ) {
+        // Sub-jobs of the same job that were already handed out are not handed out again
+        for ( int i = 0 ; i < items_count ; ++i ) {
+            struct ERI_item_status *known_item = find_eri_status_item(handler, items[i].id);
+            items[i].handed_out = known_item && known_item->handed_out;
+            keep_eri_item_values(&items[i], known_item);
+        }
+        free_eri_status_items(handler->eri_status, handler->ERI_items_count);
+        free(handler->ERI_done_queue);
+        handler->eri_status = items;
+        handler->ERI_items_count = items_count;
+        handler->ERI_done_queue = done_queue;
+        handler->ERI_done_queue_begin = 0;
+        handler->ERI_done_queue_end = 0;
+        memset(handler->ERI_items_by_status, 0, sizeof(handler->ERI_items_by_status));
+        for ( int i = 0 ; i < items_count ; ++i ) {
+            handler->ERI_items_by_status[items[i].status]++;
+            if ( items[i].status == WQC_JOB_STATUS_DONE && ! items[i].handed_out ) {
+                queue_done_eri_item(handler, i);
+            }
+        }
+    } else {
+        if ( rv ) {
+            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Array 'items' in ERI reply is empty");
+            rv = false;
+        }
+        free_eri_status_items(items, items_count);
+    }
+
+    return rv;
+}
+
+//! Merge the sub-jobs that changed since the status cursor into the status the handler has, in place
+static bool
+merge_eri_status_diff(WQC *handler, cJSON *eri_items)
+{
+    bool rv = true;
+    cJSON *iterator = NULL;
+
+    cJSON_ArrayForEach(iterator, eri_items) {
+        struct ERI_item_status status;
+        struct ERI_item_status *item = NULL;
+        bzero(&status, sizeof status);
+
+        if (cJSON_IsObject(iterator)) {
+            rv = parse_eri_status_item(handler, iterator, &status);
+        } else {
+            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Array 'items' in ERI reply must contain objects");
+            rv = false;
+        }
+        if ( rv ) {
+            item = find_eri_status_item(handler, status.id);
+            if ( ! item ) {
+                wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Unknown sub-job in ERI status changes");
+                rv = false;
+            }
+        }
+        if ( rv ) {
+            bool got_done = status.status == WQC_JOB_STATUS_DONE && item->status != WQC_JOB_STATUS_DONE;
+            count_eri_status_change(handler, item->status, status.status);
+            free(item->output_blob_name);
+            keep_eri_item_values(&status, item);
+            free(item->values);
+            status.handed_out = item->handed_out;
+            *item = status;
+            if ( got_done && ! item->handed_out ) {
+                queue_done_eri_item(handler, (int) (item - handler->eri_status));
+            }
+        } else {
+            free(status.output_blob_name);
+            free(status.values);
+            break;
+        }
+    }
+
     return rv;
 }
 
 
+//! Update the handler's job status from a status reply, as a whole or from the sub-jobs that changed
+static bool update_eri_job_status_from_JSON(WQC *handler, const cJSON *reply_json)
+{
+    bool rv = false;
+    cJSON *eri_items = NULL;
+
+    rv = get_array_from_JSON(reply_json, "items", &eri_items);
+    if (rv && eri_items) {
+        // A server that keeps a cursor of the job status may send only the sub-jobs that changed since the one
+        // the call was made with
+        bool partial = false;
+        get_bool_from_JSON(reply_json, "partial", &partial);
+        if ( partial && handler->status_cursor[0] && handler->ERI_items_count > 0 ) {
+            rv = merge_eri_status_diff(handler, eri_items);
+        } else if ( partial ) {
+            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "ERI status changes without a full status");
+            rv = false;
+        } else {
+            rv = parse_eri_status_array(handler, eri_items);
+        }
+    } else {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Cannot find array 'items' in reply");
+    }
+
+    // Without a cursor (or one too long to keep), or after a failure, the next call asks for the full status
+    memset(handler->status_cursor, 0, sizeof(handler->status_cursor));
+    if ( ! rv || ! get_string_from_JSON(reply_json, "cursor", handler->status_cursor, sizeof(handler->status_cursor)) ||
+         handler->status_cursor[sizeof(handler->status_cursor) - 1] ) {
+        handler->status_cursor[0] = '\0';
+    }
+
+    return rv;
+}
+
 bool
 update_eri_job_status(WQC *handler)
 {
     bool rv = false;
     cJSON *reply_json = NULL;
-    cJSON *eri_items = NULL;
 
-    rv = parse_JSON_reply(handler, &reply_json);
+    rv = parse_JSON_reply(handler, &reply_json) && update_eri_job_status_from_JSON(handler, reply_json);
 
-    if ( rv ) {
-        rv = get_array_from_JSON(reply_json, "items", &eri_items);
-        if (rv && eri_items) {
-            rv = parse_eri_status_array(handler, eri_items);
-        } else {
-            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "Cannot find array 'items' in reply");
-        }
+    if ( rv && handler->call.status_wait > 0 ) {
+        // A server that can hold status calls says so in every reply to one
+        bool long_poll = false;
+        get_bool_from_JSON(reply_json, "long_poll", &long_poll);
+        handler->long_poll_unsupported = ! long_poll;
     }
 
     if ( reply_json ) {
@@ -364,3 +649,7 @@ update_eri_job_status(WQC *handler)
     return rv;
 }
 
+bool update_batch_job_status(WQC *handler, const cJSON *job_reply)
+{
+    return check_batch_job_error(handler, job_reply) && update_eri_job_status_from_JSON(handler, job_reply);
+}
@@ -1,7 +1,11 @@
 #include <curl/curl.h>
 #include <string.h>
+#include <strings.h>
 #include <assert.h>
+#include <pthread.h>
 #include <cjson/cJSON.h>
+#include <unistd.h>
+#include <zlib.h>
 
 #ifdef __APPLE__
 #include <malloc/malloc.h>
@@ -15,6 +19,13 @@
 #include "libwebqc.h"
 #include "webqc-handler.h"
 #include "webqc-web-access.h"
+#include "webqc-metrics.h"
+#include "webqc-retry.h"
+#include "webqc-hedge.h"
+#include "webqc-calls.h"
+
+static CURLSH *curl_share = NULL; /// Process-wide DNS and TLS session caches, shared by all handlers
+static pthread_mutex_t curl_share_locks[CURL_LOCK_DATA_LAST]; /// One lock per type of shared data
 
 
 void reset_reply_buffer(struct web_reply_buffer *buf)
@@ -57,10 +68,109 @@ size_t wqc_collect_downloaded_data(void *data, size_t total_size, struct web_rep
     return total_size;
 }
 
+size_t wqc_write_to_download_buffer(void *data, size_t size, size_t nmemb, void *userp)
+{
+    size_t total_size = size * nmemb;
+    struct download_buffer *buf = (struct download_buffer *) userp;
+    const char *bytes = data;
+    size_t length = total_size;
+
+    if (buf->discard) {
+        return total_size;
+    }
+
+    if (buf->whole_resource) {
+        // Keep only the range that was asked for out of the whole resource
+        size_t dropped = length < buf->skip ? length : buf->skip;
+        buf->skip -= dropped;
+        bytes += dropped;
+        length -= dropped;
+        if (length > buf->size - buf->received) {
+            length = buf->size - buf->received;
+        }
+    }
+
+    if (buf->received + length > buf->size) {
+        return 0; // More data than expected, abort the download
+    }
+
+    memcpy(&buf->data[buf->received], bytes, length);
+    buf->received += length;
+
+    return total_size;
+}
+
+//! A CURL header callback for downloads into a buffer, that finds from the status line whether the reply is an error
+//! whose body is not data, and whether the server sent the range asked for (206), or the whole resource (200) that
+//! the range must be cut out of
+static size_t check_download_reply(char *header, size_t size, size_t nitems, void *userp)
+{
+    size_t total_size = size * nitems;
+    struct download_buffer *buf = (struct download_buffer *) userp;
+    int status = 0;
+
+    // Every reply of a redirect starts with a status line, and only the last one's counts
+    if (total_size > 5 && strncmp(header, "HTTP/", 5) == 0 &&
+        sscanf(header, "HTTP/%*s %d", &status) == 1) {
+        buf->discard = (status < 200 || status >= 300);
+        buf->whole_resource = (status == 200 && (buf->ranged || buf->received > 0));
+        buf->skip = buf->whole_resource ? buf->range_start + buf->received : 0;
+    }
+
+    return total_size;
+}
+
+void wqc_set_download_buffer(CURL *curl, struct download_buffer *buffer)
+{
+    buffer->skip = 0;
+    buffer->whole_resource = false;
+    buffer->discard = false;
+    curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, wqc_write_to_download_buffer);
+    curl_easy_setopt(curl, CURLOPT_WRITEDATA, buffer);
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, check_download_reply);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, buffer);
+
+    if (buffer->ranged || buffer->received > 0) {
+        char range[48];
+        snprintf(range, sizeof(range), "%zu-%zu", buffer->range_start + buffer->received,
+                 buffer->range_start + buffer->size - 1);
+        curl_easy_setopt(curl, CURLOPT_RANGE, range);
+        // A range of a compressed reply is a range of the compressed bytes, so the range is asked for uncompressed
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, NULL);
+    }
+}
+
+bool wqc_transient_failure(CURLcode result, long http_reply_code)
+{
+    bool transient = false;
+
+    switch (result) {
+        case CURLE_OK:
+        case CURLE_HTTP_RETURNED_ERROR:
+            transient = (http_reply_code >= 500 && http_reply_code <= 504 && http_reply_code != 501) ||
+                        http_reply_code == 408 || http_reply_code == 429;
+            break;
+        case CURLE_COULDNT_CONNECT:
+        case CURLE_PARTIAL_FILE:
+        case CURLE_SEND_ERROR:
+        case CURLE_RECV_ERROR:
+        case CURLE_GOT_NOTHING:
+        case CURLE_OPERATION_TIMEDOUT:
+        case CURLE_HTTP2:
+        case CURLE_HTTP2_STREAM:
+            transient = true;
+            break;
+        default:
+            break;
+    }
+
+    return transient;
+}
+
 #define AUTH_HEADER "Authorization: Bearer "
 
-static bool
-prepare_curl_security(WQC *handler)
+bool
+add_web_call_headers(WQC *handler, struct curl_slist **headers)
 {
     bool rv = false;
     char *auth_header = (char *) malloc(strlen(AUTH_HEADER) + strlen(handler->access_token) + 1);
@@ -68,13 +178,11 @@ prepare_curl_security(WQC *handler)
     if (auth_header) {
         strncpy(auth_header, AUTH_HEADER, strlen(AUTH_HEADER) + 1);
         strncat(auth_header, handler->access_token, strlen(handler->access_token));
-        handler->web_call_info.http_headers = curl_slist_append(handler->web_call_info.http_headers, auth_header);
+        *headers = curl_slist_append(*headers, auth_header);
+        *headers = curl_slist_append(*headers, "Content-Type: application/json");
+        // Without this, cURL asks before sending a large body, and waits a second if the server does not answer
+        *headers = curl_slist_append(*headers, "Expect:");
         free(auth_header);
-
-        if (handler->insecure_ssl) {
-            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_SSL_VERIFYPEER, 0L);
-            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_SSL_VERIFYHOST, 0L);
-        }
         rv = true;
     } else {
         wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
@@ -89,21 +197,22 @@ prepare_curl_reply_buffers(WQC *handler)
     curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_WRITEFUNCTION, collect_curl_downloaded_data);
     curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_WRITEDATA, handler);
     curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_ERRORBUFFER, handler->web_call_info.web_error_bufffer);
+    curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_HEADERFUNCTION, NULL);
+    curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_HEADERDATA, NULL);
 }
 
 
 
-static bool
-prepare_curl_URL(WQC *handler, const char *web_endpoint)
+bool
+format_web_call_URL(WQC *handler, const char *web_endpoint, char *URL)
 {
     bool rv = false;
-    const char *scheme = "https";
+    const char *scheme = handler->plain_http ? "http" : "https";
 
     assert(web_endpoint);
 
-    if (snprintf(handler->web_call_info.full_URL, MAX_URL_SIZE, "%s://%s:%u/%s", scheme, handler->webqc_server_name, handler->webqc_server_port,
+    if (snprintf(URL, MAX_URL_SIZE, "%s://%s:%u/%s", scheme, handler->webqc_server_name, handler->webqc_server_port,
                  web_endpoint) < MAX_URL_SIZE) {
-        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_URL, handler->web_call_info.full_URL);
         rv = true;
     } else {
         wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
@@ -112,28 +221,108 @@ prepare_curl_URL(WQC *handler, const char *web_endpoint)
     return rv;
 }
 
+static bool
+prepare_curl_URL(WQC *handler, const char *web_endpoint)
+{
+    bool rv = format_web_call_URL(handler, web_endpoint, handler->web_call_info.full_URL);
+
+    if (rv) {
+        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_URL, handler->web_call_info.full_URL);
+    }
+
+    return rv;
+}
+
+void
+setup_curl_handle(WQC *handler, CURL *curl)
+{
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, "curl/7.68.0");
+    curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT_MS, (long) handler->connect_timeout);
+    if (handler->compression) {
+        // Offer every encoding libcURL was built with; replies are decoded as they arrive, before they are written
+        curl_easy_setopt(curl, CURLOPT_ACCEPT_ENCODING, "");
+    }
+    if (curl_share) {
+        curl_easy_setopt(curl, CURLOPT_SHARE, curl_share);
+    }
+    if (handler->insecure_ssl) {
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+    }
+}
+
+
+//! Get the handler's persistent CURL handle, ready for a new call. The handle is created once per handler; resetting
+//! it clears the options of the previous call but keeps its open connections. The handle is attached to the
+//! process-wide DNS and TLS session caches.
+//! \param handler handler to get the CURL handle of
+//! \return the CURL handle, or NULL (and error set on the handler) if it cannot be created
+static CURL *
+reset_curl_handle(WQC *handler)
+{
+    if (handler->web_call_info.curl_handler == NULL) {
+        handler->web_call_info.curl_handler = curl_easy_init();
+    }
+
+    if (handler->web_call_info.curl_handler) {
+        curl_easy_reset(handler->web_call_info.curl_handler);
+        setup_curl_handle(handler, handler->web_call_info.curl_handler);
+    } else {
+        wqc_set_error_with_message(handler, WEBQC_OUT_OF_MEMORY, "Cannot create a CURL handle"); // LCOV_EXCL_LINE
+    }
+
+    return handler->web_call_info.curl_handler;
+}
+
+//! Find which of the timed endpoints a WebQC service is
+static enum wqc_endpoint find_endpoint(const char *web_endpoint)
+{
+    // Blobs are downloaded from URLs the server gives, not from an endpoint of its own
+    static const char *endpoint_names[WQC_ENDPOINTS_COUNT] = {
+        [WQC_ENDPOINT_JOB] = NEW_JOB_SERVICE_ENDPOINT,
+        [WQC_ENDPOINT_PARAMS] = PARAMETERS_SERVICE_ENDPOINT,
+        [WQC_ENDPOINT_ERI] = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT,
+        [WQC_ENDPOINT_INT_INFO] = "int_info",
+        [WQC_ENDPOINT_ERI_VALUES] = "eri_values",
+        [WQC_ENDPOINT_SUBMIT] = SUBMIT_JOB_SERVICE_ENDPOINT,
+        [WQC_ENDPOINT_SUBMIT_BATCH] = SUBMIT_BATCH_SERVICE_ENDPOINT,
+        [WQC_ENDPOINT_STATUS_BATCH] = STATUS_BATCH_SERVICE_ENDPOINT,
+    };
+    int endpoint = 0;
+
+    while (endpoint < ARRAY_SIZE(endpoint_names) &&
+           (endpoint_names[endpoint] == NULL || strcmp(endpoint_names[endpoint], web_endpoint) != 0)) {
+        endpoint++;
+    }
+
+    return endpoint < ARRAY_SIZE(endpoint_names) ? (enum wqc_endpoint) endpoint : WQC_ENDPOINTS_COUNT;
+}
 
 bool
 prepare_web_call(WQC *handler, const char *web_endpoint)
 {
     bool rv = false;
-    assert(handler->web_call_info.curl_handler == NULL);
 
-    handler->web_call_info.curl_handler = curl_easy_init();
-    if (handler->web_call_info.curl_handler) {
+    cleanup_web_call(handler);
+    handler->web_call_info.endpoint = find_endpoint(web_endpoint);
+    handler->web_call_info.conditional = false;
+    handler->web_call_info.optional = false;
+    handler->web_call_info.compressed_body = false;
+    handler->web_call_info.reply_etag[0] = '\0';
+    handler->web_call_info.hedged = false;
+    handler->web_call_info.download = NULL;
+    reset_reply_buffer(&handler->web_call_info.web_reply);
 
-        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_USERAGENT, "curl/7.68.0");
-        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_FOLLOWLOCATION, 1L);
+    if (reset_curl_handle(handler)) {
 
         prepare_curl_reply_buffers(handler);
 
         if ((rv = prepare_curl_URL(handler, web_endpoint))) {
 
-            if ((rv = prepare_curl_security(handler))) {
-                handler->web_call_info.http_headers = curl_slist_append(handler->web_call_info.http_headers,
-                                                                        "Content-Type: application/json");
+            if ((rv = add_web_call_headers(handler, &handler->web_call_info.http_headers))) {
                 curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_HTTPHEADER, handler->web_call_info.http_headers);
-                rv = true;
             }
         }
     }
@@ -141,13 +330,31 @@ prepare_web_call(WQC *handler, const char *web_endpoint)
     return rv;
 }
 
-bool make_web_call(WQC *handler)
+bool web_call_unsupported(const WQC *handler)
+{
+    int code = handler->web_call_info.http_reply_code;
+
+    return code == 404 || code == 405 || code == 501;
+}
+
+bool compressed_body_rejected(const WQC *handler)
+{
+    return handler->web_call_info.compressed_body && handler->web_call_info.http_reply_code == 415;
+}
+
+bool check_web_call_result(WQC *handler, CURLcode res)
 {
     assert (handler) ;
-    CURLcode res;
     bool rv = false;
+    long http_reply_code = 0;
+    curl_off_t retry_after = 0;
 
-    res = curl_easy_perform(handler->web_call_info.curl_handler);
+    curl_easy_getinfo(handler->web_call_info.curl_handler, CURLINFO_RESPONSE_CODE, &http_reply_code);
+    curl_easy_getinfo(handler->web_call_info.curl_handler, CURLINFO_RETRY_AFTER, &retry_after);
+    handler->web_call_info.http_reply_code = (int) http_reply_code;
+    handler->web_call_info.curl_result = res;
+    handler->web_call_info.retry_after = (int64_t) retry_after * 1000;
+    wqc_breaker_record_call(handler, wqc_transient_failure(res, http_reply_code));
 
     if (res) {
         const char *additional_messages[] = {
@@ -156,10 +363,12 @@ bool make_web_call(WQC *handler)
                 curl_easy_strerror(res),
                 NULL
         };
-        wqc_set_error_with_messages(handler, WEBQC_WEB_CALL_ERROR, additional_messages); //need some more error information
+        wqc_set_error_with_messages(handler, wqc_web_call_error_code(handler, res), additional_messages);
     } else {
-        curl_easy_getinfo(handler->web_call_info.curl_handler, CURLINFO_RESPONSE_CODE, &handler->web_call_info.http_reply_code);
-        if (handler->web_call_info.http_reply_code < 200 || handler->web_call_info.http_reply_code >= 300 ) {
+        bool not_modified = handler->web_call_info.conditional && http_reply_code == 304;
+        bool unsupported = handler->web_call_info.optional && web_call_unsupported(handler);
+        if ((http_reply_code < 200 || http_reply_code >= 300) && ! not_modified && ! unsupported &&
+            ! compressed_body_rejected(handler)) {
 
             char http_error_code[4] = {0,0,0,0};
             snprintf(http_error_code, sizeof(http_error_code), "%u", handler->web_call_info.http_reply_code);
@@ -176,21 +385,324 @@ bool make_web_call(WQC *handler)
         }
     }
 
+    record_call_timing(handler, handler->web_call_info.curl_handler, handler->web_call_info.endpoint, rv);
+
     return rv;
 }
 
+//! Get a time cURL measured, in seconds
+static double get_curl_time(CURL *curl, CURLINFO info)
+{
+    curl_off_t microseconds = 0;
+    curl_easy_getinfo(curl, info, &microseconds);
+    return microseconds * 1e-6;
+}
+
+//! Measure where the time of a finished call went
+static void measure_call(CURL *curl, struct wqc_call_timing *call)
+{
+    curl_off_t bytes_sent = 0;
+    curl_off_t bytes_received = 0;
+    double name_lookup = get_curl_time(curl, CURLINFO_NAMELOOKUP_TIME_T);
+    double connect = get_curl_time(curl, CURLINFO_CONNECT_TIME_T);
+    double tls_handshake = get_curl_time(curl, CURLINFO_APPCONNECT_TIME_T);
+
+    // cURL times are from the start of the call, and zero for steps that did not happen
+    call->name_lookup = name_lookup;
+    call->connect = connect > name_lookup ? connect - name_lookup : 0;
+    call->tls_handshake = tls_handshake > connect ? tls_handshake - connect : 0;
+    call->first_byte = get_curl_time(curl, CURLINFO_STARTTRANSFER_TIME_T);
+    call->total = get_curl_time(curl, CURLINFO_TOTAL_TIME_T);
+
+    curl_easy_getinfo(curl, CURLINFO_SIZE_UPLOAD_T, &bytes_sent);
+    curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes_received);
+    call->bytes_sent = bytes_sent;
+    call->bytes_received = bytes_received;
+}
+
+void record_call_timing(WQC *handler, CURL *curl, enum wqc_endpoint endpoint, bool succeeded)
+{
+    struct wqc_network_timing *timing = &handler->web_call_info.timing;
+
+    if (endpoint < WQC_ENDPOINTS_COUNT) {
+        struct wqc_endpoint_timing *endpoint_timing = &timing->endpoints[endpoint];
+        struct wqc_call_timing *call = &timing->last_call;
+
+        measure_call(curl, call);
+        timing->last_endpoint = endpoint;
+
+        endpoint_timing->calls++;
+        endpoint_timing->failed_calls += succeeded ? 0 : 1;
+        endpoint_timing->sum.name_lookup += call->name_lookup;
+        endpoint_timing->sum.connect += call->connect;
+        endpoint_timing->sum.tls_handshake += call->tls_handshake;
+        endpoint_timing->sum.first_byte += call->first_byte;
+        endpoint_timing->sum.total += call->total;
+        endpoint_timing->sum.bytes_sent += call->bytes_sent;
+        endpoint_timing->sum.bytes_received += call->bytes_received;
+        if (call->total > endpoint_timing->max_total) {
+            endpoint_timing->max_total = call->total;
+        }
+        // A status call the server held took as long as it was held, not as long as the server is slow
+        if (succeeded && handler->call.status_wait == 0) {
+            wqc_record_latency(handler, endpoint, call->total);
+        }
+
+        wqc_metrics_count_web_call(endpoint, succeeded);
+        if (endpoint == WQC_ENDPOINT_DOWNLOAD) {
+            wqc_metrics_count(WQC_COUNTER_ERI_BYTES_DOWNLOADED, call->bytes_received);
+        }
+    }
+}
+
+void wqc_get_network_timing(WQC *handler, struct wqc_network_timing *timing)
+{
+    memcpy(timing, &handler->web_call_info.timing, sizeof(struct wqc_network_timing));
+}
+
+void wqc_reset_network_timing(WQC *handler)
+{
+    memset(&handler->web_call_info.timing, 0, sizeof(struct wqc_network_timing));
+    wqc_reset_latency(handler);
+}
+
+#define ETAG_HEADER "ETag:"
+#define IF_NONE_MATCH_HEADER "If-None-Match: "
+
+//! A CURL header callback that keeps the ETag of a reply, in a buffer of MAX_ETAG_SIZE bytes
+static size_t collect_reply_etag(char *data, size_t size, size_t nitems, void *userp)
+{
+    size_t total_size = size * nitems;
+    char *reply_etag = (char *) userp;
+
+    if (total_size > strlen(ETAG_HEADER) && strncasecmp(data, ETAG_HEADER, strlen(ETAG_HEADER)) == 0) {
+        const char *value = data + strlen(ETAG_HEADER);
+        const char *value_end = data + total_size;
+
+        while (value < value_end && (*value == ' ' || *value == '\t')) {
+            value++;
+        }
+        while (value_end > value && (value_end[-1] == '\r' || value_end[-1] == '\n' || value_end[-1] == ' ')) {
+            value_end--;
+        }
+        // An ETag that does not fit is not kept, a cut one would never match
+        if (value_end - value < MAX_ETAG_SIZE) {
+            memcpy(reply_etag, value, value_end - value);
+            reply_etag[value_end - value] = '\0';
+        }
+    }
+
+    return total_size;
+}
+
+static size_t collect_hedge_reply(void *data, size_t size, size_t nmemb, void *userp)
+{
+    return wqc_collect_downloaded_data(data, size * nmemb, (struct web_reply_buffer *) userp);
+}
+
+/// The second call of a hedged web call, and where its reply goes until it is taken
+struct hedge_call {
+    CURL *curl; /// CURL handle of the second call, NULL if it is not running
+    struct web_reply_buffer reply; /// Reply of the second call, if the call downloads no data into a buffer
+    char reply_etag[MAX_ETAG_SIZE]; /// ETag of the reply of the second call
+    struct download_buffer download; /// Where the second call writes, the same data as the first one
+};
+
+//! Stop the second call of a hedged web call, if it runs, and keep its CURL handle for the next hedge
+static void stop_hedge(WQC *handler, struct hedge_call *hedge)
+{
+    if (hedge->curl) {
+        curl_multi_remove_handle(handler->web_call_info.hedge_multi, hedge->curl);
+        handler->web_call_info.hedge_handler = hedge->curl;
+        hedge->curl = NULL;
+    }
+}
+
+//! Make the GET call prepared on the handler again on a second CURL handle, writing its reply apart from the first
+//! one's. Like the handler's own, the handle is kept from call to call, and reset for each.
+static void start_hedge(WQC *handler, struct hedge_call *hedge)
+{
+    struct handler_curl_info *info = &handler->web_call_info;
+    bool time_left = handler->call.deadline == 0 || wqc_monotonic_milliseconds() < handler->call.deadline;
+    CURL *curl = info->hedge_handler ? info->hedge_handler : curl_easy_init();
+
+    info->hedge_handler = NULL;
+    if (curl && time_left) {
+        curl_easy_reset(curl);
+        setup_curl_handle(handler, curl);
+        curl_easy_setopt(curl, CURLOPT_URL, info->full_URL);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, info->http_headers);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, info->web_error_bufffer);
+        if (info->download) {
+            wqc_set_download_buffer(curl, &hedge->download);
+        } else {
+            curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect_hedge_reply);
+            curl_easy_setopt(curl, CURLOPT_WRITEDATA, &hedge->reply);
+        }
+        if (info->conditional) {
+            curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, collect_reply_etag);
+            curl_easy_setopt(curl, CURLOPT_HEADERDATA, hedge->reply_etag);
+        }
+        if (wqc_set_call_timeout(handler, curl) && curl_multi_add_handle(info->hedge_multi, curl) == CURLM_OK) {
+            hedge->curl = curl;
+            curl = NULL;
+            wqc_metrics_count(WQC_COUNTER_HEDGED_CALLS, 1);
+        }
+    }
+    if (curl) {
+        info->hedge_handler = curl;
+    }
+}
+
+//! Take the reply of the second call of a hedged call: its CURL handle becomes the handler's, and its reply the
+//! handler's reply. The handle of the first call is kept for the next hedge.
+static void take_hedge(WQC *handler, struct hedge_call *hedge)
+{
+    struct handler_curl_info *info = &handler->web_call_info;
+    struct web_reply_buffer reply = info->web_reply;
+
+    curl_multi_remove_handle(info->hedge_multi, info->curl_handler);
+    info->hedge_handler = info->curl_handler;
+    info->curl_handler = hedge->curl;
+    hedge->curl = NULL;
+    if (info->download) {
+        wqc_take_hedge_download(info->download, &hedge->download);
+    } else {
+        info->web_reply = hedge->reply;
+        hedge->reply = reply;
+        memcpy(info->reply_etag, hedge->reply_etag, MAX_ETAG_SIZE);
+    }
+}
+
+//! Check whether a call that is done failed in a way the other call of a hedged call may not
+static bool hedged_call_failed(CURL *curl, CURLcode res)
+{
+    long http_reply_code = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_reply_code);
+    return wqc_transient_failure(res, http_reply_code);
+}
+
+//! Make the call prepared on the handler, and if it is still running after a delay, make it again on a second CURL
+//! handle and take whichever reply comes first. If one of the calls fails with a temporary error, the other one
+//! goes on. The calls of a handler that hedges calls all run on its hedge_multi, so they share its connections.
+//! \param handler handler to make the call with
+//! \param hedge_delay how long the call runs before it is made again, in milliseconds, -1 to not make it again
+//! \return the outcome of the transfer of the call whose reply is taken
+static CURLcode perform_hedged_call(WQC *handler, int64_t hedge_delay)
+{
+    struct handler_curl_info *info = &handler->web_call_info;
+    struct hedge_call hedge = {NULL, {NULL, 0}, "", {0}};
+    int64_t hedge_at = hedge_delay >= 0 ? wqc_monotonic_milliseconds() + hedge_delay : -1;
+    CURLcode res = CURLE_OK;
+    bool done = false;
+    bool first_failed = false;
+
+    if (info->download) {
+        // The second call asks for what the first one does, from where the first one started
+        wqc_init_hedge_download(&hedge.download, info->download);
+    }
+    if (!info->hedge_multi) {
+        info->hedge_multi = curl_multi_init();
+    }
+    if (!info->hedge_multi || curl_multi_add_handle(info->hedge_multi, info->curl_handler) != CURLM_OK) {
+        res = curl_easy_perform(info->curl_handler); // LCOV_EXCL_LINE
+        done = true; // LCOV_EXCL_LINE
+    }
+
+    while (!done) {
+        int running = 0;
+        int messages_left = 0;
+        CURLMsg *message = NULL;
+
+        curl_multi_perform(info->hedge_multi, &running);
+        while (!done && (message = curl_multi_info_read(info->hedge_multi, &messages_left))) {
+            CURL *curl = message->easy_handle;
+            bool other_running = curl == hedge.curl ? !first_failed : hedge.curl != NULL;
+
+            if (message->msg != CURLMSG_DONE) {
+                continue; // LCOV_EXCL_LINE
+            }
+            curl_multi_remove_handle(info->hedge_multi, curl);
+            bool failed = hedged_call_failed(curl, message->data.result);
+            if (other_running && failed) {
+                // Wait for the other call instead
+                if (curl == hedge.curl) {
+                    stop_hedge(handler, &hedge);
+                } else {
+                    first_failed = true;
+                }
+            } else {
+                res = message->data.result;
+                done = true;
+                if (curl == hedge.curl) {
+                    take_hedge(handler, &hedge);
+                    wqc_metrics_count(WQC_COUNTER_HEDGES_WON, failed ? 0 : 1);
+                }
+            }
+        }
+
+        int64_t now = wqc_monotonic_milliseconds();
+        if (!done && hedge_at >= 0 && now >= hedge_at) {
+            start_hedge(handler, &hedge);
+            hedge_at = -1;
+        }
+        if (!done) {
+            int timeout = hedge_at >= 0 && hedge_at - now < 1000 ? (int) (hedge_at - now) : 1000;
+            curl_multi_poll(info->hedge_multi, NULL, 0, timeout, NULL);
+        }
+    }
+
+    stop_hedge(handler, &hedge);
+    reset_reply_buffer(&hedge.reply);
+
+    return res;
+}
+
+bool make_web_call(WQC *handler)
+{
+    assert (handler) ;
+    CURLcode res = CURLE_OK;
+
+    if (handler->hedge_percentile > 0) {
+        int64_t hedge_delay = handler->web_call_info.hedged ?
+                              wqc_hedge_delay(handler, handler->web_call_info.endpoint) : -1;
+        res = perform_hedged_call(handler, hedge_delay);
+    } else {
+        res = curl_easy_perform(handler->web_call_info.curl_handler);
+    }
+
+    return check_web_call_result(handler, res);
+}
+
 bool cleanup_web_call(WQC *handler)
 {
     assert (handler) ;
     if (handler->web_call_info.http_headers) {
+        if (handler->web_call_info.curl_handler) {
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_HTTPHEADER, NULL);
+        }
         curl_slist_free_all(handler->web_call_info.http_headers);
         handler->web_call_info.http_headers = NULL;
     }
+    return true;
+}
+
+void wqc_cleanup_web_calls(WQC *handler)
+{
+    cleanup_web_call(handler);
     if (handler->web_call_info.curl_handler) {
         curl_easy_cleanup(handler->web_call_info.curl_handler);
         handler->web_call_info.curl_handler = NULL;
     }
-    return true;
+    if (handler->web_call_info.hedge_handler) {
+        curl_easy_cleanup(handler->web_call_info.hedge_handler);
+        handler->web_call_info.hedge_handler = NULL;
+    }
+    if (handler->web_call_info.hedge_multi) {
+        curl_multi_cleanup(handler->web_call_info.hedge_multi);
+        handler->web_call_info.hedge_multi = NULL;
+    }
 }
 
 
@@ -229,6 +741,79 @@ add_json_fields(cJSON *object, const struct name_value_pair *pairs, int pairs_co
     return rv;
 }
 
+//! Compress data in gzip format
+//! \param data data to compress
+//! \param size size of the data, in bytes
+//! \param compressed output - the compressed data, to free by the caller. NULL if it cannot be compressed.
+//! \param compressed_size output - size of the compressed data, in bytes
+//! \return true on success, false if the data cannot be compressed
+static bool gzip_data(const char *data, size_t size, char **compressed, size_t *compressed_size)
+{
+    bool rv = false;
+    z_stream stream;
+
+    memset(&stream, 0, sizeof(stream));
+    *compressed = NULL;
+    *compressed_size = 0;
+    // 16 more bits of window ask zlib for a gzip header and trailer, instead of a zlib one
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, MAX_WBITS + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK) {
+        uLong bound = deflateBound(&stream, size);
+        *compressed = malloc(bound);
+        stream.next_in = (Bytef *) data;
+        stream.avail_in = size;
+        stream.next_out = (Bytef *) *compressed;
+        stream.avail_out = bound;
+        rv = *compressed && deflate(&stream, Z_FINISH) == Z_STREAM_END;
+        *compressed_size = stream.total_out;
+        deflateEnd(&stream);
+    }
+
+    if (!rv) {
+        free(*compressed);
+        *compressed = NULL;
+    }
+    return rv;
+}
+
+//! Set a gzip compressed copy of a body as the body of the POST call being prepared, unless the server cannot take it
+//! or compressing is not worth it
+//! \return true if the compressed body was set, false if the body must be sent as is
+static bool set_compressed_POST_body(WQC *handler, const char *body, size_t size)
+{
+    bool rv = false;
+    char *compressed = NULL;
+    size_t compressed_size = 0;
+
+    if (handler->compression && !handler->compressed_body_unsupported && size >= MIN_COMPRESSED_BODY_SIZE &&
+        gzip_data(body, size, &compressed, &compressed_size)) {
+        struct curl_slist *headers = curl_slist_append(handler->web_call_info.http_headers, "Content-Encoding: gzip");
+        if (headers) {
+            handler->web_call_info.http_headers = headers;
+            handler->web_call_info.compressed_body = true;
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_HTTPHEADER, headers);
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_POSTFIELDSIZE_LARGE,
+                             (curl_off_t) compressed_size);
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_COPYPOSTFIELDS, compressed);
+            rv = true;
+        }
+    }
+    free(compressed);
+
+    return rv;
+}
+
+//! Set a JSON object as the body of the POST call being prepared, without whitespace and compressed if it is large
+static void set_POST_JSON(WQC *handler, const cJSON *json)
+{
+    char *json_as_string = cJSON_PrintUnformatted(json);
+
+    curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_POST, 1L);
+    if (!json_as_string || !set_compressed_POST_body(handler, json_as_string, strlen(json_as_string))) {
+        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_COPYPOSTFIELDS, json_as_string);
+    }
+    free(json_as_string);
+}
+
 bool set_POST_fields(WQC *handler, struct name_value_pair values[], size_t num_values)
 {
     bool rv = false;
@@ -238,29 +823,21 @@ bool set_POST_fields(WQC *handler, struct name_value_pair values[], size_t num_v
     if (ERI_request) {
 
         if (add_json_fields(ERI_request, values, num_values ) ){
-
-            char *json_as_string = cJSON_Print(ERI_request);
-
-            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_POST, 1L);
-            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_COPYPOSTFIELDS, json_as_string);
-            free(json_as_string);
-            cJSON_Delete(ERI_request);
+            set_POST_JSON(handler, ERI_request);
             rv = true;
         } else {
             wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
         }
+        cJSON_Delete(ERI_request);
     } else {
         wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
     }
     return rv;
 }
 
-bool set_eri_job_parameters(WQC *handler, const struct two_electron_integrals_job_parameters *job_parameters)
+//! Add the parameters of an ERI job to a JSON object
+static bool add_eri_job_parameters(cJSON *object, const struct two_electron_integrals_job_parameters *job_parameters)
 {
-    bool rv = false;
-
-    handler->wqc_endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
-
     struct name_value_pair two_e_parameters_pairs[] = {
             {"basis_set_name",   WQC_STRING_TYPE, { .str_value=job_parameters->basis_set_name} },
             {"xyz_file_content", WQC_STRING_TYPE, { .str_value=job_parameters->geometry} },
@@ -268,7 +845,105 @@ bool set_eri_job_parameters(WQC *handler, const struct two_electron_integrals_jo
             {"geometry_units", WQC_STRING_TYPE, { .str_value=job_parameters->geometry_units} },
             {"shell_sets_per_file", WQC_REAL_TYPE, { .real_value=job_parameters->shell_set_per_file} },
     };
-    rv = set_POST_fields(handler, two_e_parameters_pairs, ARRAY_SIZE(two_e_parameters_pairs));
+    return add_json_fields(object, two_e_parameters_pairs, ARRAY_SIZE(two_e_parameters_pairs));
+}
+
+bool set_eri_job_parameters(WQC *handler, const struct two_electron_integrals_job_parameters *job_parameters)
+{
+    bool rv = false;
+    cJSON *parameters = cJSON_CreateObject();
+
+    handler->wqc_endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
+
+    if (parameters && add_eri_job_parameters(parameters, job_parameters)) {
+        set_POST_JSON(handler, parameters);
+        rv = true;
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+    cJSON_Delete(parameters);
+
+    return rv;
+}
+
+//! Make the request to submit one ERI job: its job type and parameters
+static cJSON *make_eri_submit_request(const struct two_electron_integrals_job_parameters *job_parameters)
+{
+    cJSON *request = cJSON_CreateObject();
+    cJSON *parameters = request ? cJSON_AddObjectToObject(request, "parameters") : NULL;
+
+    if (!parameters || !cJSON_AddStringToObject(request, "job_type", TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT) ||
+        !add_eri_job_parameters(parameters, job_parameters)) {
+        cJSON_Delete(request); // LCOV_EXCL_LINE
+        request = NULL; // LCOV_EXCL_LINE
+    }
+
+    return request;
+}
+
+bool set_eri_submit_parameters(WQC *handler, const struct two_electron_integrals_job_parameters *job_parameters)
+{
+    bool rv = false;
+    cJSON *request = make_eri_submit_request(job_parameters);
+
+    if (request) {
+        set_POST_JSON(handler, request);
+        rv = true;
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+    cJSON_Delete(request);
+
+    return rv;
+}
+
+bool set_eri_batch_submit_parameters(WQC *handler, void *job_parameters[], int jobs_count)
+{
+    bool rv = true;
+    cJSON *request = cJSON_CreateObject();
+    cJSON *jobs = request ? cJSON_AddArrayToObject(request, "jobs") : NULL;
+
+    rv = jobs != NULL;
+    for (int i = 0; rv && i < jobs_count; ++i) {
+        cJSON *job = make_eri_submit_request(job_parameters[i]);
+        rv = job && cJSON_AddItemToArray(jobs, job);
+    }
+
+    if (rv) {
+        set_POST_JSON(handler, request);
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+    cJSON_Delete(request);
+
+    return rv;
+}
+
+bool set_batch_status_parameters(WQC *handler, WQC *handlers[], int jobs_count)
+{
+    bool rv = true;
+    cJSON *request = cJSON_CreateObject();
+    cJSON *jobs = request ? cJSON_AddArrayToObject(request, "jobs") : NULL;
+
+    rv = jobs != NULL;
+    for (int i = 0; rv && i < jobs_count; ++i) {
+        cJSON *job = cJSON_CreateObject();
+        rv = job && cJSON_AddItemToArray(jobs, job) && cJSON_AddStringToObject(job, "job_id", handlers[i]->job_id);
+        if (rv && handlers[i]->status_cursor[0]) {
+            // As in a status call of one job, only the sub-jobs that changed since the status the handler has are sent
+            rv = cJSON_AddStringToObject(job, "since", handlers[i]->status_cursor) != NULL;
+        }
+    }
+    if (rv && handler->max_inline_ERI_size > 0) {
+        rv = cJSON_AddNumberToObject(request, "inline_max", handler->max_inline_ERI_size) != NULL;
+    }
+
+    if (rv) {
+        set_POST_JSON(handler, request);
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+    cJSON_Delete(request);
 
     return rv;
 }
@@ -276,13 +951,25 @@ bool set_eri_job_parameters(WQC *handler, const struct two_electron_integrals_jo
 
 void wqc_init_web_calls(WQC *handler)
 {
-    handler->web_call_info.curl_handler = NULL;
+    handler->web_call_info.curl_handler = curl_easy_init();
     handler->web_call_info.full_URL[0] = '\0';
     handler->web_call_info.web_reply.size = 0;
     handler->web_call_info.web_reply.reply = NULL;
     handler->web_call_info.web_error_bufffer[0] = '\0';
     handler->web_call_info.http_headers = NULL;
     handler->web_call_info.http_reply_code = 0;
+    handler->web_call_info.curl_result = CURLE_OK;
+    handler->web_call_info.retry_after = 0;
+    handler->web_call_info.conditional = false;
+    handler->web_call_info.optional = false;
+    handler->web_call_info.compressed_body = false;
+    handler->web_call_info.reply_etag[0] = '\0';
+    handler->web_call_info.endpoint = WQC_ENDPOINTS_COUNT;
+    handler->web_call_info.hedged = false;
+    handler->web_call_info.download = NULL;
+    handler->web_call_info.hedge_multi = NULL;
+    handler->web_call_info.hedge_handler = NULL;
+    wqc_reset_network_timing(handler);
 }
 
 
@@ -294,13 +981,42 @@ set_no_parameters(WQC *handler)
     return true;
 }
 
+bool prepare_conditional_call(WQC *handler, const char *etag)
+{
+    bool rv = true;
+    CURL *curl = handler->web_call_info.curl_handler;
+
+    handler->web_call_info.conditional = true;
+    handler->web_call_info.reply_etag[0] = '\0';
+    curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, collect_reply_etag);
+    curl_easy_setopt(curl, CURLOPT_HEADERDATA, handler->web_call_info.reply_etag);
+
+    if (etag[0]) {
+        char header[sizeof(IF_NONE_MATCH_HEADER) + MAX_ETAG_SIZE];
+        snprintf(header, sizeof(header), "%s%s", IF_NONE_MATCH_HEADER, etag);
+
+        struct curl_slist *headers = curl_slist_append(handler->web_call_info.http_headers, header);
+        if (headers) {
+            handler->web_call_info.http_headers = headers;
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        } else {
+            wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+            rv = false; // LCOV_EXCL_LINE
+        }
+    }
+
+    return rv;
+}
+
 bool prepare_get_parameter( WQC *handler, const char *param_name, const char *param_value)
 {
     bool rv = false;
 
     char URL_with_options[MAX_URL_SIZE];
 
-    if (snprintf(URL_with_options, MAX_URL_SIZE, "%s?%s=%s", handler->web_call_info.full_URL, param_name,
+    char separator = strchr(handler->web_call_info.full_URL, '?') ? '&' : '?';
+
+    if (snprintf(URL_with_options, MAX_URL_SIZE, "%s%c%s=%s", handler->web_call_info.full_URL, separator, param_name,
                  param_value) < MAX_URL_SIZE) {
         strncpy(handler->web_call_info.full_URL, URL_with_options, MAX_URL_SIZE);
         curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_URL, handler->web_call_info.full_URL);
@@ -312,46 +1028,180 @@ bool prepare_get_parameter( WQC *handler, const char *param_name, const char *pa
     return rv;
 }
 
-bool wqc_download_file(WQC *handler, const char *URL, FILE *fp)
+bool prepare_inline_values_parameter(WQC *handler)
 {
-    bool rv = false;
-    CURL *curl = curl_easy_init();
-    CURLcode res = CURLE_OK;
+    bool rv = true;
+
+    if ( handler->max_inline_ERI_size > 0 ) {
+        char inline_max[24];
+        snprintf(inline_max, sizeof(inline_max), "%d", handler->max_inline_ERI_size);
+        rv = prepare_get_parameter(handler, "inline_max", inline_max);
+    }
+
+    return rv;
+}
+
+//! Prepare the handler's CURL handle to download a URL, leaving it to the caller to set where the data goes
+static CURL *
+prepare_download(WQC *handler, const char *URL)
+{
+    CURL *curl = NULL;
+
+    cleanup_web_call(handler);
+    handler->web_call_info.endpoint = WQC_ENDPOINT_DOWNLOAD;
+    handler->web_call_info.curl_result = CURLE_OK;
+    handler->web_call_info.http_reply_code = 0;
+    handler->web_call_info.hedged = false;
+    handler->web_call_info.download = NULL;
+    curl = reset_curl_handle(handler);
 
     if (curl) {
-        curl_easy_setopt(curl, CURLOPT_URL, URL);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+        strncpy(handler->web_call_info.full_URL, URL, MAX_URL_SIZE - 1);
+        handler->web_call_info.full_URL[MAX_URL_SIZE - 1] = '\0';
+        curl_easy_setopt(curl, CURLOPT_URL, handler->web_call_info.full_URL);
         curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, handler->web_call_info.web_error_bufffer);
+    }
+    return curl;
+}
 
+static size_t write_to_file(void *data, size_t size, size_t nmemb, void *userp)
+{
+    struct file_download *file = (struct file_download *) userp;
+    size_t written = fwrite(data, size, nmemb, file->fp);
 
-        res = curl_easy_perform(curl);
+    file->written += written * size;
+    return written * size;
+}
 
-        if (res) {
-            const char *additional_messages[] = {
-                URL,
-                handler->web_call_info.web_error_bufffer,
-                curl_easy_strerror(res),
-                NULL
-            };
-            wqc_set_error_with_messages(handler, WEBQC_WEB_CALL_ERROR,
-                                        additional_messages); //need some more error information
-        } else {
-            rv = true;
-        }
+bool prepare_file_download(WQC *handler, const char *URL, struct file_download *file)
+{
+    CURL *curl = prepare_download(handler, URL);
 
-        curl_easy_cleanup(curl);
+    if (curl) {
+        file->written = 0;
+        // The body of an error reply is not written into the file
+        curl_easy_setopt(curl, CURLOPT_FAILONERROR, 1L);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, write_to_file);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, file);
+    }
+    return curl != NULL;
+}
+
+bool prepare_buffer_download(WQC *handler, const char *URL, struct download_buffer *buffer)
+{
+    CURL *curl = prepare_download(handler, URL);
+
+    if (curl) {
+        wqc_set_download_buffer(curl, buffer);
+        // Made again, the download writes the same data into the same buffer, so it can be hedged
+        handler->web_call_info.download = buffer;
+        handler->web_call_info.hedged = true;
+    }
+    return curl != NULL;
+}
+
+bool wqc_download_file(WQC *handler, const char *URL, FILE *fp)
+{
+    struct file_download file = {fp, 0};
+    int64_t retry_delay = 0;
+    curl_off_t resumed_from = 0;
+    // The easy handle of a handler in a WQC_MULTI belongs to the multi handle
+    bool rv = wqc_handler_idle(handler);
+    if (rv) {
+        wqc_start_deadline(handler);
+        rv = wqc_breaker_allows_call(handler) && prepare_file_download(handler, URL, &file) &&
+             wqc_set_call_timeout(handler, handler->web_call_info.curl_handler);
+    }
+    bool resume = rv;
+
+    for ( int retries = 0 ; resume ; ++retries ) {
+        rv = make_web_call(handler);
+        if (rv && resumed_from > 0 && handler->web_call_info.http_reply_code != 206) {
+            // Only a resumed download must get the range it asked for: a server that ignores the range may send less
+            // than what was skipped, which libcURL takes as done
+            const char *additional_messages[] = {URL, "Download cannot be resumed", NULL};
+            wqc_set_error_with_messages(handler, WEBQC_WEB_CALL_ERROR, additional_messages);
+            rv = false;
+        }
+        resume = ! rv && retries < handler->download_retries &&
+                 wqc_transient_failure(handler->web_call_info.curl_result, handler->web_call_info.http_reply_code);
+        if (resume) {
+            int64_t delay = wqc_next_retry_delay(handler, &retry_delay);
+            resume = wqc_deadline_allows_wait(handler, delay);
+            if (resume) {
+                usleep(delay * 1000);
+                resume = wqc_breaker_allows_call(handler) &&
+                         wqc_set_call_timeout(handler, handler->web_call_info.curl_handler);
+            }
+        }
+        if (resume) {
+            wqc_metrics_count(WQC_COUNTER_RETRIES, 1);
+        }
+        if (resume && file.written > 0) {
+            // Ask only for the rest of the file, as is, since what was written is kept. A call that failed before
+            // any of the file was written is simply made again.
+            resumed_from = file.written;
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_RESUME_FROM_LARGE, file.written);
+            curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_ACCEPT_ENCODING, NULL);
+        }
     }
     return rv;
 }
 
 
 
+static void
+lock_curl_share(CURL *curl, curl_lock_data data, curl_lock_access access, void *userptr)
+{
+    pthread_mutex_lock(&curl_share_locks[data]);
+}
+
+static void
+unlock_curl_share(CURL *curl, curl_lock_data data, void *userptr)
+{
+    pthread_mutex_unlock(&curl_share_locks[data]);
+}
+
+//! Create the process-wide share object, so new handlers start with a resolved server address and can resume
+//! TLS sessions negotiated by other handlers.
+static void
+init_curl_share()
+{
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+        pthread_mutex_init(&curl_share_locks[i], NULL);
+    }
+
+    curl_share = curl_share_init();
+
+    if (curl_share) {
+        curl_share_setopt(curl_share, CURLSHOPT_LOCKFUNC, lock_curl_share);
+        curl_share_setopt(curl_share, CURLSHOPT_UNLOCKFUNC, unlock_curl_share);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(curl_share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    }
+}
+
+static void
+cleanup_curl_share()
+{
+    if (curl_share) {
+        curl_share_cleanup(curl_share);
+        curl_share = NULL;
+    }
+
+    for (int i = 0; i < CURL_LOCK_DATA_LAST; ++i) {
+        pthread_mutex_destroy(&curl_share_locks[i]);
+    }
+}
+
 void web_access_init()
 {
     curl_global_init(CURL_GLOBAL_DEFAULT);
+    init_curl_share();
 }
 
 void web_access_cleanup()
 {
+    cleanup_curl_share();
     curl_global_cleanup();
-}
\ No newline at end of file
+}
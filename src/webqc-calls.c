@@ -0,0 +1,548 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-web-access.h"
+#include "webqc-json.h"
+#include "webqc-calls.h"
+#include "webqc-metrics.h"
+#include "webqc-trace.h"
+#include "webqc-retry.h"
+
+
+//! Forget what is known about the status of the last job submitted on the handler, as a new one is being submitted
+static void forget_job_status(WQC *handler)
+{
+    handler->status_etag[0] = '\0';
+    handler->status_cursor[0] = '\0';
+    // Sub-jobs handed out so far, and the values sent with them, belong to the last job, and none of the new one's are
+    for ( int i = 0 ; i < handler->ERI_items_count ; ++i ) {
+        handler->eri_status[i].handed_out = false;
+        free(handler->eri_status[i].values);
+        handler->eri_status[i].values = NULL;
+    }
+    handler->ERI_done_queue_begin = handler->ERI_done_queue_end = 0;
+    memset(&handler->items_progress, 0, sizeof(handler->items_progress));
+}
+
+static bool prepare_create_job(WQC *handler)
+{
+    bool rv = prepare_web_call(handler, NEW_JOB_SERVICE_ENDPOINT);
+
+    forget_job_status(handler);
+
+    if ( rv ) {
+        rv = set_no_parameters(handler);
+    }
+
+    return rv;
+}
+
+static bool finish_create_job(WQC *handler)
+{
+    bool rv = get_job_id_from_reply(handler);
+    wqc_reset(handler);
+    return rv;
+}
+
+static bool prepare_set_parameters(WQC *handler)
+{
+    bool rv = prepare_web_call(handler, PARAMETERS_SERVICE_ENDPOINT);
+
+    if ( rv ) {
+        if (handler->call.job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
+            rv = set_eri_job_parameters(handler, (const struct two_electron_integrals_job_parameters *) handler->call.job_parameters);
+        } else {
+            wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+static bool finish_set_parameters(WQC *handler)
+{
+    bool rv = get_parameter_set_id_from_reply(handler);
+    wqc_reset(handler);
+    handler->wqc_endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
+    handler->job_type = handler->call.job_type;
+    return rv;
+}
+
+static bool prepare_start_job(WQC *handler)
+{
+    bool rv = false;
+
+    handler->is_duplicate = false;
+
+    rv = prepare_web_call(handler, handler->wqc_endpoint);
+
+    if ( rv ) {
+        struct name_value_pair start_job_parameters[] = {
+                {"job_id",     WQC_STRING_TYPE, {.str_value=handler->job_id}},
+                {"parameter_set_id",   WQC_STRING_TYPE, {.str_value=handler->parameter_set_id}}
+        };
+        rv = set_POST_fields(handler, start_job_parameters, ARRAY_SIZE(start_job_parameters));
+    }
+
+    return rv;
+}
+
+static bool finish_start_job(WQC *handler)
+{
+    bool rv = update_job_details(handler);
+    wqc_reset(handler);
+
+    if ( rv ) {
+        wqc_metrics_count(WQC_COUNTER_JOBS_SUBMITTED, 1);
+        wqc_metrics_count(WQC_COUNTER_DUPLICATE_JOBS, handler->is_duplicate ? 1 : 0);
+    }
+    return rv;
+}
+
+static bool prepare_submit_job(WQC *handler)
+{
+    bool rv = false;
+
+    forget_job_status(handler);
+    handler->is_duplicate = false;
+
+    if (handler->call.job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
+        rv = prepare_web_call(handler, SUBMIT_JOB_SERVICE_ENDPOINT);
+        if ( rv ) {
+            // An older server has no combined submit, and the job is then submitted in three calls
+            handler->web_call_info.optional = true;
+            rv = set_eri_submit_parameters(handler,
+                                           (const struct two_electron_integrals_job_parameters *) handler->call.job_parameters);
+        }
+    } else {
+        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+    }
+
+    return rv;
+}
+
+static bool finish_submit_job(WQC *handler)
+{
+    bool rv = true;
+
+    if ( web_call_unsupported(handler) ) {
+        handler->combined_submit_unsupported = true;
+        handler->call.step_unsupported = true;
+    } else {
+        handler->wqc_endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
+        handler->job_type = handler->call.job_type;
+        rv = get_job_id_from_reply(handler) && get_parameter_set_id_from_reply(handler) && update_job_details(handler);
+    }
+    wqc_reset(handler);
+
+    if ( rv && ! handler->call.step_unsupported ) {
+        wqc_metrics_count(WQC_COUNTER_JOBS_SUBMITTED, 1);
+        wqc_metrics_count(WQC_COUNTER_DUPLICATE_JOBS, handler->is_duplicate ? 1 : 0);
+    }
+    return rv;
+}
+
+static bool prepare_submit_batch(WQC *handler)
+{
+    bool rv = false;
+
+    for ( int i = 0 ; i < handler->call.batch_count ; ++i ) {
+        forget_job_status(handler->call.batch_handlers[i]);
+        handler->call.batch_handlers[i]->is_duplicate = false;
+    }
+
+    if (handler->call.job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
+        rv = prepare_web_call(handler, SUBMIT_BATCH_SERVICE_ENDPOINT);
+        if ( rv ) {
+            // An older server has no batched calls, and each job is then submitted on its own handler
+            handler->web_call_info.optional = true;
+            rv = set_eri_batch_submit_parameters(handler, handler->call.batch_parameters, handler->call.batch_count);
+        }
+    } else {
+        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+    }
+
+    return rv;
+}
+
+static bool finish_submit_batch(WQC *handler)
+{
+    bool rv = true;
+    cJSON *reply_json = NULL;
+    cJSON *replies = NULL;
+
+    if ( web_call_unsupported(handler) ) {
+        handler->batch_unsupported = true;
+        handler->call.step_unsupported = true;
+    } else {
+        rv = parse_JSON_reply(handler, &reply_json) &&
+            get_batch_replies(handler, reply_json, handler->call.batch_count, &replies);
+    }
+
+    if ( rv && replies ) {
+        // A job that failed has the error on its own handler, and does not fail the others
+        cJSON *job_reply = NULL;
+        WQC **job_handler = handler->call.batch_handlers;
+        cJSON_ArrayForEach(job_reply, replies) {
+            (*job_handler)->wqc_endpoint = TWO_ELECTRONS_INTEGRAL_SERVICE_ENDPOINT;
+            (*job_handler)->job_type = handler->call.job_type;
+            if ( update_batch_job_details(*job_handler, job_reply) ) {
+                wqc_metrics_count(WQC_COUNTER_JOBS_SUBMITTED, 1);
+                wqc_metrics_count(WQC_COUNTER_DUPLICATE_JOBS, (*job_handler)->is_duplicate ? 1 : 0);
+            }
+            job_handler++;
+        }
+    }
+    cJSON_Delete(reply_json);
+    wqc_reset(handler);
+
+    return rv;
+}
+
+//! Count the ERI sub-jobs of the handler's job that are known to be done
+static int count_done_items(const WQC *handler)
+{
+    return handler->ERI_items_by_status[WQC_JOB_STATUS_DONE];
+}
+
+//! Count a status call of the handler's job, and whether it found more sub-jobs done than it had before
+static void count_status_poll(const WQC *handler, int items_count, int done_count)
+{
+    bool unchanged = items_count == handler->ERI_items_count && done_count == count_done_items(handler);
+
+    wqc_metrics_count(WQC_COUNTER_STATUS_POLLS, 1);
+    wqc_metrics_count(WQC_COUNTER_STATUS_POLLS_UNCHANGED, unchanged ? 1 : 0);
+}
+
+static bool prepare_get_status(WQC *handler)
+{
+    bool rv = false;
+
+    if (handler->job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS) {
+        rv = prepare_web_call(handler, handler->wqc_endpoint);
+        if ( rv ) {
+            rv = prepare_get_parameter(handler, "job_id", handler->job_id);
+        }
+        if ( rv && handler->status_cursor[0] ) {
+            // Only the sub-jobs that changed since the status the handler has are sent
+            rv = prepare_get_parameter(handler, "since", handler->status_cursor);
+        }
+        if ( rv ) {
+            rv = prepare_inline_values_parameter(handler);
+        }
+        if ( rv && handler->call.status_wait > 0 ) {
+            // The server holds the call until more sub-jobs are done than we know of, or the wait is over
+            char wait[24], done[24];
+            snprintf(wait, sizeof(wait), "%lld", (long long) handler->call.status_wait);
+            snprintf(done, sizeof(done), "%d", count_done_items(handler));
+            rv = prepare_get_parameter(handler, "wait", wait) && prepare_get_parameter(handler, "done", done);
+        }
+        if ( rv ) {
+            // A held call replies early only when the status changed, and its reply tells whether the server holds
+            // calls at all, so only polls are sent the ETag of the status the handler has
+            rv = prepare_conditional_call(handler, handler->call.status_wait > 0 ? "" : handler->status_etag);
+            // Polls can be made again if they are slow, but a held call is slow on purpose
+            handler->web_call_info.hedged = handler->call.status_wait == 0;
+        }
+    } else {
+        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+    }
+
+    return rv;
+}
+
+static bool finish_get_status(WQC *handler)
+{
+    int items_count = handler->ERI_items_count;
+    int done_count = count_done_items(handler);
+    bool rv = true;
+
+    // Not Modified: the status the handler has is still current, no need to download or parse it again
+    if ( handler->web_call_info.http_reply_code != 304 ) {
+        rv = update_eri_job_status(handler);
+        strncpy(handler->status_etag, rv ? handler->web_call_info.reply_etag : "", MAX_ETAG_SIZE);
+    }
+    wqc_reset(handler);
+
+    if ( rv ) {
+        count_status_poll(handler, items_count, done_count);
+    }
+    return rv;
+}
+
+static bool prepare_get_batch_status(WQC *handler)
+{
+    bool rv = true;
+
+    for ( int i = 0 ; rv && i < handler->call.batch_count ; ++i ) {
+        rv = handler->call.batch_handlers[i]->job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS;
+    }
+
+    if ( rv ) {
+        rv = prepare_web_call(handler, STATUS_BATCH_SERVICE_ENDPOINT);
+        if ( rv ) {
+            // An older server has no batched calls, and the status of each job is then fetched on its own handler
+            handler->web_call_info.optional = true;
+            rv = set_batch_status_parameters(handler, handler->call.batch_handlers, handler->call.batch_count);
+        }
+    } else {
+        wqc_set_error(handler, WEBQC_NOT_IMPLEMENTED);
+    }
+
+    return rv;
+}
+
+static bool finish_get_batch_status(WQC *handler)
+{
+    bool rv = true;
+    cJSON *reply_json = NULL;
+    cJSON *replies = NULL;
+
+    if ( web_call_unsupported(handler) ) {
+        handler->batch_unsupported = true;
+        handler->call.step_unsupported = true;
+    } else {
+        rv = parse_JSON_reply(handler, &reply_json) &&
+            get_batch_replies(handler, reply_json, handler->call.batch_count, &replies);
+    }
+
+    if ( rv && replies ) {
+        cJSON *job_reply = NULL;
+        WQC **job_handler = handler->call.batch_handlers;
+        cJSON_ArrayForEach(job_reply, replies) {
+            int items_count = (*job_handler)->ERI_items_count;
+            int done_count = count_done_items(*job_handler);
+            // The status came without an ETag, so a later status call cannot be answered with Not Modified
+            (*job_handler)->status_etag[0] = '\0';
+            if ( update_batch_job_status(*job_handler, job_reply) ) {
+                count_status_poll(*job_handler, items_count, done_count);
+            }
+            job_handler++;
+        }
+    }
+    cJSON_Delete(reply_json);
+    wqc_reset(handler);
+
+    return rv;
+}
+
+static bool prepare_get_integrals_details(WQC *handler)
+{
+    bool rv = prepare_web_call(handler, "int_info");
+
+    if ( rv ) {
+        rv = prepare_get_parameter(handler, "set_id", handler->parameter_set_id);
+    }
+
+    return rv;
+}
+
+static bool finish_get_integrals_details(WQC *handler)
+{
+    bool rv = update_eri_details(handler);
+    wqc_reset(handler);
+    return rv;
+}
+
+static bool finish_ERI_values_call(WQC *handler)
+{
+    bool rv = update_eri_values(handler);
+    wqc_reset(handler);
+    return rv;
+}
+
+/// All the steps of all operations, indexed by step
+static const struct wqc_call_step_info call_steps[] = {
+    {WQC_STEP_NONE, "none", NULL, NULL, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_CREATE_JOB, "create_job", prepare_create_job, finish_create_job, WQC_STEP_SET_PARAMETERS, WQC_STEP_NONE},
+    {WQC_STEP_SET_PARAMETERS, "set_parameters", prepare_set_parameters, finish_set_parameters, WQC_STEP_START_JOB, WQC_STEP_NONE},
+    {WQC_STEP_START_JOB, "start_job", prepare_start_job, finish_start_job, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_GET_STATUS, "get_status", prepare_get_status, finish_get_status, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_GET_INTEGRALS_DETAILS, "get_int_info", prepare_get_integrals_details, finish_get_integrals_details, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_GET_ERI_VALUES, "locate_ERI_values", prepare_ERI_values_call, finish_ERI_values_call, WQC_STEP_DOWNLOAD_ERI_VALUES, WQC_STEP_NONE},
+    {WQC_STEP_DOWNLOAD_ERI_VALUES, "download_ERI_values", prepare_ERI_values_download, finish_ERI_values_download, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_SUBMIT_JOB, "combined_submit", prepare_submit_job, finish_submit_job, WQC_STEP_NONE, WQC_STEP_CREATE_JOB},
+    {WQC_STEP_SUBMIT_BATCH, "submit_batch", prepare_submit_batch, finish_submit_batch, WQC_STEP_NONE, WQC_STEP_NONE},
+    {WQC_STEP_GET_BATCH_STATUS, "get_batch_status", prepare_get_batch_status, finish_get_batch_status, WQC_STEP_NONE, WQC_STEP_NONE},
+};
+
+static const struct wqc_call_step_info *get_call_step_info(enum wqc_call_step step)
+{
+    assert(step < ARRAY_SIZE(call_steps) && call_steps[step].step == step);
+    return &call_steps[step];
+}
+
+//! Release what the step running on the handler holds, whether it succeeded or not. What a download that is resumed
+//! received so far is kept.
+static void end_call_step(WQC *handler)
+{
+    cleanup_web_call(handler);
+    if ( ! handler->call.resume_download ) {
+        free(handler->call.download.data);
+        handler->call.download.data = NULL;
+    }
+    free(handler->call.eri_location.values);
+    handler->call.eri_location.values = NULL;
+}
+
+bool wqc_start_call_step(WQC *handler, enum wqc_call_step step)
+{
+    bool rv = false;
+
+    if ( step != handler->call.step || ! handler->call.resend ) {
+        handler->call.retries = 0;
+        handler->call.retry_delay = 0;
+        handler->call.retry_at = 0;
+    }
+    handler->call.step = step;
+    handler->call.step_unsupported = false;
+    handler->call.operation_done = false;
+    handler->call.resend = false;
+    handler->call.trace_start = wqc_trace_begin(handler);
+    handler->web_call_info.curl_result = CURLE_OK;
+    handler->web_call_info.http_reply_code = 0;
+    rv = wqc_breaker_allows_call(handler) && get_call_step_info(step)->prepare(handler) &&
+         wqc_set_call_timeout(handler, handler->web_call_info.curl_handler);
+    handler->call.resume_download = false;
+
+    if ( ! rv ) {
+        end_call_step(handler);
+    }
+
+    return rv;
+}
+
+//! Check whether the download of the step that just failed can go on from where it stopped: it broke off or met a
+//! temporary server error, and was not resumed as many times as the handler allows
+static bool download_resumable(const WQC *handler)
+{
+    const struct wqc_call_state *call = &handler->call;
+
+    return call->step == WQC_STEP_DOWNLOAD_ERI_VALUES && call->download.data &&
+           call->download.received < call->download.size && call->download_retries < handler->download_retries &&
+           wqc_transient_failure(handler->web_call_info.curl_result, handler->web_call_info.http_reply_code);
+}
+
+//! Check whether the step that just failed can run again: its call failed with a temporary error, and was not made
+//! again as many times as the handler allows. Downloads are resumed instead, see download_resumable().
+static bool step_retryable(const WQC *handler)
+{
+    return handler->call.step != WQC_STEP_DOWNLOAD_ERI_VALUES && handler->call.retries < handler->call_retries &&
+           wqc_transient_failure(handler->web_call_info.curl_result, handler->web_call_info.http_reply_code);
+}
+
+//! Have the step that just failed run again, once it waited as long as wqc_next_retry_delay() finds
+//! \return true if the step runs again, false if the wait would reach the deadline of the operation (and sets error)
+static bool retry_step(WQC *handler)
+{
+    int64_t delay = wqc_next_retry_delay(handler, &handler->call.retry_delay);
+    bool rv = wqc_deadline_allows_wait(handler, delay);
+
+    if ( rv ) {
+        handler->call.resend = true;
+        handler->call.retry_at = wqc_monotonic_milliseconds() + delay;
+        wqc_metrics_count(WQC_COUNTER_RETRIES, 1);
+    }
+    return rv;
+}
+
+bool wqc_finish_call_step(WQC *handler, bool call_succeeded)
+{
+    bool rv = call_succeeded;
+    const struct wqc_call_step_info *step_info = get_call_step_info(handler->call.step);
+
+    if ( ! rv && download_resumable(handler) ) {
+        // The step runs again, and asks only for the rest of the data
+        handler->call.resume_download = true;
+        handler->call.download_retries++;
+        rv = retry_step(handler);
+    } else if ( ! rv && step_retryable(handler) ) {
+        handler->call.retries++;
+        rv = retry_step(handler);
+    } else if ( rv && compressed_body_rejected(handler) ) {
+        // The request is sent again as is, and so are all later ones
+        handler->compressed_body_unsupported = true;
+        handler->call.resend = true;
+    } else if ( rv ) {
+        wqc_trace_time_t start = wqc_trace_begin(handler);
+        rv = step_info->finish(handler);
+        wqc_trace_end(handler, "process_reply", start);
+    }
+    end_call_step(handler);
+    wqc_trace_end(handler, step_info->name, handler->call.trace_start);
+
+    return rv;
+}
+
+void wqc_abandon_call_step(WQC *handler)
+{
+    handler->call.resume_download = false;
+    end_call_step(handler);
+    handler->call.step = WQC_STEP_NONE;
+}
+
+enum wqc_call_step wqc_next_call_step(const WQC *handler)
+{
+    const struct wqc_call_step_info *step_info = get_call_step_info(handler->call.step);
+
+    enum wqc_call_step next_step = handler->call.step_unsupported ? step_info->fallback_step : step_info->next_step;
+
+    if ( handler->call.resend ) {
+        next_step = handler->call.step;
+    } else if ( handler->call.operation_done ) {
+        next_step = WQC_STEP_NONE;
+    }
+    return next_step;
+}
+
+enum wqc_call_step wqc_submit_job_first_step(const WQC *handler)
+{
+    bool combined = handler->combined_submit && ! handler->combined_submit_unsupported &&
+        handler->call.job_type == WQC_JOB_TWO_ELECTRONS_INTEGRALS;
+
+    return combined ? WQC_STEP_SUBMIT_JOB : WQC_STEP_CREATE_JOB;
+}
+
+bool wqc_handler_idle(WQC *handler)
+{
+    bool rv = true;
+
+    // The easy handle of a handler in a WQC_MULTI belongs to the multi handle until the handler leaves it
+    if ( handler->call.multi || handler->call.step != WQC_STEP_NONE ) {
+        wqc_set_error(handler, WEBQC_HANDLER_BUSY);
+        rv = false;
+    }
+    return rv;
+}
+
+bool wqc_run_call(WQC *handler, enum wqc_call_step first_step)
+{
+    bool rv = wqc_handler_idle(handler);
+    enum wqc_call_step step = first_step;
+
+    if ( rv ) {
+        wqc_start_deadline(handler);
+        while ( rv && step != WQC_STEP_NONE ) {
+            int64_t wait = handler->call.resend ? handler->call.retry_at - wqc_monotonic_milliseconds() : 0;
+            if ( wait > 0 ) {
+                usleep(wait * 1000);
+            }
+            rv = wqc_start_call_step(handler, step);
+            if ( rv ) {
+                rv = wqc_finish_call_step(handler, make_web_call(handler));
+            }
+            if ( rv ) {
+                step = wqc_next_call_step(handler);
+            }
+        }
+        handler->call.step = WQC_STEP_NONE;
+    }
+
+    return rv;
+}
@@ -0,0 +1,703 @@
+#include <string.h>
+#include <stdlib.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#include <stdlib.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "webqc-handler.h"
+#include "webqc-web-access.h"
+#include "webqc-json.h"
+#include "webqc-errors.h"
+#include "webqc-metrics.h"
+#include "webqc-trace.h"
+#include "webqc-retry.h"
+#include "webqc-hedge.h"
+#include "webqc-calls.h"
+#include "libwebqc.h"
+
+#define ERI_FETCH_POLL_TIMEOUT (1000) /// How long to wait for any transfer to make progress, in milliseconds
+
+/// One ERI values blob of a job: first located using the eri_values endpoint, then downloaded
+struct ERI_blob_transfer {
+    const struct ERI_item_status *item; /// The sub-job that calculated the ERIs in the blob
+    CURL *curl; /// CURL handle running the HTTP call of the transfer
+    enum wqc_endpoint endpoint; /// Endpoint of the current HTTP call of the transfer, to time it
+    char URL[MAX_URL_SIZE]; /// URL of the current HTTP call of the transfer
+    char error_buffer[CURL_ERROR_SIZE]; /// Error message from libcURL
+    struct web_reply_buffer reply; /// Reply of the call that locates the blob
+    struct ERI_values_location location; /// Where the blob is, and what ERIs it has
+    struct download_buffer download; /// Where the blob is downloaded into
+    const char *inline_values; /// The blob, if the server sent it with the status or location, NULL otherwise
+    int retries; /// How many times the HTTP call of the transfer was made again after a temporary error
+    int64_t retry_delay; /// How long the transfer last waited before its HTTP call was made again, in milliseconds
+    int64_t retry_at; /// When the HTTP call that just failed is made again, on the monotonic clock
+    bool waiting; /// The HTTP call of the transfer failed, and waits until retry_at to be made again
+    wqc_trace_time_t trace_start; /// When the current HTTP call of the transfer started, for tracing
+    int64_t started_at; /// When the current HTTP call of the transfer started, on the monotonic clock
+    bool running; /// The HTTP call of the transfer is running
+    bool hedged; /// The current download was made again on a second CURL handle, because it was slow
+    CURL *hedge; /// CURL handle making the download again, NULL if it is not running
+    struct download_buffer hedge_download; /// Where the second call writes: the same data, into the same memory
+};
+
+/// State of fetching all the ERI values blobs of a job
+struct ERI_fetch {
+    WQC *handler; /// Handler the job was submitted on
+    CURLM *curl_multi; /// Runs the HTTP calls of all transfers concurrently
+    CURL **curl_handles; /// CURL handles created so far, at most twice max_parallel_downloads of the handler
+    int curl_handles_count; /// How many CURL handles were created
+    CURL **idle_handles; /// CURL handles that are not running a transfer
+    int idle_handles_count; /// How many CURL handles are not running a transfer
+    struct curl_slist *headers; /// HTTP headers of calls to the WebQC server
+    struct ERI_blob_transfer *transfers; /// All the transfers, in shell order
+    int transfers_count; /// How many transfers there are
+};
+
+/// Set up a CURL handle for the HTTP call of a transfer
+typedef bool (*prepare_transfer_func)(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer, CURL *curl);
+
+/// Process the reply of a successful HTTP call of a transfer
+typedef bool (*finish_transfer_func)(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer);
+
+
+static size_t collect_transfer_reply(void *data, size_t size, size_t nmemb, void *userp)
+{
+    return wqc_collect_downloaded_data(data, size * nmemb, &((struct ERI_blob_transfer *) userp)->reply);
+}
+
+//! Compare two ERI indices in shell order
+static int compare_shell_indices(const int *index_a, const int *index_b)
+{
+    int rv = 0;
+
+    for ( int i = 0 ; rv == 0 && i < 4 ; ++i ) {
+        rv = (index_a[i] > index_b[i]) - (index_a[i] < index_b[i]);
+    }
+
+    return rv;
+}
+
+static int compare_transfers(const void *a, const void *b)
+{
+    return compare_shell_indices(((const struct ERI_blob_transfer *) a)->item->range_begin,
+                                 ((const struct ERI_blob_transfer *) b)->item->range_begin);
+}
+
+//! Create a transfer for each sub-job of the job, sorted in shell order. All sub-jobs must be done.
+static bool create_transfers(struct ERI_fetch *fetch)
+{
+    WQC *handler = fetch->handler;
+    bool rv = true;
+
+    if ( handler->ERI_items_count == 0 ) {
+        wqc_set_error_with_message(handler, WEBQC_NOT_FETCHED, "No ERI sub-jobs are known, get the job status first");
+        rv = false;
+    } else if ( ! handler->eri_info.shell_to_function ) {
+        wqc_set_error_with_message(handler, WEBQC_NOT_FETCHED, "Integrals details are needed to fetch ERI values");
+        rv = false;
+    }
+
+    for ( int i = 0 ; rv && i < handler->ERI_items_count ; ++i ) {
+        if ( handler->eri_status[i].status != WQC_JOB_STATUS_DONE ) {
+            wqc_set_error_with_message(handler, WEBQC_NOT_FETCHED, "Not all ERI sub-jobs are done");
+            rv = false;
+        }
+    }
+
+    if ( rv ) {
+        fetch->transfers = calloc(handler->ERI_items_count, sizeof(struct ERI_blob_transfer));
+        if ( fetch->transfers ) {
+            fetch->transfers_count = handler->ERI_items_count;
+            for ( int i = 0 ; i < fetch->transfers_count ; ++i ) {
+                fetch->transfers[i].item = &handler->eri_status[i];
+                if ( handler->eri_status[i].values ) {
+                    // Sent with the status, so the blob is known without locating it
+                    struct ERI_blob_transfer *transfer = &fetch->transfers[i];
+                    transfer->inline_values = (const char *) transfer->item->values;
+                    memcpy(transfer->location.begin, transfer->item->range_begin, sizeof(eri_shell_index_t));
+                    memcpy(transfer->location.end, transfer->item->range_end, sizeof(eri_shell_index_t));
+                    transfer->location.precision = transfer->item->precision;
+                    transfer->location.size = transfer->item->values_size;
+                }
+            }
+            qsort(fetch->transfers, fetch->transfers_count, sizeof(struct ERI_blob_transfer), compare_transfers);
+        } else {
+            wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+            rv = false; // LCOV_EXCL_LINE
+        }
+    }
+
+    return rv;
+}
+
+static bool init_fetch(struct ERI_fetch *fetch, WQC *handler)
+{
+    bool rv = false;
+
+    memset(fetch, 0, sizeof(struct ERI_fetch));
+    fetch->handler = handler;
+    fetch->curl_multi = curl_multi_init();
+    // Each running transfer may have a hedged call too
+    fetch->curl_handles = calloc(2 * handler->max_parallel_downloads, sizeof(CURL *));
+    fetch->idle_handles = calloc(2 * handler->max_parallel_downloads, sizeof(CURL *));
+
+    if ( fetch->curl_multi && fetch->curl_handles && fetch->idle_handles ) {
+        rv = add_web_call_headers(handler, &fetch->headers);
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+
+    if ( rv ) {
+        rv = create_transfers(fetch);
+    }
+
+    return rv;
+}
+
+static void cleanup_fetch(struct ERI_fetch *fetch)
+{
+    for ( int i = 0 ; i < fetch->curl_handles_count ; ++i ) {
+        curl_multi_remove_handle(fetch->curl_multi, fetch->curl_handles[i]);
+        curl_easy_cleanup(fetch->curl_handles[i]);
+    }
+    for ( int i = 0 ; i < fetch->transfers_count ; ++i ) {
+        reset_reply_buffer(&fetch->transfers[i].reply);
+        free(fetch->transfers[i].location.values);
+    }
+    if ( fetch->curl_multi ) {
+        curl_multi_cleanup(fetch->curl_multi);
+    }
+    curl_slist_free_all(fetch->headers);
+    free(fetch->curl_handles);
+    free(fetch->idle_handles);
+    free(fetch->transfers);
+}
+
+//! Get a CURL handle to run a transfer on: an idle one if there is one, else a new one.
+static CURL *get_idle_handle(struct ERI_fetch *fetch)
+{
+    CURL *curl = NULL;
+
+    if ( fetch->idle_handles_count > 0 ) {
+        curl = fetch->idle_handles[--fetch->idle_handles_count];
+        curl_easy_reset(curl);
+    } else {
+        curl = curl_easy_init();
+        if ( curl ) {
+            fetch->curl_handles[fetch->curl_handles_count++] = curl;
+        } else {
+            wqc_set_error_with_message(fetch->handler, WEBQC_OUT_OF_MEMORY, "Cannot create a CURL handle"); // LCOV_EXCL_LINE
+        }
+    }
+
+    if ( curl ) {
+        setup_curl_handle(fetch->handler, curl);
+    }
+
+    return curl;
+}
+
+static bool start_transfer(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer, prepare_transfer_func prepare)
+{
+    CURL *curl = wqc_breaker_allows_call(fetch->handler) ? get_idle_handle(fetch) : NULL;
+    bool rv = (curl != NULL);
+
+    if ( rv ) {
+        transfer->trace_start = wqc_trace_begin(fetch->handler);
+        transfer->curl = curl;
+        transfer->error_buffer[0] = '\0';
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->error_buffer);
+        rv = prepare(fetch, transfer, curl) && wqc_set_call_timeout(fetch->handler, curl);
+        if ( rv ) {
+            CURLMcode res = curl_multi_add_handle(fetch->curl_multi, curl);
+            if ( res != CURLM_OK ) {
+                wqc_set_error_with_message(fetch->handler, WEBQC_WEB_CALL_ERROR, curl_multi_strerror(res)); // LCOV_EXCL_LINE
+                rv = false; // LCOV_EXCL_LINE
+            }
+        }
+        if ( rv ) {
+            transfer->started_at = wqc_monotonic_milliseconds();
+            transfer->running = true;
+            transfer->waiting = false;
+            transfer->hedged = false;
+            wqc_init_hedge_download(&transfer->hedge_download, &transfer->download);
+        }
+        if ( ! rv ) {
+            fetch->idle_handles[fetch->idle_handles_count++] = curl;
+        }
+    }
+
+    return rv;
+}
+
+//! Check the outcome of the HTTP call of a transfer, and set the error on the handler if it failed.
+static bool check_transfer_result(struct ERI_fetch *fetch, const struct ERI_blob_transfer *transfer, CURLcode res)
+{
+    bool rv = false;
+    long http_reply_code = 0;
+    curl_off_t retry_after = 0;
+
+    curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &http_reply_code);
+    curl_easy_getinfo(transfer->curl, CURLINFO_RETRY_AFTER, &retry_after);
+    // As for calls made on its own CURL handle, the handler keeps how the last call went, to find how long to wait before
+    // it is made again
+    fetch->handler->web_call_info.http_reply_code = (int) http_reply_code;
+    fetch->handler->web_call_info.curl_result = res;
+    fetch->handler->web_call_info.retry_after = (int64_t) retry_after * 1000;
+    wqc_breaker_record_call(fetch->handler, wqc_transient_failure(res, http_reply_code));
+
+    if ( res ) {
+        const char *additional_messages[] = {
+                transfer->URL,
+                transfer->error_buffer,
+                curl_easy_strerror(res),
+                NULL
+        };
+        wqc_set_error_with_messages(fetch->handler, wqc_web_call_error_code(fetch->handler, res), additional_messages);
+    } else {
+        if ( http_reply_code < 200 || http_reply_code >= 300 ) {
+            char http_error_code[4] = {0,0,0,0};
+            snprintf(http_error_code, sizeof(http_error_code), "%ld", http_reply_code);
+
+            const char *additional_messages[] = {
+                    transfer->URL,
+                    "HTTP Error Code: ",
+                    http_error_code,
+                    NULL
+            };
+            wqc_set_error_with_messages(fetch->handler, WEBQC_WEB_CALL_ERROR, additional_messages);
+        } else {
+            rv = true;
+        }
+    }
+
+    record_call_timing(fetch->handler, transfer->curl, transfer->endpoint, rv);
+    if ( fetch->handler->trace ) {
+        curl_off_t bytes = 0;
+        curl_easy_getinfo(transfer->curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+        wqc_trace_end_concurrent(fetch->handler,
+                                 transfer->endpoint == WQC_ENDPOINT_DOWNLOAD ? "download_blob" : "locate_blob",
+                                 transfer->trace_start, (unsigned int) (transfer - fetch->transfers), (size_t) bytes);
+    }
+
+    return rv;
+}
+
+//! Check whether the HTTP call of a transfer that failed can be made again: it met a temporary error, and was not made
+//! again as many times as the handler allows, WQC_OPTION_DOWNLOAD_RETRIES for blob downloads and
+//! WQC_OPTION_CALL_RETRIES for the calls that locate blobs. A download goes on from where it stopped.
+static bool transfer_retryable(struct ERI_fetch *fetch, const struct ERI_blob_transfer *transfer, CURLcode res)
+{
+    long http_reply_code = 0;
+    bool download = (transfer->endpoint == WQC_ENDPOINT_DOWNLOAD);
+    int allowed_retries = download ? fetch->handler->download_retries : fetch->handler->call_retries;
+
+    curl_easy_getinfo(transfer->curl, CURLINFO_RESPONSE_CODE, &http_reply_code);
+
+    return transfer->retries < allowed_retries &&
+           (! download || transfer->download.received < transfer->download.size) &&
+           wqc_transient_failure(res, http_reply_code);
+}
+
+//! Have the HTTP call of a transfer that just failed made again, once it waited as long as wqc_next_retry_delay()
+//! finds, so transfers that failed together are not made again together
+//! \return true if the call is made again, false if the wait would reach the deadline of the fetch (and sets error)
+static bool retry_transfer(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer)
+{
+    int64_t delay = wqc_next_retry_delay(fetch->handler, &transfer->retry_delay);
+    bool rv = wqc_deadline_allows_wait(fetch->handler, delay);
+
+    if ( rv ) {
+        transfer->retries++;
+        transfer->retry_at = wqc_monotonic_milliseconds() + delay;
+        transfer->waiting = true;
+        wqc_metrics_count(WQC_COUNTER_RETRIES, 1);
+    }
+    return rv;
+}
+
+//! Make again the HTTP calls of the transfers whose wait is over
+static bool start_waiting_transfers(struct ERI_fetch *fetch, prepare_transfer_func prepare)
+{
+    bool rv = true;
+    int64_t now = wqc_monotonic_milliseconds();
+
+    for ( int i = 0 ; rv && i < fetch->transfers_count ; ++i ) {
+        struct ERI_blob_transfer *transfer = &fetch->transfers[i];
+        if ( transfer->waiting && transfer->retry_at <= now ) {
+            rv = start_transfer(fetch, transfer, prepare);
+        }
+    }
+
+    return rv;
+}
+
+//! Find how long to wait for HTTP calls to make progress: no longer than the given timeout, nor until the next
+//! transfer is due to be made again
+static long waiting_timeout(const struct ERI_fetch *fetch, long timeout_milliseconds)
+{
+    int64_t now = wqc_monotonic_milliseconds();
+
+    for ( int i = 0 ; i < fetch->transfers_count ; ++i ) {
+        if ( fetch->transfers[i].waiting ) {
+            int64_t wait = fetch->transfers[i].retry_at - now;
+            wait = wait > 0 ? wait : 0;
+            if ( wait < timeout_milliseconds ) {
+                timeout_milliseconds = (long) wait;
+            }
+        }
+    }
+    return timeout_milliseconds;
+}
+
+//! Make a blob download again on a second CURL handle, because it is slow. The two calls write the same data into the
+//! same memory, from where the download started.
+static void start_hedge(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer)
+{
+    CURL *curl = get_idle_handle(fetch);
+
+    transfer->hedged = true;
+    if ( curl ) {
+        curl_easy_setopt(curl, CURLOPT_PRIVATE, transfer);
+        curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, transfer->error_buffer);
+        curl_easy_setopt(curl, CURLOPT_URL, transfer->URL);
+        wqc_set_download_buffer(curl, &transfer->hedge_download);
+        if ( wqc_set_call_timeout(fetch->handler, curl) && curl_multi_add_handle(fetch->curl_multi, curl) == CURLM_OK ) {
+            transfer->hedge = curl;
+            wqc_metrics_count(WQC_COUNTER_HEDGED_CALLS, 1);
+        } else {
+            fetch->idle_handles[fetch->idle_handles_count++] = curl; // LCOV_EXCL_LINE
+        }
+    }
+}
+
+//! Hedge the blob downloads that run for longer than the hedge delay, see wqc_hedge_delay()
+//! \return how long until the next download is due to be hedged, at most ERI_FETCH_POLL_TIMEOUT milliseconds
+static long start_hedges(struct ERI_fetch *fetch)
+{
+    int64_t delay = wqc_hedge_delay(fetch->handler, WQC_ENDPOINT_DOWNLOAD);
+    int64_t now = wqc_monotonic_milliseconds();
+    int64_t deadline = fetch->handler->call.deadline;
+    int64_t wait = ERI_FETCH_POLL_TIMEOUT;
+
+    for ( int i = 0 ; delay >= 0 && (deadline == 0 || now < deadline) && i < fetch->transfers_count ; ++i ) {
+        struct ERI_blob_transfer *transfer = &fetch->transfers[i];
+        if ( transfer->running && transfer->endpoint == WQC_ENDPOINT_DOWNLOAD && ! transfer->hedged ) {
+            int64_t due = transfer->started_at + delay - now;
+            if ( due <= 0 ) {
+                start_hedge(fetch, transfer);
+            } else if ( due < wait ) {
+                wait = due;
+            }
+        }
+    }
+
+    return (long) wait;
+}
+
+//! Settle which of the HTTP calls of a hedged transfer counts, once one of them is done: the first one to finish,
+//! unless it failed with a temporary error while the other one still runs. Transfers that are not hedged have only
+//! one call, which counts.
+//! \return true if the transfer is done with the call, false if its other call goes on
+static bool settle_hedged_transfer(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer, CURL *curl,
+                                   CURLcode res)
+{
+    long http_reply_code = 0;
+    bool is_hedge = (curl == transfer->hedge);
+    CURL *other = is_hedge ? transfer->curl : transfer->hedge;
+
+    curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &http_reply_code);
+    bool failed = wqc_transient_failure(res, http_reply_code);
+    bool rv = ! (other && failed);
+
+    if ( rv && other ) {
+        curl_multi_remove_handle(fetch->curl_multi, other);
+        fetch->idle_handles[fetch->idle_handles_count++] = other;
+    }
+    if ( is_hedge ) {
+        transfer->hedge = NULL;
+        if ( rv ) {
+            transfer->curl = curl;
+            wqc_take_hedge_download(&transfer->download, &transfer->hedge_download);
+            wqc_metrics_count(WQC_COUNTER_HEDGES_WON, failed ? 0 : 1);
+        }
+    } else if ( rv ) {
+        transfer->hedge = NULL;
+    } else {
+        // The hedge goes on alone, and is taken once it is done
+        transfer->curl = NULL;
+    }
+
+    return rv;
+}
+
+//! Process all the transfers whose HTTP call is done, and return their CURL handles to the idle list. Calls that
+//! failed with a temporary error wait to be made again, and still count as running.
+static bool process_done_transfers(struct ERI_fetch *fetch, finish_transfer_func finish, int *running)
+{
+    bool rv = true;
+    CURLMsg *message = NULL;
+    int messages_left = 0;
+
+    while ((message = curl_multi_info_read(fetch->curl_multi, &messages_left))) {
+        if (message->msg == CURLMSG_DONE) {
+            CURL *curl = message->easy_handle;
+            CURLcode result = message->data.result;
+            struct ERI_blob_transfer *transfer = NULL;
+
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&transfer);
+            curl_multi_remove_handle(fetch->curl_multi, curl);
+            fetch->idle_handles[fetch->idle_handles_count++] = curl;
+
+            if ( ! settle_hedged_transfer(fetch, transfer, curl, result) ) {
+                continue;
+            }
+            (*running)--;
+            transfer->running = false;
+
+            if ( rv && ! check_transfer_result(fetch, transfer, result) ) {
+                rv = transfer_retryable(fetch, transfer, result) && retry_transfer(fetch, transfer);
+                *running += rv ? 1 : 0;
+            } else if ( rv ) {
+                rv = finish(fetch, transfer);
+            }
+        }
+    }
+
+    return rv;
+}
+
+//! Run the HTTP calls of all transfers, at most max_parallel_downloads at once, until all are done or one fails.
+//! Transfers whose blob the server already sent need no calls.
+static bool run_transfers(struct ERI_fetch *fetch, prepare_transfer_func prepare, finish_transfer_func finish)
+{
+    bool rv = true;
+    int next_transfer = 0;
+    int running = 0;
+
+    while ( rv && (next_transfer < fetch->transfers_count || running > 0) ) {
+
+        while ( rv && next_transfer < fetch->transfers_count && running < fetch->handler->max_parallel_downloads ) {
+            struct ERI_blob_transfer *transfer = &fetch->transfers[next_transfer++];
+            if ( ! transfer->inline_values ) {
+                rv = start_transfer(fetch, transfer, prepare);
+                if ( rv ) {
+                    running++;
+                }
+            }
+        }
+
+        if ( rv ) {
+            rv = start_waiting_transfers(fetch, prepare);
+        }
+
+        if ( rv ) {
+            int still_running = 0;
+            CURLMcode res = curl_multi_perform(fetch->curl_multi, &still_running);
+            if ( res == CURLM_OK ) {
+                rv = process_done_transfers(fetch, finish, &running);
+            } else {
+                wqc_set_error_with_message(fetch->handler, WEBQC_WEB_CALL_ERROR, curl_multi_strerror(res)); // LCOV_EXCL_LINE
+                rv = false; // LCOV_EXCL_LINE
+            }
+        }
+
+        if ( rv && running > 0 ) {
+            curl_multi_poll(fetch->curl_multi, NULL, 0, (int) waiting_timeout(fetch, start_hedges(fetch)), NULL);
+        }
+    }
+
+    return rv;
+}
+
+static bool prepare_locate_blob(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer, CURL *curl)
+{
+    WQC *handler = fetch->handler;
+    char endpoint_URL[MAX_URL_SIZE];
+    const int *begin = transfer->item->range_begin;
+
+    bool rv = format_web_call_URL(handler, "eri_values", endpoint_URL);
+
+    if ( rv ) {
+        if (snprintf(transfer->URL, MAX_URL_SIZE, "%s?%s=%s&%s=%u_%u_%u_%u", endpoint_URL,
+                     "set_id", handler->parameter_set_id,
+                     "begin", begin[0], begin[1], begin[2], begin[3]) >= MAX_URL_SIZE) {
+            wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+            rv = false; // LCOV_EXCL_LINE
+        }
+    }
+
+    if ( rv && handler->max_inline_ERI_size > 0 ) {
+        size_t length = strlen(transfer->URL);
+        if (snprintf(&transfer->URL[length], MAX_URL_SIZE - length, "&inline_max=%d",
+                     handler->max_inline_ERI_size) >= MAX_URL_SIZE - length) {
+            wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+            rv = false; // LCOV_EXCL_LINE
+        }
+    }
+
+    if ( rv ) {
+        reset_reply_buffer(&transfer->reply);
+        transfer->endpoint = WQC_ENDPOINT_ERI_VALUES;
+        curl_easy_setopt(curl, CURLOPT_URL, transfer->URL);
+        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, fetch->headers);
+        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, collect_transfer_reply);
+        curl_easy_setopt(curl, CURLOPT_WRITEDATA, transfer);
+    }
+
+    return rv;
+}
+
+static bool finish_locate_blob(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer)
+{
+    bool rv = parse_ERI_values_location(fetch->handler, transfer->reply.reply, &transfer->location);
+
+    reset_reply_buffer(&transfer->reply);
+    transfer->inline_values = transfer->location.values;
+
+    return rv;
+}
+
+static bool prepare_download_blob(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer, CURL *curl)
+{
+    strncpy(transfer->URL, transfer->location.URL, MAX_URL_SIZE);
+    transfer->endpoint = WQC_ENDPOINT_DOWNLOAD;
+    curl_easy_setopt(curl, CURLOPT_URL, transfer->URL);
+    wqc_set_download_buffer(curl, &transfer->download);
+
+    return true;
+}
+
+static bool finish_download_blob(struct ERI_fetch *fetch, struct ERI_blob_transfer *transfer)
+{
+    bool rv = (transfer->download.received == transfer->download.size);
+
+    if ( ! rv ) {
+        const char *additional_messages[] = {
+                transfer->URL,
+                "ERI values blob is smaller than expected",
+                NULL
+        };
+        wqc_set_error_with_messages(fetch->handler, WEBQC_WEB_CALL_ERROR, additional_messages);
+    }
+
+    return rv;
+}
+
+//! Check that the located blobs hold consecutive ranges of ERIs, and find how much memory all of them take
+static bool check_locations(struct ERI_fetch *fetch, size_t *total_size)
+{
+    bool rv = true;
+
+    *total_size = 0;
+    for ( int i = 0 ; rv && i < fetch->transfers_count ; ++i ) {
+        const struct ERI_values_location *location = &fetch->transfers[i].location;
+
+        if ( i > 0 && compare_shell_indices(fetch->transfers[i-1].location.end, location->begin) != 0 ) {
+            wqc_set_error_with_message(fetch->handler, WEBQC_WEB_CALL_ERROR, "ERI values blobs are not contiguous");
+            rv = false;
+        }
+        *total_size += location->size;
+    }
+
+    return rv;
+}
+
+//! Download all located blobs into one memory area, each blob at its position in shell order
+static bool download_blobs(struct ERI_fetch *fetch, char *eri_data)
+{
+    size_t offset = 0;
+
+    for ( int i = 0 ; i < fetch->transfers_count ; ++i ) {
+        struct ERI_blob_transfer *transfer = &fetch->transfers[i];
+        transfer->download.data = &eri_data[offset];
+        transfer->download.size = transfer->location.size;
+        transfer->download.received = 0;
+        transfer->download.range_start = 0;
+        transfer->download.ranged = false;
+        transfer->retries = 0;
+        transfer->retry_delay = 0;
+        if ( transfer->inline_values ) {
+            memcpy(transfer->download.data, transfer->inline_values, transfer->location.size);
+            transfer->download.received = transfer->location.size;
+        }
+        offset += transfer->location.size;
+    }
+
+    return run_transfers(fetch, prepare_download_blob, finish_download_blob);
+}
+
+//! Replace the ERI values in the handler with the downloaded ones
+static void store_ERI_values(struct ERI_fetch *fetch, char *eri_data, size_t total_size)
+{
+    struct ERI_values *eri_values = &fetch->handler->eri_info.eri_values;
+    const struct ERI_blob_transfer *first = &fetch->transfers[0];
+    const struct ERI_blob_transfer *last = &fetch->transfers[fetch->transfers_count - 1];
+
+    free(eri_values->eri_values);
+    eri_values->eri_values = (double *) eri_data;
+    eri_values->eri_data_size = total_size;
+    memcpy(eri_values->begin_eri_index, first->location.begin, sizeof(eri_shell_index_t));
+    memcpy(eri_values->end_eri_index, last->location.end, sizeof(eri_shell_index_t));
+
+    eri_values->eri_precision = first->location.precision;
+    for ( int i = 1 ; i < fetch->transfers_count ; ++i ) {
+        if ( fetch->transfers[i].location.precision > eri_values->eri_precision ) {
+            eri_values->eri_precision = fetch->transfers[i].location.precision;
+        }
+    }
+    wqc_metrics_update_ERI_memory(fetch->handler);
+}
+
+bool
+wqc_fetch_all_ERI_values(WQC *handler)
+{
+    struct ERI_fetch fetch = {0};
+    size_t total_size = 0;
+    char *eri_data = NULL;
+    wqc_trace_time_t start = wqc_trace_begin(handler);
+
+    // The ERI values of a busy handler belong to its running operation
+    bool rv = wqc_handler_idle(handler);
+
+    if ( rv ) {
+        wqc_start_deadline(handler);
+        rv = init_fetch(&fetch, handler);
+    }
+
+    if ( rv ) {
+        rv = run_transfers(&fetch, prepare_locate_blob, finish_locate_blob);
+    }
+
+    if ( rv ) {
+        rv = check_locations(&fetch, &total_size);
+    }
+
+    if ( rv ) {
+        eri_data = malloc(total_size ? total_size : 1);
+        if ( ! eri_data ) {
+            wqc_set_error_with_message(handler, WEBQC_OUT_OF_MEMORY, "Not enough memory to read ERI values"); //LCOV_EXCL_LINE
+            rv = false; //LCOV_EXCL_LINE
+        }
+    }
+
+    if ( rv ) {
+        rv = download_blobs(&fetch, eri_data);
+    }
+
+    if ( rv ) {
+        store_ERI_values(&fetch, eri_data, total_size);
+    } else {
+        free(eri_data);
+    }
+
+    cleanup_fetch(&fetch);
+    wqc_trace_end(handler, "fetch_all_ERI_values", start);
+
+    return rv;
+}
@@ -1,5 +1,4 @@
 #include <string.h>
-#include <errno.h>
 
 #ifdef __APPLE__
 #include <malloc/malloc.h>
@@ -13,6 +12,9 @@
 #include "webqc-json.h"
 #include "webqc-errors.h"
 #include "libwebqc.h"
+#include "webqc-calls.h"
+#include "webqc-metrics.h"
+#include "webqc-trace.h"
 
 static void
 print_system_sizes(const struct ERI_information *eri, FILE *fp)
@@ -104,15 +106,16 @@ bool wqc_indices_equal(const eri_shell_index_t *eri_index_a, const eri_shell_ind
 }
 
 
-static int
+//! Position of a shell quartet in shell order. It goes past 32 bits for systems of a few hundred shells.
+static uint64_t
 shell_index_to_shell_order(WQC *handler, const eri_shell_index_t *eri_index)
 {
-    unsigned int n = handler->eri_info.number_of_shells;
-    unsigned int offset = 1;
-    unsigned int pos = 0;
+    uint64_t n = handler->eri_info.number_of_shells;
+    uint64_t offset = 1;
+    uint64_t pos = 0;
 
     for ( unsigned int i = 0 ; i < 4 ; i++ ) {
-        pos += offset * (*eri_index)[3-i];
+        pos += offset * (uint64_t) (*eri_index)[3-i];
         offset*=n;
     }
 
@@ -122,9 +125,9 @@ shell_index_to_shell_order(WQC *handler, const eri_shell_index_t *eri_index)
 static bool
 shell_available_in_handler(WQC *handler, const eri_shell_index_t *eri_index)
 {
-    unsigned int first_shell_position = shell_index_to_shell_order(handler, &handler->eri_info.eri_values.begin_eri_index);
-    unsigned int end_shell_position = shell_index_to_shell_order(handler, &handler->eri_info.eri_values.end_eri_index);
-    unsigned int idx_position = shell_index_to_shell_order(handler, eri_index);
+    uint64_t first_shell_position = shell_index_to_shell_order(handler, &handler->eri_info.eri_values.begin_eri_index);
+    uint64_t end_shell_position = shell_index_to_shell_order(handler, &handler->eri_info.eri_values.end_eri_index);
+    uint64_t idx_position = shell_index_to_shell_order(handler, eri_index);
     return idx_position >= first_shell_position && idx_position < end_shell_position;
 }
 
@@ -153,6 +156,48 @@ bool wqc_next_shell_index(
 }
 
 
+//! Number of ERI values of a shell quartet: the product of the number of functions in each of its shells
+static size_t quartet_values_count(WQC *handler, const eri_shell_index_t *eri_index)
+{
+    const unsigned int *shell_to_function = handler->eri_info.shell_to_function;
+    size_t count = 1;
+
+    for ( unsigned int i = 0 ; i < 4 ; ++i ) {
+        unsigned int shell = (*eri_index)[i];
+        count *= shell_to_function[shell + 1] - shell_to_function[shell];
+    }
+
+    return count;
+}
+
+//! Size in bytes of the ERI values of the shell quartets from begin to end (one after last), in shell order. A blob
+//! holds the values of its quartets one after another, so this is also where end starts in a blob that starts at begin.
+static size_t ERI_values_size(WQC *handler, const eri_shell_index_t *begin, const eri_shell_index_t *end)
+{
+    uint64_t begin_order = shell_index_to_shell_order(handler, begin);
+    uint64_t end_order = shell_index_to_shell_order(handler, end);
+    uint64_t quartets = end_order > begin_order ? end_order - begin_order : 0;
+    eri_shell_index_t eri_index;
+    size_t count = 0;
+
+    memcpy(eri_index, begin, sizeof(eri_shell_index_t));
+    for ( uint64_t i = 0 ; i < quartets ; ++i ) {
+        count += quartet_values_count(handler, (const eri_shell_index_t *) &eri_index);
+        wqc_next_shell_index(handler, &eri_index);
+    }
+
+    return count * sizeof(double);
+}
+
+//! Check whether the range of ERI values the call fetches is all inside a blob
+static bool call_range_in_blob(WQC *handler, const eri_shell_index_t *blob_begin, const eri_shell_index_t *blob_end)
+{
+    const struct wqc_call_state *call = &handler->call;
+
+    return shell_index_to_shell_order(handler, blob_begin) <= shell_index_to_shell_order(handler, &call->eri_index) &&
+           shell_index_to_shell_order(handler, &call->eri_range_end) <= shell_index_to_shell_order(handler, blob_end);
+}
+
 bool wqc_get_number_of_functions_in_shells(WQC *handler, const int *shells, int *number_of_functions, int n)
 {
     bool rv = true;
@@ -220,7 +265,7 @@ make_ERI_request_URI_parameters(WQC *handler, const eri_shell_index_t *shell_ran
 }
 
 bool
-wqc_fetch_ERI_values(WQC *handler, const eri_shell_index_t *shell_index)
+prepare_ERI_values_call(WQC *handler)
 {
     bool rv = false;
 
@@ -228,19 +273,190 @@ wqc_fetch_ERI_values(WQC *handler, const eri_shell_index_t *shell_index)
 
     if ( rv ) {
 
-        rv = make_ERI_request_URI_parameters(handler, shell_index );
+        rv = make_ERI_request_URI_parameters(handler, (const eri_shell_index_t *) &handler->call.eri_index );
 
         if (! rv ) {
             wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
         }
     }
+
     if ( rv ) {
-        rv = make_web_call(handler);
+        rv = prepare_inline_values_parameter(handler);
     }
 
-    if (rv) {
-        rv = update_eri_values(handler);
-        wqc_reset(handler);
+    return rv;
+}
+
+//! Replace the ERI values in the handler with ones that were just downloaded: the range the call fetches, if it has
+//! one, else the whole blob located
+static void store_ERI_values(WQC *handler, struct download_buffer *download, double precision)
+{
+    struct ERI_values *eri_values = &handler->eri_info.eri_values;
+    const struct wqc_call_state *call = &handler->call;
+    const struct ERI_values_location *location = &call->eri_location;
+
+    free(eri_values->eri_values);
+    eri_values->eri_values = (double *) download->data;
+    download->data = NULL;
+    eri_values->eri_data_size = download->size;
+    eri_values->eri_precision = precision;
+    memcpy(eri_values->begin_eri_index, call->eri_range ? call->eri_index : location->begin, sizeof(eri_shell_index_t));
+    memcpy(eri_values->end_eri_index, call->eri_range ? call->eri_range_end : location->end, sizeof(eri_shell_index_t));
+    wqc_metrics_update_ERI_memory(handler);
+}
+
+//! Check whether an index is that of a shell quartet of the system, or, for the end of a range, the end of all of them
+static bool shell_index_in_system(WQC *handler, const eri_shell_index_t *eri_index, bool range_end)
+{
+    int number_of_shells = (int) handler->eri_info.number_of_shells;
+    bool rv = true;
+
+    for ( unsigned int i = 0 ; i < 4 ; ++i ) {
+        rv = rv && (*eri_index)[i] >= 0 && (*eri_index)[i] < number_of_shells;
+    }
+    // wqc_next_shell_index() goes from the last quartet to the end of all of them
+    if ( ! rv && range_end ) {
+        rv = (*eri_index)[0] == number_of_shells && (*eri_index)[1] == 0 && (*eri_index)[2] == 0 &&
+             (*eri_index)[3] == 0;
+    }
+
+    return rv;
+}
+
+//! Replace the ERI values in the handler with the range the call fetches, cut out of the values of a whole blob
+//! \return true on success, false if the blob is too small for the range or out of memory (and sets error on the
+//! handler)
+static bool store_ERI_values_range(WQC *handler, const char *blob_values, size_t blob_size,
+                                   const eri_shell_index_t *blob_begin, double precision)
+{
+    const struct wqc_call_state *call = &handler->call;
+    bool in_system = shell_index_in_system(handler, blob_begin, false);
+    size_t offset = in_system ? ERI_values_size(handler, blob_begin, &call->eri_index) : 0;
+    struct download_buffer range = {NULL, ERI_values_size(handler, &call->eri_index, &call->eri_range_end)};
+    bool rv = false;
+
+    // Where the range is in the blob comes from the basis, and the blob from the server: they must agree
+    if ( ! in_system || offset > blob_size || range.size > blob_size - offset ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "ERI values blob is smaller than expected");
+    } else if ( (range.data = malloc(range.size ? range.size : 1)) ) {
+        memcpy(range.data, blob_values + offset, range.size);
+        range.received = range.size;
+        store_ERI_values(handler, &range, precision);
+        rv = true;
+    } else {
+        wqc_set_error_with_message(handler, WEBQC_OUT_OF_MEMORY, "Not enough memory to read ERI values"); //LCOV_EXCL_LINE
+    }
+
+    return rv;
+}
+
+//! Take the ERI values of the sub-job that starts at an index from its status, if the server sent them with it
+//! \return true if the values were taken, or found not to match the sub-job (and then rv is false and error is set
+//! on the handler), false if they must be fetched from the server
+static bool take_ERI_values_from_status(WQC *handler, const eri_shell_index_t *shell_index, bool *rv)
+{
+    const struct ERI_item_status *item = NULL;
+    struct ERI_values *eri_values = &handler->eri_info.eri_values;
+
+    for ( int i = 0 ; ! item && i < handler->ERI_items_count ; ++i ) {
+        if ( handler->eri_status[i].values &&
+             memcmp(handler->eri_status[i].range_begin, shell_index, sizeof(eri_shell_index_t)) == 0 ) {
+            item = &handler->eri_status[i];
+        }
+    }
+
+    // Without the integrals details the size of the sub-job is not known, and its values are taken as they are
+    bool matching = ! item || ! handler->eri_info.shell_to_function ||
+                    ( shell_index_in_system(handler, &item->range_begin, false) &&
+                      shell_index_in_system(handler, &item->range_end, true) &&
+                      item->values_size == ERI_values_size(handler, &item->range_begin, &item->range_end) );
+    if ( ! matching ) {
+        wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "ERI values in status do not match their size");
+        *rv = false;
+    }
+
+    double *values = item && matching ? malloc(item->values_size ? item->values_size : 1) : NULL;
+    if ( values ) {
+        memcpy(values, item->values, item->values_size);
+        free(eri_values->eri_values);
+        eri_values->eri_values = values;
+        eri_values->eri_data_size = item->values_size;
+        eri_values->eri_precision = item->precision;
+        memcpy(eri_values->begin_eri_index, item->range_begin, sizeof(eri_shell_index_t));
+        memcpy(eri_values->end_eri_index, item->range_end, sizeof(eri_shell_index_t));
+        wqc_metrics_update_ERI_memory(handler);
+    }
+
+    return values != NULL || ! matching;
+}
+
+//! Take the range of ERI values the call fetches from the status of the sub-job it is in, if the server sent the
+//! values of the sub-job with it
+//! \return true if the values were taken, false if they must be fetched from the server
+static bool take_ERI_range_from_status(WQC *handler, bool *rv)
+{
+    const struct ERI_item_status *item = NULL;
+
+    for ( int i = 0 ; ! item && i < handler->ERI_items_count ; ++i ) {
+        const struct ERI_item_status *status = &handler->eri_status[i];
+        if ( status->values && call_range_in_blob(handler, &status->range_begin, &status->range_end) ) {
+            item = status;
+        }
+    }
+
+    if ( item ) {
+        *rv = store_ERI_values_range(handler, (const char *) item->values, item->values_size, &item->range_begin,
+                                     item->precision);
+    }
+
+    return item != NULL;
+}
+
+bool
+wqc_fetch_ERI_range(WQC *handler, const eri_shell_index_t *begin, const eri_shell_index_t *end)
+{
+    bool rv = false;
+
+    if ( ! wqc_handler_idle(handler) ) {
+        // The call state and the ERI values of a busy handler belong to its running operation
+    } else if ( ! handler->eri_info.shell_to_function ) {
+        wqc_set_error_with_message(handler, WEBQC_NOT_FETCHED,
+                                   "Integrals details are needed to fetch a range of ERI values");
+    } else if ( ! shell_index_in_system(handler, begin, false) || ! shell_index_in_system(handler, end, true) ) {
+        wqc_set_error_with_message(handler, WEBQC_BAD_OPTION_VALUE,
+                                   "Shell index of ERI values to fetch is out of range");
+    } else if ( shell_index_to_shell_order(handler, begin) >= shell_index_to_shell_order(handler, end) ) {
+        wqc_set_error_with_message(handler, WEBQC_BAD_OPTION_VALUE, "Range of ERI values to fetch is empty");
+    } else {
+        memcpy(handler->call.eri_index, begin, sizeof(eri_shell_index_t));
+        memcpy(handler->call.eri_range_end, end, sizeof(eri_shell_index_t));
+        handler->call.eri_range = true;
+
+        wqc_trace_time_t start = wqc_trace_begin(handler);
+        if ( ! take_ERI_range_from_status(handler, &rv) ) {
+            rv = wqc_run_call(handler, WQC_STEP_GET_ERI_VALUES);
+        }
+        wqc_trace_end(handler, "fetch_ERI_range", start);
+    }
+
+    return rv;
+}
+
+bool
+wqc_fetch_ERI_values(WQC *handler, const eri_shell_index_t *shell_index)
+{
+    // The call state and the ERI values of a busy handler belong to its running operation
+    bool rv = wqc_handler_idle(handler);
+
+    if ( rv ) {
+        memcpy(handler->call.eri_index, shell_index, sizeof(eri_shell_index_t));
+        handler->call.eri_range = false;
+
+        wqc_trace_time_t start = wqc_trace_begin(handler);
+        if ( ! take_ERI_values_from_status(handler, shell_index, &rv) ) {
+            rv = wqc_run_call(handler, WQC_STEP_GET_ERI_VALUES);
+        }
+        wqc_trace_end(handler, "fetch_ERI_values", start);
     }
 
     return rv;
@@ -254,6 +470,7 @@ static bool allocate_memory_for_ERIs(WQC *handler)
     free(handler->eri_info.eri_values.eri_values);
 
     handler->eri_info.eri_values.eri_values = malloc (handler->eri_info.eri_values.eri_data_size);
+    wqc_metrics_update_ERI_memory(handler);
 
     if ( ! handler->eri_info.eri_values.eri_values ) {
         wqc_set_error_with_message(handler, WEBQC_OUT_OF_MEMORY, "Not enough memory to read ERI values"); //LCOV_EXCL_LINE
@@ -279,64 +496,94 @@ bool read_ERI_values_from_file(WQC *handler, FILE *fp)
 }
 
 
-static bool download_ERI_values(WQC *handler, const char *URL)
+bool prepare_ERI_values_download(WQC *handler)
+{
+    bool rv = false;
+    struct download_buffer *download = &handler->call.download;
+    struct wqc_call_state *call = &handler->call;
+
+    // A download that broke off goes on into the same buffer, from where it stopped
+    if ( ! call->resume_download ) {
+        download->size = call->eri_range ? ERI_values_size(handler, &call->eri_index, &call->eri_range_end)
+                                         : call->eri_location.size;
+        download->received = 0;
+        download->ranged = call->eri_range;
+        // Only the bytes of a range are downloaded, from where the range starts in the blob
+        download->range_start = call->eri_range ? ERI_values_size(handler, &call->eri_location.begin, &call->eri_index)
+                                                : 0;
+        download->data = malloc(download->size ? download->size : 1);
+        call->download_retries = 0;
+    }
+
+    if ( ! download->data ) {
+        wqc_set_error_with_message(handler, WEBQC_OUT_OF_MEMORY, "Not enough memory to read ERI values"); //LCOV_EXCL_LINE
+    } else {
+        rv = prepare_buffer_download(handler, call->eri_location.URL, download);
+    }
+    return rv;
+}
+
+bool finish_ERI_values_download(WQC *handler)
 {
     bool rv = false;
-    FILE *fp = tmpfile();
-    if ( ! fp ) {
-        const char * messages[] = { "Cannot open temporary ERI values file" , strerror(errno), NULL} ; // LCOV_EXCL_LINE
-        wqc_set_error_with_messages(handler, WEBQC_IO_ERROR, messages); // LCOV_EXCL_LINE
+    struct download_buffer *download = &handler->call.download;
+
+    if ( download->received != download->size ) {
+        const char * messages[] = { handler->call.eri_location.URL, "ERI values blob is smaller than expected", NULL};
+        wqc_set_error_with_messages(handler, WEBQC_WEB_CALL_ERROR, messages);
     } else {
-        rv = wqc_download_file(handler, URL, fp);
-        if ( rv ) {
-            fflush(fp);
-            if ( fseek(fp, 0L, SEEK_SET) < 0 ) {
-                const char * messages[] = { "Cannot rewind temporary ERI values file" , strerror(errno), NULL}; // LCOV_EXCL_LINE
-                wqc_set_error_with_messages(handler, WEBQC_IO_ERROR, messages);// LCOV_EXCL_LINE
-            } else {
-                rv = read_ERI_values_from_file(handler, fp);
-            }
-        }
-        fclose(fp);
+        store_ERI_values(handler, download, handler->call.eri_location.precision);
+        rv = true;
     }
     return rv;
 }
 
 
-bool update_eri_values(WQC *handler)
+bool parse_ERI_values_location(WQC *handler, const char *reply, struct ERI_values_location *location)
 {
     bool rv = false;
     cJSON *reply_json = NULL;
     cJSON *begin_info = NULL;
     cJSON *end_info = NULL;
-    char ERI_URL[MAX_URL_SIZE];
+    int size = 0;
 
-    rv = parse_JSON_reply(handler, &reply_json);
+    rv = parse_JSON_text(handler, reply, &reply_json);
 
     if ( rv ) {
 
         struct json_field_info fields[] = {
-            {"raw_data_url", WQC_JSON_STRING, ERI_URL, sizeof(ERI_URL)},
+            {"raw_data_url", WQC_JSON_STRING, location->URL, sizeof(location->URL)},
             {"begin",        WQC_JSON_ARRAY,  &begin_info},
             {"end",          WQC_JSON_ARRAY,  &end_info},
-            {"precision",    WQC_JSON_NUMBER, &handler->eri_info.eri_values.eri_precision},
-            {"size",    WQC_JSON_INT, &handler->eri_info.eri_values.eri_data_size},
+            {"precision",    WQC_JSON_NUMBER, &location->precision},
+            {"size",         WQC_JSON_INT,    &size},
             {NULL}
         };
 
         rv = extract_json_fields(handler, reply_json, fields);
+        location->size = size;
     }
 
     if (rv) {
-        rv = parse_int_array(handler, begin_info, handler->eri_info.eri_values.begin_eri_index, 4);
+        rv = parse_int_array(handler, begin_info, location->begin, 4);
     }
 
     if ( rv ) {
-        rv = parse_int_array(handler, end_info, handler->eri_info.eri_values.end_eri_index , 4);
+        rv = parse_int_array(handler, end_info, location->end, 4);
     }
 
     if ( rv ) {
-        rv = download_ERI_values(handler, ERI_URL);
+        // A server asked for it sends a small blob with its location, and it need not be downloaded
+        size_t values_size = 0;
+        free(location->values);
+        rv = get_base64_from_JSON(handler, reply_json, "values", &location->values, &values_size);
+        if ( rv && location->values && values_size != location->size ) {
+            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, "ERI values in reply do not match their size");
+            rv = false;
+        }
+        if ( rv && location->values ) {
+            wqc_metrics_count(WQC_COUNTER_ERI_BYTES_DOWNLOADED, values_size);
+        }
     }
 
     if ( reply_json ) {
@@ -345,3 +592,27 @@ bool update_eri_values(WQC *handler)
 
     return rv;
 }
+
+bool update_eri_values(WQC *handler)
+{
+    struct ERI_values_location *location = &handler->call.eri_location;
+    bool rv = parse_ERI_values_location(handler, handler->web_call_info.web_reply.reply, location);
+
+    if ( rv && handler->call.eri_range && ! call_range_in_blob(handler, &location->begin, &location->end) ) {
+        wqc_set_error_with_message(handler, WEBQC_NOT_IMPLEMENTED,
+                                   "Range of ERI values to fetch is in more than one sub-job");
+        rv = false;
+    }
+
+    if ( rv && location->values && handler->call.eri_range ) {
+        rv = store_ERI_values_range(handler, location->values, location->size, &location->begin, location->precision);
+        handler->call.operation_done = true;
+    } else if ( rv && location->values ) {
+        struct download_buffer inline_values = {location->values, location->size, location->size};
+        location->values = NULL;
+        store_ERI_values(handler, &inline_values, location->precision);
+        handler->call.operation_done = true;
+    }
+
+    return rv;
+}
@@ -3,6 +3,7 @@
 #include "webqc-errors.h"
 #include "webqc-handler.h"
 #include "libwebqc.h"
+#include "webqc-metrics.h"
 
 static struct webqc_error_strings {
     error_code_t error_code;
@@ -37,6 +38,18 @@ static struct webqc_error_strings {
             WEBQC_IO_ERROR,
             "I/O error"
         },
+        {
+            WEBQC_HANDLER_BUSY,
+            "An operation is already running on the handler"
+        },
+        {
+            WEBQC_SERVER_UNAVAILABLE,
+            "The server is unavailable, after too many calls to it failed"
+        },
+        {
+            WEBQC_TIMEOUT,
+            "The operation did not finish in time"
+        },
 };
 
 
@@ -57,6 +70,7 @@ wqc_get_error_by_code(error_code_t error_code)
 void wqc_set_error(WQC *handler, error_code_t code)
 {
     handler->return_value.error_code = code;
+    wqc_metrics_count_error(code);
     const char *error_message = wqc_get_error_by_code(code);
     strncpy(handler->return_value.error_message, error_message, MAX_WEBQC_ERROR_MESSAGE_LEN);
 }
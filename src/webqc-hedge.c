@@ -0,0 +1,71 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-hedge.h"
+
+
+void wqc_record_latency(WQC *handler, enum wqc_endpoint endpoint, double seconds)
+{
+    if ( endpoint < WQC_ENDPOINTS_COUNT ) {
+        struct wqc_latency_samples *samples = &handler->web_call_info.latency[endpoint];
+
+        samples->seconds[samples->next] = seconds;
+        samples->next = (samples->next + 1) % WQC_LATENCY_SAMPLES;
+        if ( samples->count < WQC_LATENCY_SAMPLES ) {
+            samples->count++;
+        }
+    }
+}
+
+static int compare_seconds(const void *a, const void *b)
+{
+    double seconds_a = *(const double *) a;
+    double seconds_b = *(const double *) b;
+
+    return (seconds_a > seconds_b) - (seconds_a < seconds_b);
+}
+
+int64_t wqc_hedge_delay(const WQC *handler, enum wqc_endpoint endpoint)
+{
+    int64_t delay = -1;
+
+    if ( handler->hedge_percentile > 0 && endpoint < WQC_ENDPOINTS_COUNT &&
+         handler->web_call_info.latency[endpoint].count >= WQC_HEDGE_MIN_SAMPLES ) {
+        const struct wqc_latency_samples *samples = &handler->web_call_info.latency[endpoint];
+        double sorted[WQC_LATENCY_SAMPLES];
+
+        memcpy(sorted, samples->seconds, samples->count * sizeof(double));
+        qsort(sorted, samples->count, sizeof(double), compare_seconds);
+        // Nearest rank: the shortest time that at least the percentile of the calls took no longer than
+        int rank = (handler->hedge_percentile * samples->count + 99) / 100;
+        delay = (int64_t) (sorted[rank - 1] * 1000) + 1;
+    }
+
+    return delay;
+}
+
+void wqc_init_hedge_download(struct download_buffer *hedge, const struct download_buffer *download)
+{
+    memset(hedge, 0, sizeof(struct download_buffer));
+    hedge->data = download->data;
+    hedge->size = download->size;
+    hedge->received = download->received;
+    hedge->range_start = download->range_start;
+    hedge->ranged = download->ranged;
+}
+
+void wqc_take_hedge_download(struct download_buffer *download, const struct download_buffer *hedge)
+{
+    // Both calls wrote the same bytes of the same range, from the same place
+    assert(hedge->data == download->data && hedge->range_start == download->range_start &&
+           hedge->ranged == download->ranged);
+    download->received = hedge->received;
+}
+
+void wqc_reset_latency(WQC *handler)
+{
+    memset(handler->web_call_info.latency, 0, sizeof(handler->web_call_info.latency));
+}
@@ -0,0 +1,189 @@
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-metrics.h"
+
+#define JSON_PARSE_BUCKETS_COUNT (6) /// Number of finite buckets in the JSON parse time histogram
+
+/// Name and help text of a metric
+struct metric_info {
+    const char *name; /// Metric name
+    const char *help; /// What the metric measures
+};
+
+static const struct metric_info counters_info[WQC_COUNTERS_COUNT] = {
+    {"wqc_jobs_submitted_total", "Jobs submitted to the WebQC server"},
+    {"wqc_duplicate_jobs_total", "Submitted jobs that were duplicates of earlier jobs"},
+    {"wqc_status_polls_total", "Job status calls"},
+    {"wqc_status_polls_unchanged_total", "Job status calls that found no newly finished ERI sub-jobs"},
+    {"wqc_eri_downloaded_bytes_total", "Bytes of ERI values downloaded"},
+    {"wqc_retries_total", "Web calls made again after a failure"},
+    {"wqc_circuit_breaker_opened_total", "Times calls to a server were stopped after too many of them failed"},
+    {"wqc_hedged_calls_total", "Slow web calls made again on a second connection"},
+    {"wqc_hedged_calls_won_total", "Hedged web calls whose second call was answered first"},
+};
+
+static const char *endpoint_names[WQC_ENDPOINTS_COUNT] = {"job", "params", "eri", "int_info", "eri_values", "download",
+                                                          "submit", "submit_batch", "status_batch"};
+
+static const double JSON_parse_buckets[JSON_PARSE_BUCKETS_COUNT] = {1e-5, 1e-4, 1e-3, 1e-2, 1e-1, 1.0};
+
+/// All metrics of the process
+static struct {
+    atomic_ulong counters[WQC_COUNTERS_COUNT];
+    atomic_ulong errors[WQC_METRICS_ERROR_CODES];
+    atomic_ulong web_calls[WQC_ENDPOINTS_COUNT];
+    atomic_ulong failed_web_calls[WQC_ENDPOINTS_COUNT];
+    atomic_ulong JSON_parse_buckets[JSON_PARSE_BUCKETS_COUNT + 1]; // Last bucket is +Inf
+    atomic_ullong JSON_parse_nanoseconds;
+    atomic_llong ERI_memory;
+} metrics;
+
+void wqc_metrics_count(enum wqc_counter counter, unsigned long amount)
+{
+    atomic_fetch_add_explicit(&metrics.counters[counter], amount, memory_order_relaxed);
+}
+
+void wqc_metrics_count_error(error_code_t code)
+{
+    if (code != WEBQC_SUCCESS && code < WQC_METRICS_ERROR_CODES) {
+        atomic_fetch_add_explicit(&metrics.errors[code], 1, memory_order_relaxed);
+    }
+}
+
+void wqc_metrics_count_web_call(enum wqc_endpoint endpoint, bool succeeded)
+{
+    if (endpoint < WQC_ENDPOINTS_COUNT) {
+        atomic_fetch_add_explicit(&metrics.web_calls[endpoint], 1, memory_order_relaxed);
+        if (!succeeded) {
+            atomic_fetch_add_explicit(&metrics.failed_web_calls[endpoint], 1, memory_order_relaxed);
+        }
+    }
+}
+
+void wqc_metrics_observe_JSON_parse(double seconds)
+{
+    int bucket = 0;
+
+    while (bucket < JSON_PARSE_BUCKETS_COUNT && seconds > JSON_parse_buckets[bucket]) {
+        bucket++;
+    }
+    atomic_fetch_add_explicit(&metrics.JSON_parse_buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&metrics.JSON_parse_nanoseconds, (unsigned long long) (seconds * 1e9),
+                              memory_order_relaxed);
+}
+
+void wqc_metrics_update_ERI_memory(WQC *handler)
+{
+    const struct ERI_values *eri_values = &handler->eri_info.eri_values;
+    size_t held = eri_values->eri_values ? eri_values->eri_data_size : 0;
+
+    atomic_fetch_add_explicit(&metrics.ERI_memory, (long long) held - (long long) handler->eri_memory_metered,
+                              memory_order_relaxed);
+    handler->eri_memory_metered = held;
+}
+
+/// Text written so far into a caller's buffer
+struct metrics_text {
+    char *buffer; /// Caller's buffer
+    size_t size; /// Size of the caller's buffer
+    size_t length; /// Length of the whole text, even the part that did not fit in the buffer
+};
+
+static void append(struct metrics_text *text, const char *format, ...)
+{
+    va_list arguments;
+    char *position = text->length < text->size ? text->buffer + text->length : NULL;
+    size_t room = text->length < text->size ? text->size - text->length : 0;
+
+    va_start(arguments, format);
+    int length = vsnprintf(position, room, format, arguments);
+    va_end(arguments);
+
+    if (length > 0) {
+        text->length += length;
+    }
+}
+
+static void append_header(struct metrics_text *text, const struct metric_info *info, const char *type)
+{
+    append(text, "# HELP %s %s\n# TYPE %s %s\n", info->name, info->help, info->name, type);
+}
+
+static unsigned long load(atomic_ulong *value)
+{
+    return atomic_load_explicit(value, memory_order_relaxed);
+}
+
+static void append_web_calls(struct metrics_text *text)
+{
+    static const struct metric_info calls_info = {"wqc_web_calls_total", "Web calls made, per endpoint"};
+    static const struct metric_info failed_info = {"wqc_web_call_failures_total",
+                                                   "Web calls that failed with a network or HTTP error, per endpoint"};
+
+    append_header(text, &calls_info, "counter");
+    for (int i = 0; i < WQC_ENDPOINTS_COUNT; ++i) {
+        append(text, "%s{endpoint=\"%s\"} %lu\n", calls_info.name, endpoint_names[i], load(&metrics.web_calls[i]));
+    }
+    append_header(text, &failed_info, "counter");
+    for (int i = 0; i < WQC_ENDPOINTS_COUNT; ++i) {
+        append(text, "%s{endpoint=\"%s\"} %lu\n", failed_info.name, endpoint_names[i],
+               load(&metrics.failed_web_calls[i]));
+    }
+}
+
+static void append_errors(struct metrics_text *text)
+{
+    static const struct metric_info errors_info = {"wqc_errors_total", "Errors set on handlers, per error code"};
+
+    append_header(text, &errors_info, "counter");
+    for (int code = 1; code < WQC_METRICS_ERROR_CODES; ++code) {
+        unsigned long count = load(&metrics.errors[code]);
+        if (count > 0 || code <= WEBQC_TIMEOUT) {
+            append(text, "%s{code=\"%d\"} %lu\n", errors_info.name, code, count);
+        }
+    }
+}
+
+static void append_JSON_parse_histogram(struct metrics_text *text)
+{
+    static const struct metric_info parse_info = {"wqc_json_parse_seconds", "Time to parse JSON replies"};
+    unsigned long cumulative = 0;
+
+    append_header(text, &parse_info, "histogram");
+    for (int bucket = 0; bucket < JSON_PARSE_BUCKETS_COUNT; ++bucket) {
+        cumulative += load(&metrics.JSON_parse_buckets[bucket]);
+        append(text, "%s_bucket{le=\"%g\"} %lu\n", parse_info.name, JSON_parse_buckets[bucket], cumulative);
+    }
+    cumulative += load(&metrics.JSON_parse_buckets[JSON_PARSE_BUCKETS_COUNT]);
+    append(text, "%s_bucket{le=\"+Inf\"} %lu\n", parse_info.name, cumulative);
+    append(text, "%s_sum %.9f\n", parse_info.name,
+           atomic_load_explicit(&metrics.JSON_parse_nanoseconds, memory_order_relaxed) * 1e-9);
+    append(text, "%s_count %lu\n", parse_info.name, cumulative);
+}
+
+size_t wqc_metrics_dump(char *buffer, size_t size)
+{
+    static const struct metric_info memory_info = {"wqc_eri_values_memory_bytes",
+                                                   "Memory held by ERI values in all handlers"};
+    struct metrics_text text = {buffer, size, 0};
+
+    if (buffer && size > 0) {
+        buffer[0] = '\0';
+    }
+
+    for (int i = 0; i < WQC_COUNTERS_COUNT; ++i) {
+        append_header(&text, &counters_info[i], "counter");
+        append(&text, "%s %lu\n", counters_info[i].name, load(&metrics.counters[i]));
+    }
+    append_header(&text, &memory_info, "gauge");
+    append(&text, "%s %lld\n", memory_info.name, atomic_load_explicit(&metrics.ERI_memory, memory_order_relaxed));
+    append_web_calls(&text);
+    append_errors(&text);
+    append_JSON_parse_histogram(&text);
+
+    return text.length;
+}
@@ -0,0 +1,386 @@
+#include <string.h>
+#include <assert.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#include <stdlib.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-web-access.h"
+#include "webqc-calls.h"
+#include "webqc-retry.h"
+
+#define WQC_MULTI_POSITION_DONE (-1) /// Position of a handler whose operation is done, in the multi handle's running list
+#define WQC_MULTI_POSITION_WAITING (-2) /// Position of a handler waiting to make a failed call again
+
+/// A list of handlers, that grows as needed
+struct handlers_list {
+    WQC **handlers; /// The handlers in the list
+    int count; /// How many handlers are in the list
+    int capacity; /// How many handlers the list can hold before it has to grow
+};
+
+/**
+ * @brief Internal structure that runs API operations of many handlers concurrently.
+ */
+struct webqc_multi_t {
+    CURLM *curl_multi; /// libcURL multi handle that performs the HTTP calls of all handlers
+    struct handlers_list running; /// Handlers whose operation is running
+    struct handlers_list waiting; /// Handlers whose operation is running, waiting to make a call that failed again
+    struct handlers_list done; /// Handlers whose operation is done, but were not returned by wqc_multi_next_done yet
+    int next_done; /// Position in the done list of the next handler to return from wqc_multi_next_done
+};
+
+
+static bool add_to_list(struct handlers_list *list, WQC *handler)
+{
+    bool rv = true;
+
+    if (list->count == list->capacity) {
+        int new_capacity = list->capacity ? list->capacity * 2 : 16;
+        WQC **handlers = realloc(list->handlers, new_capacity * sizeof(WQC *));
+        if (handlers) {
+            list->handlers = handlers;
+            list->capacity = new_capacity;
+        } else {
+            rv = false; // LCOV_EXCL_LINE
+        }
+    }
+
+    if (rv) {
+        list->handlers[list->count++] = handler;
+    }
+
+    return rv;
+}
+
+static void add_running_handler(WQC_MULTI *multi, WQC *handler)
+{
+    handler->call.multi = multi;
+    handler->call.multi_position = multi->running.count;
+    if (!add_to_list(&multi->running, handler)) {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+}
+
+static void remove_running_handler(WQC_MULTI *multi, WQC *handler)
+{
+    int position = handler->call.multi_position;
+    WQC *last = multi->running.handlers[--multi->running.count];
+
+    assert(multi->running.handlers[position] == handler);
+
+    multi->running.handlers[position] = last;
+    last->call.multi_position = position;
+    handler->call.multi = NULL;
+}
+
+//! Remove a handler whose operation is done, but was not returned by wqc_multi_next_done yet
+static void remove_done_handler(WQC_MULTI *multi, WQC *handler)
+{
+    for (int i = multi->next_done; i < multi->done.count; ++i) {
+        if (multi->done.handlers[i] == handler) {
+            multi->done.handlers[i] = NULL;
+        }
+    }
+    handler->call.multi = NULL;
+}
+
+static bool add_waiting_handler(WQC_MULTI *multi, WQC *handler)
+{
+    bool rv = add_to_list(&multi->waiting, handler);
+
+    if (rv) {
+        handler->call.multi = multi;
+        handler->call.multi_position = WQC_MULTI_POSITION_WAITING;
+    } else {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+    }
+    return rv;
+}
+
+static void remove_waiting_handler(WQC_MULTI *multi, int position)
+{
+    WQC *handler = multi->waiting.handlers[position];
+
+    multi->waiting.handlers[position] = multi->waiting.handlers[--multi->waiting.count];
+    handler->call.multi = NULL;
+}
+
+static void add_done_handler(WQC_MULTI *multi, WQC *handler, bool success)
+{
+    handler->call.step = WQC_STEP_NONE;
+    if (success) {
+        handler->return_value = init_webqc_return_value();
+    }
+    if (add_to_list(&multi->done, handler)) {
+        handler->call.multi = multi;
+        handler->call.multi_position = WQC_MULTI_POSITION_DONE;
+    }
+}
+
+//! Start one step of the operation on the handler, and add its HTTP call to the multi handle
+static bool start_step(WQC_MULTI *multi, WQC *handler, enum wqc_call_step step)
+{
+    bool rv = wqc_start_call_step(handler, step);
+
+    if (rv) {
+        curl_easy_setopt(handler->web_call_info.curl_handler, CURLOPT_PRIVATE, handler);
+        CURLMcode res = curl_multi_add_handle(multi->curl_multi, handler->web_call_info.curl_handler);
+        if (res == CURLM_OK) {
+            add_running_handler(multi, handler);
+        } else {
+            wqc_set_error_with_message(handler, WEBQC_WEB_CALL_ERROR, curl_multi_strerror(res));
+            wqc_finish_call_step(handler, false);
+            rv = false;
+        }
+    }
+
+    return rv;
+}
+
+//! Process the reply of an HTTP call that is done, and either start the next step of the operation or mark the
+//! handler as done.
+static void step_done(WQC_MULTI *multi, CURL *curl, CURLcode result)
+{
+    WQC *handler = NULL;
+    bool rv = false;
+    bool next_step_started = false;
+
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&handler);
+    curl_multi_remove_handle(multi->curl_multi, curl);
+    remove_running_handler(multi, handler);
+
+    rv = wqc_finish_call_step(handler, check_web_call_result(handler, result));
+
+    if (rv && handler->call.resend && handler->call.retry_at > wqc_monotonic_milliseconds()) {
+        // The call is made again by wqc_perform() once its wait is over
+        next_step_started = add_waiting_handler(multi, handler);
+        rv = next_step_started;
+        if (!rv) {
+            wqc_abandon_call_step(handler); // LCOV_EXCL_LINE
+        }
+    } else if (rv && wqc_next_call_step(handler) != WQC_STEP_NONE) {
+        next_step_started = start_step(multi, handler, wqc_next_call_step(handler));
+        rv = next_step_started;
+    }
+    if (!next_step_started) {
+        add_done_handler(multi, handler, rv);
+    }
+}
+
+static void process_done_calls(WQC_MULTI *multi)
+{
+    CURLMsg *message = NULL;
+    int messages_left = 0;
+
+    while ((message = curl_multi_info_read(multi->curl_multi, &messages_left))) {
+        if (message->msg == CURLMSG_DONE) {
+            step_done(multi, message->easy_handle, message->data.result);
+        }
+    }
+}
+
+//! Make again the calls whose wait after they failed is over
+static void start_waiting_calls(WQC_MULTI *multi)
+{
+    int64_t now = wqc_monotonic_milliseconds();
+    int i = 0;
+
+    while (i < multi->waiting.count) {
+        WQC *handler = multi->waiting.handlers[i];
+        if (handler->call.retry_at <= now) {
+            remove_waiting_handler(multi, i);
+            if (!start_step(multi, handler, wqc_next_call_step(handler))) {
+                add_done_handler(multi, handler, false);
+            }
+        } else {
+            ++i;
+        }
+    }
+}
+
+//! Find how long to wait for HTTP calls before a call that failed has to be made again
+//! \return the shorter of the wait until the first such call is due and the given timeout
+static long waiting_timeout(const WQC_MULTI *multi, long timeout_milliseconds)
+{
+    int64_t now = wqc_monotonic_milliseconds();
+
+    for (int i = 0; i < multi->waiting.count; ++i) {
+        int64_t wait = multi->waiting.handlers[i]->call.retry_at - now;
+        wait = wait > 0 ? wait : 0;
+        if (timeout_milliseconds < 0 || wait < timeout_milliseconds) {
+            timeout_milliseconds = (long) wait;
+        }
+    }
+    return timeout_milliseconds;
+}
+
+//! Start an operation on a handler
+static bool start_operation(WQC_MULTI *multi, WQC *handler, enum wqc_call_step first_step)
+{
+    bool rv = false;
+
+    if (wqc_handler_idle(handler)) {
+        handler->return_value = init_webqc_return_value();
+        wqc_start_deadline(handler);
+        rv = start_step(multi, handler, first_step);
+    }
+
+    return rv;
+}
+
+
+WQC_MULTI *wqc_multi_init()
+{
+    WQC_MULTI *multi = calloc(1, sizeof(struct webqc_multi_t));
+
+    if (multi) {
+        multi->curl_multi = curl_multi_init();
+        if (!multi->curl_multi) {
+            free(multi); // LCOV_EXCL_LINE
+            multi = NULL; // LCOV_EXCL_LINE
+        }
+    }
+
+    return multi;
+}
+
+void wqc_multi_cleanup(WQC_MULTI *multi)
+{
+    if (multi) {
+        while (multi->running.count) {
+            wqc_multi_remove_handler(multi->running.handlers[0]);
+        }
+        while (multi->waiting.count) {
+            wqc_multi_remove_handler(multi->waiting.handlers[0]);
+        }
+        while (wqc_multi_next_done(multi, &(bool){false})) {
+        }
+        curl_multi_cleanup(multi->curl_multi);
+        free(multi->running.handlers);
+        free(multi->waiting.handlers);
+        free(multi->done.handlers);
+        free(multi);
+    }
+}
+
+void wqc_multi_remove_handler(WQC *handler)
+{
+    WQC_MULTI *multi = handler->call.multi;
+
+    if (multi && handler->call.multi_position == WQC_MULTI_POSITION_DONE) {
+        remove_done_handler(multi, handler);
+    } else if (multi && handler->call.multi_position == WQC_MULTI_POSITION_WAITING) {
+        for (int i = 0; i < multi->waiting.count; ++i) {
+            if (multi->waiting.handlers[i] == handler) {
+                remove_waiting_handler(multi, i);
+            }
+        }
+        wqc_abandon_call_step(handler);
+    } else if (multi) {
+        curl_multi_remove_handle(multi->curl_multi, handler->web_call_info.curl_handler);
+        remove_running_handler(multi, handler);
+        wqc_finish_call_step(handler, false);
+        handler->call.step = WQC_STEP_NONE;
+    }
+}
+
+bool wqc_multi_submit_job(WQC_MULTI *multi, WQC *handler, enum wqc_job_type job_type, void *job_parameters)
+{
+    // The call state of a busy handler belongs to its running operation
+    bool rv = wqc_handler_idle(handler);
+
+    if (rv) {
+        handler->call.job_type = job_type;
+        handler->call.job_parameters = job_parameters;
+        rv = start_operation(multi, handler, wqc_submit_job_first_step(handler));
+    }
+    return rv;
+}
+
+bool wqc_multi_get_status(WQC_MULTI *multi, WQC *handler)
+{
+    return start_operation(multi, handler, WQC_STEP_GET_STATUS);
+}
+
+bool wqc_multi_get_integrals_details(WQC_MULTI *multi, WQC *handler)
+{
+    return start_operation(multi, handler, WQC_STEP_GET_INTEGRALS_DETAILS);
+}
+
+bool wqc_multi_fetch_ERI_values(WQC_MULTI *multi, WQC *handler, const eri_shell_index_t *eri_index)
+{
+    bool rv = wqc_handler_idle(handler);
+
+    if (rv) {
+        memcpy(handler->call.eri_index, eri_index, sizeof(eri_shell_index_t));
+        handler->call.eri_range = false;
+        rv = start_operation(multi, handler, WQC_STEP_GET_ERI_VALUES);
+    }
+    return rv;
+}
+
+int wqc_perform(WQC_MULTI *multi)
+{
+    int running_calls = 0;
+    int rv = -1;
+
+    start_waiting_calls(multi);
+    if (curl_multi_perform(multi->curl_multi, &running_calls) == CURLM_OK) {
+        process_done_calls(multi);
+        rv = multi->running.count + multi->waiting.count;
+    }
+
+    return rv;
+}
+
+int wqc_poll(WQC_MULTI *multi, int timeout_milliseconds)
+{
+    int rv = -1;
+
+    if ((multi->running.count == 0 && multi->waiting.count == 0) ||
+        curl_multi_poll(multi->curl_multi, NULL, 0, (int) waiting_timeout(multi, timeout_milliseconds), NULL) ==
+        CURLM_OK) {
+        rv = wqc_perform(multi);
+    }
+
+    return rv;
+}
+
+bool wqc_multi_fdset(WQC_MULTI *multi, fd_set *read_fd_set, fd_set *write_fd_set, fd_set *exc_fd_set, int *max_fd)
+{
+    return curl_multi_fdset(multi->curl_multi, read_fd_set, write_fd_set, exc_fd_set, max_fd) == CURLM_OK;
+}
+
+long wqc_multi_timeout(WQC_MULTI *multi)
+{
+    long timeout_milliseconds = -1;
+
+    curl_multi_timeout(multi->curl_multi, &timeout_milliseconds);
+
+    return waiting_timeout(multi, timeout_milliseconds);
+}
+
+WQC *wqc_multi_next_done(WQC_MULTI *multi, bool *success)
+{
+    WQC *handler = NULL;
+
+    while (handler == NULL && multi->next_done < multi->done.count) {
+        handler = multi->done.handlers[multi->next_done++];
+    }
+    if (handler) {
+        handler->call.multi = NULL;
+        *success = handler->return_value.error_code == WEBQC_SUCCESS;
+    }
+    if (multi->next_done == multi->done.count) {
+        multi->next_done = 0;
+        multi->done.count = 0;
+    }
+
+    return handler;
+}
@@ -10,6 +10,7 @@
 
 #include "webqc-handler.h"
 #include "libwebqc.h"
+#include "webqc-trace.h"
 
 typedef bool (*option_handler_func)(WQC *handler, wqc_option_t option, va_list *);
 
@@ -28,10 +29,13 @@ const char **get_string_ptr_option_value(va_list *ap)
 #define STRING_OPTION_GET_FUNCTION_NAME(struct_member_name) handle_##struct_member_name##_option_get
 #define BOOL_OPTION_SET_FUNCTION_NAME(struct_member_name) handle_##struct_member_name##_bool_option_set
 #define BOOL_OPTION_GET_FUNCTION_NAME(struct_member_name) handle_##struct_member_name##_bool_option_get
+#define INT_OPTION_SET_FUNCTION_NAME(struct_member_name) handle_##struct_member_name##_int_option_set
+#define INT_OPTION_GET_FUNCTION_NAME(struct_member_name) handle_##struct_member_name##_int_option_get
 
 
 #define STRING_OPTION_TABLE_ENTRY(option_name, struct_member_name ) { option_name,  STRING_OPTION_SET_FUNCTION_NAME(struct_member_name), STRING_OPTION_GET_FUNCTION_NAME(struct_member_name) }
 #define BOOL_OPTION_TABLE_ENTRY(option_name, struct_member_name ) { option_name,  BOOL_OPTION_SET_FUNCTION_NAME(struct_member_name), BOOL_OPTION_GET_FUNCTION_NAME(struct_member_name) }
+#define INT_OPTION_TABLE_ENTRY(option_name, struct_member_name ) { option_name,  INT_OPTION_SET_FUNCTION_NAME(struct_member_name), INT_OPTION_GET_FUNCTION_NAME(struct_member_name) }
 
 #define MAKE_STRING_OPTION_SET(struct_member_name)\
 bool STRING_OPTION_SET_FUNCTION_NAME(struct_member_name) (WQC *handler, wqc_option_t option, va_list *ap)\
@@ -74,6 +78,28 @@ bool BOOL_OPTION_GET_FUNCTION_NAME(struct_member_name) (WQC *handler, wqc_option
     return true;\
 }
 
+#define MAKE_INT_OPTION_SET(struct_member_name, min_value, max_value)\
+bool INT_OPTION_SET_FUNCTION_NAME(struct_member_name) (WQC *handler, wqc_option_t option, va_list *ap)\
+{\
+    bool result = false;\
+    int value = va_arg(*ap, int);\
+    if ( value >= (min_value) && value <= (max_value) ) {\
+        handler->struct_member_name = value;\
+        result = true;\
+    } else {\
+        wqc_set_error(handler, WEBQC_BAD_OPTION_VALUE);\
+    }\
+    return result;\
+}
+
+#define MAKE_INT_OPTION_GET(struct_member_name)\
+bool INT_OPTION_GET_FUNCTION_NAME(struct_member_name) (WQC *handler, wqc_option_t option, va_list *ap)\
+{\
+    int *valptr = va_arg(*ap, int *);\
+    *valptr = handler->struct_member_name;\
+    return true;\
+}
+
 
 MAKE_STRING_OPTION_SET(webqc_server_name)
 MAKE_STRING_OPTION_GET(webqc_server_name)
@@ -84,6 +110,60 @@ MAKE_STRING_OPTION_GET(access_token)
 MAKE_BOOL_OPTION_SET(insecure_ssl)
 MAKE_BOOL_OPTION_GET(insecure_ssl)
 
+MAKE_BOOL_OPTION_SET(plain_http)
+MAKE_BOOL_OPTION_GET(plain_http)
+
+MAKE_BOOL_OPTION_SET(long_poll)
+MAKE_BOOL_OPTION_GET(long_poll)
+
+MAKE_BOOL_OPTION_SET(combined_submit)
+MAKE_BOOL_OPTION_GET(combined_submit)
+
+MAKE_INT_OPTION_SET(webqc_server_port, 1, 65535)
+MAKE_INT_OPTION_GET(webqc_server_port)
+
+static bool handle_trace_file_option_set(WQC *handler, wqc_option_t option, va_list *ap)
+{
+    return wqc_trace_open(handler, get_string_option_value(ap));
+}
+MAKE_STRING_OPTION_GET(trace_file)
+
+MAKE_INT_OPTION_SET(min_poll_interval, 1, MAX_POLL_INTERVAL)
+MAKE_INT_OPTION_GET(min_poll_interval)
+
+MAKE_INT_OPTION_SET(max_poll_interval, 1, MAX_POLL_INTERVAL)
+MAKE_INT_OPTION_GET(max_poll_interval)
+
+MAKE_INT_OPTION_SET(max_parallel_downloads, 1, MAX_PARALLEL_DOWNLOADS)
+MAKE_INT_OPTION_GET(max_parallel_downloads)
+
+MAKE_INT_OPTION_SET(max_inline_ERI_size, 0, MAX_INLINE_ERI_SIZE)
+MAKE_INT_OPTION_GET(max_inline_ERI_size)
+
+MAKE_BOOL_OPTION_SET(compression)
+MAKE_BOOL_OPTION_GET(compression)
+
+MAKE_INT_OPTION_SET(download_retries, 0, MAX_DOWNLOAD_RETRIES)
+MAKE_INT_OPTION_GET(download_retries)
+
+MAKE_INT_OPTION_SET(call_retries, 0, MAX_CALL_RETRIES)
+MAKE_INT_OPTION_GET(call_retries)
+
+MAKE_INT_OPTION_SET(retry_base_delay, 0, MAX_RETRY_DELAY)
+MAKE_INT_OPTION_GET(retry_base_delay)
+
+MAKE_INT_OPTION_SET(retry_max_delay, 0, MAX_RETRY_DELAY)
+MAKE_INT_OPTION_GET(retry_max_delay)
+
+MAKE_INT_OPTION_SET(call_timeout, 0, MAX_TIMEOUT)
+MAKE_INT_OPTION_GET(call_timeout)
+
+MAKE_INT_OPTION_SET(connect_timeout, 1, MAX_TIMEOUT)
+MAKE_INT_OPTION_GET(connect_timeout)
+
+MAKE_INT_OPTION_SET(hedge_percentile, 0, MAX_HEDGE_PERCENTILE)
+MAKE_INT_OPTION_GET(hedge_percentile)
+
 
 static struct webqc_options_info {
     wqc_option_t options_value;
@@ -94,6 +174,23 @@ static struct webqc_options_info {
                 STRING_OPTION_TABLE_ENTRY(WQC_OPTION_ACCESS_TOKEN, access_token),
                 STRING_OPTION_TABLE_ENTRY(WQC_OPTION_SERVER_NAME, webqc_server_name),
                 BOOL_OPTION_TABLE_ENTRY(WQC_OPTION_INSECURE_SSL, insecure_ssl),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_MAX_PARALLEL_DOWNLOADS, max_parallel_downloads),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_SERVER_PORT, webqc_server_port),
+                BOOL_OPTION_TABLE_ENTRY(WQC_OPTION_PLAIN_HTTP, plain_http),
+                { WQC_OPTION_TRACE_FILE, handle_trace_file_option_set, STRING_OPTION_GET_FUNCTION_NAME(trace_file) },
+                BOOL_OPTION_TABLE_ENTRY(WQC_OPTION_LONG_POLL, long_poll),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_MIN_POLL_INTERVAL, min_poll_interval),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_MAX_POLL_INTERVAL, max_poll_interval),
+                BOOL_OPTION_TABLE_ENTRY(WQC_OPTION_COMBINED_SUBMIT, combined_submit),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_MAX_INLINE_ERI_SIZE, max_inline_ERI_size),
+                BOOL_OPTION_TABLE_ENTRY(WQC_OPTION_COMPRESSION, compression),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_DOWNLOAD_RETRIES, download_retries),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_CALL_RETRIES, call_retries),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_RETRY_BASE_DELAY, retry_base_delay),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_RETRY_MAX_DELAY, retry_max_delay),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_CALL_TIMEOUT, call_timeout),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_CONNECT_TIMEOUT, connect_timeout),
+                INT_OPTION_TABLE_ENTRY(WQC_OPTION_HEDGE_PERCENTILE, hedge_percentile),
         } ;
 
 bool wqc_set_option(
@@ -0,0 +1,212 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libwebqc.h"
+#include "webqc-handler.h"
+#include "webqc-errors.h"
+#include "webqc-metrics.h"
+#include "webqc-retry.h"
+
+#define BREAKER_SERVERS (16) /// How many servers the circuit breaker follows at once
+
+/// Calls to one server, as the circuit breaker follows them
+struct breaker_server {
+    char name[MAX_URL_SIZE]; /// Name of the server
+    unsigned short port; /// Port of the server
+    int failures; /// How many calls to the server failed in a row with a temporary error
+    int64_t open_until; /// When calls to the server may be made again, once it failed too many times
+    int64_t probe_started; /// When the one call let through to find whether the server is back was made, 0 if none
+};
+
+/// The circuit breaker all handlers of the process share
+static struct {
+    pthread_mutex_t lock; /// Taken while the breaker is looked at or changed
+    int failures_to_open; /// How many failed calls in a row stop the calls to a server, 0 to never stop them
+    int64_t open_time; /// How long calls to a server are stopped for, in milliseconds
+    struct breaker_server servers[BREAKER_SERVERS]; /// Servers that calls failed to
+    int servers_count; /// How many servers are in the list
+} breaker = {PTHREAD_MUTEX_INITIALIZER, DEFAULT_BREAKER_FAILURES, DEFAULT_BREAKER_OPEN_TIME};
+
+
+int64_t wqc_monotonic_milliseconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+//! Draw a random number from 0 to limit - 1
+static int64_t random_below(WQC *handler, int64_t limit)
+{
+    uint64_t bits = ((uint64_t) rand_r(&handler->retry_random_state) << 31) ^ rand_r(&handler->retry_random_state);
+
+    return (int64_t) (bits % (uint64_t) limit);
+}
+
+int64_t wqc_next_retry_delay(WQC *handler, int64_t *previous_delay)
+{
+    int64_t delay = 0;
+    int http_reply_code = handler->web_call_info.http_reply_code;
+    bool broke_off = handler->web_call_info.curl_result != CURLE_OK && http_reply_code >= 200 && http_reply_code < 300;
+
+    if ( ! broke_off ) {
+        int64_t base = handler->retry_base_delay;
+        int64_t longest = *previous_delay * 3 > base ? *previous_delay * 3 : base;
+
+        delay = base + random_below(handler, longest - base + 1);
+        if ( delay < handler->web_call_info.retry_after ) {
+            delay = handler->web_call_info.retry_after;
+        }
+        if ( delay > handler->retry_max_delay ) {
+            delay = handler->retry_max_delay;
+        }
+    }
+    *previous_delay = delay;
+
+    return delay;
+}
+
+//! Find the handler's server in the circuit breaker. Must be called with the breaker locked.
+//! \param add add the server if it is not there, in place of one whose calls succeed if the list is full
+//! \return the server, or NULL if it is not there and was not added
+static struct breaker_server *find_server(const WQC *handler, bool add)
+{
+    struct breaker_server *server = NULL;
+
+    for (int i = 0; i < breaker.servers_count && ! server; ++i) {
+        if ( breaker.servers[i].port == handler->webqc_server_port &&
+             strcmp(breaker.servers[i].name, handler->webqc_server_name) == 0 ) {
+            server = &breaker.servers[i];
+        }
+    }
+    if ( ! server && add ) {
+        if ( breaker.servers_count < BREAKER_SERVERS ) {
+            server = &breaker.servers[breaker.servers_count++];
+        }
+        for (int i = 0; i < breaker.servers_count && ! server; ++i) {
+            if ( breaker.servers[i].failures == 0 ) {
+                server = &breaker.servers[i];
+            }
+        }
+        if ( server ) {
+            strncpy(server->name, handler->webqc_server_name, MAX_URL_SIZE - 1);
+            server->name[MAX_URL_SIZE - 1] = '\0';
+            server->port = handler->webqc_server_port;
+            server->failures = 0;
+            server->open_until = 0;
+            server->probe_started = 0;
+        }
+    }
+    return server;
+}
+
+bool wqc_breaker_allows_call(WQC *handler)
+{
+    bool rv = true;
+
+    pthread_mutex_lock(&breaker.lock);
+    struct breaker_server *server = find_server(handler, false);
+    if ( server && breaker.failures_to_open > 0 && server->failures >= breaker.failures_to_open ) {
+        int64_t now = wqc_monotonic_milliseconds();
+        // Once the calls were stopped for long enough, one call at a time finds out whether the server is back
+        if ( now >= server->open_until && (server->probe_started == 0 || now >= server->probe_started +
+                                                                              breaker.open_time) ) {
+            server->probe_started = now;
+        } else {
+            rv = false;
+        }
+    }
+    pthread_mutex_unlock(&breaker.lock);
+
+    if ( ! rv ) {
+        wqc_set_error_with_message(handler, WEBQC_SERVER_UNAVAILABLE, handler->webqc_server_name);
+    }
+    return rv;
+}
+
+void wqc_breaker_record_call(WQC *handler, bool server_failed)
+{
+    pthread_mutex_lock(&breaker.lock);
+    struct breaker_server *server = find_server(handler, server_failed);
+    if ( server && ! server_failed ) {
+        server->failures = 0;
+        server->probe_started = 0;
+    } else if ( server ) {
+        int64_t now = wqc_monotonic_milliseconds();
+        server->failures++;
+        // Calls that were made before the calls were stopped do not stop them for longer
+        if ( breaker.failures_to_open > 0 && server->failures >= breaker.failures_to_open && now >= server->open_until ) {
+            server->open_until = now + breaker.open_time;
+            server->probe_started = 0;
+            wqc_metrics_count(WQC_COUNTER_BREAKER_OPENED, 1);
+        }
+    }
+    pthread_mutex_unlock(&breaker.lock);
+}
+
+void wqc_set_deadline(WQC *handler, int64_t milliseconds)
+{
+    // A deadline already passed is kept as the earliest time the clock gives, since 0 stands for no deadline
+    int64_t deadline = wqc_monotonic_milliseconds() + milliseconds;
+    handler->deadline = milliseconds < 0 ? 0 : (deadline > 0 ? deadline : 1);
+}
+
+void wqc_start_deadline(WQC *handler)
+{
+    int64_t deadline = handler->deadline;
+
+    if ( handler->call_timeout > 0 ) {
+        int64_t timeout_at = wqc_monotonic_milliseconds() + handler->call_timeout + handler->call.status_wait;
+        if ( deadline == 0 || timeout_at < deadline ) {
+            deadline = timeout_at;
+        }
+    }
+    handler->call.deadline = deadline;
+}
+
+bool wqc_set_call_timeout(WQC *handler, CURL *curl)
+{
+    bool rv = true;
+
+    if ( handler->call.deadline ) {
+        int64_t time_left = handler->call.deadline - wqc_monotonic_milliseconds();
+        if ( time_left > 0 ) {
+            curl_easy_setopt(curl, CURLOPT_TIMEOUT_MS, (long) time_left);
+        } else {
+            wqc_set_error(handler, WEBQC_TIMEOUT);
+            rv = false;
+        }
+    }
+    return rv;
+}
+
+bool wqc_deadline_allows_wait(WQC *handler, int64_t wait)
+{
+    bool rv = handler->call.deadline == 0 || wqc_monotonic_milliseconds() + wait < handler->call.deadline;
+
+    if ( ! rv ) {
+        wqc_set_error_with_message(handler, WEBQC_TIMEOUT, "No time is left to make the failed call again");
+    }
+    return rv;
+}
+
+int wqc_web_call_error_code(const WQC *handler, CURLcode res)
+{
+    bool cut = res == CURLE_OPERATION_TIMEDOUT && handler->call.deadline &&
+               wqc_monotonic_milliseconds() >= handler->call.deadline;
+
+    return cut ? WEBQC_TIMEOUT : WEBQC_WEB_CALL_ERROR;
+}
+
+void wqc_set_circuit_breaker(int failures, int64_t open_milliseconds)
+{
+    pthread_mutex_lock(&breaker.lock);
+    breaker.failures_to_open = failures > 0 ? failures : 0;
+    breaker.open_time = open_milliseconds > 0 ? open_milliseconds : 0;
+    // Servers that failed before start afresh
+    breaker.servers_count = 0;
+    pthread_mutex_unlock(&breaker.lock);
+}
@@ -0,0 +1,186 @@
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __APPLE__
+#include <malloc/malloc.h>
+#include <stdlib.h>
+#else
+#include <malloc.h>
+#endif
+
+#include "webqc-handler.h"
+#include "webqc-errors.h"
+#include "webqc-trace.h"
+
+/// A trace file, shared by all handlers that trace into it
+struct wqc_trace_file {
+    char *path; /// Path the file was opened with
+    FILE *fp; /// The open file
+    int handlers_count; /// How many handlers trace into the file
+    bool has_events; /// Some event was already written, so the next one needs a separator
+    struct wqc_trace_file *next; /// Next open trace file
+};
+
+static pthread_mutex_t trace_files_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct wqc_trace_file *trace_files = NULL; /// All open trace files
+static int tracks_count = 0; /// Tracks given to handlers so far, each handler gets the next one
+
+static wqc_trace_time_t now_in_microseconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (wqc_trace_time_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+}
+
+//! Start writing an event into a trace file. Must be called with trace_files_lock held.
+static FILE *begin_event(struct wqc_trace_file *trace)
+{
+    fputs(trace->has_events ? ",\n" : "[\n", trace->fp);
+    trace->has_events = true;
+    return trace->fp;
+}
+
+static struct wqc_trace_file *find_trace_file(const char *path)
+{
+    struct wqc_trace_file *trace = trace_files;
+
+    while ( trace && strcmp(trace->path, path) != 0 ) {
+        trace = trace->next;
+    }
+    return trace;
+}
+
+static struct wqc_trace_file *create_trace_file(const char *path)
+{
+    struct wqc_trace_file *trace = calloc(1, sizeof(struct wqc_trace_file));
+
+    if ( trace ) {
+        trace->path = strdup(path);
+        trace->fp = fopen(path, "w");
+        if ( trace->path && trace->fp ) {
+            trace->next = trace_files;
+            trace_files = trace;
+        } else {
+            if ( trace->fp ) {
+                fclose(trace->fp); // LCOV_EXCL_LINE
+            }
+            free(trace->path);
+            free(trace);
+            trace = NULL;
+        }
+    }
+    return trace;
+}
+
+//! Finish a trace file no handler traces into any more. Must be called with trace_files_lock held.
+static void release_trace_file(struct wqc_trace_file *trace)
+{
+    struct wqc_trace_file **link = &trace_files;
+
+    if ( --trace->handlers_count == 0 ) {
+        while ( *link != trace ) {
+            link = &(*link)->next;
+        }
+        *link = trace->next;
+        fputs(trace->has_events ? "\n]\n" : "[]\n", trace->fp);
+        fclose(trace->fp);
+        free(trace->path);
+        free(trace);
+    } else {
+        fflush(trace->fp);
+    }
+}
+
+bool wqc_trace_open(WQC *handler, const char *path)
+{
+    bool rv = true;
+    char *trace_file = path ? strdup(path) : NULL; // path may be the handler's own trace_file, freed below
+
+    wqc_trace_close(handler);
+
+    if ( trace_file ) {
+        pthread_mutex_lock(&trace_files_lock);
+        struct wqc_trace_file *trace = find_trace_file(trace_file);
+        if ( ! trace ) {
+            trace = create_trace_file(trace_file);
+        }
+        if ( trace ) {
+            trace->handlers_count++;
+            handler->trace = trace;
+            handler->trace_track = ++tracks_count;
+            fprintf(begin_event(trace),
+                    "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"handler %d\"}}",
+                    (int) getpid(), handler->trace_track, handler->trace_track);
+        }
+        pthread_mutex_unlock(&trace_files_lock);
+
+        if ( trace ) {
+            handler->trace_file = trace_file;
+        } else {
+            const char *additional_messages[] = {"Cannot open trace file", trace_file, NULL};
+            wqc_set_error_with_messages(handler, WEBQC_IO_ERROR, additional_messages);
+            free(trace_file);
+            rv = false;
+        }
+    } else if ( path ) {
+        wqc_set_error(handler, WEBQC_OUT_OF_MEMORY); // LCOV_EXCL_LINE
+        rv = false; // LCOV_EXCL_LINE
+    }
+
+    return rv;
+}
+
+void wqc_trace_close(WQC *handler)
+{
+    if ( handler->trace ) {
+        pthread_mutex_lock(&trace_files_lock);
+        release_trace_file(handler->trace);
+        pthread_mutex_unlock(&trace_files_lock);
+        handler->trace = NULL;
+    }
+    free(handler->trace_file);
+    handler->trace_file = NULL;
+}
+
+wqc_trace_time_t wqc_trace_begin(const WQC *handler)
+{
+    return handler->trace ? now_in_microseconds() : 0;
+}
+
+void wqc_trace_end(WQC *handler, const char *name, wqc_trace_time_t start)
+{
+    if ( handler->trace ) {
+        wqc_trace_time_t end = now_in_microseconds();
+
+        pthread_mutex_lock(&trace_files_lock);
+        fprintf(begin_event(handler->trace),
+                "{\"name\":\"%s\",\"cat\":\"wqc\",\"ph\":\"X\",\"ts\":%" PRId64 ",\"dur\":%" PRId64 ",\"pid\":%d,\"tid\":%d}",
+                name, start, end - start, (int) getpid(), handler->trace_track);
+        pthread_mutex_unlock(&trace_files_lock);
+    }
+}
+
+void wqc_trace_end_concurrent(WQC *handler, const char *name, wqc_trace_time_t start, unsigned int id, size_t bytes)
+{
+    if ( handler->trace ) {
+        wqc_trace_time_t end = now_in_microseconds();
+        int pid = (int) getpid();
+
+        // Async events with the same id nest on their own row, so concurrent spans do not overlap on the track
+        pthread_mutex_lock(&trace_files_lock);
+        fprintf(begin_event(handler->trace),
+                "{\"name\":\"%s\",\"cat\":\"wqc\",\"ph\":\"b\",\"id2\":{\"local\":\"%d.%u\"},\"ts\":%" PRId64
+                ",\"pid\":%d,\"tid\":%d}",
+                name, handler->trace_track, id, start, pid, handler->trace_track);
+        fprintf(begin_event(handler->trace),
+                "{\"name\":\"%s\",\"cat\":\"wqc\",\"ph\":\"e\",\"id2\":{\"local\":\"%d.%u\"},\"ts\":%" PRId64
+                ",\"pid\":%d,\"tid\":%d,\"args\":{\"bytes\":%zu}}",
+                name, handler->trace_track, id, end, pid, handler->trace_track, bytes);
+        pthread_mutex_unlock(&trace_files_lock);
+    }
+}
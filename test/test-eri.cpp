@@ -2,6 +2,7 @@
 #include <catch2/catch_test_macros.hpp>
 #include <stdlib.h>
 #include <unistd.h>
+#include <vector>
 
 #include "include/webqc-json.h"
 #include "include/webqc-handler.h"
@@ -181,6 +182,65 @@ TEST_CASE( "submit integrals job and wait for it to finish", "[eri]" ) {
 }
 
 
+TEST_CASE( "fetch all integrals of a job in parallel", "[eri]" ) {
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+
+    SECTION("premature fetch") {
+        CHECK(wqc_fetch_all_ERI_values(handler) == false);
+
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(handler, &error_structure) == true );
+        CHECK(error_structure.error_code == WEBQC_NOT_FETCHED );
+    }
+
+    SECTION("Do REST Call") {
+        struct two_electron_integrals_job_parameters multifile =  parameters;
+        multifile.shell_set_per_file = 125;
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, 3) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &multifile) == true);
+        CHECK(wqc_wait_for_job(handler, 60000) == true );
+        CHECK(wqc_get_integrals_details(handler) == true);
+        CHECK(wqc_fetch_all_ERI_values(handler) == true );
+
+        eri_shell_index_t eri_shell_index, eri_shell_range_end;
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        eri_shell_index_t end_shell = {5, 0, 0, 0};
+        CHECK(wqc_get_shell_set_range(handler, &eri_shell_index, &eri_shell_range_end) == true );
+        CHECK(wqc_indices_equal(&eri_shell_index, &first_shell));
+        CHECK(wqc_indices_equal(&eri_shell_range_end, &end_shell));
+
+        const double *eri_values = nullptr;
+        double eri_precision = WQC_PRECISION_UNKNOWN;
+        CHECK(wqc_get_eri_values(handler, &eri_values, &eri_precision));
+        std::vector<double> all_values(eri_values, eri_values + 7*7*7*7);
+
+        // The first sub-job's values, fetched alone, start the full set
+        CHECK(wqc_fetch_ERI_values(handler, &first_shell) == true );
+        CHECK(wqc_get_shell_set_range(handler, &eri_shell_index, &eri_shell_range_end) == true );
+        CHECK(wqc_get_eri_values(handler, &eri_values, &eri_precision));
+
+        int dpos = 0;
+        for (; !wqc_indices_equal(&eri_shell_index, &eri_shell_range_end);
+               wqc_next_shell_index(handler, &eri_shell_index)
+            ) {
+            int shells_count[4];
+            wqc_get_number_of_functions_in_shells(handler, eri_shell_index, shells_count , 4);
+            for (int n = shells_count[0]*shells_count[1]*shells_count[2]*shells_count[3]; n > 0 ; --n, ++dpos) {
+                CHECK(eri_values[dpos] == all_values[dpos]);
+            }
+        }
+        CHECK(dpos > 0);
+    }
+
+    SECTION("Bad number of parallel downloads") {
+        CHECK(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, 0) == false);
+        CHECK(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, MAX_PARALLEL_DOWNLOADS + 1) == false);
+    }
+    wqc_cleanup(handler);
+}
+
+
 
 TEST_CASE( "submit integrals job and get status", "[eri]" ) {
     WQC *handler = wqc_init();
@@ -0,0 +1,1298 @@
+#include <libwebqc.h>
+#include <catch2/catch_test_macros.hpp>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "include/webqc-handler.h"
+#include "include/webqc-web-access.h"
+#include "mock-server/webqc-mock-server.h"
+
+static const char *water_xyz_geometry =
+        "3\n"
+        "H2O\n"
+        "O 0.00000000 0.00000000 -0.07223463\n"
+        "H 0.83020871 0.00000000  0.53109206\n"
+        "H 0.00000000 0.53109206  0.56568542\n";
+
+static struct two_electron_integrals_job_parameters mock_parameters = {"sto-3g", water_xyz_geometry, WQC_PRECISION_UNKNOWN, "angstrom", 0};
+
+//! Point a handler to a running mock server
+static void use_mock_server(WQC *handler, WQC_MOCK_SERVER *server)
+{
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_SERVER_NAME, "127.0.0.1") == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_SERVER_PORT, (int) wqc_mock_server_port(server)) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_PLAIN_HTTP, true) == true);
+}
+
+//! Check the ERI values a handler holds against the values the mock server generates
+static int check_mock_values(WQC *handler)
+{
+    eri_shell_index_t eri_shell_index, eri_shell_range_end;
+    const double *eri_values = nullptr;
+    double eri_precision = WQC_PRECISION_UNKNOWN;
+    long long quartet = 0;
+    int dpos = 0;
+    int mismatches = 0;
+
+    REQUIRE(wqc_get_eri_values(handler, &eri_values, &eri_precision) == true);
+    REQUIRE(wqc_get_shell_set_range(handler, &eri_shell_index, &eri_shell_range_end) == true);
+
+    // Values are generated from the position of the quartet in the whole system, so start from the first quartet
+    for (eri_shell_index_t index = {0, 0, 0, 0}; !wqc_indices_equal(&index, &eri_shell_index);
+           wqc_next_shell_index(handler, &index)) {
+        quartet++;
+    }
+
+    for (; !wqc_indices_equal(&eri_shell_index, &eri_shell_range_end);
+           wqc_next_shell_index(handler, &eri_shell_index), quartet++) {
+        int shells_count[4];
+        wqc_get_number_of_functions_in_shells(handler, eri_shell_index, shells_count, 4);
+        int quartet_size = shells_count[0]*shells_count[1]*shells_count[2]*shells_count[3];
+        for (int n = 0; n < quartet_size; ++n, ++dpos) {
+            mismatches += eri_values[dpos] == wqc_mock_server_eri_value(quartet, n) ? 0 : 1;
+        }
+    }
+    CHECK(dpos > 0);
+
+    return mismatches;
+}
+
+//! Read the value of one metric from the process-wide metrics text
+static double metric_value(const char *metric)
+{
+    std::vector<char> text(wqc_metrics_dump(nullptr, 0) + 1);
+    wqc_metrics_dump(text.data(), text.size());
+
+    std::string line_start = std::string("\n") + metric + " ";
+    const char *line = strstr(text.data(), line_start.c_str());
+    REQUIRE(line != nullptr);
+    return strtod(line + line_start.size(), nullptr);
+}
+
+TEST_CASE( "run a job on the mock server", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.shell_sets_per_file = 100;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    SECTION("Fetch values one sub-job at a time") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_job_is_duplicate(handler) == false);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        eri_shell_index_t later_shell = {1, 2, 0, 3};
+        CHECK(wqc_fetch_ERI_values(handler, &first_shell) == true);
+        CHECK(check_mock_values(handler) == 0);
+        CHECK(wqc_fetch_ERI_values(handler, &later_shell) == true);
+        CHECK(check_mock_values(handler) == 0);
+    }
+
+    SECTION("Fetch all values") {
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, 2) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        CHECK(wqc_fetch_all_ERI_values(handler) == true);
+
+        eri_shell_index_t eri_shell_index, eri_shell_range_end;
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        eri_shell_index_t end_shell = {WQC_MOCK_DEFAULT_SHELLS, 0, 0, 0};
+        CHECK(wqc_get_shell_set_range(handler, &eri_shell_index, &eri_shell_range_end) == true);
+        CHECK(wqc_indices_equal(&eri_shell_index, &first_shell));
+        CHECK(wqc_indices_equal(&eri_shell_range_end, &end_shell));
+        CHECK(check_mock_values(handler) == 0);
+    }
+
+    SECTION("Fetch sub-jobs as they are done") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+
+        int items = 0;
+        int mismatches = 0;
+        while (wqc_wait_for_any_items(handler, 10000)) {
+            const struct ERI_item_status *item = nullptr;
+            while ((item = wqc_next_done_ERI_item(handler)) != nullptr) {
+                CHECK(item->status == WQC_JOB_STATUS_DONE);
+                REQUIRE(wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &item->range_begin) == true);
+                mismatches += check_mock_values(handler);
+                items++;
+            }
+        }
+        CHECK(wqc_job_done(handler) == true);
+        CHECK(items == handler->ERI_items_count);
+        CHECK(mismatches == 0);
+        CHECK(wqc_next_done_ERI_item(handler) == nullptr);
+    }
+
+    SECTION("Details of two jobs on one handler") {
+        struct two_electron_integrals_job_parameters other_parameters = mock_parameters;
+        other_parameters.geometry_units = "bohr";
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &other_parameters) == true);
+        CHECK(wqc_job_is_duplicate(handler) == false);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        CHECK(wqc_fetch_ERI_values(handler, &first_shell) == true);
+        CHECK(check_mock_values(handler) == 0);
+    }
+
+    SECTION("Network timing of a job") {
+        struct wqc_network_timing timing;
+        wqc_get_network_timing(handler, &timing);
+        for (auto & endpoint : timing.endpoints) {
+            CHECK(endpoint.calls == 0);
+        }
+
+        // Small blobs would otherwise come inside replies, and not be downloaded, and blobs would come compressed
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_COMPRESSION, false) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        CHECK(wqc_fetch_ERI_values(handler, &first_shell) == true);
+
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == 1);
+        CHECK(timing.endpoints[WQC_ENDPOINT_JOB].calls == 0);
+        CHECK(timing.endpoints[WQC_ENDPOINT_PARAMS].calls == 0);
+        CHECK(timing.endpoints[WQC_ENDPOINT_ERI].calls >= 1);
+        CHECK(timing.endpoints[WQC_ENDPOINT_INT_INFO].calls == 1);
+        CHECK(timing.endpoints[WQC_ENDPOINT_ERI_VALUES].calls == 1);
+        CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].calls == 1);
+        CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].sum.bytes_received == handler->eri_info.eri_values.eri_data_size);
+        CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].sum.bytes_sent > 0);
+        for (auto & endpoint : timing.endpoints) {
+            CHECK(endpoint.failed_calls == 0);
+            CHECK(endpoint.max_total <= endpoint.sum.total);
+        }
+        CHECK(timing.last_endpoint == WQC_ENDPOINT_DOWNLOAD);
+        CHECK(timing.last_call.total >= timing.last_call.first_byte);
+        CHECK(timing.last_call.total > 0);
+
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, 2) == true);
+        CHECK(wqc_fetch_all_ERI_values(handler) == true);
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_ERI_VALUES].calls == 1 + (unsigned long) handler->ERI_items_count);
+        CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].calls == 1 + (unsigned long) handler->ERI_items_count);
+
+        wqc_reset_network_timing(handler);
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].calls == 0);
+    }
+
+    SECTION("Metrics of a job") {
+        double submitted = metric_value("wqc_jobs_submitted_total");
+        double polls = metric_value("wqc_status_polls_total");
+        double downloaded = metric_value("wqc_eri_downloaded_bytes_total");
+        double memory = metric_value("wqc_eri_values_memory_bytes");
+        double download_calls = metric_value("wqc_web_calls_total{endpoint=\"download\"}");
+        double parses = metric_value("wqc_json_parse_seconds_count");
+
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_COMPRESSION, false) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        eri_shell_index_t first_shell = {0, 0, 0, 0};
+        CHECK(wqc_fetch_ERI_values(handler, &first_shell) == true);
+
+        double values_size = handler->eri_info.eri_values.eri_data_size;
+        CHECK(metric_value("wqc_jobs_submitted_total") == submitted + 1);
+        CHECK(metric_value("wqc_status_polls_total") > polls);
+        CHECK(metric_value("wqc_eri_downloaded_bytes_total") == downloaded + values_size);
+        CHECK(metric_value("wqc_eri_values_memory_bytes") == memory + values_size);
+        CHECK(metric_value("wqc_web_calls_total{endpoint=\"download\"}") == download_calls + 1);
+        CHECK(metric_value("wqc_json_parse_seconds_count") > parses);
+
+        wqc_cleanup(handler);
+        handler = wqc_init();
+        CHECK(metric_value("wqc_eri_values_memory_bytes") == memory);
+    }
+
+    SECTION("Metrics text cut to fit") {
+        size_t length = wqc_metrics_dump(nullptr, 0);
+        char small[16];
+        CHECK(wqc_metrics_dump(small, sizeof(small)) == length);
+        CHECK(strlen(small) == sizeof(small) - 1);
+    }
+
+    SECTION("Trace a job") {
+        const char *trace_file = "test-mock-trace.json";
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_TRACE_FILE, trace_file) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        CHECK(wqc_fetch_all_ERI_values(handler) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_TRACE_FILE, (const char *) nullptr) == true);
+
+        FILE *fp = fopen(trace_file, "r");
+        REQUIRE(fp != nullptr);
+        std::string trace;
+        for (int c = fgetc(fp); c != EOF; c = fgetc(fp)) {
+            trace += (char) c;
+        }
+        fclose(fp);
+        remove(trace_file);
+
+        CHECK(trace.front() == '[');
+        CHECK(trace.find_last_not_of('\n') == trace.rfind(']'));
+        for (const char *span : {"submit_job", "combined_submit", "wait_for_job",
+                                 "get_status", "get_integrals_details", "get_int_info", "process_reply",
+                                 "fetch_all_ERI_values", "locate_blob", "download_blob"}) {
+            CHECK(trace.find(std::string("\"name\":\"") + span + "\"") != std::string::npos);
+        }
+    }
+
+    SECTION("Wait with long polling") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(handler->long_poll_unsupported == false);
+
+        // Every held status call returns when another sub-job finishes
+        struct wqc_network_timing timing;
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_ERI].calls <= 1 + (unsigned long) handler->ERI_items_count);
+    }
+
+    SECTION("Same job twice") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_job_is_duplicate(handler) == false);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_job_is_duplicate(handler) == true);
+    }
+
+    SECTION("Bad access token") {
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_ACCESS_TOKEN, "not-the-token") == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+        CHECK(handler->web_call_info.http_reply_code == 401);
+    }
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "wait for a job on a server without long polling", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.no_long_poll = true;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    SECTION("Falls back to polling") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+        CHECK(handler->long_poll_unsupported == true);
+    }
+
+    SECTION("Polls at the predicted finish") {
+        struct two_electron_integrals_job_parameters parameters = mock_parameters;
+        parameters.shell_set_per_file = 50;
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_POLL_INTERVAL, 100) == true);
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 10000) == true);
+
+        // Polling every min_poll_interval would take about 25 polls
+        struct wqc_network_timing timing;
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_ERI].calls < 15);
+    }
+
+    SECTION("Times out") {
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        CHECK(wqc_wait_for_job(handler, 20) == false);
+    }
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "poll job status conditionally", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.no_long_poll = true;
+    config.job_duration = 60000; // Nothing changes between the polls of the test
+
+    SECTION("Not modified status is not sent again") {
+    }
+
+    SECTION("Server without ETags") {
+        config.no_etag = true;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_get_status(handler) == true);
+    int items_count = handler->ERI_items_count;
+    CHECK(items_count > 0);
+    CHECK((handler->status_etag[0] != '\0') == !config.no_etag);
+
+    struct wqc_network_timing first_poll;
+    wqc_get_network_timing(handler, &first_poll);
+    REQUIRE(wqc_get_status(handler) == true);
+    struct wqc_network_timing second_poll;
+    wqc_get_network_timing(handler, &second_poll);
+
+    // A 304 reply has no body, and the status the handler has is kept
+    CHECK(second_poll.last_endpoint == WQC_ENDPOINT_ERI);
+    if (config.no_etag) {
+        CHECK(second_poll.last_call.bytes_received > 0);
+    } else {
+        CHECK(second_poll.last_call.bytes_received == 0);
+    }
+    CHECK(handler->ERI_items_count == items_count);
+    CHECK(wqc_job_done(handler) == false);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "merge job status changes", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.no_long_poll = true;
+
+    SECTION("Status changes since the cursor") {
+    }
+
+    SECTION("Server without status cursor") {
+        config.no_status_diff = true;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    struct two_electron_integrals_job_parameters parameters = mock_parameters;
+    parameters.shell_set_per_file = 50;
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_POLL_INTERVAL, 50) == true);
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+
+    CHECK((handler->status_cursor[0] != '\0') == !config.no_status_diff);
+    CHECK(handler->ERI_items_count > 1);
+    CHECK(handler->ERI_items_by_status[WQC_JOB_STATUS_DONE] == handler->ERI_items_count);
+    int out_of_place = 0;
+    for (int i = 0; i < handler->ERI_items_count; ++i) {
+        out_of_place += handler->eri_status[i].id == i && handler->eri_status[i].output_blob_name ? 0 : 1;
+    }
+    CHECK(out_of_place == 0);
+
+    // Values that cannot be read without the integrals details are not fetched
+    struct wqc_return_value error_structure = init_webqc_return_value();
+    CHECK(wqc_fetch_all_ERI_values(handler) == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_NOT_FETCHED);
+
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+    REQUIRE(wqc_fetch_all_ERI_values(handler) == true);
+    CHECK(check_mock_values(handler) == 0);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "get small ERI values inside replies", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.shell_sets_per_file = 100;
+
+    SECTION("Values sent with the status") {
+    }
+
+    SECTION("Server without inline values") {
+        config.no_inline = true;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+
+    unsigned long items = 0;
+    int mismatches = 0;
+    const struct ERI_item_status *item = nullptr;
+    while ((item = wqc_next_done_ERI_item(handler)) != nullptr) {
+        CHECK((item->values != nullptr) == !config.no_inline);
+        REQUIRE(wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &item->range_begin) == true);
+        mismatches += check_mock_values(handler);
+        items++;
+    }
+    CHECK(items == (unsigned long) handler->ERI_items_count);
+
+    // A blob found from a shell quartet inside it comes with its location
+    eri_shell_index_t later_shell = {1, 2, 0, 3};
+    REQUIRE(wqc_fetch_ERI_values(handler, &later_shell) == true);
+    mismatches += check_mock_values(handler);
+
+    REQUIRE(wqc_fetch_all_ERI_values(handler) == true);
+    mismatches += check_mock_values(handler);
+    CHECK(mismatches == 0);
+
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handler, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_ERI_VALUES].calls == (config.no_inline ? 2 * items + 1 : 1));
+    CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].calls == (config.no_inline ? 2 * items + 1 : 0));
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "fetch a range of ERI values", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.shell_sets_per_file = 100;
+    int max_inline_size = 0;
+
+    SECTION("Range requests") {
+    }
+
+    SECTION("Server ignoring ranges") {
+        config.no_range = true;
+    }
+
+    SECTION("Range of values sent with the status") {
+        max_inline_size = 1024 * 1024;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, max_inline_size) == true);
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+    REQUIRE(handler->ERI_items_count > 2);
+
+    // Quartets 10 to 30 of the second sub-job
+    eri_shell_index_t begin, end, fetched_begin, fetched_end;
+    memcpy(begin, handler->eri_status[1].range_begin, sizeof(eri_shell_index_t));
+    for (int i = 0; i < 10; ++i) {
+        wqc_next_shell_index(handler, &begin);
+    }
+    memcpy(end, begin, sizeof(eri_shell_index_t));
+    for (int i = 0; i < 20; ++i) {
+        wqc_next_shell_index(handler, &end);
+    }
+
+    REQUIRE(wqc_fetch_ERI_range(handler, &begin, &end) == true);
+    CHECK(check_mock_values(handler) == 0);
+    REQUIRE(wqc_get_shell_set_range(handler, &fetched_begin, &fetched_end) == true);
+    CHECK(wqc_indices_equal(&fetched_begin, &begin));
+    CHECK(wqc_indices_equal(&fetched_end, &end));
+
+    // Only the bytes of the range are downloaded, unless the server sends the whole blob
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handler, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_DOWNLOAD].calls == (max_inline_size ? 0 : 1));
+    CHECK((timing.endpoints[WQC_ENDPOINT_DOWNLOAD].sum.bytes_received == handler->eri_info.eri_values.eri_data_size) ==
+          (!max_inline_size && !config.no_range));
+
+    // A range that goes on into the next sub-job is not fetched
+    memcpy(end, handler->eri_status[2].range_end, sizeof(eri_shell_index_t));
+    CHECK(wqc_fetch_ERI_range(handler, &begin, &end) == false);
+    CHECK(wqc_fetch_ERI_range(handler, &begin, &begin) == false);
+
+    // Shell indices must be those of the system, and only the end may be the end of all quartets
+    struct wqc_return_value error_structure = init_webqc_return_value();
+    int shells = (int) handler->eri_info.number_of_shells;
+    const eri_shell_index_t out_of_range[] = {{0, 0, 0, shells + 3}, {0, 0, -1, 0}, {shells, 0, 0, 0}};
+    for (const eri_shell_index_t &index : out_of_range) {
+        CHECK(wqc_fetch_ERI_range(handler, &index, &end) == false);
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_BAD_OPTION_VALUE);
+    }
+    memcpy(end, begin, sizeof(eri_shell_index_t));
+    end[3] = shells;
+    CHECK(wqc_fetch_ERI_range(handler, &begin, &end) == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_BAD_OPTION_VALUE);
+
+    // The last quartets of the system end where all quartets end
+    const struct ERI_item_status *last = &handler->eri_status[handler->ERI_items_count - 1];
+    const eri_shell_index_t end_of_system = {shells, 0, 0, 0};
+    REQUIRE(wqc_indices_equal((const eri_shell_index_t *) &last->range_end, &end_of_system));
+    memcpy(begin, last->range_begin, sizeof(eri_shell_index_t));
+    CHECK(wqc_fetch_ERI_range(handler, &begin, &end_of_system) == true);
+    CHECK(check_mock_values(handler) == 0);
+
+    // Values sent with the status that are shorter than their sub-job are not read past their end
+    if (max_inline_size) {
+        struct ERI_item_status *short_item = &handler->eri_status[handler->ERI_items_count - 1];
+        REQUIRE(short_item->values != nullptr);
+        short_item->values_size -= sizeof(double);
+        CHECK(wqc_fetch_ERI_range(handler, &begin, &end_of_system) == false);
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+        CHECK(wqc_fetch_ERI_values(handler, &begin) == false);
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+    }
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "resume broken blob downloads", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.shell_sets_per_file = 100;
+    config.break_rate = 0.5;
+    int retries = 50;
+
+    SECTION("Range requests") {
+    }
+
+    SECTION("Server ignoring ranges") {
+        config.no_range = true;
+    }
+
+    SECTION("No retries") {
+        config.break_rate = 1.0;
+        retries = 0;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, retries) == true);
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+
+    // Enough downloads for some of them to break
+    double retried = metric_value("wqc_retries_total");
+    const int rounds = 4;
+    int fetched = 0;
+    int mismatches = 0;
+    for (int round = 0; round < rounds; ++round) {
+        for (int i = 0; i < handler->ERI_items_count; ++i) {
+            if (wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &handler->eri_status[i].range_begin)) {
+                mismatches += check_mock_values(handler);
+                fetched++;
+            }
+        }
+    }
+
+    CHECK(mismatches == 0);
+    if (retries > 0) {
+        CHECK(fetched == rounds * handler->ERI_items_count);
+        CHECK(metric_value("wqc_retries_total") > retried);
+    } else {
+        CHECK(fetched == 0);
+        CHECK(metric_value("wqc_retries_total") == retried);
+        // So many failed downloads stop calls to the server's port, which a later test may get
+        wqc_set_circuit_breaker(DEFAULT_BREAKER_FAILURES, DEFAULT_BREAKER_OPEN_TIME);
+    }
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "compress replies and request bodies", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+
+    SECTION("Compressed both ways") {
+    }
+
+    SECTION("Server without compression") {
+        config.no_compression = true;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+
+    // A geometry large enough for the request body to be compressed
+    std::string geometry = "100\nlarge\n";
+    for (int atom = 0; atom < 100; ++atom) {
+        geometry += "H " + std::to_string(atom) + ".00000000 0.00000000 0.00000000\n";
+    }
+    struct two_electron_integrals_job_parameters parameters = mock_parameters;
+    parameters.geometry = geometry.c_str();
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+    REQUIRE(wqc_fetch_all_ERI_values(handler) == true);
+    CHECK(check_mock_values(handler) == 0);
+
+    // A server that cannot take a compressed body is sent it again as is, and is asked once
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handler, &timing);
+    CHECK(handler->compressed_body_unsupported == config.no_compression);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == (config.no_compression ? 2 : 1));
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].failed_calls == 0);
+    CHECK((timing.endpoints[WQC_ENDPOINT_SUBMIT].sum.bytes_sent < geometry.size()) == !config.no_compression);
+    CHECK((timing.endpoints[WQC_ENDPOINT_DOWNLOAD].sum.bytes_received < handler->eri_info.eri_values.eri_data_size) ==
+          !config.no_compression);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "submit jobs in three calls", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+
+    SECTION("Server without combined submit") {
+        config.no_combined_submit = true;
+    }
+
+    SECTION("Combined submit turned off") {
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    if (!config.no_combined_submit) {
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_COMBINED_SUBMIT, false) == true);
+    }
+
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    CHECK(wqc_job_is_duplicate(handler) == false);
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    CHECK(wqc_job_is_duplicate(handler) == true);
+    CHECK(wqc_wait_for_job(handler, 10000) == true);
+
+    // The server is asked once whether it can submit a job in one call
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handler, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == (config.no_combined_submit ? 1 : 0));
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].failed_calls == 0);
+    CHECK(timing.endpoints[WQC_ENDPOINT_JOB].calls == 2);
+    CHECK(timing.endpoints[WQC_ENDPOINT_PARAMS].calls == 2);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "submit many jobs at once", "[mock]" ) {
+    const int jobs_count = WQC_MAX_BATCH_JOBS + 5;
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+
+    SECTION("Batched calls") {
+    }
+
+    SECTION("Server without batched calls") {
+        config.no_batch = true;
+    }
+
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+
+    // Move an atom a little in every job, except for the last one that is a duplicate of the first
+    std::vector<std::string> geometries(jobs_count);
+    std::vector<two_electron_integrals_job_parameters> parameters(jobs_count, mock_parameters);
+    std::vector<void *> job_parameters(jobs_count);
+    std::vector<WQC *> handlers(jobs_count);
+    for (int i = 0; i < jobs_count; ++i) {
+        int atom_shift = i < jobs_count - 1 ? i : 0;
+        geometries[i] = "3\nH2O\nO 0.0 0.0 " + std::to_string(atom_shift) + "\nH 0.83 0.0 0.53\nH 0.0 0.53 0.56\n";
+        parameters[i].geometry = geometries[i].c_str();
+        job_parameters[i] = &parameters[i];
+        handlers[i] = wqc_init();
+        REQUIRE(handlers[i] != NULL);
+        use_mock_server(handlers[i], server);
+    }
+
+    CHECK(wqc_submit_jobs(handlers.data(), WQC_JOB_TWO_ELECTRONS_INTEGRALS, job_parameters.data(), jobs_count) == true);
+    for (int i = 0; i < jobs_count; ++i) {
+        CHECK(handlers[i]->job_id[0] != '\0');
+        CHECK(handlers[i]->parameter_set_id[0] != '\0');
+    }
+    CHECK(wqc_job_is_duplicate(handlers[0]) == false);
+    CHECK(wqc_job_is_duplicate(handlers[jobs_count - 1]) == true);
+    CHECK(strcmp(handlers[0]->job_id, handlers[jobs_count - 1]->job_id) == 0);
+
+    bool all_done = false;
+    for (int polls = 0; !all_done && polls < 1000; ++polls) {
+        REQUIRE(wqc_get_statuses(handlers.data(), jobs_count) == true);
+        all_done = true;
+        for (int i = 0; i < jobs_count; ++i) {
+            all_done = all_done && wqc_job_done(handlers[i]);
+        }
+    }
+    CHECK(all_done == true);
+
+    WQC *last = handlers[jobs_count - 1];
+    REQUIRE(wqc_get_integrals_details(last) == true);
+    REQUIRE(wqc_fetch_all_ERI_values(last) == true);
+    CHECK(check_mock_values(last) == 0);
+
+    // Batches are made on the first handler, and a server without them is asked once
+    struct wqc_network_timing timing;
+    wqc_get_network_timing(handlers[0], &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT_BATCH].calls == (config.no_batch ? 1 : 2));
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT_BATCH].failed_calls == 0);
+    CHECK((timing.endpoints[WQC_ENDPOINT_STATUS_BATCH].calls > 0) == !config.no_batch);
+    wqc_get_network_timing(handlers[1], &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == (config.no_batch ? 1 : 0));
+
+    for (WQC *handler : handlers) {
+        wqc_cleanup(handler);
+    }
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "mock server errors", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.error_rate = 1.0;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, 10) == true);
+
+    SECTION("Every call fails") {
+        double retried = metric_value("wqc_retries_total");
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+        CHECK(metric_value("wqc_retries_total") == retried + DEFAULT_CALL_RETRIES);
+
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+        CHECK(handler->web_call_info.http_reply_code == 500);
+
+        std::string errors_metric = "wqc_errors_total{code=\"" + std::to_string(WEBQC_WEB_CALL_ERROR) + "\"}";
+        CHECK(metric_value(errors_metric.c_str()) >= 1);
+
+        struct wqc_network_timing timing;
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == 1 + DEFAULT_CALL_RETRIES);
+        CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].failed_calls == 1 + DEFAULT_CALL_RETRIES);
+    }
+
+    SECTION("Batched submit fails") {
+        WQC *other = wqc_init();
+        REQUIRE(other != NULL);
+        use_mock_server(other, server);
+        REQUIRE(wqc_set_option(other, WQC_OPTION_RETRY_MAX_DELAY, 10) == true);
+        WQC *handlers[] = {handler, other};
+        void *job_parameters[] = {&mock_parameters, &mock_parameters};
+
+        CHECK(wqc_submit_jobs(handlers, WQC_JOB_TWO_ELECTRONS_INTEGRALS, job_parameters, 2) == false);
+
+        // The call was made on the first handler, and its error is the error of all the jobs
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(other, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+        CHECK(handler->web_call_info.http_reply_code == 500);
+
+        wqc_cleanup(other);
+    }
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "retry failed calls", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.shell_sets_per_file = 100;
+    config.error_rate = 0.5;
+
+    SECTION("Temporary errors") {
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 50) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, 50) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, 10) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+
+        // Half of the calls fail, and each of them is made again until it succeeds
+        double retried = metric_value("wqc_retries_total");
+        REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+        REQUIRE(wqc_get_integrals_details(handler) == true);
+        int mismatches = 0;
+        for (int i = 0; i < handler->ERI_items_count; ++i) {
+            REQUIRE(wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &handler->eri_status[i].range_begin));
+            mismatches += check_mock_values(handler);
+        }
+        CHECK(mismatches == 0);
+        CHECK(metric_value("wqc_retries_total") > retried);
+
+        // So are the calls that locate blobs and download them concurrently
+        retried = metric_value("wqc_retries_total");
+        CHECK(wqc_fetch_all_ERI_values(handler) == true);
+        CHECK(check_mock_values(handler) == 0);
+        CHECK(metric_value("wqc_retries_total") > retried);
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+
+    SECTION("Blob downloads into a file") {
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 50) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, 50) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, 10) == true);
+        REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+        REQUIRE(wqc_get_integrals_details(handler) == true);
+        REQUIRE(wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &handler->eri_status[0].range_begin));
+        const char *values = (const char *) handler->eri_info.eri_values.eri_values;
+        size_t size = handler->eri_info.eri_values.eri_data_size;
+        char URL[MAX_URL_SIZE];
+        snprintf(URL, sizeof(URL), "http://127.0.0.1:%u/blobs/%s/0", (unsigned int) wqc_mock_server_port(server),
+                 handler->parameter_set_id);
+
+        // Failed calls are answered with an error before any of the blob is sent, and are made again from the start
+        double retried = metric_value("wqc_retries_total");
+        int mismatches = 0;
+        for (int i = 0; i < 10; ++i) {
+            FILE *fp = tmpfile();
+            REQUIRE(fp != nullptr);
+            CHECK(wqc_download_file(handler, URL, fp) == true);
+            std::vector<char> downloaded(size + 1);
+            rewind(fp);
+            mismatches += fread(downloaded.data(), 1, downloaded.size(), fp) == size &&
+                          memcmp(downloaded.data(), values, size) == 0 ? 0 : 1;
+            fclose(fp);
+        }
+        CHECK(mismatches == 0);
+        CHECK(metric_value("wqc_retries_total") > retried);
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+
+    SECTION("Concurrent calls") {
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC_MULTI *multi = wqc_multi_init();
+        REQUIRE(multi != NULL);
+        std::vector<WQC *> handlers(4);
+        for (auto &handler : handlers) {
+            handler = wqc_init();
+            REQUIRE(handler != NULL);
+            use_mock_server(handler, server);
+            REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 50) == true);
+            REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+            REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, 10) == true);
+            REQUIRE(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+        }
+
+        // Handlers waiting to make a call again count as running
+        int succeeded = 0;
+        while (wqc_poll(multi, 1000) > 0) {
+            bool success = false;
+            while (wqc_multi_next_done(multi, &success)) {
+                succeeded += success ? 1 : 0;
+            }
+        }
+        bool success = false;
+        while (wqc_multi_next_done(multi, &success)) {
+            succeeded += success ? 1 : 0;
+        }
+        CHECK(succeeded == (int) handlers.size());
+
+        for (auto &handler : handlers) {
+            wqc_cleanup(handler);
+        }
+        wqc_multi_cleanup(multi);
+        wqc_mock_server_stop(server);
+    }
+
+    SECTION("Server asks to wait") {
+        config.error_rate = 1.0;
+        config.retry_after = 1;
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 1) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+
+        auto start = std::chrono::steady_clock::now();
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(handler->web_call_info.http_reply_code == 429);
+        CHECK(elapsed >= std::chrono::milliseconds(1000));
+
+        struct wqc_network_timing timing;
+        wqc_get_network_timing(handler, &timing);
+        CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == 2);
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+}
+
+TEST_CASE( "stop calls to a failing server", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.error_rate = 1.0;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 0) == true);
+
+    // A job run on a healthy server, whose blobs are then fetched from the failing one
+    wqc_mock_server_default_config(&config);
+    WQC_MOCK_SERVER *healthy_server = wqc_mock_server_start(&config);
+    REQUIRE(healthy_server != NULL);
+    WQC *fetching = wqc_init();
+    REQUIRE(fetching != NULL);
+    use_mock_server(fetching, healthy_server);
+    REQUIRE(wqc_set_option(fetching, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+    REQUIRE(wqc_submit_job(fetching, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_wait_for_job(fetching, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(fetching) == true);
+    use_mock_server(fetching, server);
+    wqc_set_circuit_breaker(2, 200);
+
+    struct wqc_return_value error_structure = init_webqc_return_value();
+    struct wqc_network_timing timing;
+    double opened = metric_value("wqc_circuit_breaker_opened_total");
+
+    // Two failed calls in a row stop the calls to the server
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+    CHECK(metric_value("wqc_circuit_breaker_opened_total") == opened + 1);
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_SERVER_UNAVAILABLE);
+    wqc_get_network_timing(handler, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == 2);
+
+    // Once they were stopped for long enough, one call finds the server still failing
+    std::this_thread::sleep_for(std::chrono::milliseconds(300));
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+    CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_SERVER_UNAVAILABLE);
+    wqc_get_network_timing(handler, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_SUBMIT].calls == 3);
+    CHECK(metric_value("wqc_circuit_breaker_opened_total") == opened + 2);
+
+    // Blobs are not fetched from a server whose calls are stopped either
+    CHECK(wqc_fetch_all_ERI_values(fetching) == false);
+    CHECK(wqc_get_last_error(fetching, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_SERVER_UNAVAILABLE);
+    wqc_get_network_timing(fetching, &timing);
+    CHECK(timing.endpoints[WQC_ENDPOINT_ERI_VALUES].calls == 0);
+
+    wqc_set_circuit_breaker(DEFAULT_BREAKER_FAILURES, DEFAULT_BREAKER_OPEN_TIME);
+    wqc_cleanup(fetching);
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(healthy_server);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "bound operations by deadlines", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    struct wqc_return_value error_structure = init_webqc_return_value();
+
+    SECTION("Call timeout") {
+        config.latency = 500;
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_TIMEOUT, 200) == true);
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, 1) == true);
+
+        // The call is cut at the timeout, and there is no time left to make it again
+        auto start = std::chrono::steady_clock::now();
+        CHECK(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == false);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_TIMEOUT);
+        CHECK(elapsed >= std::chrono::milliseconds(200));
+        CHECK(elapsed < std::chrono::milliseconds(450));
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+
+    SECTION("Deadline shared by the calls") {
+        config.latency = 100;
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+
+        // The second call gets only what the first one left of the time
+        wqc_set_deadline(handler, 150);
+        CHECK(wqc_get_integrals_details(handler) == true);
+        CHECK(wqc_get_integrals_details(handler) == false);
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_TIMEOUT);
+        CHECK(wqc_get_status(handler) == false);
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_TIMEOUT);
+
+        wqc_set_deadline(handler, -1);
+        CHECK(wqc_get_integrals_details(handler) == true);
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+
+    SECTION("Waiting for a job") {
+        config.job_duration = 5000;
+        WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+        REQUIRE(server != NULL);
+        WQC *handler = wqc_init();
+        REQUIRE(handler != NULL);
+        use_mock_server(handler, server);
+        REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+
+        // The held status call ends at the deadline, long before the wait would
+        wqc_set_deadline(handler, 300);
+        auto start = std::chrono::steady_clock::now();
+        CHECK(wqc_wait_for_job(handler, 10000) == false);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_TIMEOUT);
+        CHECK(elapsed < std::chrono::milliseconds(1000));
+
+        wqc_cleanup(handler);
+        wqc_mock_server_stop(server);
+    }
+}
+
+TEST_CASE( "hedge slow calls", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.stall_rate = 0.1;
+    config.stall_time = 500;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_HEDGE_PERCENTILE, 75) == true);
+
+    struct two_electron_integrals_job_parameters parameters = mock_parameters;
+    parameters.shell_set_per_file = 10;
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+
+    // The first downloads tell how long a download takes, and the slowest of the later ones are made again
+    double hedged = metric_value("wqc_hedged_calls_total");
+    int mismatches = 0;
+    int fetched = 0;
+    for (int i = 0; i < handler->ERI_items_count; ++i) {
+        if (wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &handler->eri_status[i].range_begin)) {
+            mismatches += check_mock_values(handler);
+            fetched++;
+        }
+    }
+    CHECK(fetched == handler->ERI_items_count);
+    CHECK(mismatches == 0);
+    CHECK(metric_value("wqc_hedged_calls_total") > hedged);
+    CHECK(metric_value("wqc_hedged_calls_won_total") <= metric_value("wqc_hedged_calls_total"));
+
+    hedged = metric_value("wqc_hedged_calls_total");
+    CHECK(wqc_fetch_all_ERI_values(handler) == true);
+    CHECK(check_mock_values(handler) == 0);
+    CHECK(metric_value("wqc_hedged_calls_total") > hedged);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+TEST_CASE( "hedge resumed downloads", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    config.stall_rate = 0.3;
+    config.stall_time = 300;
+    config.break_rate = 0.5;
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_HEDGE_PERCENTILE, 50) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, 50) == true);
+
+    struct two_electron_integrals_job_parameters parameters = mock_parameters;
+    parameters.shell_set_per_file = 10;
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+
+    // Downloads that broke off go on from where they stopped, and the slow ones are made again from there too, for
+    // whole blobs and for ranges inside them
+    double hedged = metric_value("wqc_hedged_calls_total");
+    double retried = metric_value("wqc_retries_total");
+    int mismatches = 0;
+    int fetched = 0;
+    int ranges = 0;
+    for (int i = 0; i < handler->ERI_items_count; ++i) {
+        const struct ERI_item_status *item = &handler->eri_status[i];
+        if (wqc_fetch_ERI_values(handler, (const eri_shell_index_t *) &item->range_begin)) {
+            mismatches += check_mock_values(handler);
+            fetched++;
+        }
+
+        // Quartets 2 to 7 of the blob, if it has that many
+        eri_shell_index_t begin, end;
+        int quartets = 0;
+        memcpy(begin, item->range_begin, sizeof(eri_shell_index_t));
+        memcpy(end, item->range_begin, sizeof(eri_shell_index_t));
+        for (; quartets < 7 && !wqc_indices_equal(&end, (const eri_shell_index_t *) &item->range_end); ++quartets) {
+            wqc_next_shell_index(handler, &end);
+            if (quartets < 2) {
+                wqc_next_shell_index(handler, &begin);
+            }
+        }
+        if (quartets == 7) {
+            ranges++;
+            if (wqc_fetch_ERI_range(handler, &begin, &end)) {
+                mismatches += check_mock_values(handler);
+                fetched++;
+            }
+        }
+    }
+    CHECK(ranges > 0);
+    CHECK(fetched == handler->ERI_items_count + ranges);
+    CHECK(mismatches == 0);
+    CHECK(metric_value("wqc_retries_total") > retried);
+    CHECK(metric_value("wqc_hedged_calls_total") > hedged);
+
+    CHECK(wqc_fetch_all_ERI_values(handler) == true);
+    CHECK(check_mock_values(handler) == 0);
+
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
+
+//! Check that a synchronous call on a handler in a WQC_MULTI fails as busy
+static void check_busy(WQC *handler, bool rv)
+{
+    struct wqc_return_value error_structure = init_webqc_return_value();
+    CHECK(rv == false);
+    CHECK(wqc_get_last_error(handler, &error_structure) == true);
+    CHECK(error_structure.error_code == WEBQC_HANDLER_BUSY);
+}
+
+TEST_CASE( "keep synchronous calls off handlers in a multi handle", "[mock]" ) {
+    struct wqc_mock_server_config config;
+    wqc_mock_server_default_config(&config);
+    WQC_MOCK_SERVER *server = wqc_mock_server_start(&config);
+    REQUIRE(server != NULL);
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+    use_mock_server(handler, server);
+    WQC_MULTI *multi = wqc_multi_init();
+    REQUIRE(multi != NULL);
+
+    REQUIRE(wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters) == true);
+    REQUIRE(wqc_wait_for_job(handler, 10000) == true);
+    REQUIRE(wqc_get_integrals_details(handler) == true);
+
+    eri_shell_index_t first_shell = {0, 0, 0, 0};
+    eri_shell_index_t later_shell = {1, 2, 0, 3};
+    char URL[MAX_URL_SIZE];
+    snprintf(URL, sizeof(URL), "http://127.0.0.1:%u/blobs/%s/0", (unsigned int) wqc_mock_server_port(server),
+             handler->parameter_set_id);
+    FILE *fp = tmpfile();
+    REQUIRE(fp != nullptr);
+
+    // Neither the running operation nor its call state is touched by the calls that are turned down
+    REQUIRE(wqc_multi_fetch_ERI_values(multi, handler, &first_shell) == true);
+    check_busy(handler, wqc_multi_fetch_ERI_values(multi, handler, &later_shell));
+    check_busy(handler, wqc_submit_job(handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &mock_parameters));
+    check_busy(handler, wqc_get_status(handler));
+    check_busy(handler, wqc_wait_for_job(handler, 100));
+    check_busy(handler, wqc_fetch_ERI_values(handler, &later_shell));
+    check_busy(handler, wqc_fetch_ERI_range(handler, &first_shell, &later_shell));
+    check_busy(handler, wqc_fetch_all_ERI_values(handler));
+    check_busy(handler, wqc_download_file(handler, URL, fp));
+
+    while (wqc_poll(multi, 1000) > 0) {
+    }
+    bool success = false;
+    CHECK(wqc_multi_next_done(multi, &success) == handler);
+    CHECK(success == true);
+
+    eri_shell_index_t eri_shell_index, eri_shell_range_end;
+    CHECK(wqc_get_shell_set_range(handler, &eri_shell_index, &eri_shell_range_end) == true);
+    CHECK(wqc_indices_equal(&eri_shell_index, &first_shell));
+    CHECK(check_mock_values(handler) == 0);
+    CHECK(wqc_fetch_ERI_values(handler, &later_shell) == true);
+    CHECK(check_mock_values(handler) == 0);
+
+    fclose(fp);
+    wqc_multi_cleanup(multi);
+    wqc_cleanup(handler);
+    wqc_mock_server_stop(server);
+}
@@ -0,0 +1,122 @@
+#include <libwebqc.h>
+#include <catch2/catch_test_macros.hpp>
+
+static const char *water_xyz_geometry =
+        "3\n"
+        "H2O\n"
+        "O 0.00000000 0.00000000 -0.07223463\n"
+        "H 0.83020871 0.00000000  0.53109206\n"
+        "H 0.00000000 0.53109206  0.56568542\n";
+
+static struct two_electron_integrals_job_parameters water_parameters = {"sto-3g", water_xyz_geometry, WQC_PRECISION_UNKNOWN, "angstrom", 0};
+
+//! Drive the multi handle until count handlers are done, and return how many of them succeeded
+static int wait_for_handlers(WQC_MULTI *multi, int count)
+{
+    int done = 0;
+    int succeeded = 0;
+
+    while (done < count && wqc_poll(multi, 1000) >= 0) {
+        bool success = false;
+        while (wqc_multi_next_done(multi, &success)) {
+            done++;
+            succeeded += success ? 1 : 0;
+        }
+    }
+    return succeeded;
+}
+
+TEST_CASE( "submit integrals jobs concurrently", "[multi]" ) {
+    const int handlers_count = 4;
+    WQC *handlers[handlers_count];
+    WQC_MULTI *multi = wqc_multi_init();
+    REQUIRE(multi != NULL);
+
+    for (auto &handler : handlers) {
+        handler = wqc_init();
+        REQUIRE(handler != NULL);
+    }
+
+    SECTION("Do REST Calls") {
+
+        for (auto &handler : handlers) {
+            CHECK(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &water_parameters) == true);
+        }
+        CHECK(wait_for_handlers(multi, handlers_count) == handlers_count);
+
+        for (auto &handler : handlers) {
+            CHECK(wqc_multi_get_status(multi, handler) == true);
+        }
+        CHECK(wait_for_handlers(multi, handlers_count) == handlers_count);
+
+        for (auto &handler : handlers) {
+            CHECK(wqc_wait_for_job(handler, 60000) == true);
+            CHECK(wqc_multi_get_integrals_details(multi, handler) == true);
+        }
+        CHECK(wait_for_handlers(multi, handlers_count) == handlers_count);
+
+        eri_shell_index_t eri_range_begin = {0, 0, 0, 0};
+        for (auto &handler : handlers) {
+            CHECK(wqc_multi_fetch_ERI_values(multi, handler, &eri_range_begin) == true);
+        }
+        CHECK(wait_for_handlers(multi, handlers_count) == handlers_count);
+
+        const double *eri_values = nullptr;
+        double eri_precision = WQC_PRECISION_UNKNOWN;
+        CHECK(wqc_get_eri_values(handlers[0], &eri_values, &eri_precision) == true);
+    }
+
+    for (auto &handler : handlers) {
+        wqc_cleanup(handler);
+    }
+    wqc_multi_cleanup(multi);
+}
+
+TEST_CASE( "only one call at a time on a handler", "[multi]" ) {
+    WQC *handler = wqc_init();
+    WQC_MULTI *multi = wqc_multi_init();
+    REQUIRE(handler != NULL);
+    REQUIRE(multi != NULL);
+
+    SECTION("Start two calls") {
+        CHECK(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &water_parameters) == true);
+        CHECK(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &water_parameters) == false);
+
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_HANDLER_BUSY);
+    }
+
+    SECTION("Abandon a running call") {
+        CHECK(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &water_parameters) == true);
+        CHECK(wqc_perform(multi) >= 0);
+    }
+
+    wqc_multi_cleanup(multi);
+    wqc_cleanup(handler);
+}
+
+TEST_CASE( "failed concurrent calls", "[multi]" ) {
+    WQC *handler = wqc_init();
+    WQC_MULTI *multi = wqc_multi_init();
+    REQUIRE(handler != NULL);
+    REQUIRE(multi != NULL);
+
+    SECTION("Status of a job that was not submitted") {
+        CHECK(wqc_multi_get_status(multi, handler) == false);
+        CHECK(wqc_perform(multi) == 0);
+    }
+
+    SECTION("Submit to bad server") {
+        REQUIRE(wqc_set_option(handler, WQC_OPTION_SERVER_NAME, "nosuchserver.cam") == true);
+        CHECK(wqc_multi_submit_job(multi, handler, WQC_JOB_TWO_ELECTRONS_INTEGRALS, &water_parameters) == true);
+        CHECK(wait_for_handlers(multi, 1) == 0);
+
+        struct wqc_return_value error_structure = init_webqc_return_value();
+        CHECK(wqc_get_last_error(handler, &error_structure) == true);
+        CHECK(error_structure.error_code == WEBQC_WEB_CALL_ERROR);
+    }
+
+    wqc_multi_cleanup(multi);
+    wqc_cleanup(handler);
+}
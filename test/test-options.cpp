@@ -63,7 +63,8 @@ TEST_CASE( "bool values get and set", "[options]" ) {
     WQC *handler = wqc_init();
     REQUIRE(handler != NULL);
 
-    wqc_option_t string_options[] = {WQC_OPTION_INSECURE_SSL};
+    wqc_option_t string_options[] = {WQC_OPTION_INSECURE_SSL, WQC_OPTION_LONG_POLL, WQC_OPTION_COMBINED_SUBMIT,
+                                     WQC_OPTION_COMPRESSION};
 
     for (auto & string_option : string_options) {
 
@@ -81,6 +82,104 @@ TEST_CASE( "bool values get and set", "[options]" ) {
     wqc_cleanup(handler);
 }
 
+TEST_CASE( "int values get and set", "[options]" ) {
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+
+    int value = 0;
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, &value) == true);
+    REQUIRE(value == DEFAULT_MAX_PARALLEL_DOWNLOADS);
+
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, 3) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, &value) == true);
+    REQUIRE(value == 3);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MIN_POLL_INTERVAL, &value) == true);
+    REQUIRE(value == DEFAULT_MIN_POLL_INTERVAL);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_POLL_INTERVAL, 250) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MAX_POLL_INTERVAL, &value) == true);
+    REQUIRE(value == 250);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MIN_POLL_INTERVAL, 0) == false);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, &value) == true);
+    REQUIRE(value == DEFAULT_MAX_INLINE_ERI_SIZE);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, 0) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, &value) == true);
+    REQUIRE(value == 0);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_INLINE_ERI_SIZE, MAX_INLINE_ERI_SIZE + 1) == false);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, &value) == true);
+    REQUIRE(value == DEFAULT_DOWNLOAD_RETRIES);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, 0) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, &value) == true);
+    REQUIRE(value == 0);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_DOWNLOAD_RETRIES, MAX_DOWNLOAD_RETRIES + 1) == false);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_CALL_RETRIES, &value) == true);
+    REQUIRE(value == DEFAULT_CALL_RETRIES);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, 0) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_CALL_RETRIES, &value) == true);
+    REQUIRE(value == 0);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_RETRIES, MAX_CALL_RETRIES + 1) == false);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_RETRY_BASE_DELAY, &value) == true);
+    REQUIRE(value == DEFAULT_RETRY_BASE_DELAY);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_RETRY_MAX_DELAY, &value) == true);
+    REQUIRE(value == DEFAULT_RETRY_MAX_DELAY);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, 50) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_RETRY_MAX_DELAY, &value) == true);
+    REQUIRE(value == 50);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_BASE_DELAY, -1) == false);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_RETRY_MAX_DELAY, MAX_RETRY_DELAY + 1) == false);
+
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_CALL_TIMEOUT, &value) == true);
+    REQUIRE(value == DEFAULT_CALL_TIMEOUT);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_TIMEOUT, 5000) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_CALL_TIMEOUT, &value) == true);
+    REQUIRE(value == 5000);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CALL_TIMEOUT, MAX_TIMEOUT + 1) == false);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_CONNECT_TIMEOUT, &value) == true);
+    REQUIRE(value == DEFAULT_CONNECT_TIMEOUT);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_CONNECT_TIMEOUT, 0) == false);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_HEDGE_PERCENTILE, &value) == true);
+    REQUIRE(value == DEFAULT_HEDGE_PERCENTILE);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_HEDGE_PERCENTILE, 90) == true);
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_HEDGE_PERCENTILE, MAX_HEDGE_PERCENTILE + 1) == false);
+
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_MAX_PARALLEL_DOWNLOADS, -1) == false);
+    struct wqc_return_value error_info = init_webqc_return_value();
+    REQUIRE(wqc_get_last_error(handler, &error_info) == true);
+    REQUIRE(error_info.error_code == WEBQC_BAD_OPTION_VALUE);
+
+    wqc_cleanup(handler);
+}
+
+TEST_CASE( "trace file get and set", "[options]" ) {
+    const char *trace_file = "test-options-trace.json";
+    WQC *handler = wqc_init();
+    REQUIRE(handler != NULL);
+
+    const char *value = "not set";
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_TRACE_FILE, &value) == true);
+    REQUIRE(value == nullptr);
+
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_TRACE_FILE, trace_file) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_TRACE_FILE, &value) == true);
+    REQUIRE(strcmp(value, trace_file) == 0);
+
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_TRACE_FILE, (const char *) nullptr) == true);
+    REQUIRE(wqc_get_option(handler, WQC_OPTION_TRACE_FILE, &value) == true);
+    REQUIRE(value == nullptr);
+    remove(trace_file);
+
+    REQUIRE(wqc_set_option(handler, WQC_OPTION_TRACE_FILE, "/no/such/directory/trace.json") == false);
+    struct wqc_return_value error_info = init_webqc_return_value();
+    REQUIRE(wqc_get_last_error(handler, &error_info) == true);
+    REQUIRE(error_info.error_code == WEBQC_IO_ERROR);
+
+    wqc_cleanup(handler);
+}
+
 TEST_CASE("Download nonexistent file", "[web]")
 {
     WQC *handler = wqc_init();
@@ -96,4 +195,20 @@ TEST_CASE("Download nonexistent file", "[web]")
     CHECK(error_structure.error_message[0] != '\0');
     wqc_cleanup(handler);
 
-}
\ No newline at end of file
+}
+
+TEST_CASE("Download into a buffer of known size", "[web]")
+{
+    char data[8] = "1234567";
+    char target[8];
+    struct download_buffer buffer = {target, sizeof(target), 0};
+
+    CHECK(wqc_write_to_download_buffer(data, 1, 4, &buffer) == 4);
+    CHECK(wqc_write_to_download_buffer(data, 1, 4, &buffer) == 4);
+    CHECK(buffer.received == sizeof(target));
+    CHECK(memcmp(target, "12341234", sizeof(target)) == 0);
+
+    // More data than the buffer can hold aborts the download
+    CHECK(wqc_write_to_download_buffer(data, 1, 1, &buffer) == 0);
+    CHECK(buffer.received == sizeof(target));
+}